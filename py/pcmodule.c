@@ -72,6 +72,14 @@
 
 #define NBUFF 4
 
+// Format del framebuffer que coincideix amb la superfície SDL de 32
+// bits (bytes B,G,R,0).
+#if PC_BE
+#define FB_FORMAT PC_FB_BGRX8888
+#else
+#define FB_FORMAT PC_FB_XRGB8888
+#endif
+
 
 
 
@@ -124,8 +132,7 @@ static struct
   int      pos;
   int      size;
   int      nsamples;
-  double   ratio;
-  double   pos2;
+  int      freq;
   
 } _audio;
 
@@ -1747,7 +1754,9 @@ audio_callback (
 
 // Torna 0 si tot ha anat bé.
 static const char *
-init_audio (void)
+init_audio (
+            const int freq
+            )
 {
   
   SDL_AudioSpec desired, obtained;
@@ -1760,7 +1769,7 @@ init_audio (void)
   for ( n= 0; n < NBUFF; ++n ) _audio.buffers[n].full= 0;
   
   // Inicialitza.
-  desired.freq= 44100;
+  desired.freq= freq;
   desired.format= AUDIO_S16;
   desired.channels= 2;
   desired.samples= 2048;
@@ -1786,13 +1795,12 @@ init_audio (void)
   _audio.pos= 0;
   _audio.size= obtained.size;
   _audio.nsamples= _audio.size/2;
-  if ( obtained.freq > 44100 )
+  if ( obtained.freq < PC_AUDIO_FREQ_MIN || obtained.freq > PC_AUDIO_FREQ_MAX )
     {
       SDL_CloseAudio ();
-      return "Freqüència massa gran";
+      return "Freqüència no suportada";
     }
-  _audio.ratio= 44100 / (double) obtained.freq;
-  _audio.pos2= 0.0;
+  _audio.freq= obtained.freq;
   
   return NULL;
   
@@ -1924,18 +1932,21 @@ get_current_time (
 } // end get_current_time
 
 
+// El framebuffer ja està en el format de la superfície (FB_FORMAT),
+// sols cal copiar les files.
 static void
 update_screen (
-               void         *udata,
-               const PC_RGB *fb,
-               const int     width,
-               const int     height,
-               const int     line_stride
+               void       *udata,
+               const void *fb,
+               const int   width,
+               const int   height,
+               const int   line_stride
                )
 {
 
+  const Uint32 *line;
   Uint8 *p;
-  int r,c;
+  int r;
   
   
   if ( width != _screen.width || height != _screen.height )
@@ -1943,16 +1954,12 @@ update_screen (
   if ( SDL_MUSTLOCK ( _screen.surface ) )
     SDL_LockSurface ( _screen.surface );
   p= (Uint8 *) _screen.surface->pixels;
+  line= (const Uint32 *) fb;
   for ( r= 0; r < height; ++r )
     {
-      for ( c= 0; c < width; ++c )
-        {
-          *(p++)= ((Uint8) fb[c].b);
-          *(p++)= ((Uint8) fb[c].g);
-          *(p++)= ((Uint8) fb[c].r);
-          *(p++)= 0x00;
-        }
-      fb+= line_stride;
+      memcpy ( p, line, width*4 );
+      p+= _screen.surface->pitch;
+      line+= line_stride;
     }
   if ( SDL_MUSTLOCK ( _screen.surface ) )
     SDL_UnlockSurface ( _screen.surface );
@@ -1965,6 +1972,51 @@ update_screen (
   
 } // end update_screen 
 
+
+static void
+update_screen_damage (
+                      void                *udata,
+                      const void          *fb,
+                      const int            width,
+                      const int            height,
+                      const int            line_stride,
+                      const PC_ScreenRect *rects,
+                      const int            nrects
+                      )
+{
+
+  const Uint32 *line;
+  Uint8 *p;
+  int i,r;
+  
+  
+  // Canvi de resolució.
+  if ( width != _screen.width || height != _screen.height )
+    {
+      update_screen ( udata, fb, width, height, line_stride );
+      return;
+    }
+  if ( nrects == 0 ) return;
+
+  // Sols copia les zones que han canviat.
+  if ( SDL_MUSTLOCK ( _screen.surface ) )
+    SDL_LockSurface ( _screen.surface );
+  for ( i= 0; i < nrects; ++i )
+    for ( r= rects[i].y; r < rects[i].y+rects[i].height; ++r )
+      {
+        line= ((const Uint32 *) fb) + r*line_stride + rects[i].x;
+        p= ((Uint8 *) _screen.surface->pixels) +
+          r*_screen.surface->pitch + rects[i].x*4;
+        memcpy ( p, line, rects[i].width*4 );
+      }
+  if ( SDL_MUSTLOCK ( _screen.surface ) )
+    SDL_UnlockSurface ( _screen.surface );
+  for ( i= 0; i < nrects; ++i )
+    SDL_UpdateRect ( _screen.surface, rects[i].x, rects[i].y,
+                     rects[i].width, rects[i].height );
+  
+} // end update_screen_damage
+
 //static FILE *F;
 static void
 play_sound (
@@ -1973,36 +2025,30 @@ play_sound (
             )
 {
 
-  int nofull, j;
+  int j;
   int16_t *buffer;
   
+  // NOTA!! El simulador ja genera el so a la freqüència del
+  // dispositiu (config.audio_freq).
   //fwrite(samples,PC_AUDIO_BUFFER_SIZE*2,1,F);
-  for (;;)
+  j= 0;
+  while ( j < PC_AUDIO_BUFFER_SIZE )
     {
       
       while ( _audio.buffers[_audio.buff_in].full ) SDL_Delay ( 1 );
       buffer= _audio.buffers[_audio.buff_in].v;
-      
-      j= (int) (_audio.pos2 + 0.5);
-      while ( (nofull= (_audio.pos != _audio.nsamples)) &&
-              j < PC_AUDIO_BUFFER_SIZE )
+      while ( _audio.pos != _audio.nsamples && j < PC_AUDIO_BUFFER_SIZE )
         {
           buffer[_audio.pos++]= samples[2*j];
           buffer[_audio.pos++]= samples[2*j+1];
-          _audio.pos2+= _audio.ratio;
-          j= (int) (_audio.pos2 + 0.5);
+          ++j;
         }
-      if ( !nofull )
+      if ( _audio.pos == _audio.nsamples )
         {
           _audio.pos= 0;
           _audio.buffers[_audio.buff_in].full= 1;
           _audio.buff_in= (_audio.buff_in+1)%NBUFF;
         }
-      if ( j >= PC_AUDIO_BUFFER_SIZE )
-        {
-          _audio.pos2-= PC_AUDIO_BUFFER_SIZE;
-          break;
-        }
       
     }
   
@@ -2079,7 +2125,8 @@ PC_init_module (
       get_current_time,
       update_screen,
       play_sound,
-      &trace_callbacks
+      &trace_callbacks,
+      update_screen_damage
     };
   static PC_Config config=
     {
@@ -2115,10 +2162,13 @@ PC_init_module (
         .sensitivity= 0,
         .acceleration= 5.0
         */
-      }
+      },
+      .fb_format= FB_FORMAT
     };
 
-  static char *kwlist[]= {"bios","vgabios","hdd","use_unix_epoch",NULL};
+  static char *kwlist[]= {"bios","vgabios","hdd","use_unix_epoch",
+                          "fast_floppy","render_thread","vram_size",
+                          "fast_retrace","audio_freq",NULL};
   
   const char *err2;
   PyObject *bytes,*vga_bytes;
@@ -2126,17 +2176,40 @@ PC_init_module (
   PC_Error err;
   PC_IDEDevice ide_devices[2][2];
   const char *hdd;
-  int i;
+  int i,fast_floppy,render_thread,vram_size,fast_retrace,audio_freq;
   
   //F= fopen("out.s16","wb");
   _use_unix_epoch= 0;
+  fast_floppy= 0;
+  render_thread= 0;
+  vram_size= 4;
+  fast_retrace= 0;
+  audio_freq= PC_AUDIO_FREQ_DEFAULT;
   if ( _initialized ) Py_RETURN_NONE;
-  if ( !PyArg_ParseTupleAndKeywords ( args, kwargs, "O!O!z|p",
+  if ( !PyArg_ParseTupleAndKeywords ( args, kwargs, "O!O!z|pppipi",
                                       kwlist,
                                       &PyBytes_Type, &bytes,
                                       &PyBytes_Type, &vga_bytes,
-                                      &hdd, &_use_unix_epoch ) )
+                                      &hdd, &_use_unix_epoch,
+                                      &fast_floppy, &render_thread,
+                                      &vram_size, &fast_retrace,
+                                      &audio_freq ) )
     return NULL;
+  switch ( vram_size )
+    {
+    case 1: config.svga_vram_size= PC_SVGA_VRAM_SIZE_1MB; break;
+    case 2: config.svga_vram_size= PC_SVGA_VRAM_SIZE_2MB; break;
+    case 4: config.svga_vram_size= PC_SVGA_VRAM_SIZE_4MB; break;
+    default:
+      PyErr_SetString ( PCError, "Invalid VRAM size (1, 2 or 4 MB)" );
+      return NULL;
+    }
+  if ( fast_floppy ) config.flags|= PC_CFG_FD_FAST_MEDIA;
+  else               config.flags&= ~PC_CFG_FD_FAST_MEDIA;
+  if ( render_thread ) config.flags|= PC_CFG_SVGA_RENDER_THREAD;
+  else                 config.flags&= ~PC_CFG_SVGA_RENDER_THREAD;
+  if ( fast_retrace ) config.flags|= PC_CFG_SVGA_FAST_RETRACE;
+  else                config.flags&= ~PC_CFG_SVGA_FAST_RETRACE;
   
   // Prepara.
   _bios= NULL;
@@ -2197,12 +2270,13 @@ PC_init_module (
   _screen.surface= NULL;
   _screen.width= -1;
   _screen.height= -1;
-  if ( (err2= init_audio ()) != NULL )
+  if ( (err2= init_audio ( audio_freq )) != NULL )
     {
       PyErr_SetString ( PCError, err2 );
       SDL_Quit ();
       return NULL; 
     }
+  config.audio_freq= _audio.freq;
   
   // Tracer.
   _tracer.dbg_flags= 0;
@@ -2237,6 +2311,18 @@ PC_init_module (
     case PC_HDD_WRONG_SIZE:
       PyErr_SetString ( PCError, "HDD wrong size" );
       goto error;
+    case PC_BAD_FB_FORMAT:
+      PyErr_SetString ( PCError, "Invalid framebuffer format" );
+      goto error;
+    case PC_NOMEM:
+      PyErr_SetString ( PCError, "Cannot allocate memory" );
+      goto error;
+    case PC_BAD_VRAM_SIZE:
+      PyErr_SetString ( PCError, "Invalid VRAM size" );
+      goto error;
+    case PC_BAD_AUDIO_FREQ:
+      PyErr_SetString ( PCError, "Unsupported audio frequency" );
+      goto error;
     case PC_NOERROR:
     default: break;
     }
@@ -2647,14 +2733,15 @@ PC_set_floppy (
 {
 
   const char *fn;
-  int drv;
+  int drv,in_mem;
   PC_File *f;
   PC_Error err;
   
   
   CHECK_INITIALIZED;
 
-  if ( !PyArg_ParseTuple ( args, "zi", &fn, &drv ) )
+  in_mem= 0;
+  if ( !PyArg_ParseTuple ( args, "zi|p", &fn, &drv, &in_mem ) )
     return NULL;
 
   if ( drv < 0 || drv > 4 )
@@ -2663,7 +2750,9 @@ PC_set_floppy (
       return NULL;
     }
 
-  f= PC_file_new_from_file ( fn, true );
+  f= in_mem ?
+    PC_file_new_from_file_mem ( fn, true ) :
+    PC_file_new_from_file ( fn, true );
   if ( f == NULL )
     {
       PyErr_Format ( PCError, "unable to open %s", fn );
@@ -2735,6 +2824,202 @@ PC_cirrus_clgd5446_get_vram (
 } // end PC_cirrus_clgd5446_get_vram
 
 
+static PyObject *
+PC_set_cache_budget (
+                     PyObject *self,
+                     PyObject *args
+                     )
+{
+
+  unsigned long long nbytes;
+
+  
+  if ( !PyArg_ParseTuple ( args, "K", &nbytes ) )
+    return NULL;
+  PC_cache_set_budget ( (size_t) nbytes );
+  
+  Py_RETURN_NONE;
+  
+} // end PC_set_cache_budget
+
+
+static PyObject *
+PC_get_cache_stats (
+                    PyObject *self,
+                    PyObject *args
+                    )
+{
+
+  PC_CacheStats stats;
+
+  
+  PC_cache_get_stats ( &stats );
+  
+  return Py_BuildValue ( "{sKsKsKsKsK}",
+                         "hits", (unsigned long long) stats.hits,
+                         "misses", (unsigned long long) stats.misses,
+                         "evictions", (unsigned long long) stats.evictions,
+                         "used", (unsigned long long) stats.used,
+                         "budget", (unsigned long long) stats.budget );
+  
+} // end PC_get_cache_stats
+
+
+static PyObject *
+PC_set_frame_skip (
+                   PyObject *self,
+                   PyObject *args
+                   )
+{
+
+  int skip;
+
+  
+  if ( !PyArg_ParseTuple ( args, "i", &skip ) )
+    return NULL;
+  PC_svga_cirrus_clgd5446_set_frame_skip ( skip );
+  
+  Py_RETURN_NONE;
+  
+} // end PC_set_frame_skip
+
+
+static PyObject *
+PC_request_frame (
+                  PyObject *self,
+                  PyObject *args
+                  )
+{
+
+  PC_svga_cirrus_clgd5446_request_frame ();
+  
+  Py_RETURN_NONE;
+  
+} // end PC_request_frame
+
+
+static PyObject *
+PC_get_frame_stats (
+                    PyObject *self,
+                    PyObject *args
+                    )
+{
+
+  PC_SVGAFrameStats stats;
+
+  
+  PC_svga_cirrus_clgd5446_get_frame_stats ( &stats );
+  
+  return Py_BuildValue ( "{sKsK}",
+                         "rendered", (unsigned long long) stats.rendered,
+                         "skipped", (unsigned long long) stats.skipped );
+  
+} // end PC_get_frame_stats
+
+
+static PyObject *
+PC_export_shm (
+               PyObject *self,
+               PyObject *args
+               )
+{
+
+  const char *name;
+  int fd;
+  
+
+  name= NULL;
+  if ( !PyArg_ParseTuple ( args, "|z", &name ) )
+    return NULL;
+  fd= PC_svga_cirrus_clgd5446_export_shm ( name );
+  if ( fd == -1 )
+    {
+      PyErr_SetFromErrno ( PyExc_OSError );
+      return NULL;
+    }
+  
+  return PyLong_FromLong ( fd );
+  
+} // end PC_export_shm
+
+
+static PyObject *
+PC_export_shm_close (
+                     PyObject *self,
+                     PyObject *args
+                     )
+{
+
+  PC_svga_cirrus_clgd5446_export_shm_close ();
+  
+  Py_RETURN_NONE;
+  
+} // end PC_export_shm_close
+
+
+static PyObject *
+PC_capture_open_ (
+                  PyObject *self,
+                  PyObject *args
+                  )
+{
+
+  const char *file_name;
+  
+
+  if ( !PyArg_ParseTuple ( args, "s", &file_name ) )
+    return NULL;
+  if ( !PC_capture_open ( file_name ) )
+    {
+      PyErr_SetFromErrnoWithFilename ( PyExc_OSError, file_name );
+      return NULL;
+    }
+  
+  Py_RETURN_NONE;
+  
+} // end PC_capture_open_
+
+
+static PyObject *
+PC_capture_close_ (
+                   PyObject *self,
+                   PyObject *args
+                   )
+{
+
+  if ( !PC_capture_close () )
+    {
+      PyErr_SetString ( PCError, "Error writing the capture file" );
+      return NULL;
+    }
+  
+  Py_RETURN_NONE;
+  
+} // end PC_capture_close_
+
+
+static PyObject *
+PC_get_capture_stats (
+                      PyObject *self,
+                      PyObject *args
+                      )
+{
+
+  PC_CaptureStats stats;
+
+  
+  PC_capture_get_stats ( &stats );
+  
+  return Py_BuildValue ( "{sKsKsKsKsK}",
+                         "frames", (unsigned long long) stats.frames,
+                         "written", (unsigned long long) stats.written,
+                         "duplicated", (unsigned long long) stats.duplicated,
+                         "dropped", (unsigned long long) stats.dropped,
+                         "bytes", (unsigned long long) stats.bytes );
+  
+} // end PC_get_capture_stats
+
+
 
 
 /************************/
@@ -2777,6 +3062,28 @@ static PyMethodDef PCMethods[]=
      "Set cdrom" },
    { "cirrus_clgd5446_get_vram", PC_cirrus_clgd5446_get_vram, METH_NOARGS,
       "Returns vgram from CLGD5446" },
+   { "set_cache_budget", PC_set_cache_budget, METH_VARARGS,
+     "Set the size in bytes of the shared disk block cache (0 disables it)" },
+   { "get_cache_stats", PC_get_cache_stats, METH_NOARGS,
+     "Returns the shared disk block cache counters" },
+   { "set_frame_skip", PC_set_frame_skip, METH_VARARGS,
+     "Rasterize only one of every N frames (1 renders all, 0 only"
+     " requested frames)" },
+   { "request_frame", PC_request_frame, METH_NOARGS,
+     "Rasterize the next complete frame" },
+   { "get_frame_stats", PC_get_frame_stats, METH_NOARGS,
+     "Returns the number of rendered and skipped frames" },
+   { "export_shm", PC_export_shm, METH_VARARGS,
+     "Export frames to shared memory (memfd if no name is given)."
+     " Returns the file descriptor" },
+   { "export_shm_close", PC_export_shm_close, METH_NOARGS,
+     "Stop exporting frames to shared memory" },
+   { "capture_open", PC_capture_open_, METH_VARARGS,
+     "Start capturing video frames to a file or pipe" },
+   { "capture_close", PC_capture_close_, METH_NOARGS,
+     "Write the pending frames and close the capture" },
+   { "get_capture_stats", PC_get_capture_stats, METH_NOARGS,
+     "Returns the video capture counters" },
    { NULL, NULL, 0, NULL }
   };
 
@@ -31,10 +31,13 @@ glib_libs,glib_cflags= pkgconfig('glib-2.0','2.50')
 
 module= Extension ( 'PC',
                     sources= [ 'pcmodule.c',
+                               '../src/cache.c',
+                               '../src/capture.c',
                                '../src/cdrom.c',
                                '../src/files.c',
                                '../src/mtxc.c',
                                '../src/piix4_power_management.c',
+                               '../src/pixels.c',
                                '../src/rtc.c',
                                '../src/svga_cirrus_clgd5446.c',
                                '../src/cpu.c',
@@ -52,6 +55,7 @@ module= Extension ( 'PC',
                                '../src/main.c',
                                '../src/piix4_pci_isa_bridge.c',
                                '../src/ps2.c',
+                               '../src/resampler.c',
                                '../src/speaker.c',
                                'IA32/src/cpu.c',
                                'IA32/src/dis.c',
@@ -86,7 +90,7 @@ module= Extension ( 'PC',
                                'CD/src/cue.h',
                                'CD/src/iso.h',
                                'CD/src/utils.h'],
-                    libraries= ['SDL']+glib_libs,
+                    libraries= ['SDL','pthread','m']+glib_libs,
                     extra_compile_args= glib_cflags+['-UNDEBUG',
                                                      '-frounding-math',
                                                      '-Wno-unknown-pragmas'],
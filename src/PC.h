@@ -64,7 +64,11 @@ typedef enum
    PC_UNK_CPU_MODEL,
    PC_BADOPTROM,
    PC_HDD_WRONG_SIZE,
-   PC_FD_WRONG_SIZE
+   PC_FD_WRONG_SIZE,
+   PC_BAD_FB_FORMAT,
+   PC_NOMEM,
+   PC_BAD_VRAM_SIZE,
+   PC_BAD_AUDIO_FREQ
   } PC_Error;
 
 // DMA Signal
@@ -404,6 +408,18 @@ typedef enum
   } PC_PCIDevice;
 
 #define PC_CFG_QEMU_COMPATIBLE 0x01
+// Les disqueteres fan els seeks i les lectures quasi sense retard
+// (no és precís, pensat per a execucions automàtiques).
+#define PC_CFG_FD_FAST_MEDIA   0x02
+// La targeta gràfica converteix els píxels al format del framebuffer
+// en un fil a banda. Els frames es continuen passant al frontend des
+// del fil de l'emulador i la temporització no canvia.
+#define PC_CFG_SVGA_RENDER_THREAD 0x04
+// Quan el programa espera en un bucle llegint el registre d'estat de
+// la targeta gràfica (0x3DA) s'avança el rellotge fins just abans del
+// canvi (no és precís si el bucle fa alguna cosa més, pensat per a
+// execucions automàtiques).
+#define PC_CFG_SVGA_FAST_RETRACE  0x08
 
 typedef enum
   {
@@ -437,6 +453,16 @@ typedef struct
   
 } PC_HostMouse;
 
+// Format dels píxels del framebuffer. Els formats de 16 i 32 bits
+// són valors en l'ordre de bytes natiu.
+typedef enum
+  {
+    PC_FB_RGB= 0, // PC_RGB
+    PC_FB_XRGB8888, // uint32_t 0x00RRGGBB
+    PC_FB_BGRX8888, // uint32_t 0xBBGGRR00
+    PC_FB_RGB565 // uint16_t
+  } PC_FBFormat;
+
 // Configura les característiques del PC.
 typedef struct
 {
@@ -489,6 +515,21 @@ typedef struct
   
   // Característiques del ratolí real.
   PC_HostMouse host_mouse;
+
+  // Format dels píxels que rep PC_UpdateScreen.
+  PC_FBFormat fb_format;
+
+  // Memòria de vídeo de la targeta SVGA. Per defecte (0) 4MB.
+  enum {
+    PC_SVGA_VRAM_SIZE_4MB= 0,
+    PC_SVGA_VRAM_SIZE_2MB,
+    PC_SVGA_VRAM_SIZE_1MB,
+    PC_SVGA_VRAM_SIZE_SENTINEL
+  }           svga_vram_size;
+
+  // Freqüència en Hz del so que rep PC_PlaySound. Ha d'estar entre
+  // PC_AUDIO_FREQ_MIN i PC_AUDIO_FREQ_MAX. Per defecte (0) 44100Hz.
+  int         audio_freq;
   
 } PC_Config;
 
@@ -535,19 +576,56 @@ typedef struct
   uint8_t r,g,b;
 } PC_RGB;
 
-// Es cridat per la targeta gràfica per a refrescar la pantalla.
+// Es cridat per la targeta gràfica per a refrescar la pantalla. 'fb'
+// està en el format triat en PC_Config i 'line_stride' es mesura en
+// píxels.
 typedef void (PC_UpdateScreen) (
-                                void         *udata,
-                                const PC_RGB *fb,
-                                const int     width,
-                                const int     height,
-                                const int     line_stride
+                                void       *udata,
+                                const void *fb,
+                                const int   width,
+                                const int   height,
+                                const int   line_stride
                                 );
 
+// Rectangle de la pantalla.
+typedef struct
+{
+  int x,y;
+  int width,height;
+} PC_ScreenRect;
+
+// Alternativa a PC_UpdateScreen. A més del framebuffer rep la llista
+// de rectangles que han canviat des de l'última crida ('nrects' pot
+// ser 0 si no ha canviat res). Quan canvia la resolució es rep tota
+// la pantalla com a un únic rectangle.
+typedef void (PC_UpdateScreenDamage) (
+                                      void                *udata,
+                                      const void          *fb,
+                                      const int            width,
+                                      const int            height,
+                                      const int            line_stride,
+                                      const PC_ScreenRect *rects,
+                                      const int            nrects
+                                      );
+
+// Font de blocs de la cau (vore secció CACHE).
+typedef struct PC_CacheSource_ PC_CacheSource;
+
+// Sectors que es lligen seguits del disc quan es falla en la
+// finestra de lectura anticipada i en la cau.
+#define PC_CDROM_READAHEAD 32
+
 typedef struct
 {
-  CD_Info *info;
-  CD_Disc *current;
+  CD_Info        *info;
+  CD_Disc        *current;
+  PC_CacheSource *cache; // Pot ser NULL
+  long            pos; // Sector on està el lector (absolut)
+  long            disc_pos; // Sector on està CD_Disc (-1 desconegut)
+  long            end_pos; // Sector següent a l'últim del disc
+  long            ra_first; // Primer sector en ra (-1 cap)
+  int             ra_n; // Sectors vàlids en ra
+  uint8_t         ra[PC_CDROM_READAHEAD][CD_SEC_SIZE+CD_SUBCH_SIZE+2];
 } PC_CDRom;
 
 
@@ -570,18 +648,249 @@ uint64_t PC_swap64(const uint64_t val);
 #endif
 
 
+/*********/
+/* CACHE */
+/*********/
+// Cau LRU de blocs compartida per tots els dispositius
+// d'emmagatzematge (disc dur, CD-ROM i disquetera). Els blocs
+// s'identifiquen per una font i un índex de bloc. Les imatges de
+// només lectura obertes des del mateix fitxer comparteixen font, i
+// per tant blocs, entre totes les màquines del mateix procés.
+
+// Pressupost inicial en bytes.
+#define PC_CACHE_DEFAULT_BUDGET (32*1024*1024)
+
+typedef struct
+{
+  uint64_t hits;
+  uint64_t misses;
+  uint64_t evictions;
+  size_t   used; // Bytes ocupats pels blocs
+  size_t   budget; // Màxim de bytes
+} PC_CacheStats;
+
+// Fixa el pressupost de la cau. Si és 0 es desactiva. S'alliberen
+// els blocs que no caben.
+void
+PC_cache_set_budget (
+                     const size_t nbytes
+                     );
+
+void
+PC_cache_get_stats (
+                    PC_CacheStats *stats
+                    );
+
+// Posa a 0 els comptadors (no buida la cau).
+void
+PC_cache_clear_stats (void);
+
+bool
+PC_cache_enabled (void);
+
+// Torna la font associada al fitxer o NULL en cas d'error. Si shared
+// és cert i ja existeix una font compartida per al mateix fitxer es
+// reutilitza. Sols s'han de compartir fonts de només lectura.
+PC_CacheSource *
+PC_cache_source_new (
+                     const char *file_name,
+                     const bool  shared
+                     );
+
+// Allibera la font. Quan ja no la gasta ningú s'alliberen els seus
+// blocs.
+void
+PC_cache_source_free (
+                      PC_CacheSource *src
+                      );
+
+// Torna cert si el bloc està en la cau amb la grandària indicada. En
+// eixe cas el copia en dst.
+bool
+PC_cache_lookup (
+                 PC_CacheSource *src,
+                 const uint64_t  block,
+                 void           *dst,
+                 const size_t    size
+                 );
+
+// Afegeix (o reemplaça) un bloc.
+void
+PC_cache_insert (
+                 PC_CacheSource *src,
+                 const uint64_t  block,
+                 const void     *data,
+                 const size_t    size
+                 );
+
+// Actualitza part d'un bloc si està en la cau. Utilitzat en les
+// escriptures. Les altres fonts del mateix fitxer perden tots els
+// seus blocs.
+void
+PC_cache_update (
+                 PC_CacheSource *src,
+                 const uint64_t  block,
+                 const size_t    offset,
+                 const void     *data,
+                 const size_t    nbytes
+                 );
+
+
+
+/**********/
+/* PIXELS */
+/**********/
+// Conversió de files de píxels a un format intermedi de 32 bits
+// (0x00RRGGBB) i d'aquest al format del framebuffer. Cada funció té versions
+// vectorials que es trien en temps d'execució amb PC_pixels_init.
+
+// Tria la millor implementació per a la CPU. Si no es crida es gasta
+// la versió escalar.
+void
+PC_pixels_init (void);
+
+// Nom de la implementació triada ("scalar", "sse2" o "avx2").
+const char *
+PC_pixels_impl (void);
+
+// Força una implementació concreta ("scalar", "sse2" o "avx2"). Torna
+// fals si no existeix o la CPU no la suporta.
+bool
+PC_pixels_set_impl (
+                    const char *name
+                    );
+
+// Índexs de 8 bits a través d'una paleta de 256 entrades.
+void
+PC_pixels_lut8 (
+                uint32_t       *dst,
+                const uint8_t  *src,
+                const uint32_t *pal,
+                const int       n
+                );
+
+void
+PC_pixels_rgb555 (
+                  uint32_t       *dst,
+                  const uint16_t *src,
+                  const int       n
+                  );
+
+void
+PC_pixels_rgb565 (
+                  uint32_t       *dst,
+                  const uint16_t *src,
+                  const int       n
+                  );
+
+// 3 bytes per píxel en l'ordre B,G,R.
+void
+PC_pixels_rgb888 (
+                  uint32_t      *dst,
+                  const uint8_t *src,
+                  const int      n
+                  );
+
+// Descarta el byte alt.
+void
+PC_pixels_xrgb8888 (
+                    uint32_t       *dst,
+                    const uint32_t *src,
+                    const int       n
+                    );
+
+// Bytes per píxel del format.
+int
+PC_pixels_size (
+                const PC_FBFormat format
+                );
+
+// Escriu 'n' píxels en el format indicat.
+void
+PC_pixels_store (
+                 void              *dst,
+                 const uint32_t    *src,
+                 const int          n,
+                 const PC_FBFormat  format
+                 );
+
+/***********/
+/* CAPTURE */
+/***********/
+// Captura de vídeo per a analitzar sessions. Els frames es codifiquen
+// i s'escriuen en un fil en segon pla, en un format cru propi
+// descrit en capture.c. Els frames idèntics a l'anterior no
+// s'escriuen i quan canvia poca pantalla sols s'escriuen les
+// tesel·les modificades. Si el fil no dona l'abast es perden frames
+// en compte de parar la simulació.
+
+typedef struct
+{
+  uint64_t frames; // Frames rebuts
+  uint64_t written; // Frames escrits
+  uint64_t duplicated; // Frames idèntics a l'anterior
+  uint64_t dropped; // Frames perduts
+  uint64_t bytes; // Bytes escrits
+} PC_CaptureStats;
+
+// Comença a capturar en el fitxer (o FIFO) indicat. Torna fals si no
+// s'ha pogut obrir.
+bool
+PC_capture_open (
+                 const char *file_name
+                 );
+
+// Escriu els frames pendents i tanca el fitxer. Torna fals si alguna
+// escriptura ha fallat; en eixe cas la captura va parar en el primer
+// error i el fitxer està truncat.
+bool
+PC_capture_close (void);
+
+bool
+PC_capture_enabled (void);
+
+// Encua un frame. 'rects' són les zones que han canviat des de
+// l'anterior (com en PC_UpdateScreenDamage) i 'timestamp' l'instant
+// en nanosegons de temps emulat.
+void
+PC_capture_frame (
+                  const void          *fb,
+                  const PC_FBFormat    format,
+                  const int            width,
+                  const int            height,
+                  const int            line_stride,
+                  const PC_ScreenRect *rects,
+                  const int            nrects,
+                  const uint64_t       timestamp
+                  );
+
+void
+PC_capture_get_stats (
+                      PC_CaptureStats *stats
+                      );
+
 /*********/
 /* FILES */
 /*********/
 // Implementa fitxers
 
-// Retorna NULL en cas d'error
+// Retorna NULL en cas d'error. Les lectures passen per la cau de
+// blocs.
 PC_File *
 PC_file_new_from_file (
                        const char *file_name,
                        const bool  read_only
                        );
 
+// Com PC_file_new_from_file però carrega tot el fitxer en memòria en
+// el moment de crear-lo. Les escriptures s'apliquen en memòria i en
+// el fitxer. Retorna NULL en cas d'error.
+PC_File *
+PC_file_new_from_file_mem (
+                           const char *file_name,
+                           const bool  read_only
+                           );
+
 /*********/
 /* CDROM */
 /*********/
@@ -607,6 +916,47 @@ PC_cdrom_insert_disc (
                       char       **err
                       );
 
+// Les següents funcions accedeixen al disc a través de la cau de
+// blocs. Cal que hi haja un disc inserit.
+
+// Mou el lector a la posició absoluta indicada. Torna fals si no és
+// vàlida.
+bool
+PC_cdrom_seek (
+               PC_CDRom  *cdrom,
+               const int  mm,
+               const int  ss,
+               const int  sec
+               );
+
+// Llig el subcanal Q del sector actual sense avançar.
+bool
+PC_cdrom_read_q (
+                 PC_CDRom *cdrom,
+                 uint8_t   q[CD_SUBCH_SIZE],
+                 bool     *crc_ok
+                 );
+
+// Llig el sector actual. Si move és cert avança al següent.
+bool
+PC_cdrom_read (
+               PC_CDRom   *cdrom,
+               uint8_t     buf[CD_SEC_SIZE],
+               bool       *audio,
+               const bool  move
+               );
+
+// Com PC_cdrom_read però sense còpia. Torna un punter al sector
+// actual dins de la finestra de lectura anticipada, que és vàlid fins
+// a la següent crida a qualsevol funció de lectura. Torna NULL si
+// falla.
+const uint8_t *
+PC_cdrom_read_ptr (
+                   PC_CDRom   *cdrom,
+                   bool       *audio,
+                   const bool  move
+                   );
+
 
 /*********/
 /* SOUND */
@@ -616,10 +966,15 @@ PC_cdrom_insert_disc (
 // Poc més de mijta centèssima de segon
 #define PC_AUDIO_BUFFER_SIZE 256
 
+// Freqüències de l'eixida acceptades (PC_Config.audio_freq).
+#define PC_AUDIO_FREQ_DEFAULT 44100
+#define PC_AUDIO_FREQ_MIN     8000
+#define PC_AUDIO_FREQ_MAX     48000
+
 /* Tipus de la funció que actualitza es crida per a reproduir so. Es
  * proporcionen dos canals intercalats (esquerra/dreta). Cada mostra
- * està codificada com un valor de 16 bits amb signe amb una
- * freqüència de 44100Hz.
+ * està codificada com un valor de 16 bits amb signe amb la
+ * freqüència indicada en PC_Config.audio_freq.
  */
 typedef void (PC_PlaySound) (
                              const int16_t  samples[PC_AUDIO_BUFFER_SIZE*2],
@@ -643,6 +998,67 @@ PC_sound_set (
               );
 
 
+/*************/
+/* RESAMPLER */
+/*************/
+// Remostrejador polifàsic en punt fix (sinc amb finestra) que
+// gasten totes les fonts de so per a passar a la freqüència de
+// l'eixida. Treballa amb mostres estèreo intercalades (L/R). Les
+// freqüències poden ser qualsevol parella d'enters amb la relació
+// correcta (no cal que siguen Hz). La mostra d'eixida va retardada
+// PC_RESAMPLER_TAPS/2 mostres d'entrada.
+
+#define PC_RESAMPLER_TAPS   32
+#define PC_RESAMPLER_PHASES 256
+
+typedef struct
+{
+  
+  long    in_rate; // Simplificades
+  long    out_rate;
+  long    acc; // Posició de la següent mostra d'eixida des de l'última
+               // d'entrada en unitats de 1/out_rate.
+  bool    bypass; // Mateixa freqüència, no es filtra.
+  double  fc; // Freqüència de tall de 'coef'.
+  int     p; // Posició de la mostra més antiga en 'hist'.
+  int16_t hist[2][2*PC_RESAMPLER_TAPS];
+  int16_t coef[PC_RESAMPLER_PHASES][PC_RESAMPLER_TAPS];
+  
+} PC_Resampler;
+
+void
+PC_resampler_init (
+                   PC_Resampler *rs,
+                   const long    in_rate,
+                   const long    out_rate
+                   );
+
+// Canvia les freqüències sense perdre l'historial.
+void
+PC_resampler_set_rates (
+                        PC_Resampler *rs,
+                        long          in_rate,
+                        long          out_rate
+                        );
+
+// Buida l'historial.
+void
+PC_resampler_clear (
+                    PC_Resampler *rs
+                    );
+
+// Afegeix 'n' mostres i escriu en 'out' les mostres d'eixida que
+// estan disponibles. Torna el número de mostres escrites, que com a
+// molt és n*ceil(out_rate/in_rate).
+int
+PC_resampler_push (
+                   PC_Resampler  *rs,
+                   const int16_t *in,
+                   const int      n,
+                   int16_t       *out
+                   );
+
+
 /*******/
 /* UCP */
 /*******/
@@ -788,6 +1204,61 @@ PC_mtxc_confdata_write32 (
                           const uint32_t data
                           );
 
+// Accés en bloc al mapa de memòria física (per a DMA i similars). Els
+// trams que són RAM es copien directament, la resta (MMIO, regions
+// PAM no habilitades) passa byte a byte pels dispositius PCI. Les
+// escriptures invaliden el codi JIT afectat. No es tracegen.
+void
+PC_mtxc_read_block (
+                    const uint64_t  addr,
+                    uint8_t        *dst,
+                    const uint64_t  n
+                    );
+
+void
+PC_mtxc_write_block (
+                     const uint64_t  addr,
+                     const uint8_t  *src,
+                     const uint64_t  n
+                     );
+
+// Torna cert si tot [addr,addr+n) es llig directament de RAM, és a
+// dir, si PC_mtxc_read_block no passarà per cap dispositiu.
+bool
+PC_mtxc_is_ram (
+                const uint64_t addr,
+                const uint64_t n
+                );
+
+// Finestra de memòria d'un dispositiu PCI que el MTXC accedeix
+// directament, sense passar per les funcions de 'PC_PCIMem'. El byte
+// de l'adreça ADDR, dins de [begin,end), és mem[(ADDR-begin)^swap]
+// (swap 1 i 3 intercanvien els bytes de paraules de 16 i 32 bits).
+// Si 'writing' no és NULL es crida abans de cada escriptura amb el
+// rang de 'mem' que es va a modificar, i si 'written' no és NULL es
+// crida després amb el mateix rang.
+typedef struct
+{
+  uint64_t   begin;
+  uint64_t   end; // No inclòs
+  uint8_t   *mem;
+  uint32_t   swap;
+  bool       writable; // Si és fals les escriptures van al dispositiu
+  void     (*writing) (const uint32_t offset,const int nbytes);
+  void     (*written) (const uint32_t offset,const int nbytes);
+} PC_MemDirect;
+
+#define PC_MTXC_MAX_DIRECT 4
+
+// Reemplaça les finestres d'accés directe. Tenen prioritat sobre els
+// dispositius PCI però no sobre el PIIX4. És responsabilitat del
+// dispositiu tornar-les a publicar quan canvien els seus registres.
+void
+PC_mtxc_set_direct (
+                    const PC_MemDirect *maps,
+                    const int           N // <= PC_MTXC_MAX_DIRECT
+                    );
+
 void
 PC_mtxc_set_mode_trace (
                         const bool val
@@ -1535,6 +2006,15 @@ PC_fd_dma_signal (
 uint8_t
 PC_fd_dma_read (void);
 
+// Llig fins a max bytes del fifo durant una operació de lectura (mode
+// ràfega del DMA). Torna els bytes llegits, que poden ser 0. Desactiva
+// DREQ quan el fifo es buida igual que PC_fd_dma_read.
+int
+PC_fd_dma_read_block (
+                      uint8_t   *dst,
+                      const int  max
+                      );
+
 
 /********/
 /* PS/2 */
@@ -1582,7 +2062,8 @@ PC_ps2_command (
 void
 PC_speaker_init (
                  PC_Warning *warning,
-                 void       *udata
+                 void       *udata,
+                 const int   audio_freq
                  );
 
 int
@@ -1625,7 +2106,8 @@ PC_speaker_get_enabled (void);
 void
 PC_sb16_init (
               PC_Warning *warning,
-              void       *udata
+              void       *udata,
+              const int   audio_freq
               );
 
 int
@@ -1694,6 +2176,28 @@ PC_sb16_dma16_write (
                      const uint16_t data
                      );
 
+// Versions en ràfega de PC_sb16_dma_write/PC_sb16_dma16_write. Accepta
+// valors mentre el DSP manté DREQ actiu i torna quants ha consumit.
+int
+PC_sb16_dma_write_block (
+                         const uint8_t *src,
+                         const int      n
+                         );
+
+int
+PC_sb16_dma16_write_block (
+                           const uint16_t *src,
+                           const int       n
+                           );
+
+// Torna cert si el DSP manté DREQ actiu, és a dir, si acceptaria un
+// valor més.
+bool
+PC_sb16_dma_dreq (void);
+
+bool
+PC_sb16_dma16_dreq (void);
+
 void
 PC_sb16_mixer_set_addr (
                         const uint8_t addr
@@ -1793,6 +2297,11 @@ PC_Error
 PC_svga_cirrus_clgd5446_init (
                               PC_Warning            *warning,
                               PC_UpdateScreen       *update_screen,
+                              PC_UpdateScreenDamage *update_screen_damage,
+                              const PC_FBFormat      fb_format,
+                              const bool             render_thread,
+                              const bool             fast_retrace,
+                              const uint32_t         vram_size, // Bytes
                               PC_VGAMemAccess       *vga_mem_access,
                               PC_VGAMemLinearAccess *vga_mem_linear_acces,
                               uint8_t               *optrom,
@@ -1800,10 +2309,95 @@ PC_svga_cirrus_clgd5446_init (
                               void                  *udata
                               );
 
-// Torna un punter a la memòria interna de 1MB
+// Atura el fil de rasterització (si n'hi ha) i tanca l'exportació
+// en memòria compartida.
+void
+PC_svga_cirrus_clgd5446_close (void);
+
+// Memòria compartida amb els frames (vore
+// PC_svga_cirrus_clgd5446_export_shm). Comença amb PC_SVGAShmHeader
+// i després hi ha dos buffers de 'buffer_size' bytes, el primer en
+// 'buffer_offset'. Els píxels estan en 'format' i cada fila ocupa
+// 'stride' bytes.
+//
+// El simulador renderitza en el seu framebuffer i copia les files
+// que han canviat en el buffer que no és 'front'; quan acaba actualitza
+// 'front'. Per a llegir un frame:
+//   1. b= front; s= buf[b].seq. Si 's' és senar tornar a 1.
+//   2. Llegir els píxels i els rectangles del buffer 'b'.
+//   3. Si buf[b].seq != s el frame s'ha sobreescrit, tornar a 1.
+// Els rectangles són les zones que han canviat respecte al frame
+// anterior ('frame'-1). Si el lector s'ha perdut algun frame ha de
+// considerar que ha canviat tota la pantalla.
+#define PC_SVGA_SHM_MAGIC 0x42464350 // "PCFB"
+#define PC_SVGA_SHM_MAX_RECTS 64
+
+typedef struct
+{
+  uint64_t      seq; // Senar mentre s'escriu
+  uint64_t      frame; // Comença en 1. 0 vol dir buit
+  int32_t       width;
+  int32_t       height;
+  int32_t       stride;
+  int32_t       nrects;
+  PC_ScreenRect rects[PC_SVGA_SHM_MAX_RECTS];
+} PC_SVGAShmBuffer;
+
+typedef struct
+{
+  uint32_t         magic;
+  uint32_t         format; // PC_FBFormat
+  uint64_t         buffer_offset;
+  uint64_t         buffer_size;
+  uint32_t         front; // Últim buffer publicat
+  uint32_t         reserved;
+  PC_SVGAShmBuffer buf[2];
+} PC_SVGAShmHeader;
+
+// Comença a exportar els frames en memòria compartida, a més de
+// passar-los al frontend. Amb 'name' NULL es crea un memfd anònim,
+// si no es crea amb shm_open (i s'esborra en tancar). Torna el
+// descriptor, que el lector ha de mapejar amb mmap, o -1 si hi ha
+// hagut un error. El descriptor és propietat del simulador.
+int
+PC_svga_cirrus_clgd5446_export_shm (
+                                    const char *name
+                                    );
+
+void
+PC_svga_cirrus_clgd5446_export_shm_close (void);
+
+// Torna un punter a la memòria de vídeo (1, 2 o 4MB segons
+// PC_Config.svga_vram_size).
 const uint8_t *
 PC_svga_cirrus_clgd5446_get_vram (void);
 
+// Per a execucions sense pantalla. La temporització (registre d'estat,
+// comptadors de línia) continua igual, però sols es rasteritza i es
+// passa al frontend un de cada 'skip' frames. Amb 1 (per defecte) es
+// rasteritzen tots i amb 0 sols els demanats amb
+// PC_svga_cirrus_clgd5446_request_frame. En els frames botats els
+// bits de diagnòstic de 0x3DA es lligen a 0.
+void
+PC_svga_cirrus_clgd5446_set_frame_skip (
+                                        const int skip
+                                        );
+
+// Força rasteritzar el següent frame complet.
+void
+PC_svga_cirrus_clgd5446_request_frame (void);
+
+typedef struct
+{
+  uint64_t rendered; // Frames passats al frontend
+  uint64_t skipped; // Frames botats
+} PC_SVGAFrameStats;
+
+void
+PC_svga_cirrus_clgd5446_get_frame_stats (
+                                         PC_SVGAFrameStats *stats
+                                         );
+
 extern const PC_PCICallbacks PC_svga_cirrus_clgd5446;
 
 
@@ -1879,6 +2473,7 @@ typedef struct
   PC_UpdateScreen          *update_screen;
   PC_PlaySound             *play_sound;
   const PC_TraceCallbacks  *trace; // Pot ser NULL.
+  PC_UpdateScreenDamage    *update_screen_damage; // Pot ser NULL.
   
 } PC_Frontend;
 
@@ -0,0 +1,458 @@
+/*
+ * Copyright 2025 Adrià Giménez Pastor.
+ *
+ * This file is part of adriagipas/PC.
+ *
+ * adriagipas/PC is free software: you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as
+ * published by the Free Software Foundation, either version 3 of the
+ * License, or (at your option) any later version.
+ *
+ * adriagipas/PC is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with adriagipas/PC.  If not, see <https://www.gnu.org/licenses/>.
+ */
+/*
+ *  cache.c - Implementa una cau LRU de blocs compartida per tots els
+ *            dispositius d'emmagatzematge.
+ *
+ */
+
+#include <assert.h>
+#include <pthread.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+
+#include "PC.h"
+
+
+
+
+/**********/
+/* MACROS */
+/**********/
+
+#define NBUCKETS_BITS 12
+#define NBUCKETS (1<<NBUCKETS_BITS)
+
+#define HASH(ID,BLOCK)                                                  \
+  ((uint32_t) ((((uint64_t) (ID))*0x9E3779B97F4A7C15ULL ^               \
+                ((uint64_t) (BLOCK))*0xC2B2AE3D27D4EB4FULL)             \
+               >>(64-NBUCKETS_BITS)))
+
+
+
+
+/*********/
+/* TIPUS */
+/*********/
+
+typedef struct entry entry_t;
+
+struct entry
+{
+
+  PC_CacheSource *src;
+  uint64_t        block;
+  size_t          size;
+  entry_t        *hnext; // Següent en el 'bucket'
+  entry_t        *prev; // LRU (prev és més recent)
+  entry_t        *next;
+  uint8_t         data[];
+
+};
+
+struct PC_CacheSource_
+{
+
+  uint32_t        id;
+  int             refs;
+  size_t          nblocks; // Blocs en la cau
+  bool            shared;
+  dev_t           dev;
+  ino_t           ino;
+  off_t           size;
+  time_t          mtime;
+  PC_CacheSource *next;
+
+};
+
+
+
+
+/*********/
+/* ESTAT */
+/*********/
+
+static pthread_mutex_t _lock= PTHREAD_MUTEX_INITIALIZER;
+
+static entry_t *_buckets[NBUCKETS];
+
+// Llista LRU. _head és el més recent.
+static entry_t *_head= NULL;
+static entry_t *_tail= NULL;
+
+// Fonts registrades.
+static PC_CacheSource *_sources= NULL;
+static uint32_t _next_id= 1;
+
+static PC_CacheStats _stats= {
+  .hits= 0,
+  .misses= 0,
+  .evictions= 0,
+  .used= 0,
+  .budget= PC_CACHE_DEFAULT_BUDGET
+};
+
+
+
+
+/*********************/
+/* FUNCIONS PRIVADES */
+/*********************/
+
+static void
+lru_unlink (
+            entry_t *e
+            )
+{
+
+  if ( e->prev != NULL ) e->prev->next= e->next;
+  else _head= e->next;
+  if ( e->next != NULL ) e->next->prev= e->prev;
+  else _tail= e->prev;
+
+} // end lru_unlink
+
+
+static void
+lru_push_front (
+                entry_t *e
+                )
+{
+
+  e->prev= NULL;
+  e->next= _head;
+  if ( _head != NULL ) _head->prev= e;
+  else _tail= e;
+  _head= e;
+
+} // end lru_push_front
+
+
+static entry_t *
+find_entry (
+            const PC_CacheSource *src,
+            const uint64_t        block
+            )
+{
+
+  entry_t *e;
+
+
+  for ( e= _buckets[HASH(src->id,block)]; e != NULL; e= e->hnext )
+    if ( e->src == src && e->block == block )
+      return e;
+
+  return NULL;
+
+} // end find_entry
+
+
+// Lleva l'entrada de la taula i de la LRU i l'allibera.
+static void
+remove_entry (
+              entry_t *e
+              )
+{
+
+  entry_t **p;
+
+
+  p= &_buckets[HASH(e->src->id,e->block)];
+  while ( *p != e ) p= &((*p)->hnext);
+  *p= e->hnext;
+  lru_unlink ( e );
+  _stats.used-= e->size;
+  --(e->src->nblocks);
+  free ( e );
+
+} // end remove_entry
+
+
+// Allibera els blocs menys recents fins que hi ha lloc per a
+// 'nbytes' bytes més.
+static void
+evict (
+       const size_t nbytes
+       )
+{
+
+  while ( _tail != NULL && _stats.used + nbytes > _stats.budget )
+    {
+      remove_entry ( _tail );
+      ++_stats.evictions;
+    }
+
+} // end evict
+
+
+static void
+drop_source_blocks (
+                    const PC_CacheSource *src
+                    )
+{
+
+  entry_t *e,*next;
+
+
+  for ( e= _head; e != NULL && src->nblocks > 0; e= next )
+    {
+      next= e->next;
+      if ( e->src == src ) remove_entry ( e );
+    }
+
+} // end drop_source_blocks
+
+
+
+
+/**********************/
+/* FUNCIONS PÚBLIQUES */
+/**********************/
+
+void
+PC_cache_set_budget (
+                     const size_t nbytes
+                     )
+{
+
+  pthread_mutex_lock ( &_lock );
+  _stats.budget= nbytes;
+  evict ( 0 );
+  pthread_mutex_unlock ( &_lock );
+
+} // end PC_cache_set_budget
+
+
+void
+PC_cache_get_stats (
+                    PC_CacheStats *stats
+                    )
+{
+
+  pthread_mutex_lock ( &_lock );
+  *stats= _stats;
+  pthread_mutex_unlock ( &_lock );
+
+} // end PC_cache_get_stats
+
+
+void
+PC_cache_clear_stats (void)
+{
+
+  pthread_mutex_lock ( &_lock );
+  _stats.hits= 0;
+  _stats.misses= 0;
+  _stats.evictions= 0;
+  pthread_mutex_unlock ( &_lock );
+
+} // end PC_cache_clear_stats
+
+
+PC_CacheSource *
+PC_cache_source_new (
+                     const char *file_name,
+                     const bool  shared
+                     )
+{
+
+  struct stat st;
+  PC_CacheSource *ret;
+
+
+  if ( stat ( file_name, &st ) == -1 ) return NULL;
+
+  pthread_mutex_lock ( &_lock );
+
+  // Busca una font compartida per al mateix fitxer.
+  if ( shared )
+    for ( ret= _sources; ret != NULL; ret= ret->next )
+      if ( ret->shared &&
+           ret->dev == st.st_dev && ret->ino == st.st_ino &&
+           ret->size == st.st_size && ret->mtime == st.st_mtime )
+        {
+          ++(ret->refs);
+          goto end;
+        }
+
+  // Crea una nova.
+  ret= (PC_CacheSource *) malloc ( sizeof(PC_CacheSource) );
+  if ( ret == NULL ) goto end;
+  ret->id= _next_id++;
+  ret->refs= 1;
+  ret->nblocks= 0;
+  ret->shared= shared;
+  ret->dev= st.st_dev;
+  ret->ino= st.st_ino;
+  ret->size= st.st_size;
+  ret->mtime= st.st_mtime;
+  ret->next= _sources;
+  _sources= ret;
+
+ end:
+  pthread_mutex_unlock ( &_lock );
+
+  return ret;
+
+} // end PC_cache_source_new
+
+
+void
+PC_cache_source_free (
+                      PC_CacheSource *src
+                      )
+{
+
+  PC_CacheSource **p;
+
+
+  pthread_mutex_lock ( &_lock );
+  if ( --(src->refs) == 0 )
+    {
+      drop_source_blocks ( src );
+      for ( p= &_sources; *p != src; p= &((*p)->next) );
+      *p= src->next;
+      free ( src );
+    }
+  pthread_mutex_unlock ( &_lock );
+
+} // end PC_cache_source_free
+
+
+bool
+PC_cache_enabled (void)
+{
+  return _stats.budget > 0;
+} // end PC_cache_enabled
+
+
+bool
+PC_cache_lookup (
+                 PC_CacheSource *src,
+                 const uint64_t  block,
+                 void           *dst,
+                 const size_t    size
+                 )
+{
+
+  entry_t *e;
+  bool ret;
+
+
+  pthread_mutex_lock ( &_lock );
+  e= find_entry ( src, block );
+  if ( e != NULL && e->size == size )
+    {
+      memcpy ( dst, e->data, size );
+      if ( e != _head )
+        {
+          lru_unlink ( e );
+          lru_push_front ( e );
+        }
+      ++_stats.hits;
+      ret= true;
+    }
+  else
+    {
+      ++_stats.misses;
+      ret= false;
+    }
+  pthread_mutex_unlock ( &_lock );
+
+  return ret;
+
+} // end PC_cache_lookup
+
+
+void
+PC_cache_insert (
+                 PC_CacheSource *src,
+                 const uint64_t  block,
+                 const void     *data,
+                 const size_t    size
+                 )
+{
+
+  entry_t *e;
+  uint32_t h;
+
+
+  pthread_mutex_lock ( &_lock );
+  e= find_entry ( src, block );
+  if ( e != NULL ) remove_entry ( e );
+  if ( size > _stats.budget ) goto end;
+  evict ( size );
+  e= (entry_t *) malloc ( sizeof(entry_t) + size );
+  if ( e != NULL )
+    {
+      e->src= src;
+      e->block= block;
+      e->size= size;
+      memcpy ( e->data, data, size );
+      h= HASH(src->id,block);
+      e->hnext= _buckets[h];
+      _buckets[h]= e;
+      lru_push_front ( e );
+      _stats.used+= size;
+      ++(src->nblocks);
+    }
+ end:
+  pthread_mutex_unlock ( &_lock );
+
+} // end PC_cache_insert
+
+
+void
+PC_cache_update (
+                 PC_CacheSource *src,
+                 const uint64_t  block,
+                 const size_t    offset,
+                 const void     *data,
+                 const size_t    nbytes
+                 )
+{
+
+  entry_t *e;
+  PC_CacheSource *s;
+
+
+  pthread_mutex_lock ( &_lock );
+  e= find_entry ( src, block );
+  if ( e != NULL )
+    {
+      if ( offset + nbytes <= e->size )
+        memcpy ( e->data + offset, data, nbytes );
+      else remove_entry ( e );
+    }
+
+  // Altres fonts del mateix fitxer (per exemple una compartida de
+  // només lectura). Poden tindre blocs d'una altra grandària, per
+  // tant es descarten tots.
+  for ( s= _sources; s != NULL; s= s->next )
+    if ( s != src && s->nblocks > 0 &&
+         s->dev == src->dev && s->ino == src->ino )
+      drop_source_blocks ( s );
+  pthread_mutex_unlock ( &_lock );
+
+} // end PC_cache_update
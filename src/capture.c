@@ -0,0 +1,594 @@
+/*
+ * Copyright 2025 Adrià Giménez Pastor.
+ *
+ * This file is part of adriagipas/PC.
+ *
+ * adriagipas/PC is free software: you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as
+ * published by the Free Software Foundation, either version 3 of the
+ * License, or (at your option) any later version.
+ *
+ * adriagipas/PC is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with adriagipas/PC.  If not, see <https://www.gnu.org/licenses/>.
+ */
+/*
+ *  capture.c - Captura de vídeo en un fil en segon pla.
+ *
+ *  Format del fitxer (tot en little-endian):
+ *
+ *    Capçalera: "PCCAP001", uint32 grandària de tesel·la, uint32 0.
+ *
+ *    Cada frame: uint32 tipus, uint32 format (PC_FBFormat), uint32
+ *    amplària, uint32 altura, uint64 instant en ns de temps emulat,
+ *    uint32 número de tesel·les, uint32 bytes de dades. Després:
+ *      - CAP_FULL: totes les files seguides, sense farciment.
+ *      - CAP_TILES: per cada tesel·la uint16 columna, uint16 fila i
+ *        les seues files (les de les vores poden ser més menudes).
+ *        La resta de la pantalla és igual que en el frame anterior.
+ *
+ *  Els frames idèntics a l'anterior no s'escriuen. Si falla una
+ *  escriptura el fil de captura para, la resta de frames es perden i
+ *  PC_capture_close ho indica.
+ *
+ */
+
+#include <assert.h>
+#include <pthread.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "PC.h"
+
+
+
+
+/**********/
+/* MACROS */
+/**********/
+
+#define NSLOTS 4
+
+#define TILE 16
+
+// Cada quants frames escrits es força un frame complet.
+#define KEY_INTERVAL 600
+
+#define CAP_FULL  0
+#define CAP_TILES 1
+
+#define HEADER_SIZE 32
+
+// Els dos fils actualitzen els comptadors.
+#define STAT_ADD(FIELD,N)                                               \
+  __atomic_fetch_add ( &_cap.stats.FIELD, (N), __ATOMIC_RELAXED )
+
+
+
+
+/*********/
+/* TIPUS */
+/*********/
+
+// Frame pendent de processar. Es reutilitzen, per això sols es
+// copien les files que han canviat des de l'última vegada que es va
+// omplir ('filled').
+typedef struct
+{
+
+  uint8_t     *v;
+  size_t       capacity;
+  PC_FBFormat  format;
+  int          width;
+  int          height;
+  uint64_t     timestamp;
+  uint64_t     filled;
+
+} slot_t;
+
+
+
+
+/*********/
+/* ESTAT */
+/*********/
+
+static struct
+{
+
+  bool            enabled;
+  FILE           *f;
+  pthread_t       thread;
+  pthread_mutex_t lock;
+  pthread_cond_t  cond;
+  bool            quit;
+  bool            error; // Ha fallat alguna escriptura (atòmic)
+
+  // Cua. Sols el fil principal escriu 'head' i sols el de captura
+  // escriu 'tail'.
+  slot_t          slots[NSLOTS];
+  unsigned int    head;
+  unsigned int    tail;
+
+  // Fil principal.
+  uint64_t       *row_frame; // Últim frame en què ha canviat cada fila
+  int             nrows;
+  uint64_t        frame;
+  PC_FBFormat     format;
+  int             width;
+  int             height;
+  bool            last_queued;
+
+  // Fil de captura.
+  uint8_t        *prev; // Últim frame escrit
+  size_t          prev_capacity;
+  uint64_t        prev_hash;
+  bool            prev_valid;
+  PC_FBFormat     prev_format;
+  int             prev_width;
+  int             prev_height;
+  int             since_key;
+  uint8_t        *buf; // Dades del frame que s'escriu
+  size_t          buf_capacity;
+
+  PC_CaptureStats stats;
+
+} _cap;
+
+
+
+
+/*********************/
+/* FUNCIONS PRIVADES */
+/*********************/
+
+static void
+put32 (
+       uint8_t        *p,
+       const uint32_t  val
+       )
+{
+
+  p[0]= (uint8_t) val;
+  p[1]= (uint8_t) (val>>8);
+  p[2]= (uint8_t) (val>>16);
+  p[3]= (uint8_t) (val>>24);
+
+} // end put32
+
+
+static bool
+reserve (
+         uint8_t      **v,
+         size_t        *capacity,
+         const size_t   size
+         )
+{
+
+  uint8_t *tmp;
+
+
+  if ( size <= *capacity ) return true;
+  tmp= (uint8_t *) realloc ( *v, size );
+  if ( tmp == NULL ) return false;
+  *v= tmp;
+  *capacity= size;
+
+  return true;
+
+} // end reserve
+
+
+static uint64_t
+hash_frame (
+            const uint8_t *v,
+            const size_t   size
+            )
+{
+
+  uint64_t h,w;
+  size_t i;
+
+
+  h= 0x9E3779B97F4A7C15ULL ^ size;
+  for ( i= 0; i+8 <= size; i+= 8 )
+    {
+      memcpy ( &w, v+i, 8 );
+      h= (h^w)*0xC2B2AE3D27D4EB4FULL;
+      h^= h>>29;
+    }
+  for ( ; i < size; ++i )
+    h= (h^v[i])*0x100000001B3ULL;
+
+  return h;
+
+} // end hash_frame
+
+
+// Torna fals si no s'ha pogut escriure tot el registre.
+static bool
+write_record (
+              const slot_t   *s,
+              const int       type,
+              const uint32_t  ntiles,
+              const size_t    size
+              )
+{
+
+  uint8_t hdr[HEADER_SIZE];
+
+
+  put32 ( &hdr[0], (uint32_t) type );
+  put32 ( &hdr[4], (uint32_t) s->format );
+  put32 ( &hdr[8], (uint32_t) s->width );
+  put32 ( &hdr[12], (uint32_t) s->height );
+  put32 ( &hdr[16], (uint32_t) s->timestamp );
+  put32 ( &hdr[20], (uint32_t) (s->timestamp>>32) );
+  put32 ( &hdr[24], ntiles );
+  put32 ( &hdr[28], (uint32_t) size );
+  if ( fwrite ( hdr, HEADER_SIZE, 1, _cap.f ) != 1 ||
+       (size > 0 && fwrite ( _cap.buf, size, 1, _cap.f ) != 1) )
+    {
+      __atomic_store_n ( &_cap.error, true, __ATOMIC_RELEASE );
+      STAT_ADD ( dropped, 1 );
+      return false;
+    }
+  STAT_ADD ( bytes, HEADER_SIZE + size );
+  STAT_ADD ( written, 1 );
+
+  return true;
+
+} // end write_record
+
+
+// Escriu el frame complet o les tesel·les que han canviat i actualitza
+// 'prev'. S'executa en el fil de captura.
+static void
+encode_frame (
+              const slot_t *s
+              )
+{
+
+  size_t psize,row,size,total;
+  uint64_t h;
+  int tx,ty,ntx,nty,tw,th,y;
+  uint32_t ntiles;
+  const uint8_t *src,*old;
+  uint8_t *dst;
+  bool changed;
+
+
+  psize= (size_t) PC_pixels_size ( s->format );
+  row= s->width*psize;
+  total= row*s->height;
+
+  // Frames repetits.
+  h= hash_frame ( s->v, total );
+  if ( _cap.prev_valid && h == _cap.prev_hash &&
+       s->format == _cap.prev_format &&
+       s->width == _cap.prev_width && s->height == _cap.prev_height )
+    {
+      STAT_ADD ( duplicated, 1 );
+      return;
+    }
+  if ( !reserve ( &_cap.buf, &_cap.buf_capacity,
+                  total + total/4 + 4 + TILE*TILE*psize ) ||
+       !reserve ( &_cap.prev, &_cap.prev_capacity, total ) )
+    {
+      STAT_ADD ( dropped, 1 );
+      return;
+    }
+
+  // Tesel·les.
+  if ( _cap.prev_valid && s->format == _cap.prev_format &&
+       s->width == _cap.prev_width && s->height == _cap.prev_height &&
+       _cap.since_key < KEY_INTERVAL )
+    {
+      ntx= (s->width+TILE-1)/TILE;
+      nty= (s->height+TILE-1)/TILE;
+      ntiles= 0;
+      size= 0;
+      for ( ty= 0; ty < nty && size < total/2; ++ty )
+        {
+          th= s->height-ty*TILE < TILE ? s->height-ty*TILE : TILE;
+          for ( tx= 0; tx < ntx && size < total/2; ++tx )
+            {
+              tw= s->width-tx*TILE < TILE ? s->width-tx*TILE : TILE;
+              src= s->v + (ty*TILE)*row + tx*TILE*psize;
+              old= _cap.prev + (ty*TILE)*row + tx*TILE*psize;
+              changed= false;
+              for ( y= 0; y < th && !changed; ++y )
+                changed= memcmp ( src+y*row, old+y*row, tw*psize ) != 0;
+              if ( !changed ) continue;
+              dst= _cap.buf + size;
+              dst[0]= (uint8_t) tx; dst[1]= (uint8_t) (tx>>8);
+              dst[2]= (uint8_t) ty; dst[3]= (uint8_t) (ty>>8);
+              dst+= 4;
+              for ( y= 0; y < th; ++y, dst+= tw*psize )
+                memcpy ( dst, src+y*row, tw*psize );
+              size+= 4 + th*tw*psize;
+              ++ntiles;
+            }
+        }
+      // Si ha canviat prou pantalla s'escriu el frame complet.
+      if ( size < total/2 )
+        {
+          if ( !write_record ( s, CAP_TILES, ntiles, size ) ) return;
+          ++_cap.since_key;
+          memcpy ( _cap.prev, s->v, total );
+          _cap.prev_hash= h;
+          return;
+        }
+    }
+
+  // Frame complet.
+  memcpy ( _cap.buf, s->v, total );
+  if ( !write_record ( s, CAP_FULL, 0, total ) ) return;
+  memcpy ( _cap.prev, s->v, total );
+  _cap.prev_hash= h;
+  _cap.prev_valid= true;
+  _cap.prev_format= s->format;
+  _cap.prev_width= s->width;
+  _cap.prev_height= s->height;
+  _cap.since_key= 0;
+
+} // end encode_frame
+
+
+static void *
+capture_main (
+              void *arg
+              )
+{
+
+  slot_t *s;
+
+
+  pthread_mutex_lock ( &_cap.lock );
+  for (;;)
+    {
+      while ( _cap.tail == _cap.head && !_cap.quit )
+        pthread_cond_wait ( &_cap.cond, &_cap.lock );
+      if ( _cap.tail == _cap.head ) break;
+      s= &(_cap.slots[_cap.tail%NSLOTS]);
+      pthread_mutex_unlock ( &_cap.lock );
+      encode_frame ( s );
+      pthread_mutex_lock ( &_cap.lock );
+      __atomic_store_n ( &_cap.tail, _cap.tail+1, __ATOMIC_RELEASE );
+      // Després d'un error ja no s'escriu res més.
+      if ( __atomic_load_n ( &_cap.error, __ATOMIC_ACQUIRE ) ) break;
+    }
+  pthread_mutex_unlock ( &_cap.lock );
+  if ( fflush ( _cap.f ) != 0 )
+    __atomic_store_n ( &_cap.error, true, __ATOMIC_RELEASE );
+
+  return NULL;
+
+} // end capture_main
+
+
+static void
+free_buffers (void)
+{
+
+  int i;
+
+
+  for ( i= 0; i < NSLOTS; ++i )
+    {
+      free ( _cap.slots[i].v );
+      _cap.slots[i].v= NULL;
+      _cap.slots[i].capacity= 0;
+    }
+  free ( _cap.row_frame );
+  _cap.row_frame= NULL;
+  _cap.nrows= 0;
+  free ( _cap.prev );
+  _cap.prev= NULL;
+  _cap.prev_capacity= 0;
+  free ( _cap.buf );
+  _cap.buf= NULL;
+  _cap.buf_capacity= 0;
+
+} // end free_buffers
+
+
+
+
+/**********************/
+/* FUNCIONS PÚBLIQUES */
+/**********************/
+
+bool
+PC_capture_open (
+                 const char *file_name
+                 )
+{
+
+  uint8_t hdr[16];
+
+
+  if ( _cap.enabled ) PC_capture_close ();
+  _cap.f= fopen ( file_name, "wb" );
+  if ( _cap.f == NULL ) return false;
+  memcpy ( hdr, "PCCAP001", 8 );
+  put32 ( &hdr[8], TILE );
+  put32 ( &hdr[12], 0 );
+  if ( fwrite ( hdr, sizeof(hdr), 1, _cap.f ) != 1 )
+    {
+      fclose ( _cap.f );
+      return false;
+    }
+  memset ( &_cap.stats, 0, sizeof(_cap.stats) );
+  _cap.stats.bytes= sizeof(hdr);
+  _cap.head= 0;
+  _cap.tail= 0;
+  _cap.quit= false;
+  _cap.error= false;
+  _cap.frame= 0;
+  _cap.width= -1;
+  _cap.height= -1;
+  _cap.last_queued= false;
+  _cap.prev_valid= false;
+  _cap.since_key= 0;
+  pthread_mutex_init ( &_cap.lock, NULL );
+  pthread_cond_init ( &_cap.cond, NULL );
+  if ( pthread_create ( &_cap.thread, NULL, capture_main, NULL ) != 0 )
+    {
+      pthread_cond_destroy ( &_cap.cond );
+      pthread_mutex_destroy ( &_cap.lock );
+      fclose ( _cap.f );
+      return false;
+    }
+  _cap.enabled= true;
+
+  return true;
+
+} // end PC_capture_open
+
+
+bool
+PC_capture_close (void)
+{
+
+  bool ret;
+  
+
+  if ( !_cap.enabled ) return true;
+  pthread_mutex_lock ( &_cap.lock );
+  _cap.quit= true;
+  pthread_cond_signal ( &_cap.cond );
+  pthread_mutex_unlock ( &_cap.lock );
+  pthread_join ( _cap.thread, NULL );
+  pthread_cond_destroy ( &_cap.cond );
+  pthread_mutex_destroy ( &_cap.lock );
+  ret= !_cap.error;
+  if ( fclose ( _cap.f ) != 0 ) ret= false;
+  free_buffers ();
+  _cap.enabled= false;
+
+  return ret;
+
+} // end PC_capture_close
+
+
+bool
+PC_capture_enabled (void)
+{
+  return _cap.enabled;
+} // end PC_capture_enabled
+
+
+void
+PC_capture_frame (
+                  const void          *fb,
+                  const PC_FBFormat    format,
+                  const int            width,
+                  const int            height,
+                  const int            line_stride,
+                  const PC_ScreenRect *rects,
+                  const int            nrects,
+                  const uint64_t       timestamp
+                  )
+{
+
+  slot_t *s;
+  uint64_t *tmp;
+  size_t psize,row;
+  int i,y;
+  bool resized;
+
+
+  STAT_ADD ( frames, 1 );
+  if ( __atomic_load_n ( &_cap.error, __ATOMIC_ACQUIRE ) ) goto drop;
+  ++_cap.frame;
+  resized= (format != _cap.format || width != _cap.width ||
+            height != _cap.height);
+
+  // Si no ha canviat res des de l'últim frame encuat és un repetit.
+  if ( !resized && nrects == 0 && _cap.last_queued )
+    {
+      STAT_ADD ( duplicated, 1 );
+      return;
+    }
+  _cap.format= format;
+  _cap.width= width;
+  _cap.height= height;
+
+  // Files que han canviat.
+  if ( height > _cap.nrows )
+    {
+      tmp= (uint64_t *) realloc ( _cap.row_frame, height*sizeof(uint64_t) );
+      if ( tmp == NULL ) goto drop;
+      for ( y= _cap.nrows; y < height; ++y ) tmp[y]= _cap.frame;
+      _cap.row_frame= tmp;
+      _cap.nrows= height;
+    }
+  if ( resized )
+    for ( y= 0; y < height; ++y )
+      _cap.row_frame[y]= _cap.frame;
+  else
+    for ( i= 0; i < nrects; ++i )
+      for ( y= rects[i].y;
+            y < rects[i].y+rects[i].height && y < height;
+            ++y )
+        _cap.row_frame[y]= _cap.frame;
+
+  // Busca lloc en la cua.
+  if ( _cap.head - __atomic_load_n ( &_cap.tail, __ATOMIC_ACQUIRE ) ==
+       NSLOTS )
+    goto drop;
+  s= &(_cap.slots[_cap.head%NSLOTS]);
+  psize= (size_t) PC_pixels_size ( format );
+  row= width*psize;
+  if ( !reserve ( &(s->v), &(s->capacity), row*height ) ) goto drop;
+  if ( s->format != format || s->width != width || s->height != height )
+    s->filled= 0;
+  for ( y= 0; y < height; ++y )
+    if ( _cap.row_frame[y] > s->filled )
+      memcpy ( s->v + y*row,
+               ((const uint8_t *) fb) + y*line_stride*psize, row );
+  s->format= format;
+  s->width= width;
+  s->height= height;
+  s->timestamp= timestamp;
+  s->filled= _cap.frame;
+
+  // Encua.
+  pthread_mutex_lock ( &_cap.lock );
+  ++_cap.head;
+  pthread_cond_signal ( &_cap.cond );
+  pthread_mutex_unlock ( &_cap.lock );
+  _cap.last_queued= true;
+
+  return;
+
+ drop:
+  STAT_ADD ( dropped, 1 );
+  _cap.last_queued= false;
+
+} // end PC_capture_frame
+
+
+void
+PC_capture_get_stats (
+                      PC_CaptureStats *stats
+                      )
+{
+
+  stats->frames= __atomic_load_n ( &_cap.stats.frames, __ATOMIC_RELAXED );
+  stats->written= __atomic_load_n ( &_cap.stats.written, __ATOMIC_RELAXED );
+  stats->duplicated=
+    __atomic_load_n ( &_cap.stats.duplicated, __ATOMIC_RELAXED );
+  stats->dropped= __atomic_load_n ( &_cap.stats.dropped, __ATOMIC_RELAXED );
+  stats->bytes= __atomic_load_n ( &_cap.stats.bytes, __ATOMIC_RELAXED );
+
+} // end PC_capture_get_stats
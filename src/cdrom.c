@@ -27,12 +27,150 @@
 #include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 
 #include "PC.h"
 
 
 
 
+/**********/
+/* MACROS */
+/**********/
+
+// Disposició de cada sector en PC_CDRom.ra i en la cau.
+#define SEC_Q_OFFSET     CD_SEC_SIZE
+#define SEC_AUDIO_OFFSET (CD_SEC_SIZE+CD_SUBCH_SIZE)
+#define SEC_CRC_OFFSET   (CD_SEC_SIZE+CD_SUBCH_SIZE+1)
+#define SEC_ENTRY_SIZE   (CD_SEC_SIZE+CD_SUBCH_SIZE+2)
+
+
+
+
+/*********************/
+/* FUNCIONS PRIVADES */
+/*********************/
+
+static bool
+disc_seek (
+           PC_CDRom   *cdrom,
+           const long  pos
+           )
+{
+
+  int amm,ass,asect;
+  long tmp;
+  
+
+  tmp= pos;
+  amm= (int) (tmp/(60*75));
+  tmp%= 60*75;
+  ass= (int) (tmp/75);
+  asect= (int) (tmp%75);
+  if ( !CD_disc_seek ( cdrom->current, amm, ass, asect ) )
+    {
+      cdrom->disc_pos= -1;
+      return false;
+    }
+  cdrom->disc_pos= pos;
+
+  return true;
+  
+} // end disc_seek
+
+
+// Llig del disc el sector on està CD_Disc.
+static bool
+read_disc_sector (
+                  PC_CDRom *cdrom,
+                  uint8_t  *sec
+                  )
+{
+
+  bool audio,crc_ok;
+  
+
+  if ( !CD_disc_read_q ( cdrom->current, &(sec[SEC_Q_OFFSET]),
+                         &crc_ok, false ) )
+    return false;
+  if ( !CD_disc_read ( cdrom->current, sec, &audio, true ) )
+    {
+      cdrom->disc_pos= -1;
+      return false;
+    }
+  ++(cdrom->disc_pos);
+  sec[SEC_AUDIO_OFFSET]= audio ? 1 : 0;
+  sec[SEC_CRC_OFFSET]= crc_ok ? 1 : 0;
+
+  return true;
+  
+} // end read_disc_sector
+
+
+// Torna el sector cdrom->pos. Primer el busca en la finestra de
+// lectura anticipada, després en la cau i si no està llig
+// PC_CDROM_READAHEAD sectors seguits del disc amb una única
+// recerca.
+static const uint8_t *
+load_sector (
+             PC_CDRom *cdrom
+             )
+{
+
+  long n;
+  int i;
+  
+
+  // Finestra.
+  n= cdrom->pos - cdrom->ra_first;
+  if ( cdrom->ra_first != -1 && n >= 0 && n < cdrom->ra_n )
+    return cdrom->ra[n];
+
+  // Cau.
+  cdrom->ra_first= cdrom->pos;
+  cdrom->ra_n= 0;
+  if ( cdrom->cache != NULL &&
+       PC_cache_lookup ( cdrom->cache, (uint64_t) cdrom->pos,
+                         cdrom->ra[0], SEC_ENTRY_SIZE ) )
+    {
+      cdrom->ra_n= 1;
+      return cdrom->ra[0];
+    }
+  
+  // Llig del disc.
+  if ( cdrom->disc_pos != cdrom->pos && !disc_seek ( cdrom, cdrom->pos ) )
+    return NULL;
+  for ( i= 0;
+        i < PC_CDROM_READAHEAD &&
+          (i == 0 || cdrom->pos+i < cdrom->end_pos);
+        ++i )
+    {
+      if ( !read_disc_sector ( cdrom, cdrom->ra[i] ) ) break;
+      if ( cdrom->cache != NULL )
+        PC_cache_insert ( cdrom->cache, (uint64_t) (cdrom->pos+i),
+                          cdrom->ra[i], SEC_ENTRY_SIZE );
+    }
+  cdrom->ra_n= i;
+  
+  return i > 0 ? cdrom->ra[0] : NULL;
+  
+} // end load_sector
+
+
+static long
+bcd2pos (
+         const CD_Position pos
+         )
+{
+  return
+    (10*((long) (pos.mm>>4)) + ((long) (pos.mm&0xf)))*60*75 +
+    (10*((long) (pos.ss>>4)) + ((long) (pos.ss&0xf)))*75 +
+    (10*((long) (pos.sec>>4)) + ((long) (pos.sec&0xf)));
+} // end bcd2pos
+
+
+
+
 /**********************/
 /* FUNCIONS PÚBLIQUES */
 /**********************/
@@ -48,6 +186,12 @@ PC_cdrom_new (void)
   if ( ret == NULL ) return NULL;
   ret->info= NULL;
   ret->current= NULL;
+  ret->cache= NULL;
+  ret->pos= 0;
+  ret->disc_pos= -1;
+  ret->end_pos= 0;
+  ret->ra_first= -1;
+  ret->ra_n= 0;
   
   return ret;
   
@@ -62,6 +206,7 @@ PC_cdrom_free (
   
   if ( cdrom->info != NULL ) CD_info_free ( cdrom->info );
   if ( cdrom->current != NULL ) CD_disc_free ( cdrom->current );
+  if ( cdrom->cache != NULL ) PC_cache_source_free ( cdrom->cache );
   free ( cdrom );
   
 } // end PC_cdrom_free
@@ -76,6 +221,7 @@ PC_cdrom_insert_disc (
 {
   
   CD_Disc *disc;
+  PC_CacheSource *cache;
   
 
   // Intenta carregar.
@@ -83,15 +229,119 @@ PC_cdrom_insert_disc (
     {
       disc= CD_disc_new ( file_name, err );
       if ( disc == NULL ) return false;
+      // Els CDs sempre són de només lectura, es comparteixen.
+      cache= PC_cache_source_new ( file_name, true );
+    }
+  else
+    {
+      disc= NULL;
+      cache= NULL;
     }
-  else disc= NULL;
       
   // Intercànvia.
   if ( cdrom->info != NULL ) CD_info_free ( cdrom->info );
   if ( cdrom->current != NULL ) CD_disc_free ( cdrom->current );
+  if ( cdrom->cache != NULL ) PC_cache_source_free ( cdrom->cache );
   cdrom->current= disc;
   cdrom->info= disc!=NULL ? CD_disc_get_info ( disc ) : NULL;
+  cdrom->cache= cache;
+  cdrom->pos= 0;
+  cdrom->disc_pos= -1;
+  cdrom->end_pos=
+    cdrom->info!=NULL && cdrom->info->ntracks > 0 ?
+    bcd2pos ( cdrom->info->tracks[cdrom->info->ntracks-1].pos_last_sector )+1 :
+    0;
+  cdrom->ra_first= -1;
+  cdrom->ra_n= 0;
   
   return true;
   
 } // end PC_cdrom_insert_disc
+
+
+bool
+PC_cdrom_seek (
+               PC_CDRom  *cdrom,
+               const int  mm,
+               const int  ss,
+               const int  sec
+               )
+{
+
+  long pos;
+
+
+  assert ( cdrom->current != NULL );
+  pos= ((long) mm)*60*75 + ((long) ss)*75 + (long) sec;
+  if ( cdrom->disc_pos != pos && !disc_seek ( cdrom, pos ) )
+    return false;
+  cdrom->pos= pos;
+
+  return true;
+  
+} // end PC_cdrom_seek
+
+
+bool
+PC_cdrom_read_q (
+                 PC_CDRom *cdrom,
+                 uint8_t   q[CD_SUBCH_SIZE],
+                 bool     *crc_ok
+                 )
+{
+
+  const uint8_t *sec;
+  
+  
+  assert ( cdrom->current != NULL );
+  sec= load_sector ( cdrom );
+  if ( sec == NULL ) return false;
+  memcpy ( q, &(sec[SEC_Q_OFFSET]), CD_SUBCH_SIZE );
+  *crc_ok= sec[SEC_CRC_OFFSET]!=0;
+
+  return true;
+  
+} // end PC_cdrom_read_q
+
+
+bool
+PC_cdrom_read (
+               PC_CDRom   *cdrom,
+               uint8_t     buf[CD_SEC_SIZE],
+               bool       *audio,
+               const bool  move
+               )
+{
+
+  const uint8_t *sec;
+  
+
+  sec= PC_cdrom_read_ptr ( cdrom, audio, move );
+  if ( sec == NULL ) return false;
+  memcpy ( buf, sec, CD_SEC_SIZE );
+
+  return true;
+  
+} // end PC_cdrom_read
+
+
+const uint8_t *
+PC_cdrom_read_ptr (
+                   PC_CDRom   *cdrom,
+                   bool       *audio,
+                   const bool  move
+                   )
+{
+
+  const uint8_t *sec;
+  
+
+  assert ( cdrom->current != NULL );
+  sec= load_sector ( cdrom );
+  if ( sec == NULL ) return NULL;
+  *audio= sec[SEC_AUDIO_OFFSET]!=0;
+  if ( move ) ++(cdrom->pos);
+
+  return sec;
+  
+} // end PC_cdrom_read_ptr
@@ -49,6 +49,9 @@
 
 #define ADDR_MASK 0xFFFFFF
 
+// Unitats màximes per ràfega (modes DEMAND i BLOCK).
+#define BURST_MAX 512
+
 
 
 
@@ -481,6 +484,7 @@ mem_jit_read16_trace (
 } // end mem_jit_read16_trace
 
 
+
 static void
 write_byte (
            const int      chn,
@@ -559,105 +563,271 @@ read_word (
 
 
 static void
-run_transfer (void)
+transfer_unit (void)
 {
 
   uint32_t addr;
+  
+  
+  // Transferència 8bit
+  if ( _transfer.chn < 4 )
+    {
+      
+      // Adreça
+      addr=
+        (((uint32_t) _chns[_transfer.chn].low_page)<<16) |
+        ((uint32_t) _chns[_transfer.chn].addr);
+      
+      // Transferència
+      switch ( _chns[_transfer.chn].transfer_type )
+        {
+        case WRITE: write_byte ( _transfer.chn, addr ); break;
+        case READ: read_byte ( _transfer.chn, addr ); break;
+        default:
+          PC_MSGF("dma.c - run_transfer DMA.%d:"
+                  " TRANSFER_TYPE %d",
+                  _transfer.chn,_chns[_transfer.chn].transfer_type);
+          exit(EXIT_FAILURE);
+        }
+      
+      // Incrementa/Decrementa adreça
+      if ( _chns[_transfer.chn].inc )
+        {
+          ++_chns[_transfer.chn].addr;
+          /* // NO SÉ SI TINC QUE FER-HO
+             if ( _chns[_transfer.chn].addr == 0x0000 )
+             ++_chns[_transfer.chn].low_page;
+          */
+        }
+      else
+        {
+          --_chns[_transfer.chn].addr;
+          /* // NO SÉ SI TINC QUE FER-HO
+             if ( _chns[_transfer.chn].addr == 0xFFFF )
+             --_chns[_transfer.chn].low_page;
+          */
+        }
+      
+    }
+  else // Transferència 16bit
+    {
+      
+      // Adreça (Es fa un shift de l'adreçai s'ignora el bit
+      // inferior de la pàgina)
+      addr=
+        (((uint32_t) (_chns[_transfer.chn].low_page&0xfe))<<16) |
+        (((uint32_t) _chns[_transfer.chn].addr)<<1);
+      
+      // Transferència
+      switch ( _chns[_transfer.chn].transfer_type )
+        {
+        case READ: read_word ( _transfer.chn, addr ); break;
+        default:
+          PC_MSGF("dma.c - run_transfer DMA.%d:"
+                  " TRANSFER_TYPE %d",
+                  _transfer.chn,_chns[_transfer.chn].transfer_type);
+          exit(EXIT_FAILURE);
+        }
+      
+      // Incrementa/Decrementa adreça
+      if ( _chns[_transfer.chn].inc )
+        {
+          ++_chns[_transfer.chn].addr;
+          /*
+            if ( _chns[_transfer.chn].addr == 0x0000 )
+            //_chns[_transfer.chn].low_page+= 2; // Big inferior s'ignora
+            ++_chns[_transfer.chn].low_page;
+          */
+        }
+      else
+        {
+          --_chns[_transfer.chn].addr;
+          /*
+            if ( _chns[_transfer.chn].addr == 0xFFFF )
+            //_chns[_transfer.chn].low_page-= 2; // Big inferior s'ignora
+            --_chns[_transfer.chn].low_page;
+          */
+        }
+      
+    }
+  
+} // end transfer_unit
+
+
+// Torna el nombre màxim d'unitats que es poden transferir en una
+// ràfega pel canal actual, o 0 si cal anar unitat a unitat.
+static int
+burst_len (void)
+{
+
+  int chn,n;
+  
+
+  chn= _transfer.chn;
+  if ( _trace_mode ||
+       (_chns[chn].transfer_mode != DEMAND &&
+        _chns[chn].transfer_mode != BLOCK) ||
+       !_chns[chn].inc )
+    return 0;
+
+  // Fins al TC, sense que l'adreça pegue la volta i sense passar-se
+  // del buffer.
+  n= ((int) _chns[chn].counter) + 1;
+  if ( n > 0x10000 - (int) _chns[chn].addr )
+    n= 0x10000 - (int) _chns[chn].addr;
+  if ( n > BURST_MAX ) n= BURST_MAX;
+  
+  return n;
+  
+} // end burst_len
+
+
+// Passa fins a max bytes de memòria al DSP de la SB16. Abans de
+// llegir cada byte es pregunta si el DSP el vol, per a no llegir res
+// que després no es transfereix.
+static int
+sb16_read_units (
+                 const uint32_t addr,
+                 const int      max
+                 )
+{
+
+  uint8_t data;
+  int n;
+
+  
+  for ( n= 0; n < max && PC_sb16_dma_dreq (); ++n )
+    {
+      PC_mtxc_read_block ( (uint64_t) (addr+n), &data, 1 );
+      if ( PC_sb16_dma_write_block ( &data, 1 ) == 0 ) break;
+    }
+  
+  return n;
+  
+} // end sb16_read_units
+
+
+// Com sb16_read_units però en paraules de 16 bits.
+static int
+sb16_read_units16 (
+                   const uint32_t addr,
+                   const int      max
+                   )
+{
+
+  uint8_t buf[2];
+  uint16_t data;
+  int n;
+
+  
+  for ( n= 0; n < max && PC_sb16_dma16_dreq (); ++n )
+    {
+      PC_mtxc_read_block ( (uint64_t) (addr+2*n), buf, 2 );
+      data= ((uint16_t) buf[0]) | (((uint16_t) buf[1])<<8);
+      if ( PC_sb16_dma16_write_block ( &data, 1 ) == 0 ) break;
+    }
+  
+  return n;
+  
+} // end sb16_read_units16
+
+
+// Transfereix en ràfega fins a max unitats. Torna les unitats
+// transferides, 0 si el dispositiu no en pot proporcionar/acceptar
+// cap en ràfega.
+// NOTA!! Quan tot el rang és RAM es llig per avançat el que podria
+// consumir el dispositiu, encara que al final en consumisca
+// menys. Si no, es pregunta unitat a unitat per a no provocar
+// lectures en dispositius que després no es transfereixen.
+static int
+transfer_burst (
+                const int max
+                )
+{
+
+  static uint8_t buf[2*BURST_MAX];
+  static uint16_t buf16[BURST_MAX];
+  
+  int chn,n,i;
+  uint32_t addr;
+  
+
+  chn= _transfer.chn;
+  n= 0;
+  
+  // Transferència 8bit
+  if ( chn < 4 )
+    {
+      addr=
+        (((uint32_t) _chns[chn].low_page)<<16) |
+        ((uint32_t) _chns[chn].addr);
+      if ( _chns[chn].transfer_type == WRITE && chn == 2 )
+        {
+          n= PC_fd_dma_read_block ( buf, max );
+          if ( n > 0 ) PC_mtxc_write_block ( (uint64_t) addr, buf, n );
+        }
+      else if ( _chns[chn].transfer_type == READ && chn == 1 )
+        {
+          if ( PC_mtxc_is_ram ( (uint64_t) addr, max ) )
+            {
+              PC_mtxc_read_block ( (uint64_t) addr, buf, max );
+              n= PC_sb16_dma_write_block ( buf, max );
+            }
+          else n= sb16_read_units ( addr, max );
+        }
+    }
+
+  // Transferència 16bit
+  else if ( _chns[chn].transfer_type == READ && chn == 5 )
+    {
+      addr=
+        (((uint32_t) (_chns[chn].low_page&0xfe))<<16) |
+        (((uint32_t) _chns[chn].addr)<<1);
+      if ( PC_mtxc_is_ram ( (uint64_t) addr, 2*max ) )
+        {
+          PC_mtxc_read_block ( (uint64_t) addr, buf, 2*max );
+          for ( i= 0; i < max; ++i )
+            buf16[i]= ((uint16_t) buf[2*i]) | (((uint16_t) buf[2*i+1])<<8);
+          n= PC_sb16_dma16_write_block ( buf16, max );
+        }
+      else n= sb16_read_units16 ( addr, max );
+    }
+
+  // Incrementa adreça.
+  _chns[chn].addr+= (uint16_t) n;
+  
+  return n;
+  
+} // end transfer_burst
+
+
+static void
+run_transfer (void)
+{
+
   bool tc;
+  int n;
   
   
   // NOTA!! No deuria de passar que es processen més d'una run de
   // colp, però així és més robust.
   do {
-    
-    // Transferència 8bit
-    if ( _transfer.chn < 4 )
-      {
-
-        // Adreça
-        addr=
-          (((uint32_t) _chns[_transfer.chn].low_page)<<16) |
-          ((uint32_t) _chns[_transfer.chn].addr);
-
-        // Transferència
-        switch ( _chns[_transfer.chn].transfer_type )
-          {
-          case WRITE: write_byte ( _transfer.chn, addr ); break;
-          case READ: read_byte ( _transfer.chn, addr ); break;
-          default:
-            PC_MSGF("dma.c - run_transfer DMA.%d:"
-                    " TRANSFER_TYPE %d",
-                    _transfer.chn,_chns[_transfer.chn].transfer_type);
-            exit(EXIT_FAILURE);
-          }
 
-        // Incrementa/Decrementa adreça
-        if ( _chns[_transfer.chn].inc )
-          {
-            ++_chns[_transfer.chn].addr;
-            /* // NO SÉ SI TINC QUE FER-HO
-            if ( _chns[_transfer.chn].addr == 0x0000 )
-              ++_chns[_transfer.chn].low_page;
-            */
-          }
-        else
-          {
-            --_chns[_transfer.chn].addr;
-            /* // NO SÉ SI TINC QUE FER-HO
-            if ( _chns[_transfer.chn].addr == 0xFFFF )
-              --_chns[_transfer.chn].low_page;
-            */
-          }
-        
-      }
-    else // Transferència 16bit
+    // Transferència. En mode DEMAND/BLOCK s'intenta moure una ràfega
+    // sencera, si no es pot unitat a unitat.
+    n= burst_len ();
+    if ( n == 0 || (n= transfer_burst ( n )) == 0 )
       {
-
-        // Adreça (Es fa un shift de l'adreçai s'ignora el bit
-        // inferior de la pàgina)
-        addr=
-          (((uint32_t) (_chns[_transfer.chn].low_page&0xfe))<<16) |
-          (((uint32_t) _chns[_transfer.chn].addr)<<1);
-        
-        // Transferència
-        switch ( _chns[_transfer.chn].transfer_type )
-          {
-          case READ: read_word ( _transfer.chn, addr ); break;
-          default:
-            PC_MSGF("dma.c - run_transfer DMA.%d:"
-                    " TRANSFER_TYPE %d",
-                    _transfer.chn,_chns[_transfer.chn].transfer_type);
-            exit(EXIT_FAILURE);
-          }
-
-        // Incrementa/Decrementa adreça
-        if ( _chns[_transfer.chn].inc )
-          {
-            ++_chns[_transfer.chn].addr;
-            /*
-            if ( _chns[_transfer.chn].addr == 0x0000 )
-              //_chns[_transfer.chn].low_page+= 2; // Big inferior s'ignora
-              ++_chns[_transfer.chn].low_page;
-            */
-          }
-        else
-          {
-            --_chns[_transfer.chn].addr;
-            /*
-            if ( _chns[_transfer.chn].addr == 0xFFFF )
-              //_chns[_transfer.chn].low_page-= 2; // Big inferior s'ignora
-              --_chns[_transfer.chn].low_page;
-            */
-          }
-        
+        transfer_unit ();
+        n= 1;
       }
-
+    
     // Decrementa counter
-    --_chns[_transfer.chn].counter;
-    tc= false;
-    if ( _chns[_transfer.chn].counter == 0xFFFF ) // TC
+    tc= (n == ((int) _chns[_transfer.chn].counter) + 1);
+    _chns[_transfer.chn].counter-= (uint16_t) n;
+    if ( tc ) // TC
       {
-        tc= true; // Sempre o sols quan no hi ha autonit ???
+        // Sempre o sols quan no hi ha autonit ???
         tc_signal ( _transfer.chn );
         if ( _chns[_transfer.chn].autoinit )
           {
@@ -676,6 +846,7 @@ run_transfer (void)
         _transfer.cc= 0;
         break;
       case DEMAND: // Desactiva
+      case BLOCK: // Sols para amb el TC
         if ( tc )
           {
             _transfer.running= false;
@@ -42,6 +42,13 @@
 
 #define SECTOR_SIZE 512
 
+// Mode PC_CFG_FD_FAST_MEDIA. Els cicles d'un byte han de ser major que
+// el que tarda el DMA en transferir-lo (~1us), si no la FIFO es
+// desbordaria.
+#define FAST_MEDIA(CFG) (((CFG)->flags&PC_CFG_FD_FAST_MEDIA)!=0)
+#define FAST_CC_STEP 10
+#define FAST_NS_BYTE 2000
+
 
 
 
@@ -320,6 +327,17 @@ update_cc_variable (void)
     case 2: _timing.cc__byte= (PC_ClockFreq*8)/250000; break; // 250K
     case 3: _timing.cc__byte= (PC_ClockFreq*8)/1000000; break; // 1M
     }
+
+  // Mode ràpid: seeks i càrrega del capçal quasi instantanis i bytes
+  // al ritme que permet el DMA.
+  if ( FAST_MEDIA ( _config ) )
+    {
+      _timing.cc__srt= FAST_CC_STEP;
+      _timing.cc__hlt= FAST_CC_STEP;
+      _timing.cc__byte= (int) (((int64_t) PC_ClockFreq*FAST_NS_BYTE)/
+                               1000000000);
+      if ( _timing.cc__byte == 0 ) _timing.cc__byte= 1;
+    }
   
 } // end upadte_cc_variable
 
@@ -334,6 +352,9 @@ bytes2cc (
   int us,ret;
   
   
+  // Mode ràpid
+  if ( FAST_MEDIA ( _config ) ) return bytes*_timing.cc__byte;
+  
   // Calcula microsegons
   switch ( _regs.dsr.drate )
     {
@@ -2152,3 +2173,35 @@ PC_fd_dma_read (void)
   return ret;
   
 } // end PC_fd_dma_read
+
+
+int
+PC_fd_dma_read_block (
+                      uint8_t   *dst,
+                      const int  max
+                      )
+{
+
+  int n;
+  
+  
+  // En mode traça cada byte ha de passar per _dma_read.
+  if ( _dma_read != dma_read ) return 0;
+  
+  clock ( false );
+  n= 0;
+  if ( _state.dma_state.op == DMA_OP_READ_DATA )
+    {
+      while ( n < max && _fifo.N > 0 )
+        {
+          dst[n++]= _fifo.v[_fifo.p];
+          _fifo.p= (_fifo.p+1)%FIFO_SIZE;
+          --_fifo.N;
+        }
+      if ( n > 0 && _fifo.N == 0 ) PC_dma_dreq ( 2, false );
+    }
+  update_cc_to_event ();
+  
+  return n;
+  
+} // end PC_fd_dma_read_block
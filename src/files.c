@@ -27,12 +27,23 @@
 #include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 
 #include "PC.h"
 
 
 
 
+/**********/
+/* MACROS */
+/**********/
+
+// Grandària dels blocs que es desen en la cau.
+#define BLOCK_SIZE 4096
+
+
+
+
 /*********/
 /* TIPUS */
 /*********/
@@ -41,11 +52,25 @@ typedef struct
 {
   
   PC_FILE_CLASS;
-  FILE *fd;
-  long  offset;
+  FILE           *fd;
+  long            offset;
+  PC_CacheSource *cache; // Pot ser NULL
+  uint8_t         buf[BLOCK_SIZE];
   
 } file_t;
 
+// Fitxer carregat sencer en memòria. Les escriptures es repeteixen
+// en el fitxer real.
+typedef struct
+{
+  
+  PC_FILE_CLASS;
+  FILE    *fd;
+  long     offset;
+  uint8_t *data;
+  
+} mem_t;
+
 
 
 
@@ -61,17 +86,16 @@ file_seek (
 {
   
   file_t *self;
-  int ret;
   
   
+  // NOTA!! El fseek real es fa en cada lectura/escriptura, perquè la
+  // cau pot deixar el descriptor en qualsevol posició.
   self= (file_t *) f;
-  if ( offset >= self->nbytes )
+  if ( offset < 0 || offset >= self->nbytes )
     return -1;
-  ret= fseek ( self->fd, offset, SEEK_SET );
-  if ( ret != -1 )
-    self->offset= offset;
+  self->offset= offset;
   
-  return ret;
+  return 0;
   
 } // end file_seek
 
@@ -85,6 +109,32 @@ file_tell (
 } // end file_tell
 
 
+// Llig el bloc indicat en self->buf, des de la cau si és possible.
+static bool
+read_block (
+            file_t         *self,
+            const uint64_t  block,
+            size_t         *size
+            )
+{
+
+  long offset;
+  
+
+  offset= (long) (block*BLOCK_SIZE);
+  *size= self->nbytes-offset < BLOCK_SIZE ?
+    (size_t) (self->nbytes-offset) : BLOCK_SIZE;
+  if ( PC_cache_lookup ( self->cache, block, self->buf, *size ) )
+    return true;
+  if ( fseek ( self->fd, offset, SEEK_SET ) == -1 ) return false;
+  if ( fread ( self->buf, *size, 1, self->fd ) != 1 ) return false;
+  PC_cache_insert ( self->cache, block, self->buf, *size );
+  
+  return true;
+  
+} // end read_block
+
+
 static int
 file_read (
            PC_File *f,
@@ -94,7 +144,10 @@ file_read (
 {
 
   file_t *self;
-  long tmp;
+  long tmp,off,remain,len;
+  uint64_t block;
+  size_t bsize,boff;
+  uint8_t *p;
   int ret;
 
   
@@ -103,10 +156,35 @@ file_read (
   if ( nbytes == 0 ) return -1;
   if ( tmp < nbytes ) return -1;
   if ( tmp > self->nbytes ) return -1;
-  ret= (int) fread ( dst, (size_t) nbytes, 1, self->fd );
-  if ( ret==1 ) self->offset+= nbytes;
+
+  // Sense cau.
+  if ( self->cache == NULL || !PC_cache_enabled () )
+    {
+      if ( fseek ( self->fd, self->offset, SEEK_SET ) == -1 ) return -1;
+      ret= (int) fread ( dst, (size_t) nbytes, 1, self->fd );
+      if ( ret==1 ) self->offset+= nbytes;
+      return ret==1 ? 0 : -1;
+    }
+
+  // Per blocs.
+  p= (uint8_t *) dst;
+  off= self->offset;
+  remain= nbytes;
+  while ( remain > 0 )
+    {
+      block= (uint64_t) (off/BLOCK_SIZE);
+      boff= (size_t) (off%BLOCK_SIZE);
+      if ( !read_block ( self, block, &bsize ) ) return -1;
+      len= (long) (bsize-boff);
+      if ( len > remain ) len= remain;
+      memcpy ( p, &(self->buf[boff]), (size_t) len );
+      p+= len;
+      off+= len;
+      remain-= len;
+    }
+  self->offset+= nbytes;
   
-  return ret==1 ? 0 : -1;
+  return 0;
   
 } // end file_read
 
@@ -120,7 +198,9 @@ file_write (
 {
 
   file_t *self;
-  long tmp;
+  long tmp,off,remain,len;
+  size_t boff;
+  const uint8_t *p;
   int ret;
   
   
@@ -129,10 +209,29 @@ file_write (
   if ( nbytes == 0 ) return -1;
   if ( tmp < nbytes ) return -1;
   if ( tmp > self->nbytes ) return -1;
+  if ( fseek ( self->fd, self->offset, SEEK_SET ) == -1 ) return -1;
   ret= (int) fwrite ( src, (size_t) nbytes, 1, self->fd );
   if ( ret==1 )
     {
       fflush ( self->fd );
+      // Manté la cau coherent.
+      if ( self->cache != NULL )
+        {
+          p= (const uint8_t *) src;
+          off= self->offset;
+          remain= nbytes;
+          while ( remain > 0 )
+            {
+              boff= (size_t) (off%BLOCK_SIZE);
+              len= (long) (BLOCK_SIZE-boff);
+              if ( len > remain ) len= remain;
+              PC_cache_update ( self->cache, (uint64_t) (off/BLOCK_SIZE),
+                                boff, p, (size_t) len );
+              p+= len;
+              off+= len;
+              remain-= len;
+            }
+        }
       self->offset+= nbytes;
     }
   
@@ -153,11 +252,117 @@ file_free (
 
   self= (file_t *) f;
   if ( self->fd != NULL ) fclose ( self->fd );
+  if ( self->cache != NULL ) PC_cache_source_free ( self->cache );
   free ( self );
   
 } // end file_free
 
 
+static int
+mem_seek (
+          PC_File *f,
+          long     offset
+          )
+{
+  
+  mem_t *self;
+  
+  
+  self= (mem_t *) f;
+  if ( offset < 0 || offset >= self->nbytes )
+    return -1;
+  self->offset= offset;
+  
+  return 0;
+  
+} // end mem_seek
+
+
+static long
+mem_tell (
+          PC_File *f
+          )
+{
+  return ((mem_t *) f)->offset;
+} // end mem_tell
+
+
+static int
+mem_read (
+          PC_File *f,
+          void    *dst,
+          long     nbytes
+          )
+{
+
+  mem_t *self;
+  long tmp;
+  
+  
+  self= (mem_t *) f;
+  tmp= self->offset + nbytes;
+  if ( nbytes == 0 ) return -1;
+  if ( tmp < nbytes ) return -1;
+  if ( tmp > self->nbytes ) return -1;
+  memcpy ( dst, &(self->data[self->offset]), (size_t) nbytes );
+  self->offset+= nbytes;
+  
+  return 0;
+  
+} // end mem_read
+
+
+static int
+mem_write (
+           PC_File *f,
+           void    *src,
+           long     nbytes
+           )
+{
+
+  mem_t *self;
+  long tmp;
+  int ret;
+  
+  
+  self= (mem_t *) f;
+  tmp= self->offset + nbytes;
+  if ( self->fd == NULL ) return -1;
+  if ( nbytes == 0 ) return -1;
+  if ( tmp < nbytes ) return -1;
+  if ( tmp > self->nbytes ) return -1;
+  if ( fseek ( self->fd, self->offset, SEEK_SET ) == -1 ) return -1;
+  ret= (int) fwrite ( src, (size_t) nbytes, 1, self->fd );
+  if ( ret==1 )
+    {
+      fflush ( self->fd );
+      memcpy ( &(self->data[self->offset]), src, (size_t) nbytes );
+      self->offset+= nbytes;
+    }
+  
+  return ret==1 ? 0 : -1;
+  
+} // end mem_write
+
+
+static void
+mem_free (
+          PC_File *f
+          )
+
+{
+
+  mem_t *self;
+
+
+  self= (mem_t *) f;
+  if ( self->fd != NULL ) fclose ( self->fd );
+  if ( self->data != NULL ) free ( self->data );
+  free ( self );
+  
+} // end mem_free
+
+
 
 
 /**********************/
@@ -179,6 +384,7 @@ PC_file_new_from_file (
   ret= (file_t *) malloc ( sizeof(file_t) );
   if ( ret == NULL ) return NULL;
   ret->fd= NULL;
+  ret->cache= NULL;
   ret->read_only= read_only;
   ret->seek= file_seek;
   ret->tell= file_tell;
@@ -197,6 +403,9 @@ PC_file_new_from_file (
   ret->nbytes= size;
   rewind ( ret->fd );
   ret->offset= 0;
+
+  // Cau. Les imatges de només lectura es comparteixen.
+  ret->cache= PC_cache_source_new ( file_name, read_only );
   
   return PC_FILE(ret);
   
@@ -205,3 +414,59 @@ PC_file_new_from_file (
   return NULL;
   
 } // end PC_file_new_from_file
+
+
+PC_File *
+PC_file_new_from_file_mem (
+                           const char *file_name,
+                           const bool  read_only
+                           )
+{
+
+  mem_t *ret;
+  long size;
+  
+
+  // Prepara.
+  ret= (mem_t *) malloc ( sizeof(mem_t) );
+  if ( ret == NULL ) return NULL;
+  ret->fd= NULL;
+  ret->data= NULL;
+  ret->read_only= read_only;
+  ret->seek= mem_seek;
+  ret->tell= mem_tell;
+  ret->read= mem_read;
+  ret->write= mem_write;
+  ret->free= mem_free;
+  
+  // Obri fitxer.
+  ret->fd= fopen ( file_name, read_only ? "rb" : "r+b" );
+  if ( ret->fd == NULL ) goto error;
+
+  // Comprova grandària.
+  if ( fseek ( ret->fd, 0, SEEK_END ) == -1 ) goto error;
+  size= ftell ( ret->fd );
+  if ( size == -1 || size == 0 ) goto error;
+  ret->nbytes= size;
+  rewind ( ret->fd );
+  ret->offset= 0;
+
+  // Carrega.
+  ret->data= (uint8_t *) malloc ( (size_t) size );
+  if ( ret->data == NULL ) goto error;
+  if ( fread ( ret->data, (size_t) size, 1, ret->fd ) != 1 ) goto error;
+  
+  // Si és de només lectura ja no cal el descriptor.
+  if ( read_only )
+    {
+      fclose ( ret->fd );
+      ret->fd= NULL;
+    }
+  
+  return PC_FILE(ret);
+  
+ error:
+  PC_file_free ( PC_FILE(ret) );
+  return NULL;
+  
+} // end PC_file_new_from_file_mem
@@ -161,9 +161,12 @@ PC_init (
          )
 {
   
+  static const uint32_t SVGA_VRAM_SIZE_MB[PC_SVGA_VRAM_SIZE_SENTINEL]=
+    { 4, 2, 1 };
+  
   PC_Error err;
   bool pci_devs[PC_PCI_DEVICE_NULL];
-  int i;
+  int i,audio_freq;
   
   
   _config= *config;
@@ -190,6 +193,17 @@ PC_init (
     default: return PC_UNK_CPU_MODEL;
     }
   PC_ClockFreq*= SCALE_FREQ;
+
+  // Freqüència del so.
+  audio_freq= config->audio_freq!=0 ?
+    config->audio_freq : PC_AUDIO_FREQ_DEFAULT;
+  if ( audio_freq < PC_AUDIO_FREQ_MIN || audio_freq > PC_AUDIO_FREQ_MAX )
+    return PC_BAD_AUDIO_FREQ;
+
+  // Memòria de vídeo.
+  if ( (unsigned int) config->svga_vram_size >=
+       (unsigned int) PC_SVGA_VRAM_SIZE_SENTINEL )
+    return PC_BAD_VRAM_SIZE;
   
   // Prepara PCIdevs
   err= PC_NOERROR;
@@ -207,6 +221,11 @@ PC_init (
             err= PC_svga_cirrus_clgd5446_init
               ( frontend->warning,
                 frontend->update_screen,
+                frontend->update_screen_damage,
+                config->fb_format,
+                (config->flags&PC_CFG_SVGA_RENDER_THREAD)!=0,
+                (config->flags&PC_CFG_SVGA_FAST_RETRACE)!=0,
+                SVGA_VRAM_SIZE_MB[config->svga_vram_size]*1024*1024,
                 frontend->trace!=NULL ?
                 frontend->trace->vga_mem_access:
                 NULL,
@@ -262,8 +281,8 @@ PC_init (
                frontend->trace!=NULL?
                frontend->trace->floppy_fifo_access:NULL,
                udata, &_config );
-  PC_speaker_init ( frontend->warning, udata );
-  PC_sb16_init ( frontend->warning, udata );
+  PC_speaker_init ( frontend->warning, udata, audio_freq );
+  PC_sb16_init ( frontend->warning, udata, audio_freq );
   PC_sound_init ( frontend->warning, frontend->play_sound, udata );
   
   return PC_NOERROR;
@@ -602,6 +621,8 @@ void
 PC_close (void)
 {
   
+  PC_svga_cirrus_clgd5446_close ();
+  PC_capture_close ();
   PC_mtxc_close ();
   PC_cpu_close ();
   
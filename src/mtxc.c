@@ -60,6 +60,15 @@
 
 #define PAGE_CODE_BITS 4
 
+#define DIRECT_READ16(MEM,OFF)                                          \
+  SWAPU16((((const uint16_t *) ((MEM)+((OFF)&0x1)))[(OFF)>>1]))
+#define DIRECT_READ32(MEM,OFF)                                          \
+  SWAPU32((((const uint32_t *) ((MEM)+((OFF)&0x3)))[(OFF)>>2]))
+#define DIRECT_WRITE16(MEM,OFF,DATA)                                    \
+  (((uint16_t *) ((MEM)+((OFF)&0x1)))[(OFF)>>1]= SWAPU16(DATA))
+#define DIRECT_WRITE32(MEM,OFF,DATA)                                    \
+  (((uint32_t *) ((MEM)+((OFF)&0x3)))[(OFF)>>2]= SWAPU32(DATA))
+
 
 
 
@@ -141,6 +150,13 @@ static struct
   uint16_t pcicmd;
 } _pci_regs;
 
+// Finestres d'accés directe publicades pels dispositius PCI.
+static struct
+{
+  PC_MemDirect v[PC_MTXC_MAX_DIRECT];
+  int          N;
+} _direct;
+
 // Access a confdata
 static uint8_t (*_confdata_read8) (const uint8_t low_addr);
 static uint16_t (*_confdata_read16) (const uint8_t low_addr);
@@ -746,6 +762,98 @@ close_ram (void)
 } // end close_ram
 
 
+static const PC_MemDirect *
+direct_lookup (
+               const uint64_t addr,
+               const int      nbytes,
+               const bool     write
+               )
+{
+
+  int i;
+  const PC_MemDirect *m;
+  
+  
+  for ( i= 0; i < _direct.N; ++i )
+    {
+      m= &(_direct.v[i]);
+      if ( addr >= m->begin && addr+nbytes <= m->end &&
+           (!write || m->writable) )
+        return m;
+    }
+  
+  return NULL;
+  
+} // end direct_lookup
+
+
+// Torna el valor en little-endian.
+static uint64_t
+direct_read (
+             const PC_MemDirect *m,
+             const uint64_t      addr,
+             const int           nbytes
+             )
+{
+
+  uint32_t off;
+  uint64_t ret;
+  int i;
+  
+  
+  off= (uint32_t) (addr-m->begin);
+  if ( m->swap == 0 )
+    switch ( nbytes )
+      {
+      case 1: return m->mem[off];
+      case 2: return DIRECT_READ16(m->mem,off);
+      case 4: return DIRECT_READ32(m->mem,off);
+      default:
+        return
+          ((uint64_t) DIRECT_READ32(m->mem,off)) |
+          (((uint64_t) DIRECT_READ32(m->mem,off+4))<<32);
+      }
+  ret= 0;
+  for ( i= nbytes-1; i >= 0; --i )
+    ret= (ret<<8) | m->mem[(off+i)^m->swap];
+  
+  return ret;
+  
+} // end direct_read
+
+
+static void
+direct_write (
+              const PC_MemDirect *m,
+              const uint64_t      addr,
+              const uint32_t      data,
+              const int           nbytes
+              )
+{
+
+  uint32_t off,first,last;
+  int i;
+  
+  
+  off= (uint32_t) (addr-m->begin);
+  first= off&(~m->swap);
+  last= (off+nbytes-1)|m->swap;
+  if ( m->writing != NULL ) m->writing ( first, (int) (last-first+1) );
+  if ( m->swap == 0 )
+    switch ( nbytes )
+      {
+      case 1: m->mem[off]= (uint8_t) data; break;
+      case 2: DIRECT_WRITE16(m->mem,off,(uint16_t) data); break;
+      default: DIRECT_WRITE32(m->mem,off,data); break;
+      }
+  else
+    for ( i= 0; i < nbytes; ++i )
+      m->mem[(off+i)^m->swap]= (uint8_t) (data>>(8*i));
+  if ( m->written != NULL ) m->written ( first, (int) (last-first+1) );
+  
+} // end direct_write
+
+
 static uint8_t
 pci_mem_read8 (
                const uint64_t addr
@@ -754,10 +862,13 @@ pci_mem_read8 (
 
   int i;
   uint8_t ret;
+  const PC_MemDirect *m;
 
   
   if ( !PC_piix4_mem_read8 ( addr, &ret ) )
     {
+      if ( (m= direct_lookup ( addr, 1, false )) != NULL )
+        return (uint8_t) direct_read ( m, addr, 1 );
       ret= 0xFF;
       for ( i= 0; _pci_devs[i] != NULL; ++i )
         if ( _pci_devs[i]->mem != NULL )
@@ -896,10 +1007,13 @@ pci_mem_read16 (
 
   int i;
   uint16_t ret;
+  const PC_MemDirect *m;
   
 
   if ( !PC_piix4_mem_read16 ( addr, &ret ) )
     {
+      if ( (m= direct_lookup ( addr, 2, false )) != NULL )
+        return (uint16_t) direct_read ( m, addr, 2 );
       ret= 0xFFFF;
       for ( i= 0; _pci_devs[i] != NULL; ++i )
         if ( _pci_devs[i]->mem != NULL )
@@ -1030,10 +1144,13 @@ pci_mem_read32 (
   
   int i;
   uint32_t ret;
+  const PC_MemDirect *m;
   
   
   if ( !PC_piix4_mem_read32 ( addr, &ret ) )
     {
+      if ( (m= direct_lookup ( addr, 4, false )) != NULL )
+        return (uint32_t) direct_read ( m, addr, 4 );
       ret= 0xFFFFFFFF;
       for ( i= 0; _pci_devs[i] != NULL; ++i )
         if ( _pci_devs[i]->mem != NULL )
@@ -1164,8 +1281,11 @@ pci_mem_read64 (
 
   int i;
   uint64_t ret;
+  const PC_MemDirect *m;
   
 
+  if ( (m= direct_lookup ( addr, 8, false )) != NULL )
+    return direct_read ( m, addr, 8 );
   ret= 0xFFFFFFFFFFFFFFFF;
   for ( i= 0; _pci_devs[i] != NULL; ++i )
     if ( _pci_devs[i]->mem != NULL )
@@ -1209,13 +1329,19 @@ pci_mem_write8 (
 {
 
   int i;
+  const PC_MemDirect *m;
   
   
   if ( !PC_piix4_mem_write8 ( addr, data ) )
-    for ( i= 0; _pci_devs[i] != NULL; ++i )
-      if ( _pci_devs[i]->mem != NULL )
-        if ( _pci_devs[i]->mem->write8 ( addr, data ) )
-          break;
+    {
+      if ( (m= direct_lookup ( addr, 1, true )) != NULL )
+        direct_write ( m, addr, (uint32_t) data, 1 );
+      else
+        for ( i= 0; _pci_devs[i] != NULL; ++i )
+          if ( _pci_devs[i]->mem != NULL )
+            if ( _pci_devs[i]->mem->write8 ( addr, data ) )
+              break;
+    }
   
 } // end pci_mem_write8
 
@@ -1374,13 +1500,19 @@ pci_mem_write16 (
 {
 
   int i;
+  const PC_MemDirect *m;
   
 
   if ( !PC_piix4_mem_write16 ( addr, data ) )
-    for ( i= 0; _pci_devs[i] != NULL; ++i )
-      if ( _pci_devs[i]->mem != NULL )
-        if ( _pci_devs[i]->mem->write16 ( addr, data ) )
-          break;
+    {
+      if ( (m= direct_lookup ( addr, 2, true )) != NULL )
+        direct_write ( m, addr, (uint32_t) data, 2 );
+      else
+        for ( i= 0; _pci_devs[i] != NULL; ++i )
+          if ( _pci_devs[i]->mem != NULL )
+            if ( _pci_devs[i]->mem->write16 ( addr, data ) )
+              break;
+    }
   
 } // end pci_mem_write16
 
@@ -1573,13 +1705,19 @@ pci_mem_write32 (
 
   
   int i;
+  const PC_MemDirect *m;
   
 
   if ( !PC_piix4_mem_write32 ( addr, data ) )
-    for ( i= 0; _pci_devs[i] != NULL; ++i )
-      if ( _pci_devs[i]->mem != NULL )
-        if ( _pci_devs[i]->mem->write32 ( addr, data ) )
-          break;
+    {
+      if ( (m= direct_lookup ( addr, 4, true )) != NULL )
+        direct_write ( m, addr, (uint32_t) data, 4 );
+      else
+        for ( i= 0; _pci_devs[i] != NULL; ++i )
+          if ( _pci_devs[i]->mem != NULL )
+            if ( _pci_devs[i]->mem->write32 ( addr, data ) )
+              break;
+    }
   
 } // end pci_mem_write32
 
@@ -1763,6 +1901,93 @@ mem_jit_write32 (
 } // end mem_jit_write32
 
 
+// Calcula el tram [addr,addr+*len) de com a molt n bytes on l'accés
+// és homogeni. Torna cert si el tram és RAM.
+static bool
+get_block_run (
+               const uint64_t  addr,
+               const uint64_t  n,
+               const bool      write,
+               uint64_t       *len,
+               bool           *check_code
+               )
+{
+
+  uint64_t end,tmp;
+  bool ret;
+  int i,j;
+  
+
+  *check_code= true;
+  if ( addr < 0x000A0000 ) { end= 0x000A0000; ret= true; }
+  
+  // Video Buffer Area (A0000h–BFFFFh)
+  else if ( addr < 0x000C0000 ) { end= 0x000C0000; ret= false; }
+  
+  // Secció configurable via PAM. Segments de 16K i 64K.
+  else if ( addr < 0x000F0000 )
+    {
+      tmp= addr&0x3FFFF;
+      i= (tmp>>15)+1;
+      j= (tmp>>14)&0x1;
+      end= (addr&(~((uint64_t) 0x3FFF))) + 0x4000;
+      ret= write ?
+        _ram.pam[i].flags[j].write_enabled :
+        _ram.pam[i].flags[j].read_enabled;
+      *check_code= _ram.pam[i].flags[j].read_enabled;
+    }
+  else if ( addr < 0x00100000 )
+    {
+      end= 0x00100000;
+      ret= write ?
+        _ram.pam[0].flags[1].write_enabled :
+        _ram.pam[0].flags[1].read_enabled;
+      *check_code= _ram.pam[0].flags[1].read_enabled;
+    }
+  
+  // Més RAM
+  else if ( addr < _ram.size ) { end= _ram.size; ret= true; }
+
+  // PCI
+  else { end= addr+n; ret= false; }
+
+  *len= end-addr;
+  if ( *len > n ) *len= n;
+  
+  return ret;
+  
+} // end get_block_run
+
+
+// Invalida el codi JIT que hi haja en [addr,addr+n). Sols es miren
+// byte a byte les pàgines marcades, com fa mem_jit_write8.
+static void
+block_code_changed (
+                    const uint64_t addr,
+                    const uint64_t n
+                    )
+{
+
+  uint64_t a,end;
+  int page;
+  
+
+  end= addr+n;
+  a= addr;
+  while ( a < end )
+    {
+      page= a>>PAGE_CODE_BITS;
+      if ( _ram.pages_code[page] )
+        {
+          page_code_changed ( a );
+          ++a;
+        }
+      else a= (((uint64_t) page)+1)<<PAGE_CODE_BITS;
+    }
+  
+} // end block_code_changed
+
+
 static uint8_t
 mem_read8_trace (
                  void           *udata,
@@ -2235,6 +2460,7 @@ PC_mtxc_init (
   // Inicialitza memòria.
   init_ram ( config );
   init_pci_regs ();
+  _direct.N= 0;
   PC_CPU.mem_read8= mem_read8;
   PC_CPU.mem_read16= mem_read16;
   PC_CPU.mem_read32= mem_read32;
@@ -2452,6 +2678,106 @@ PC_mtxc_confadd_write (
 } // end PC_mtxc_confadd_write
 
 
+bool
+PC_mtxc_is_ram (
+                const uint64_t addr,
+                const uint64_t n
+                )
+{
+
+  uint64_t a,len;
+  bool check_code;
+  
+  
+  a= addr;
+  while ( a < addr+n )
+    {
+      if ( !get_block_run ( a, addr+n-a, false, &len, &check_code ) )
+        return false;
+      a+= len;
+    }
+
+  return true;
+  
+} // end PC_mtxc_is_ram
+
+
+void
+PC_mtxc_read_block (
+                    const uint64_t  addr,
+                    uint8_t        *dst,
+                    const uint64_t  n
+                    )
+{
+
+  uint64_t a,len,i;
+  bool check_code;
+  
+  
+  a= addr;
+  while ( a < addr+n )
+    {
+      if ( get_block_run ( a, addr+n-a, false, &len, &check_code ) )
+        memcpy ( dst, &(_ram.v[a]), len );
+      else
+        for ( i= 0; i < len; ++i )
+          dst[i]= pci_mem_read8 ( a+i );
+      dst+= len;
+      a+= len;
+    }
+  
+} // end PC_mtxc_read_block
+
+
+void
+PC_mtxc_write_block (
+                     const uint64_t  addr,
+                     const uint8_t  *src,
+                     const uint64_t  n
+                     )
+{
+
+  uint64_t a,len,i;
+  bool check_code;
+  
+  
+  a= addr;
+  while ( a < addr+n )
+    {
+      if ( get_block_run ( a, addr+n-a, true, &len, &check_code ) )
+        {
+          // NOTA!! Les pàgines sols es marquen amb el JIT.
+          if ( check_code ) block_code_changed ( a, len );
+          memcpy ( &(_ram.v[a]), src, len );
+        }
+      else
+        for ( i= 0; i < len; ++i )
+          pci_mem_write8 ( a+i, src[i] );
+      src+= len;
+      a+= len;
+    }
+  
+} // end PC_mtxc_write_block
+
+
+void
+PC_mtxc_set_direct (
+                    const PC_MemDirect *maps,
+                    const int           N
+                    )
+{
+
+  int i;
+  
+
+  assert ( N >= 0 && N <= PC_MTXC_MAX_DIRECT );
+  for ( i= 0; i < N; ++i )
+    _direct.v[i]= maps[i];
+  _direct.N= N;
+  
+} // end PC_mtxc_set_direct
+
+
 void
 PC_mtxc_set_mode_trace (
                         const bool val
@@ -1529,7 +1529,7 @@ cdrom_seek (
   asect= (int) (offset%75);
   
   // Fa seek.
-  if ( !CD_disc_seek ( drv->cdrom.cd->current, amm, ass, asect ) )
+  if ( !PC_cdrom_seek ( drv->cdrom.cd, amm, ass, asect ) )
     {
       cdrom_abort ( ide, drv, CD_SENSE_KEY_MEDIUM_ERROR,
                     CD_ADD_SENSE_NO_SEEK_COMPLETE );
@@ -1543,18 +1543,18 @@ cdrom_seek (
 } // end cdrom_seek
 
 
-// NOTA!! Ha d'estar ready.
+// NOTA!! Ha d'estar ready. Copia les dades d'usuari del bloc lògic
+// actual en dst.
 static bool
 cdrom_readlb (
               const int  ide,
-              drv_t     *drv
+              drv_t     *drv,
+              uint8_t   *dst
               )
 {
 
-  static uint8_t buf[CD_SEC_SIZE];
-  
+  const uint8_t *buf;
   bool audio,crc_ok;
-  unsigned int i;
   uint8_t mode;
   
   
@@ -1567,14 +1567,14 @@ cdrom_readlb (
     }
 
   // Llig
-  if ( !CD_disc_read_q ( drv->cdrom.cd->current, drv->cdrom.subchn_Q,
-                         &crc_ok, false ) )
+  if ( !PC_cdrom_read_q ( drv->cdrom.cd, drv->cdrom.subchn_Q, &crc_ok ) )
     {
       cdrom_abort ( ide, drv, CD_SENSE_KEY_MEDIUM_ERROR,
                     CD_ADD_SENSE_CAN_NOT_READ_UNK_FORMAT );
       return false;
     }
-  if ( !CD_disc_read ( drv->cdrom.cd->current, buf, &audio, true ) )
+  buf= PC_cdrom_read_ptr ( drv->cdrom.cd, &audio, true );
+  if ( buf == NULL )
     {
       cdrom_abort ( ide, drv, CD_SENSE_KEY_MEDIUM_ERROR,
                     CD_ADD_SENSE_CAN_NOT_READ_UNK_FORMAT );
@@ -1589,21 +1589,11 @@ cdrom_readlb (
     }
   mode= buf[15];
   if ( mode == 1 )
-    {
-      for ( i= 16; i < 2064; i++ )
-        drv->cdrom.buflb.v[i-16]= buf[i];
-      drv->cdrom.buflb.p= 0;
-      drv->cdrom.buflb.l= 2048;
-    }
+    memcpy ( dst, &buf[16], 2048 );
   else if ( mode == 2 )
     {
       if ( (buf[0x12]&0x20) == 0 ) // Form 1
-        {
-          for ( i= 0x18; i < 0x818; i++ )
-            drv->cdrom.buflb.v[i-0x18]= buf[i];
-          drv->cdrom.buflb.p= 0;
-          drv->cdrom.buflb.l= 2048;
-        }
+        memcpy ( dst, &buf[0x18], 2048 );
       else
         {
           PC_MSG("piix4_ide.c - cdrom_readlb: FORM 2");
@@ -1733,7 +1723,7 @@ cdrom_play_load_next_sector (
     }
 
   // Llig.
-  if ( !CD_disc_seek ( drv->cdrom.cd->current,
+  if ( !PC_cdrom_seek ( drv->cdrom.cd,
                        (int) (drv->cdrom.audio.current.m),
                        (int) (drv->cdrom.audio.current.s),
                        (int) (drv->cdrom.audio.current.f) ) )
@@ -1742,15 +1732,13 @@ cdrom_play_load_next_sector (
                     CD_ADD_SENSE_NO_SEEK_COMPLETE );
       goto stop;
     }
-  if ( !CD_disc_read_q ( drv->cdrom.cd->current, drv->cdrom.subchn_Q,
-                         &crc_ok, false ) )
+  if ( !PC_cdrom_read_q ( drv->cdrom.cd, drv->cdrom.subchn_Q, &crc_ok ) )
     {
       cdrom_abort ( ide, drv, CD_SENSE_KEY_MEDIUM_ERROR,
                     CD_ADD_SENSE_CAN_NOT_READ_UNK_FORMAT );
       return false;
     }
-  if ( !CD_disc_read ( drv->cdrom.cd->current,
-                       drv->cdrom.audio.v, &audio, false ) )
+  if ( !PC_cdrom_read ( drv->cdrom.cd, drv->cdrom.audio.v, &audio, false ) )
     {
       cdrom_abort ( ide, drv, CD_SENSE_KEY_MEDIUM_ERROR,
                     CD_ADD_SENSE_CAN_NOT_READ_UNK_FORMAT );
@@ -1982,10 +1970,9 @@ read_cdlb_iter (
                 )
 {
 
-  bool available,data_empty;
-  int nbytes;
-  unsigned int i;
-  uint16_t data;
+  bool available;
+  int nbytes,n;
+  uint8_t *dst;
   
   
   // Comprova disponibilitat
@@ -2002,45 +1989,55 @@ read_cdlb_iter (
       return;
     }
 
-  // Intena omplir buffer PIO
+  // Intena omplir buffer PIO. Els blocs sencers que caben es copien
+  // directament en el buffer PIO, sols el bloc que queda partit passa
+  // per buflb.
+  dst= (uint8_t *) &(drv->pio_transfer.buf[0]);
   nbytes= 0;
-  data_empty= true;
-  data= 0x0000;
   drv->pio_transfer.begin= 0;
   drv->pio_transfer.end= 0;
-  while ( nbytes < drv->pio_transfer.cdlb.byte_count && available )
+  while ( nbytes < drv->pio_transfer.cdlb.byte_count )
     {
+      
+      // Bytes pendents del bloc anterior.
+      if ( drv->cdrom.buflb.p < drv->cdrom.buflb.l )
+        {
+          n= (int) (drv->cdrom.buflb.l - drv->cdrom.buflb.p);
+          if ( n > drv->pio_transfer.cdlb.byte_count - nbytes )
+            n= drv->pio_transfer.cdlb.byte_count - nbytes;
+          memcpy ( dst+nbytes, &(drv->cdrom.buflb.v[drv->cdrom.buflb.p]), n );
+          drv->cdrom.buflb.p+= n;
+          nbytes+= n;
+        }
 
-      // Si no queden bytes carrega
-      if ( drv->cdrom.buflb.p >= drv->cdrom.buflb.l )
+      // Nou bloc.
+      else if ( drv->pio_transfer.cdlb.remain > 0 )
         {
-          if ( drv->pio_transfer.cdlb.remain > 0 )
+          if ( drv->pio_transfer.cdlb.byte_count - nbytes >= 2048 )
             {
-              if ( !cdrom_readlb ( ide, drv ) )
+              if ( !cdrom_readlb ( ide, drv, dst+nbytes ) )
                 return;
-              --drv->pio_transfer.cdlb.remain;
+              nbytes+= 2048;
             }
-          else available= false;
-        }
-
-      // Còpia
-      for ( i= drv->cdrom.buflb.p;
-            i != drv->cdrom.buflb.l &&
-              nbytes < drv->pio_transfer.cdlb.byte_count;
-            i++, nbytes++ )
-        {
-          if ( data_empty ) data= (uint16_t) (drv->cdrom.buflb.v[i]);
           else
             {
-              data|= ((uint16_t) (drv->cdrom.buflb.v[i]))<<8;
-              drv->pio_transfer.buf[drv->pio_transfer.end++]= data;
+              if ( !cdrom_readlb ( ide, drv, drv->cdrom.buflb.v ) )
+                return;
+              drv->cdrom.buflb.p= 0;
+              drv->cdrom.buflb.l= 2048;
             }
-          data_empty= !data_empty;
+          --drv->pio_transfer.cdlb.remain;
         }
-      drv->cdrom.buflb.p= i;
+      else break;
       
     }
-  if ( !data_empty ) drv->pio_transfer.buf[drv->pio_transfer.end++]= data;
+  if ( nbytes&1 ) dst[nbytes]= 0x00;
+  drv->pio_transfer.end= (nbytes+1)/2;
+  // --> El buffer està en l'endianisme de la màquina.
+#if PC_BE
+  for ( n= 0; n < drv->pio_transfer.end; ++n )
+    drv->pio_transfer.buf[n]= PC_SWAP16(drv->pio_transfer.buf[n]);
+#endif
   assert ( drv->pio_transfer.end > 0 );
   
   // Prepara comandament
@@ -2567,14 +2564,13 @@ cd_read_toc (
     }
 
   // Simula l'accés per a llegir el toc i obtindre el Q.
-  if ( !CD_disc_seek ( drv->cdrom.cd->current, 0, 1, 74 ) )
+  if ( !PC_cdrom_seek ( drv->cdrom.cd, 0, 1, 74 ) )
     {
       cdrom_abort ( ide, drv, CD_SENSE_KEY_MEDIUM_ERROR,
                     CD_ADD_SENSE_NO_SEEK_COMPLETE );
       return;
     }
-  if ( !CD_disc_read_q ( drv->cdrom.cd->current, drv->cdrom.subchn_Q,
-                         &crc_ok, false ) )
+  if ( !PC_cdrom_read_q ( drv->cdrom.cd, drv->cdrom.subchn_Q, &crc_ok ) )
     {
       cdrom_abort ( ide, drv, CD_SENSE_KEY_MEDIUM_ERROR,
                     CD_ADD_SENSE_CAN_NOT_READ_UNK_FORMAT );
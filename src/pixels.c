@@ -0,0 +1,872 @@
+/*
+ * Copyright 2025 Adrià Giménez Pastor.
+ *
+ * This file is part of adriagipas/PC.
+ *
+ * adriagipas/PC is free software: you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as
+ * published by the Free Software Foundation, either version 3 of the
+ * License, or (at your option) any later version.
+ *
+ * adriagipas/PC is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with adriagipas/PC.  If not, see <https://www.gnu.org/licenses/>.
+ */
+/*
+ *  pixels.c - Conversió de files de píxels emprada per la targeta
+ *             gràfica. Cada funció té una versió escalar i, si la
+ *             CPU ho permet, versions SSE2/AVX2 que es trien en
+ *             temps d'execució.
+ *
+ */
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "PC.h"
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define PIXELS_X86
+#include <immintrin.h>
+#endif
+
+
+
+
+/**********/
+/* MACROS */
+/**********/
+
+#define SSE2 __attribute__((target("sse2")))
+#define AVX2 __attribute__((target("avx2")))
+
+
+
+
+/*********/
+/* TIPUS */
+/*********/
+
+typedef struct
+{
+
+  const char *name;
+  void (*lut8) (uint32_t *dst,const uint8_t *src,const uint32_t *pal,
+                const int n);
+  void (*rgb555) (uint32_t *dst,const uint16_t *src,const int n);
+  void (*rgb565) (uint32_t *dst,const uint16_t *src,const int n);
+  void (*rgb888) (uint32_t *dst,const uint8_t *src,const int n);
+  void (*xrgb8888) (uint32_t *dst,const uint32_t *src,const int n);
+  void (*to_rgb) (PC_RGB *dst,const uint32_t *src,const int n);
+  void (*to_bgrx8888) (uint32_t *dst,const uint32_t *src,const int n);
+  void (*to_rgb565) (uint16_t *dst,const uint32_t *src,const int n);
+  
+} kernels_t;
+
+
+
+
+/*********************/
+/* FUNCIONS PRIVADES */
+/*********************/
+
+/* Escalar. */
+
+static void
+lut8_scalar (
+             uint32_t       *dst,
+             const uint8_t  *src,
+             const uint32_t *pal,
+             const int       n
+             )
+{
+
+  int i;
+
+  
+  for ( i= 0; i < n; ++i )
+    dst[i]= pal[src[i]];
+  
+} // end lut8_scalar
+
+
+static void
+rgb555_scalar (
+               uint32_t       *dst,
+               const uint16_t *src,
+               const int       n
+               )
+{
+
+  int i;
+  uint32_t color;
+
+  
+  for ( i= 0; i < n; ++i )
+    {
+      color= src[i];
+      dst[i]= ((color&0x7C00)<<9) | ((color&0x03E0)<<6) | ((color&0x1F)<<3);
+    }
+  
+} // end rgb555_scalar
+
+
+static void
+rgb565_scalar (
+               uint32_t       *dst,
+               const uint16_t *src,
+               const int       n
+               )
+{
+
+  int i;
+  uint32_t color;
+
+  
+  for ( i= 0; i < n; ++i )
+    {
+      color= src[i];
+      dst[i]= ((color&0xF800)<<8) | ((color&0x07E0)<<5) | ((color&0x1F)<<3);
+    }
+  
+} // end rgb565_scalar
+
+
+static void
+rgb888_scalar (
+               uint32_t      *dst,
+               const uint8_t *src,
+               const int      n
+               )
+{
+
+  int i;
+
+  
+  for ( i= 0; i < n; ++i, src+= 3 )
+    dst[i]=
+      ((uint32_t) src[0]) |
+      (((uint32_t) src[1])<<8) |
+      (((uint32_t) src[2])<<16);
+  
+} // end rgb888_scalar
+
+
+static void
+xrgb8888_scalar (
+                 uint32_t       *dst,
+                 const uint32_t *src,
+                 const int       n
+                 )
+{
+
+  int i;
+
+  
+  for ( i= 0; i < n; ++i )
+    dst[i]= src[i]&0x00FFFFFF;
+  
+} // end xrgb8888_scalar
+
+
+static void
+to_rgb_scalar (
+               PC_RGB         *dst,
+               const uint32_t *src,
+               const int       n
+               )
+{
+
+  int i;
+
+  
+  for ( i= 0; i < n; ++i )
+    {
+      dst[i].r= (uint8_t) (src[i]>>16);
+      dst[i].g= (uint8_t) (src[i]>>8);
+      dst[i].b= (uint8_t) src[i];
+    }
+  
+} // end to_rgb_scalar
+
+
+static void
+to_bgrx8888_scalar (
+                    uint32_t       *dst,
+                    const uint32_t *src,
+                    const int       n
+                    )
+{
+
+  int i;
+
+  
+  for ( i= 0; i < n; ++i )
+    dst[i]=
+      (src[i]<<24) | ((src[i]&0x0000FF00)<<8) | ((src[i]&0x00FF0000)>>8);
+  
+} // end to_bgrx8888_scalar
+
+
+static void
+to_rgb565_scalar (
+                  uint16_t       *dst,
+                  const uint32_t *src,
+                  const int       n
+                  )
+{
+
+  int i;
+
+  
+  for ( i= 0; i < n; ++i )
+    dst[i]= (uint16_t)
+      (((src[i]>>8)&0xF800) | ((src[i]>>5)&0x07E0) | ((src[i]>>3)&0x001F));
+  
+} // end to_rgb565_scalar
+
+
+static const kernels_t KERNELS_SCALAR=
+  {
+    "scalar",
+    lut8_scalar,
+    rgb555_scalar,
+    rgb565_scalar,
+    rgb888_scalar,
+    xrgb8888_scalar,
+    to_rgb_scalar,
+    to_bgrx8888_scalar,
+    to_rgb565_scalar
+  };
+
+
+#ifdef PIXELS_X86
+
+/* SSE2. No té 'shuffle' de bytes ni 'gather', per tant la paleta i
+ * les conversions de/a 24 bits es queden en la versió escalar. */
+
+static SSE2 __m128i
+rgb555_sse2_4 (
+               const __m128i v
+               )
+{
+  return _mm_or_si128 (
+    _mm_or_si128 (
+      _mm_slli_epi32 ( _mm_and_si128 ( v, _mm_set1_epi32 ( 0x7C00 ) ), 9 ),
+      _mm_slli_epi32 ( _mm_and_si128 ( v, _mm_set1_epi32 ( 0x03E0 ) ), 6 ) ),
+    _mm_slli_epi32 ( _mm_and_si128 ( v, _mm_set1_epi32 ( 0x001F ) ), 3 ) );
+} // end rgb555_sse2_4
+
+
+static SSE2 __m128i
+rgb565_sse2_4 (
+               const __m128i v
+               )
+{
+  return _mm_or_si128 (
+    _mm_or_si128 (
+      _mm_slli_epi32 ( _mm_and_si128 ( v, _mm_set1_epi32 ( 0xF800 ) ), 8 ),
+      _mm_slli_epi32 ( _mm_and_si128 ( v, _mm_set1_epi32 ( 0x07E0 ) ), 5 ) ),
+    _mm_slli_epi32 ( _mm_and_si128 ( v, _mm_set1_epi32 ( 0x001F ) ), 3 ) );
+} // end rgb565_sse2_4
+
+
+static SSE2 void
+rgb555_sse2 (
+             uint32_t       *dst,
+             const uint16_t *src,
+             const int       n
+             )
+{
+
+  __m128i v,zero;
+  int i;
+
+  
+  zero= _mm_setzero_si128 ();
+  for ( i= 0; i+8 <= n; i+= 8 )
+    {
+      v= _mm_loadu_si128 ( (const __m128i *) (src+i) );
+      _mm_storeu_si128 ( (__m128i *) (dst+i),
+                         rgb555_sse2_4 ( _mm_unpacklo_epi16 ( v, zero ) ) );
+      _mm_storeu_si128 ( (__m128i *) (dst+i+4),
+                         rgb555_sse2_4 ( _mm_unpackhi_epi16 ( v, zero ) ) );
+    }
+  rgb555_scalar ( dst+i, src+i, n-i );
+  
+} // end rgb555_sse2
+
+
+static SSE2 void
+rgb565_sse2 (
+             uint32_t       *dst,
+             const uint16_t *src,
+             const int       n
+             )
+{
+
+  __m128i v,zero;
+  int i;
+
+  
+  zero= _mm_setzero_si128 ();
+  for ( i= 0; i+8 <= n; i+= 8 )
+    {
+      v= _mm_loadu_si128 ( (const __m128i *) (src+i) );
+      _mm_storeu_si128 ( (__m128i *) (dst+i),
+                         rgb565_sse2_4 ( _mm_unpacklo_epi16 ( v, zero ) ) );
+      _mm_storeu_si128 ( (__m128i *) (dst+i+4),
+                         rgb565_sse2_4 ( _mm_unpackhi_epi16 ( v, zero ) ) );
+    }
+  rgb565_scalar ( dst+i, src+i, n-i );
+  
+} // end rgb565_sse2
+
+
+static SSE2 void
+xrgb8888_sse2 (
+               uint32_t       *dst,
+               const uint32_t *src,
+               const int       n
+               )
+{
+
+  __m128i mask;
+  int i;
+
+  
+  mask= _mm_set1_epi32 ( 0x00FFFFFF );
+  for ( i= 0; i+4 <= n; i+= 4 )
+    _mm_storeu_si128 ( (__m128i *) (dst+i),
+                       _mm_and_si128 ( _mm_loadu_si128 ( (const __m128i *)
+                                                         (src+i) ),
+                                       mask ) );
+  xrgb8888_scalar ( dst+i, src+i, n-i );
+  
+} // end xrgb8888_sse2
+
+
+static SSE2 void
+to_bgrx8888_sse2 (
+                  uint32_t       *dst,
+                  const uint32_t *src,
+                  const int       n
+                  )
+{
+
+  __m128i v;
+  int i;
+
+  
+  for ( i= 0; i+4 <= n; i+= 4 )
+    {
+      v= _mm_loadu_si128 ( (const __m128i *) (src+i) );
+      v= _mm_or_si128 (
+        _mm_or_si128 (
+          _mm_slli_epi32 ( v, 24 ),
+          _mm_slli_epi32 ( _mm_and_si128
+                           ( v, _mm_set1_epi32 ( 0x0000FF00 ) ), 8 ) ),
+        _mm_srli_epi32 ( _mm_and_si128
+                         ( v, _mm_set1_epi32 ( 0x00FF0000 ) ), 8 ) );
+      _mm_storeu_si128 ( (__m128i *) (dst+i), v );
+    }
+  to_bgrx8888_scalar ( dst+i, src+i, n-i );
+  
+} // end to_bgrx8888_sse2
+
+
+static SSE2 __m128i
+to_rgb565_sse2_4 (
+                  const __m128i v
+                  )
+{
+
+  __m128i ret;
+
+  
+  ret= _mm_or_si128 (
+    _mm_or_si128 (
+      _mm_and_si128 ( _mm_srli_epi32 ( v, 8 ), _mm_set1_epi32 ( 0xF800 ) ),
+      _mm_and_si128 ( _mm_srli_epi32 ( v, 5 ), _mm_set1_epi32 ( 0x07E0 ) ) ),
+    _mm_and_si128 ( _mm_srli_epi32 ( v, 3 ), _mm_set1_epi32 ( 0x001F ) ) );
+  
+  // Estén el signe perquè _mm_packs_epi32 no sature.
+  return _mm_srai_epi32 ( _mm_slli_epi32 ( ret, 16 ), 16 );
+  
+} // end to_rgb565_sse2_4
+
+
+static SSE2 void
+to_rgb565_sse2 (
+                uint16_t       *dst,
+                const uint32_t *src,
+                const int       n
+                )
+{
+
+  __m128i lo,hi;
+  int i;
+
+  
+  for ( i= 0; i+8 <= n; i+= 8 )
+    {
+      lo= to_rgb565_sse2_4 ( _mm_loadu_si128 ( (const __m128i *) (src+i) ) );
+      hi= to_rgb565_sse2_4 ( _mm_loadu_si128 ( (const __m128i *)
+                                               (src+i+4) ) );
+      _mm_storeu_si128 ( (__m128i *) (dst+i), _mm_packs_epi32 ( lo, hi ) );
+    }
+  to_rgb565_scalar ( dst+i, src+i, n-i );
+  
+} // end to_rgb565_sse2
+
+
+static const kernels_t KERNELS_SSE2=
+  {
+    "sse2",
+    lut8_scalar,
+    rgb555_sse2,
+    rgb565_sse2,
+    rgb888_scalar,
+    xrgb8888_sse2,
+    to_rgb_scalar,
+    to_bgrx8888_sse2,
+    to_rgb565_sse2
+  };
+
+
+/* AVX2. */
+
+static AVX2 void
+lut8_avx2 (
+           uint32_t       *dst,
+           const uint8_t  *src,
+           const uint32_t *pal,
+           const int       n
+           )
+{
+
+  __m256i idx;
+  int i;
+
+  
+  for ( i= 0; i+8 <= n; i+= 8 )
+    {
+      idx= _mm256_cvtepu8_epi32 ( _mm_loadl_epi64 ( (const __m128i *)
+                                                    (src+i) ) );
+      _mm256_storeu_si256 ( (__m256i *) (dst+i),
+                            _mm256_i32gather_epi32 ( (const int *) pal,
+                                                     idx, 4 ) );
+    }
+  lut8_scalar ( dst+i, src+i, pal, n-i );
+  
+} // end lut8_avx2
+
+
+static AVX2 void
+rgb555_avx2 (
+             uint32_t       *dst,
+             const uint16_t *src,
+             const int       n
+             )
+{
+
+  __m256i v;
+  int i;
+
+  
+  for ( i= 0; i+8 <= n; i+= 8 )
+    {
+      v= _mm256_cvtepu16_epi32 ( _mm_loadu_si128 ( (const __m128i *)
+                                                   (src+i) ) );
+      v= _mm256_or_si256 (
+        _mm256_or_si256 (
+          _mm256_slli_epi32 ( _mm256_and_si256
+                              ( v, _mm256_set1_epi32 ( 0x7C00 ) ), 9 ),
+          _mm256_slli_epi32 ( _mm256_and_si256
+                              ( v, _mm256_set1_epi32 ( 0x03E0 ) ), 6 ) ),
+        _mm256_slli_epi32 ( _mm256_and_si256
+                            ( v, _mm256_set1_epi32 ( 0x001F ) ), 3 ) );
+      _mm256_storeu_si256 ( (__m256i *) (dst+i), v );
+    }
+  rgb555_scalar ( dst+i, src+i, n-i );
+  
+} // end rgb555_avx2
+
+
+static AVX2 void
+rgb565_avx2 (
+             uint32_t       *dst,
+             const uint16_t *src,
+             const int       n
+             )
+{
+
+  __m256i v;
+  int i;
+
+  
+  for ( i= 0; i+8 <= n; i+= 8 )
+    {
+      v= _mm256_cvtepu16_epi32 ( _mm_loadu_si128 ( (const __m128i *)
+                                                   (src+i) ) );
+      v= _mm256_or_si256 (
+        _mm256_or_si256 (
+          _mm256_slli_epi32 ( _mm256_and_si256
+                              ( v, _mm256_set1_epi32 ( 0xF800 ) ), 8 ),
+          _mm256_slli_epi32 ( _mm256_and_si256
+                              ( v, _mm256_set1_epi32 ( 0x07E0 ) ), 5 ) ),
+        _mm256_slli_epi32 ( _mm256_and_si256
+                            ( v, _mm256_set1_epi32 ( 0x001F ) ), 3 ) );
+      _mm256_storeu_si256 ( (__m256i *) (dst+i), v );
+    }
+  rgb565_scalar ( dst+i, src+i, n-i );
+  
+} // end rgb565_avx2
+
+
+// Cada meitat del registre agafa 4 píxels de 3 bytes. Es lligen 16
+// bytes per meitat, per això el bucle deixa marge al final.
+static AVX2 void
+rgb888_avx2 (
+             uint32_t      *dst,
+             const uint8_t *src,
+             const int      n
+             )
+{
+
+  __m256i v,shuf;
+  int i;
+
+  
+  shuf= _mm256_setr_epi8 ( 0, 1, 2, -1, 3, 4, 5, -1,
+                           6, 7, 8, -1, 9, 10, 11, -1,
+                           0, 1, 2, -1, 3, 4, 5, -1,
+                           6, 7, 8, -1, 9, 10, 11, -1 );
+  for ( i= 0; i+10 <= n; i+= 8 )
+    {
+      v= _mm256_inserti128_si256
+        ( _mm256_castsi128_si256 ( _mm_loadu_si128 ( (const __m128i *)
+                                                     (src+i*3) ) ),
+          _mm_loadu_si128 ( (const __m128i *) (src+i*3+12) ), 1 );
+      _mm256_storeu_si256 ( (__m256i *) (dst+i),
+                            _mm256_shuffle_epi8 ( v, shuf ) );
+    }
+  rgb888_scalar ( dst+i, src+i*3, n-i );
+  
+} // end rgb888_avx2
+
+
+static AVX2 void
+xrgb8888_avx2 (
+               uint32_t       *dst,
+               const uint32_t *src,
+               const int       n
+               )
+{
+
+  __m256i mask;
+  int i;
+
+  
+  mask= _mm256_set1_epi32 ( 0x00FFFFFF );
+  for ( i= 0; i+8 <= n; i+= 8 )
+    _mm256_storeu_si256 ( (__m256i *) (dst+i),
+                          _mm256_and_si256 ( _mm256_loadu_si256
+                                             ( (const __m256i *) (src+i) ),
+                                             mask ) );
+  xrgb8888_scalar ( dst+i, src+i, n-i );
+  
+} // end xrgb8888_avx2
+
+
+// Cada meitat del registre genera 12 bytes. Les escriptures són de 16
+// bytes i es solapen, per això el bucle deixa marge al final.
+static AVX2 void
+to_rgb_avx2 (
+             PC_RGB         *dst,
+             const uint32_t *src,
+             const int       n
+             )
+{
+
+  __m256i v,shuf;
+  uint8_t *p;
+  int i;
+
+  
+  shuf= _mm256_setr_epi8 ( 2, 1, 0, 6, 5, 4, 10, 9,
+                           8, 14, 13, 12, -1, -1, -1, -1,
+                           2, 1, 0, 6, 5, 4, 10, 9,
+                           8, 14, 13, 12, -1, -1, -1, -1 );
+  p= (uint8_t *) dst;
+  for ( i= 0; i+10 <= n; i+= 8 )
+    {
+      v= _mm256_shuffle_epi8 ( _mm256_loadu_si256 ( (const __m256i *)
+                                                     (src+i) ),
+                               shuf );
+      _mm_storeu_si128 ( (__m128i *) (p+i*3),
+                         _mm256_castsi256_si128 ( v ) );
+      _mm_storeu_si128 ( (__m128i *) (p+i*3+12),
+                         _mm256_extracti128_si256 ( v, 1 ) );
+    }
+  to_rgb_scalar ( dst+i, src+i, n-i );
+  
+} // end to_rgb_avx2
+
+
+static AVX2 void
+to_bgrx8888_avx2 (
+                  uint32_t       *dst,
+                  const uint32_t *src,
+                  const int       n
+                  )
+{
+
+  __m256i shuf;
+  int i;
+
+  
+  shuf= _mm256_setr_epi8 ( 3, 2, 1, 0, 7, 6, 5, 4,
+                           11, 10, 9, 8, 15, 14, 13, 12,
+                           3, 2, 1, 0, 7, 6, 5, 4,
+                           11, 10, 9, 8, 15, 14, 13, 12 );
+  for ( i= 0; i+8 <= n; i+= 8 )
+    _mm256_storeu_si256 ( (__m256i *) (dst+i),
+                          _mm256_shuffle_epi8 ( _mm256_loadu_si256
+                                                ( (const __m256i *) (src+i) ),
+                                                shuf ) );
+  to_bgrx8888_scalar ( dst+i, src+i, n-i );
+  
+} // end to_bgrx8888_avx2
+
+
+static AVX2 __m256i
+to_rgb565_avx2_8 (
+                  const __m256i v
+                  )
+{
+  return _mm256_or_si256 (
+    _mm256_or_si256 (
+      _mm256_and_si256 ( _mm256_srli_epi32 ( v, 8 ),
+                         _mm256_set1_epi32 ( 0xF800 ) ),
+      _mm256_and_si256 ( _mm256_srli_epi32 ( v, 5 ),
+                         _mm256_set1_epi32 ( 0x07E0 ) ) ),
+    _mm256_and_si256 ( _mm256_srli_epi32 ( v, 3 ),
+                       _mm256_set1_epi32 ( 0x001F ) ) );
+} // end to_rgb565_avx2_8
+
+
+// _mm256_packus_epi32 treballa per meitats, per això després cal
+// reordenar.
+static AVX2 void
+to_rgb565_avx2 (
+                uint16_t       *dst,
+                const uint32_t *src,
+                const int       n
+                )
+{
+
+  __m256i lo,hi;
+  int i;
+
+  
+  for ( i= 0; i+16 <= n; i+= 16 )
+    {
+      lo= to_rgb565_avx2_8 ( _mm256_loadu_si256 ( (const __m256i *)
+                                                  (src+i) ) );
+      hi= to_rgb565_avx2_8 ( _mm256_loadu_si256 ( (const __m256i *)
+                                                  (src+i+8) ) );
+      _mm256_storeu_si256 ( (__m256i *) (dst+i),
+                            _mm256_permute4x64_epi64
+                            ( _mm256_packus_epi32 ( lo, hi ), 0xD8 ) );
+    }
+  to_rgb565_scalar ( dst+i, src+i, n-i );
+  
+} // end to_rgb565_avx2
+
+
+static const kernels_t KERNELS_AVX2=
+  {
+    "avx2",
+    lut8_avx2,
+    rgb555_avx2,
+    rgb565_avx2,
+    rgb888_avx2,
+    xrgb8888_avx2,
+    to_rgb_avx2,
+    to_bgrx8888_avx2,
+    to_rgb565_avx2
+  };
+
+#endif // PIXELS_X86
+
+
+
+
+/*********/
+/* ESTAT */
+/*********/
+
+static const kernels_t *_k= &KERNELS_SCALAR;
+
+
+
+
+/**********************/
+/* FUNCIONS PÚBLIQUES */
+/**********************/
+
+void
+PC_pixels_init (void)
+{
+
+#ifdef PIXELS_X86
+  __builtin_cpu_init ();
+  if ( __builtin_cpu_supports ( "avx2" ) ) _k= &KERNELS_AVX2;
+  else if ( __builtin_cpu_supports ( "sse2" ) ) _k= &KERNELS_SSE2;
+  else _k= &KERNELS_SCALAR;
+#else
+  _k= &KERNELS_SCALAR;
+#endif
+  
+} // end PC_pixels_init
+
+
+const char *
+PC_pixels_impl (void)
+{
+  return _k->name;
+} // end PC_pixels_impl
+
+
+bool
+PC_pixels_set_impl (
+                    const char *name
+                    )
+{
+
+  const kernels_t *k;
+  
+
+  k= NULL;
+  if ( strcmp ( name, KERNELS_SCALAR.name ) == 0 ) k= &KERNELS_SCALAR;
+#ifdef PIXELS_X86
+  else
+    {
+      __builtin_cpu_init ();
+      if ( strcmp ( name, KERNELS_SSE2.name ) == 0 &&
+           __builtin_cpu_supports ( "sse2" ) )
+        k= &KERNELS_SSE2;
+      else if ( strcmp ( name, KERNELS_AVX2.name ) == 0 &&
+                __builtin_cpu_supports ( "avx2" ) )
+        k= &KERNELS_AVX2;
+    }
+#endif
+  if ( k == NULL ) return false;
+  _k= k;
+  
+  return true;
+  
+} // end PC_pixels_set_impl
+
+
+void
+PC_pixels_lut8 (
+                uint32_t       *dst,
+                const uint8_t  *src,
+                const uint32_t *pal,
+                const int       n
+                )
+{
+  _k->lut8 ( dst, src, pal, n );
+} // end PC_pixels_lut8
+
+
+void
+PC_pixels_rgb555 (
+                  uint32_t       *dst,
+                  const uint16_t *src,
+                  const int       n
+                  )
+{
+  _k->rgb555 ( dst, src, n );
+} // end PC_pixels_rgb555
+
+
+void
+PC_pixels_rgb565 (
+                  uint32_t       *dst,
+                  const uint16_t *src,
+                  const int       n
+                  )
+{
+  _k->rgb565 ( dst, src, n );
+} // end PC_pixels_rgb565
+
+
+void
+PC_pixels_rgb888 (
+                  uint32_t      *dst,
+                  const uint8_t *src,
+                  const int      n
+                  )
+{
+  _k->rgb888 ( dst, src, n );
+} // end PC_pixels_rgb888
+
+
+void
+PC_pixels_xrgb8888 (
+                    uint32_t       *dst,
+                    const uint32_t *src,
+                    const int       n
+                    )
+{
+  _k->xrgb8888 ( dst, src, n );
+} // end PC_pixels_xrgb8888
+
+
+int
+PC_pixels_size (
+                const PC_FBFormat format
+                )
+{
+
+  switch ( format )
+    {
+    case PC_FB_RGB: return 3;
+    case PC_FB_XRGB8888:
+    case PC_FB_BGRX8888: return 4;
+    case PC_FB_RGB565: return 2;
+    default: return 0;
+    }
+  
+} // end PC_pixels_size
+
+
+void
+PC_pixels_store (
+                 void              *dst,
+                 const uint32_t    *src,
+                 const int          n,
+                 const PC_FBFormat  format
+                 )
+{
+
+  switch ( format )
+    {
+    case PC_FB_RGB: _k->to_rgb ( (PC_RGB *) dst, src, n ); break;
+    case PC_FB_XRGB8888: memcpy ( dst, src, n*sizeof(uint32_t) ); break;
+    case PC_FB_BGRX8888: _k->to_bgrx8888 ( (uint32_t *) dst, src, n ); break;
+    case PC_FB_RGB565: _k->to_rgb565 ( (uint16_t *) dst, src, n ); break;
+    default: break;
+    }
+  
+} // end PC_pixels_store
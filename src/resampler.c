@@ -0,0 +1,399 @@
+/*
+ * Copyright 2025 Adrià Giménez Pastor.
+ *
+ * This file is part of adriagipas/PC.
+ *
+ * adriagipas/PC is free software: you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as
+ * published by the Free Software Foundation, either version 3 of the
+ * License, or (at your option) any later version.
+ *
+ * adriagipas/PC is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with adriagipas/PC.  If not, see <https://www.gnu.org/licenses/>.
+ */
+/*
+ *  resampler.c - Remostrejador polifàsic en punt fix compartit per
+ *                les fonts de so. El filtre és una sinc amb finestra
+ *                de Kaiser. El producte escalar té una versió AVX2
+ *                que es tria en temps d'execució.
+ *
+ */
+
+#include <assert.h>
+#include <math.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "PC.h"
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define RESAMPLER_X86
+#include <immintrin.h>
+#endif
+
+
+
+
+/**********/
+/* MACROS */
+/**********/
+
+#define AVX2 __attribute__((target("avx2")))
+
+#define TAPS   PC_RESAMPLER_TAPS
+#define PHASES PC_RESAMPLER_PHASES
+
+// Els coeficients estan en Q14 i cada fase suma exactament 1<<14. Amb
+// mostres de 16 bits l'acumulador de 32 bits no es desborda.
+#define COEF_BITS 14
+
+// Paràmetres del filtre. La freqüència de tall és ROLLOFF vegades la
+// freqüència de Nyquist més menuda de les dos.
+#define KAISER_BETA 6.0
+#define ROLLOFF     0.85
+
+
+
+
+/*********/
+/* TIPUS */
+/*********/
+
+typedef void (dot_t) (int32_t *l,int32_t *r,const int16_t *hl,
+                      const int16_t *hr,const int16_t *coef);
+
+
+
+
+/*********/
+/* ESTAT */
+/*********/
+
+static dot_t *_dot= NULL;
+
+
+
+
+/*********************/
+/* FUNCIONS PRIVADES */
+/*********************/
+
+static long
+gcd (
+     long a,
+     long b
+     )
+{
+
+  long tmp;
+
+
+  while ( b != 0 )
+    {
+      tmp= a%b;
+      a= b;
+      b= tmp;
+    }
+
+  return a;
+
+} // end gcd
+
+
+// Funció de Bessel modificada de primera espècie i ordre 0.
+static double
+bessel_i0 (
+           const double x
+           )
+{
+
+  double sum,term,y;
+  int k;
+
+
+  y= x*x/4.0;
+  sum= term= 1.0;
+  for ( k= 1; k < 64 && term > sum*1e-12; ++k )
+    {
+      term*= y/((double) k*k);
+      sum+= term;
+    }
+
+  return sum;
+
+} // end bessel_i0
+
+
+// Calcula els coeficients de totes les fases. 'fc' és la freqüència
+// de tall normalitzada (1 és la freqüència de Nyquist de l'entrada).
+static void
+build_coefs (
+             PC_Resampler *rs,
+             const double  fc
+             )
+{
+
+  double h[TAPS],t,x,total,half,i0b;
+  int ph,k,kmax,sum;
+
+
+  half= TAPS/2;
+  i0b= bessel_i0 ( KAISER_BETA );
+  for ( ph= 0; ph < PHASES; ++ph )
+    {
+
+      // La mostra d'eixida cau entre les mostres half-1 i half de la
+      // finestra, a una distància ph/PHASES de la primera.
+      total= 0.0;
+      for ( k= 0; k < TAPS; ++k )
+        {
+          t= (k - (half-1)) - ph/(double) PHASES;
+          x= M_PI*fc*t;
+          h[k]= x == 0.0 ? fc : fc*sin ( x )/x;
+          x= t/half;
+          x= 1.0 - x*x;
+          h[k]*= bessel_i0 ( KAISER_BETA*sqrt ( x > 0.0 ? x : 0.0 ) )/i0b;
+          total+= h[k];
+        }
+
+      // Quantifica. El que falta per a sumar 1<<COEF_BITS s'afegeix al
+      // coeficient més gran perquè el guany en continua siga exacte.
+      sum= 0; kmax= 0;
+      for ( k= 0; k < TAPS; ++k )
+        {
+          rs->coef[ph][k]= (int16_t) lround ( (h[k]/total)*(1<<COEF_BITS) );
+          sum+= rs->coef[ph][k];
+          if ( fabs ( h[k] ) > fabs ( h[kmax] ) ) kmax= k;
+        }
+      rs->coef[ph][kmax]+= (1<<COEF_BITS) - sum;
+
+    }
+  rs->fc= fc;
+
+} // end build_coefs
+
+
+static void
+dot_scalar (
+            int32_t       *l,
+            int32_t       *r,
+            const int16_t *hl,
+            const int16_t *hr,
+            const int16_t *coef
+            )
+{
+
+  int32_t sl,sr;
+  int k;
+
+
+  sl= sr= 0;
+  for ( k= 0; k < TAPS; ++k )
+    {
+      sl+= ((int32_t) hl[k])*((int32_t) coef[k]);
+      sr+= ((int32_t) hr[k])*((int32_t) coef[k]);
+    }
+  *l= sl;
+  *r= sr;
+
+} // end dot_scalar
+
+
+#ifdef RESAMPLER_X86
+// Cada canal són dos registres de 16 mostres. Les dos sumes
+// horitzontals deixen L i R en les posicions 0 i 1 de cada meitat.
+static AVX2 void
+dot_avx2 (
+          int32_t       *l,
+          int32_t       *r,
+          const int16_t *hl,
+          const int16_t *hr,
+          const int16_t *coef
+          )
+{
+
+  __m256i c0,c1,a,b,s;
+  __m128i t;
+
+
+  c0= _mm256_loadu_si256 ( (const __m256i *) coef );
+  c1= _mm256_loadu_si256 ( (const __m256i *) (coef+16) );
+  a= _mm256_add_epi32
+    ( _mm256_madd_epi16 ( _mm256_loadu_si256 ( (const __m256i *) hl ), c0 ),
+      _mm256_madd_epi16 ( _mm256_loadu_si256 ( (const __m256i *) (hl+16) ),
+                          c1 ) );
+  b= _mm256_add_epi32
+    ( _mm256_madd_epi16 ( _mm256_loadu_si256 ( (const __m256i *) hr ), c0 ),
+      _mm256_madd_epi16 ( _mm256_loadu_si256 ( (const __m256i *) (hr+16) ),
+                          c1 ) );
+  s= _mm256_hadd_epi32 ( a, b );
+  s= _mm256_hadd_epi32 ( s, s );
+  t= _mm_add_epi32 ( _mm256_castsi256_si128 ( s ),
+                     _mm256_extracti128_si256 ( s, 1 ) );
+  *l= _mm_cvtsi128_si32 ( t );
+  *r= _mm_extract_epi32 ( t, 1 );
+
+} // end dot_avx2
+#endif
+
+
+static void
+select_kernel (void)
+{
+
+#ifdef RESAMPLER_X86
+  __builtin_cpu_init ();
+  if ( __builtin_cpu_supports ( "avx2" ) ) _dot= dot_avx2;
+  else _dot= dot_scalar;
+#else
+  _dot= dot_scalar;
+#endif
+
+} // end select_kernel
+
+
+static int16_t
+sat16 (
+       const int32_t acc
+       )
+{
+
+  int32_t tmp;
+
+
+  tmp= (acc + (1<<(COEF_BITS-1)))>>COEF_BITS;
+  if      ( tmp > 32767 )  tmp= 32767;
+  else if ( tmp < -32768 ) tmp= -32768;
+
+  return (int16_t) tmp;
+
+} // end sat16
+
+
+
+
+/**********************/
+/* FUNCIONS PÚBLIQUES */
+/**********************/
+
+void
+PC_resampler_init (
+                   PC_Resampler *rs,
+                   const long    in_rate,
+                   const long    out_rate
+                   )
+{
+
+  if ( _dot == NULL ) select_kernel ();
+  rs->in_rate= 1;
+  rs->out_rate= 1;
+  rs->fc= 0.0;
+  PC_resampler_clear ( rs );
+  PC_resampler_set_rates ( rs, in_rate, out_rate );
+
+} // end PC_resampler_init
+
+
+void
+PC_resampler_set_rates (
+                        PC_Resampler *rs,
+                        long          in_rate,
+                        long          out_rate
+                        )
+{
+
+  long g;
+  double fc;
+
+
+  assert ( in_rate > 0 && out_rate > 0 );
+  g= gcd ( in_rate, out_rate );
+  in_rate/= g;
+  out_rate/= g;
+
+  // Conserva la posició de la següent mostra d'eixida.
+  if ( out_rate != rs->out_rate )
+    rs->acc= (long) ((((int64_t) rs->acc)*out_rate)/rs->out_rate);
+  rs->in_rate= in_rate;
+  rs->out_rate= out_rate;
+
+  // Filtre.
+  rs->bypass= in_rate == out_rate;
+  fc= in_rate > out_rate ? (ROLLOFF*out_rate)/in_rate : ROLLOFF;
+  if ( !rs->bypass && fc != rs->fc )
+    build_coefs ( rs, fc );
+
+} // end PC_resampler_set_rates
+
+
+void
+PC_resampler_clear (
+                    PC_Resampler *rs
+                    )
+{
+
+  memset ( rs->hist, 0, sizeof(rs->hist) );
+  rs->p= 0;
+  rs->acc= 0;
+
+} // end PC_resampler_clear
+
+
+int
+PC_resampler_push (
+                   PC_Resampler  *rs,
+                   const int16_t *in,
+                   const int      n,
+                   int16_t       *out
+                   )
+{
+
+  const int16_t *hl,*hr;
+  int32_t l,r;
+  int i,nout,ph;
+
+
+  nout= 0;
+  for ( i= 0; i < n; ++i )
+    {
+
+      // Afegeix a l'historial. Cada mostra es guarda dues vegades
+      // perquè la finestra siga sempre contigua.
+      rs->hist[0][rs->p]= rs->hist[0][rs->p+TAPS]= in[2*i];
+      rs->hist[1][rs->p]= rs->hist[1][rs->p+TAPS]= in[2*i+1];
+      rs->p= (rs->p+1)%TAPS;
+      hl= &(rs->hist[0][rs->p]);
+      hr= &(rs->hist[1][rs->p]);
+
+      // Genera les mostres d'eixida que cauen abans de la següent
+      // mostra d'entrada.
+      for ( ; rs->acc < rs->out_rate; rs->acc+= rs->in_rate, ++nout )
+        {
+          if ( rs->bypass )
+            {
+              out[2*nout]= hl[TAPS/2-1];
+              out[2*nout+1]= hr[TAPS/2-1];
+            }
+          else
+            {
+              ph= (int) ((((int64_t) rs->acc)*PHASES)/rs->out_rate);
+              _dot ( &l, &r, hl, hr, rs->coef[ph] );
+              out[2*nout]= sat16 ( l );
+              out[2*nout+1]= sat16 ( r );
+            }
+        }
+      rs->acc-= rs->out_rate;
+
+    }
+
+  return nout;
+
+} // end PC_resampler_push
@@ -46,7 +46,8 @@
  *   l'ignoraré.
  *
  * - Crec que per a eixida no és cert, però per simplificar no vaig a
- *   permetre freqüències de mostreig fora del rang [4000,44100].
+ *   permetre freqüències de mostreig fora del rang [4000,44100]. Les
+ *   mostres es passen a la freqüència de l'eixida amb PC_resampler.
  *
  * - IMPORTANTÍSIM!!!! Igual he de simular amb un gra més fi
  *   l'activació del DREQ. Ara va a blocs, de colp llig moltes dades i
@@ -55,13 +56,20 @@
  */
 
 #include <assert.h>
+#include <math.h>
 #include <stdbool.h>
 #include <stddef.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 
 #include "PC.h"
 
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define FM_X86
+#include <immintrin.h>
+#endif
+
 
 
 
@@ -85,6 +93,11 @@
 
 #define FM_BUF_SIZE (PC_AUDIO_BUFFER_SIZE*3)
 
+// Mostres FM que es sintetitzen de colp (fm_run_block).
+#define FM_BLOCK_SIZE 64
+
+#define AVX2 __attribute__((target("avx2")))
+
 #define DSP_OUT_BUF_SIZE 4
 
 
@@ -93,6 +106,9 @@
 /* CONSTANTS */
 /*************/
 
+// Modulació nul·la per a fm_op_out_block.
+static const int32_t FM_NO_MOD[FM_BLOCK_SIZE]= {0};
+
 // Cicles del Master Clock FM per increment
 static const long FM_TIMERS_CC[2]=
   {
@@ -545,16 +561,25 @@ static struct
   int     nts; // 0 o 1
   int     cc_delay_status; // Emulem que llegir de l'status costa un
                            // poc més de de 23/35 micros segons.
+
+  // Taules per a calcular l'eixida dels operadors (fm_init). Cada
+  // entrada de 'wave' és l'atenuació de l'ona (4.8) amb el signe en
+  // el bit 16. 'pow' és FM_POW_TABLE ja multiplicada per 4.
+  int32_t wave[8][1024];
+  int32_t pow[256];
+  void (*op_out_block) (int32_t *out,const int32_t *phase,
+                        const int32_t *mod,const int32_t *att,
+                        const int32_t *wave,const int n);
   
-  // Buffer eixida
+  // Buffer eixida (ja a la freqüència de l'eixida)
   struct
   {
-    int     N;
-    int     p;
-    int32_t l[FM_BUF_SIZE];
-    int32_t r[FM_BUF_SIZE];
-    double  fss; // Factor susbsampling per a passar a 44.1KHz
-    double  pss; // Posició subsampling per a passar a 44.1KHz
+    int          N;
+    int          p;
+    int16_t      l[FM_BUF_SIZE];
+    int16_t      r[FM_BUF_SIZE];
+    PC_Resampler rs; // Passa de 14.32MHz/288 a la freqüència de
+                     // l'eixida.
   } out;
   
 } _fm;
@@ -587,7 +612,6 @@ static struct
     // fer els càlculs en l'operació.
     double  freq;
     double  ifreq;
-    double  ratio; // freq/44100
     bool    mono;
     enum {
       DSP_FORMAT_U8, // Ho deixe, però igual és redundant
@@ -627,7 +651,9 @@ static struct
     int16_t r[PC_AUDIO_BUFFER_SIZE*2];
     int     p;
     int     N;
-    double  pss; // Posició subsampling
+    PC_Resampler rs; // Passa de 'format.freq' a la freqüència de
+                     // l'eixida.
+    int     flush; // Mostres a zero que falten per buidar 'rs'.
     bool    stop_dma; // Força una parada de DMA
   }       render;
   struct
@@ -714,13 +740,25 @@ static struct
   int cc;
   int cctoEvent;
 
-  // Per a passar a mostres a 44100Hz (cc*(cc_mul))/cc_div
+  // Per a passar a mostres de l'eixida (cc*(cc_mul))/cc_div
+  int  freq; // Freqüència de l'eixida
   long cc_mul;
   long cc_div;
   long cc_remain; // Ja multiplicades
   
 } _timing;
 
+// Àudio del CD-ROM (44100Hz).
+static struct
+{
+
+  PC_Resampler rs;
+  int16_t      buf[2*2]; // 44100*2 > PC_AUDIO_FREQ_MAX
+  int          N;
+  int          p;
+  
+} _cd;
+
 // Buffer d'eixida.
 static struct
 {
@@ -1255,25 +1293,24 @@ fm_op_eg_clock (
 // l'ona base (0..1) en valor absolut, i si el signe és positiu o
 // negatiu. En realitat el valor no està en un format preparat per
 // poder-se sumar als valors de l'atenuació (veura taules
-// FM_SIN_TABLE).
+// FM_SIN_TABLE). S'utilitza per a omplir _fm.wave.
 static void
-fm_op_get_wave_out (
-                    fm_op_t   *op,
-                    const int  phase,
-                    int16_t   *out,
-                    bool      *sign_neg
-                    )
+fm_get_wave_out (
+                 const int  ws,
+                 const int  phase,
+                 int16_t   *out,
+                 bool      *sign_neg
+                 )
 {
 
   const int16_t OUT_0= 0x859; // No aplega a ser 0.
   const int16_t OUT_1= 0x000;
   
-  int ws,ind_exp;
+  int ind_exp;
   uint8_t sin_ind;
   int16_t tmp;
   
   
-  ws= _fm.opl3_mode ? (op->regs.ws&0x7) : (op->regs.ws&0x3);
   switch ( ws )
     {
       
@@ -1366,90 +1403,269 @@ fm_op_get_wave_out (
       break;
     }
   
-} // end fm_op_get_wave_out
+} // end fm_get_wave_out
 
 
+static const int32_t *
+fm_op_get_wave (
+                const fm_op_t *op
+                )
+{
+  return _fm.wave[_fm.opl3_mode ? (op->regs.ws&0x7) : (op->regs.ws&0x3)];
+} // end fm_op_get_wave
+
+
+// Avança 'n' mostres els LFO. 'n' no pot passar del següent
+// increment de cap dels dos.
 static void
-fm_op_clock (
-             fm_op_t       *op,
-             const int16_t  ph_mod // 10bit
-             )
+fm_op_lfo_clock (
+                 fm_op_t   *op,
+                 const int  n
+                 )
 {
 
-  int16_t phase,att,am_att,out_att,out;
-  bool sign_neg;
-  uint8_t w,f;
-  
+  // --> VIB
+  op->vib.cc-= n;
+  if ( op->vib.cc == 0 )
+    {
+      ++op->vib.counter;
+      op->vib.cc= FM_VIB_CC;
+      // Canvis en el vib afecten a la phase.
+      if ( op->vib.enabled )
+        fm_op_update_pg_and_eg ( op );
+    }
+  // --> AM
+  op->am.cc-= n;
+  if ( op->am.cc == 0 )
+    {
+      ++op->am.counter;
+      op->am.cc= FM_AM_CC;
+    }
   
-  // Incrementa phase i modula
-  op->phase= (op->phase + op->pg)&0x7FFFF; // Comptador intern (19bits??)
-  phase= (op->phase>>9); // Descarta precisió inferior (volem 10 bits)
-  phase= (phase + ph_mod)&0x3FF; // Suma 10bits
+} // end fm_op_lfo_clock
+
 
-  // Calcula atenuació EG.
-  if ( ++op->eg.cc == 3 )
+// Un operador està en silenci quan el EG està en la màxima atenuació
+// i no pot baixar sense un keyon (release o sustain). En eixe cas
+// l'eixida és sempre 0 i el EG sols incrementa el comptador.
+static bool
+fm_op_is_silent (
+                 const fm_op_t *op
+                 )
+{
+  return op->eg.out == EG_MAX_ATTENUATION &&
+    (op->eg.state == EG_RELEASE || op->eg.state == EG_SUSTAIN);
+} // end fm_op_is_silent
+
+
+// Avança 'n' mostres un operador en silenci sense calcular
+// l'eixida. L'estat queda igual que si s'haguera sintetitzat.
+static void
+fm_op_skip_block (
+                  fm_op_t   *op,
+                  const int  n
+                  )
+{
+
+  int i,m;
+  
+  
+  for ( i= 0; i < n; i+= m )
     {
-      fm_op_eg_clock ( op );
-      op->eg.cc= 0;
+      m= n-i;
+      if ( op->vib.cc < m ) m= op->vib.cc;
+      if ( op->am.cc < m ) m= op->am.cc;
+      op->phase= (op->phase + m*op->pg)&0x7FFFF;
+      op->eg.counter+= (uint32_t) ((op->eg.cc + m)/3);
+      op->eg.cc= (op->eg.cc + m)%3;
+      fm_op_lfo_clock ( op, m );
     }
-  att= op->eg.out;
+  op->out= 0;
+  
+} // end fm_op_skip_block
 
-  // Aplica total level
-  att+= op->tlevel;
 
-  // Aplica atenuació KSL
-  att+= op->ksl_att;
+// Calcula la fase (10 bits, sense modular) i l'atenuació de les
+// següents 'n' mostres de l'operador. Els LFO sols canvien cada
+// FM_VIB_CC/FM_AM_CC mostres, per tant es processa a trossos on 'pg',
+// els rates i l'atenuació AM són constants.
+static void
+fm_op_prepare_block (
+                     fm_op_t   *op,
+                     const int  n,
+                     int32_t   *phase,
+                     int32_t   *att
+                     )
+{
 
-  // Aplica Amplitude Modulation (Tremolo)
-  if ( op->am.enabled )
+  int i,k,m;
+  int32_t ph,pg,base,tmp;
+  int16_t am_att;
+  
+  
+  for ( i= 0; i < n; i+= m )
     {
-      // NOTA!!! El LFO és un contador de 7bits (128 pasos) el bit
-      // superior és el signe. Però en l'atenuació interpretem el
-      // signe al revés.
-      am_att= (int16_t) (op->am.counter&0x3F);
-      if ( (op->am.counter&0x40) == 0 )
-        am_att= (~am_att)&0x3F;
-      am_att= FM_AM_TABLE[_fm.dam][am_att];
-      att+= am_att;
+
+      // Grandària del tros.
+      m= n-i;
+      if ( op->vib.cc < m ) m= op->vib.cc;
+      if ( op->am.cc < m ) m= op->am.cc;
+
+      // Incrementa phase. Es descarta la precisió inferior (volem 10
+      // bits).
+      ph= op->phase;
+      pg= op->pg;
+      for ( k= 0; k < m; ++k )
+        phase[i+k]= ((ph + (k+1)*pg)&0x7FFFF)>>9;
+      op->phase= (ph + m*pg)&0x7FFFF; // Comptador intern (19bits??)
+
+      // Atenuació que no depén del EG: total level, KSL i Amplitude
+      // Modulation (Tremolo).
+      base= op->tlevel + op->ksl_att;
+      if ( op->am.enabled )
+        {
+          // NOTA!!! El LFO és un contador de 7bits (128 pasos) el bit
+          // superior és el signe. Però en l'atenuació interpretem el
+          // signe al revés.
+          am_att= (int16_t) (op->am.counter&0x3F);
+          if ( (op->am.counter&0x40) == 0 )
+            am_att= (~am_att)&0x3F;
+          base+= FM_AM_TABLE[_fm.dam][am_att];
+        }
+
+      // Calcula atenuació EG i comprova que no supera el màxim.
+      for ( k= 0; k < m; ++k )
+        {
+          if ( ++op->eg.cc == 3 )
+            {
+              fm_op_eg_clock ( op );
+              op->eg.cc= 0;
+            }
+          tmp= op->eg.out + base;
+          att[i+k]= tmp > EG_MAX_ATTENUATION ? EG_MAX_ATTENUATION : tmp;
+        }
+      
+      // Actualitza LFOs
+      fm_op_lfo_clock ( op, m );
+      
     }
+  
+} // end fm_op_prepare_block
+
+
+// Eixida d'una mostra. 'phase' ja està modulada.
+static inline int32_t
+fm_op_out_sample (
+                  const int32_t *wave,
+                  const int32_t  phase,
+                  const int32_t  att
+                  )
+{
 
-  // Comprova que l'atenuació no supera el màxim
-  if ( att > EG_MAX_ATTENUATION )
-    att= EG_MAX_ATTENUATION;
+  int32_t w,out_att,out,sign;
+  
 
   // Obté atenuació eixida (wav + att)
   // NOTA!! out_att és 13 bits en format 5.8
-  fm_op_get_wave_out ( op, phase, &out_att, &sign_neg );
-  out_att= out_att + (att<<2);
+  w= wave[phase&0x3FF];
+  out_att= (w&0xFFFF) + (att<<2);
 
   // Db a lineal
-  // out és un valor de 13bits
-  w= (uint8_t) (out_att>>8);
-  f= (uint8_t) (out_att&0xFF);
-  out= (FM_POW_TABLE[f]<<2)>>w;
+  // out és un valor de 14bits
+  out= _fm.pow[out_att&0xFF]>>(out_att>>8);
 
   // Aplica signe (Complement a 2)
-  // out és un valor de 14bits amb signe
-  op->out= (int32_t) out;
-  if ( sign_neg && out != 0 )
-    op->out= -op->out;
+  sign= w>>16;
   
-  // Actualitza LFOs
-  // --> VIB
-  if ( --op->vib.cc == 0 )
-    {
-      ++op->vib.counter;
-      op->vib.cc= FM_VIB_CC;
-      // Canvis en el vib afecten a la phase.
-      if ( op->vib.enabled )
-        fm_op_update_pg_and_eg ( op );
-    }
-  // --> AM
-  if ( --op->am.cc == 0 )
+  return (out^(-sign)) + sign;
+  
+} // end fm_op_out_sample
+
+
+// Eixida de 'n' mostres d'un operador sense feedback. 'mod' són les
+// eixides de l'operador que el modula (o FM_NO_MOD).
+static void
+fm_op_out_block_scalar (
+                        int32_t       *out,
+                        const int32_t *phase,
+                        const int32_t *mod,
+                        const int32_t *att,
+                        const int32_t *wave,
+                        const int      n
+                        )
+{
+
+  int i;
+
+  
+  for ( i= 0; i < n; ++i )
+    out[i]= fm_op_out_sample ( wave, phase[i] + OUT2PHASEMOD(mod[i]), att[i] );
+  
+} // end fm_op_out_block_scalar
+
+
+#ifdef FM_X86
+static AVX2 void
+fm_op_out_block_avx2 (
+                      int32_t       *out,
+                      const int32_t *phase,
+                      const int32_t *mod,
+                      const int32_t *att,
+                      const int32_t *wave,
+                      const int      n
+                      )
+{
+
+  __m256i mask,ph,w,out_att,v,sign;
+  int i;
+
+  
+  mask= _mm256_set1_epi32 ( 0x3FF );
+  for ( i= 0; i+8 <= n; i+= 8 )
     {
-      ++op->am.counter;
-      op->am.cc= FM_AM_CC;
+      ph= _mm256_and_si256 (
+        _mm256_srai_epi32 ( _mm256_loadu_si256 ( (const __m256i *) (mod+i) ),
+                            1 ),
+        mask );
+      ph= _mm256_and_si256 (
+        _mm256_add_epi32 ( _mm256_loadu_si256 ( (const __m256i *) (phase+i) ),
+                           ph ),
+        mask );
+      w= _mm256_i32gather_epi32 ( (const int *) wave, ph, 4 );
+      out_att= _mm256_add_epi32 (
+        _mm256_and_si256 ( w, _mm256_set1_epi32 ( 0xFFFF ) ),
+        _mm256_slli_epi32 ( _mm256_loadu_si256 ( (const __m256i *) (att+i) ),
+                            2 ) );
+      v= _mm256_i32gather_epi32 (
+        (const int *) _fm.pow,
+        _mm256_and_si256 ( out_att, _mm256_set1_epi32 ( 0xFF ) ), 4 );
+      v= _mm256_srlv_epi32 ( v, _mm256_srli_epi32 ( out_att, 8 ) );
+      sign= _mm256_srli_epi32 ( w, 16 );
+      v= _mm256_add_epi32 (
+        _mm256_xor_si256 ( v, _mm256_sub_epi32 ( _mm256_setzero_si256 (),
+                                                 sign ) ),
+        sign );
+      _mm256_storeu_si256 ( (__m256i *) (out+i), v );
     }
+  fm_op_out_block_scalar ( out+i, phase+i, mod+i, att+i, wave, n-i );
+  
+} // end fm_op_out_block_avx2
+#endif
+
+
+// Clock d'una mostra. S'utilitza en els canals de 4 operadors.
+static void
+fm_op_clock (
+             fm_op_t       *op,
+             const int16_t  ph_mod // 10bit
+             )
+{
+
+  int32_t phase,att;
+  
+  
+  fm_op_prepare_block ( op, 1, &phase, &att );
+  op->out= fm_op_out_sample ( fm_op_get_wave ( op ), phase + ph_mod, att );
   
 } // end fm_op_clock
 
@@ -1675,44 +1891,57 @@ fm_channel_calc_feedback (
 } // end fm_channel_calc_feedback
 
 
+// Sintetitza 'n' mostres d'un canal de 2 operadors. El primer
+// operador té feedback i s'ha de fer mostra a mostra, el segon es fa
+// tot de colp.
 static void
-fm_channel_clock_op2_alg0 (
-                           fm_channel_t *chn
-                           )
+fm_channel_block_op2 (
+                      fm_channel_t *chn,
+                      const int     n,
+                      int32_t      *out
+                      )
 {
 
-  // OP1
-  fm_op_clock ( chn->slots2[0], fm_channel_calc_feedback ( chn ) );
-  chn->fb_buf[0]= chn->fb_buf[1];
-  chn->fb_buf[1]= chn->slots2[0]->out;
-
-  // OP2
-  fm_op_clock ( chn->slots2[1], OUT2PHASEMOD(chn->slots2[0]->out) );
-
-  // OUT
-  chn->out= chn->slots2[1]->out;
+  int32_t phase[FM_BLOCK_SIZE],att[FM_BLOCK_SIZE],out1[FM_BLOCK_SIZE],
+    out2[FM_BLOCK_SIZE];
+  const int32_t *wave;
+  fm_op_t *op;
+  int i;
+  
   
-} // end fm_channel_clock_op2_alg0
-
-
-static void
-fm_channel_clock_op2_alg1 (
-                           fm_channel_t *chn
-                           )
-{
-
   // OP1
-  fm_op_clock ( chn->slots2[0], fm_channel_calc_feedback ( chn ) );
-  chn->fb_buf[0]= chn->fb_buf[1];
-  chn->fb_buf[1]= chn->slots2[0]->out;
-
-  // OP2
-  fm_op_clock ( chn->slots2[1], 0 );
+  op= chn->slots2[0];
+  fm_op_prepare_block ( op, n, phase, att );
+  wave= fm_op_get_wave ( op );
+  for ( i= 0; i < n; ++i )
+    {
+      out1[i]= fm_op_out_sample ( wave,
+                                  phase[i] + fm_channel_calc_feedback ( chn ),
+                                  att[i] );
+      chn->fb_buf[0]= chn->fb_buf[1];
+      chn->fb_buf[1]= out1[i];
+    }
+  op->out= out1[n-1];
 
-  // OUT
-  chn->out= chn->slots2[0]->out + chn->slots2[1]->out;
+  // OP2 i OUT
+  op= chn->slots2[1];
+  fm_op_prepare_block ( op, n, phase, att );
+  if ( (chn->regs.chd_chc_chb_cha_fb_cnt&0x1) == 0 )
+    {
+      _fm.op_out_block ( out, phase, out1, att, fm_op_get_wave ( op ), n );
+      op->out= out[n-1];
+    }
+  else
+    {
+      _fm.op_out_block ( out2, phase, FM_NO_MOD, att,
+                         fm_op_get_wave ( op ), n );
+      op->out= out2[n-1];
+      for ( i= 0; i < n; ++i )
+        out[i]= out1[i] + out2[i];
+    }
+  chn->out= out[n-1];
   
-} // end fm_channel_clock_op2_alg1
+} // end fm_channel_block_op2
 
 
 static void
@@ -1819,32 +2048,26 @@ fm_channel_clock_op4_alg3 (
 } // end fm_channel_clock_op4_alg3
 
 
+// Sintetitza 'n' mostres d'un canal de 4 operadors. Es fa mostra a
+// mostra perquè slots4[1] i slots4[2] són el mateix operador
+// (fm_connect_channels) i l'ordre dels clocks importa.
 static void
-fm_channel_clock (
-                  fm_channel_t *chn
-                  )
+fm_channel_block_op4 (
+                      fm_channel_t *chn,
+                      const int     n,
+                      int32_t      *out
+                      )
 {
 
-  int alg;
+  int alg,i;
 
   
-  switch ( chn->mode )
+  alg=
+    ((chn->regs.chd_chc_chb_cha_fb_cnt&0x1)<<1) |
+    (chn->chn_col->regs.chd_chc_chb_cha_fb_cnt&0x1)
+    ;
+  for ( i= 0; i < n; ++i )
     {
-      
-    case CHN_OP2:
-      alg= chn->regs.chd_chc_chb_cha_fb_cnt&0x1;
-      switch ( alg )
-        {
-        case 0: fm_channel_clock_op2_alg0 ( chn ); break;
-        case 1: fm_channel_clock_op2_alg1 ( chn ); break;
-        }
-      break;
-
-    case CHN_OP4:
-      alg=
-        ((chn->regs.chd_chc_chb_cha_fb_cnt&0x1)<<1) |
-        (chn->chn_col->regs.chd_chc_chb_cha_fb_cnt&0x1)
-        ;
       switch ( alg )
         {
         case 0: fm_channel_clock_op4_alg0 ( chn ); break;
@@ -1852,17 +2075,75 @@ fm_channel_clock (
         case 2: fm_channel_clock_op4_alg2 ( chn ); break;
         case 3: fm_channel_clock_op4_alg3 ( chn ); break;
         }
-      break;
+      out[i]= chn->out;
+    }
+  
+} // end fm_channel_block_op4
+
+
+// Torna cert si tots els operadors del canal estan en silenci.
+static bool
+fm_channel_is_silent (
+                      const fm_channel_t *chn
+                      )
+{
 
+  int i;
+  
+  
+  switch ( chn->mode )
+    {
+    case CHN_OP2:
+      for ( i= 0; i < 2; ++i )
+        if ( !fm_op_is_silent ( chn->slots2[i] ) )
+          return false;
+      break;
+    case CHN_OP4:
+      for ( i= 0; i < 4; ++i )
+        if ( !fm_op_is_silent ( chn->slots4[i] ) )
+          return false;
+      break;
     case CHN_DISABLED:
-      chn->out= 0;
+    default: break;
+    }
+  
+  return true;
+  
+} // end fm_channel_is_silent
+
+
+// Avança 'n' mostres un canal en silenci. L'eixida és 0.
+static void
+fm_channel_skip_block (
+                       fm_channel_t *chn,
+                       const int     n
+                       )
+{
+
+  int i;
+  
+  
+  // NOTA!! En mode 4 operadors un mateix operador pot aparéixer dues
+  // vegades en 'slots4' i aleshores es clocka dues vegades per mostra.
+  switch ( chn->mode )
+    {
+    case CHN_OP2:
+      for ( i= 0; i < 2; ++i )
+        fm_op_skip_block ( chn->slots2[i], n );
       break;
-      
-    default:
-      
+    case CHN_OP4:
+      for ( i= 0; i < 4; ++i )
+        fm_op_skip_block ( chn->slots4[i], n );
+      break;
+    case CHN_DISABLED:
+    default: break;
     }
+  if ( n == 1 ) chn->fb_buf[0]= chn->fb_buf[1];
+  else          chn->fb_buf[0]= 0;
+  chn->fb_buf[1]= 0;
+  chn->out= 0;
   
-} // end fm_channel_clock
+} // end fm_channel_skip_block
 
 
 static void
@@ -2032,7 +2313,9 @@ fm_init (void)
 
   static const int DIVS[4]= {2,2,2,179};
 
-  int i;
+  int i,j;
+  int16_t out;
+  bool sign_neg;
   
   
   // Timing (Master clock 14.32Mhz).
@@ -2051,11 +2334,28 @@ fm_init (void)
   // Inicialitza canals.
   fm_connect_channels ();
 
+  // Taules de síntesi.
+  for ( i= 0; i < 8; ++i )
+    for ( j= 0; j < 1024; ++j )
+      {
+        fm_get_wave_out ( i, j, &out, &sign_neg );
+        _fm.wave[i][j]= ((int32_t) out) | (sign_neg ? 0x10000 : 0);
+      }
+  for ( i= 0; i < 256; ++i )
+    _fm.pow[i]= ((int32_t) FM_POW_TABLE[i])<<2;
+#ifdef FM_X86
+  __builtin_cpu_init ();
+  if ( __builtin_cpu_supports ( "avx2" ) )
+    _fm.op_out_block= fm_op_out_block_avx2;
+  else _fm.op_out_block= fm_op_out_block_scalar;
+#else
+  _fm.op_out_block= fm_op_out_block_scalar;
+#endif
+  
   // Buffer eixida. (No es reseteja=
   _fm.out.N= 0;
   _fm.out.p= 0;
-  _fm.out.pss= 0.0;
-  _fm.out.fss= (14320000.0/288) / 44100.0;
+  PC_resampler_init ( &_fm.out.rs, 14320000, 288L*_timing.freq );
   
   // Reseteja.
   fm_reset ();
@@ -2066,48 +2366,146 @@ fm_init (void)
 } // end fm_init
 
 
+// Remostreja 'n' mostres i les inserta en el buffer d'eixida.
 static void
-fm_run_cycle (void)
+fm_out_push (
+             const int16_t *frames,
+             const int      n
+             )
 {
 
-  int i,j,narray,npos;
-  int32_t l,r,val;
+  int16_t out[FM_BLOCK_SIZE*2];
+  int i,nout,npos;
+  
+  
+  // NOTA!! La freqüència de l'eixida és menor que la del xip, per
+  // tant com a molt n mostres.
+  nout= PC_resampler_push ( &_fm.out.rs, frames, n, out );
+  for ( i= 0; i < nout; ++i )
+    {
+      if ( _fm.out.N < FM_BUF_SIZE )
+        {
+          npos= (_fm.out.p+_fm.out.N)%FM_BUF_SIZE;
+          _fm.out.l[npos]= out[2*i];
+          _fm.out.r[npos]= out[2*i+1];
+          ++_fm.out.N;
+        }
+      else _warning ( _udata, "SB16 FM: out buffer overflow" );
+    }
+  
+} // end fm_out_push
+
+
+static void
+fm_run_block (
+              const int n
+              )
+{
+
+  int i,j,k,narray;
+  int32_t l[FM_BLOCK_SIZE],r[FM_BLOCK_SIZE],out[FM_BLOCK_SIZE],val;
+  int16_t frames[FM_BLOCK_SIZE*2];
   fm_channel_t *chn;
   
   
   // Calcula mostres L i R
   narray= _fm.opl3_mode ? 2 : 1;
-  l= r= 0;
+  memset ( l, 0, n*sizeof(int32_t) );
+  memset ( r, 0, n*sizeof(int32_t) );
   for ( i= 0; i < narray; ++i )
     for ( j= 0; j < 9; ++j )
       {
         chn= &_fm.channels[i][j];
-        fm_channel_clock ( chn );
-        /*
-        val= 4*chn->out;
-        if      ( val > 32767 )  val= 32767;
-        else if ( val < -32768 ) val= -32768;
-        */
-        val= 2*chn->out;
-        if      ( val > 16256 )  val= 16256;
-        else if ( val < -16384 ) val= -16384;
-        if ( !_fm.opl3_mode || chn->l ) l+= val;
-        if ( !_fm.opl3_mode || chn->r ) r+= val;
+        if ( chn->mode != CHN_DISABLED && fm_channel_is_silent ( chn ) )
+          {
+            fm_channel_skip_block ( chn, n );
+            continue;
+          }
+        switch ( chn->mode )
+          {
+          case CHN_OP2: fm_channel_block_op2 ( chn, n, out ); break;
+          case CHN_OP4: fm_channel_block_op4 ( chn, n, out ); break;
+          case CHN_DISABLED:
+          default:
+            chn->out= 0;
+            continue;
+          }
+        for ( k= 0; k < n; ++k )
+          {
+            /*
+            val= 4*out[k];
+            if      ( val > 32767 )  val= 32767;
+            else if ( val < -32768 ) val= -32768;
+            */
+            val= 2*out[k];
+            if      ( val > 16256 )  val= 16256;
+            else if ( val < -16384 ) val= -16384;
+            out[k]= val;
+          }
+        if ( !_fm.opl3_mode || chn->l )
+          for ( k= 0; k < n; ++k ) l[k]+= out[k];
+        if ( !_fm.opl3_mode || chn->r )
+          for ( k= 0; k < n; ++k ) r[k]+= out[k];
       }
-  l/= 9*narray;
-  r/= 9*narray;
-
+  
   // Inserta en buffer
-  if ( _fm.out.N < FM_BUF_SIZE )
+  for ( k= 0; k < n; ++k )
     {
-      npos= (_fm.out.p+_fm.out.N)%FM_BUF_SIZE;
-      _fm.out.l[npos]= l;
-      _fm.out.r[npos]= r;
-      ++_fm.out.N;
+      frames[2*k]= (int16_t) (l[k]/(9*narray));
+      frames[2*k+1]= (int16_t) (r[k]/(9*narray));
     }
-  else _warning ( _udata, "SB16 FM: out buffer overflow" );
+  fm_out_push ( frames, n );
+  
+} // end fm_run_block
+
+
+// Torna cert si cap canal actiu del xip produeix so.
+static bool
+fm_is_silent (void)
+{
+
+  int i,j,narray;
+  
   
-} // end fm_run_cycle
+  narray= _fm.opl3_mode ? 2 : 1;
+  for ( i= 0; i < narray; ++i )
+    for ( j= 0; j < 9; ++j )
+      if ( !fm_channel_is_silent ( &_fm.channels[i][j] ) )
+        return false;
+  
+  return true;
+  
+} // end fm_is_silent
+
+
+// Avança 'n' mostres amb el xip en silenci. No sintetitza res, sols
+// actualitza l'estat dels operadors i remostreja zeros.
+static void
+fm_run_silent (
+               const long n
+               )
+{
+
+  static const int16_t ZEROS[FM_BLOCK_SIZE*2]= {0};
+  
+  int i,j,narray;
+  long k;
+  fm_channel_t *chn;
+  
+  
+  narray= _fm.opl3_mode ? 2 : 1;
+  for ( i= 0; i < narray; ++i )
+    for ( j= 0; j < 9; ++j )
+      {
+        chn= &_fm.channels[i][j];
+        if ( chn->mode != CHN_DISABLED )
+          fm_channel_skip_block ( chn, (int) n );
+        else chn->out= 0;
+      }
+  for ( k= 0; k < n; k+= FM_BLOCK_SIZE )
+    fm_out_push ( ZEROS, n-k < FM_BLOCK_SIZE ? (int) (n-k) : FM_BLOCK_SIZE );
+  
+} // end fm_run_silent
 
 
 static void
@@ -2116,7 +2514,8 @@ fm_clock (
           )
 {
   
-  long tmp_cc,sample_cc;
+  long tmp_cc,sample_cc,nsamples;
+  int n;
 
   
   // Calcula cicles FM.
@@ -2127,56 +2526,45 @@ fm_clock (
   // Clock.
   fm_timers_clock ( sample_cc );
 
-  // Clock síntesi FM.
+  // Clock síntesi FM (una mostra cada 288 cicles).
   tmp_cc= sample_cc + _fm.cc_fm_accum;
-  while ( tmp_cc >= 288 )
+  nsamples= tmp_cc/288;
+  _fm.cc_fm_accum= tmp_cc%288;
+  if ( nsamples > 0 && fm_is_silent () )
     {
-      fm_run_cycle ();
-      tmp_cc-= 288;
+      fm_run_silent ( nsamples );
+      return;
+    }
+  for ( ; nsamples > 0; nsamples-= n )
+    {
+      n= nsamples < FM_BLOCK_SIZE ? (int) nsamples : FM_BLOCK_SIZE;
+      fm_run_block ( n );
     }
-  _fm.cc_fm_accum= tmp_cc;
   
 } // end fm_clock
 
 
 static void
-fm_get_next_44_1KHz_sample (
-                            int16_t *l,
-                            int16_t *r
-                            )
+fm_get_next_sample (
+                    int16_t *l,
+                    int16_t *r
+                    )
 {
 
-  // NOTA!! Faig un subsampling senzill.
-
-
-  // Obté mostra
-  assert ( _fm.out.pss < 1.0 );
   if ( _fm.out.N < 1 )
     {
-      _warning ( _udata, "SB16 FM: FM buffer underflow (A)" );
+      _warning ( _udata, "SB16 FM: FM buffer underflow" );
       *l= *r= 0;
     }
   else
     {
       *l= _fm.out.l[_fm.out.p];
       *r= _fm.out.r[_fm.out.p];
+      _fm.out.p= (_fm.out.p+1)%FM_BUF_SIZE;
+      --_fm.out.N;
     }
   
-  // Incrementa
-  _fm.out.pss+= _fm.out.fss;
-  while ( _fm.out.pss >= 1.0 )
-    {
-      _fm.out.pss-= 1.0;
-      if ( _fm.out.N > 0 )
-        {
-          _fm.out.p= (_fm.out.p+1)%FM_BUF_SIZE;
-          --_fm.out.N;
-        }
-      else _warning ( _udata, "SB16 FM: FM buffer underflow (B)" );
-        
-    }
-  
-} // end fm_get_next_44_1KHz_sample
+} // end fm_get_next_sample
 
 
 // DSP /////////////////////////////////////////////////////////////////////////
@@ -2209,8 +2597,8 @@ dsp_update_format (void)
       freq= 44100;
     }
   
-  // Ratio.
-  _dsp.format.ratio= freq/44100.0;
+  // Remostrejador.
+  PC_resampler_set_rates ( &_dsp.render.rs, lround ( freq ), _timing.freq );
   
 } // end dsp_update_format
 
@@ -2237,7 +2625,8 @@ dsp_reset (void)
   _dsp.in.empty= true;
   _dsp.render.p= 0;
   _dsp.render.N= 0;
-  _dsp.render.pss= 0.0;
+  PC_resampler_clear ( &_dsp.render.rs );
+  _dsp.render.flush= 0;
   _dsp.render.stop_dma= false;
   if ( _dsp.dma.state != DSP_DMA_NONE && !_dsp.dma.paused )
     PC_dma_dreq ( 1, false );
@@ -2276,6 +2665,7 @@ dsp_init (void)
   _dsp.dma16.state= DSP_DMA16_NONE;
   _dsp.dma16.in_clock= false;
   _dsp.dma16.irq_on= false;
+  PC_resampler_init ( &_dsp.render.rs, 44100, _timing.freq );
   dsp_reset ();
   
 } // end dsp_init
@@ -2462,7 +2852,7 @@ dsp_dma_pause (void)
   /* 
   _dsp.render.N= 0;
   _dsp.render.p= 0;
-  _dsp.render.pss= 0.0;
+  PC_resampler_clear ( &_dsp.render.rs );
   _dsp.render.stop_dma= false;
   */
   
@@ -2500,7 +2890,7 @@ dsp_dma16_pause (void)
   /* 
   _dsp.render.N= 0;
   _dsp.render.p= 0;
-  _dsp.render.pss= 0.0;
+  PC_resampler_clear ( &_dsp.render.rs );
   _dsp.render.stop_dma= false;
   */
   
@@ -2964,6 +3354,26 @@ dsp_render_buf_add (
 } // end dsp_render_buf_add
 
 
+static void
+dsp_render_push (
+                 const int16_t l,
+                 const int16_t r
+                 )
+{
+
+  // 4000Hz és la freqüència mínima.
+  int16_t in[2],out[2*(PC_AUDIO_FREQ_MAX/4000)];
+  int i,n;
+  
+  
+  in[0]= l; in[1]= r;
+  n= PC_resampler_push ( &_dsp.render.rs, in, 1, out );
+  for ( i= 0; i < n; ++i )
+    dsp_render_buf_add ( out[2*i], out[2*i+1] );
+  
+} // end dsp_render_push
+
+
 static void
 dsp_render_resample_sample (
                             const int16_t l,
@@ -2971,14 +3381,8 @@ dsp_render_resample_sample (
                             )
 {
   
-  assert ( _dsp.render.pss < 1.0 );
-  while ( _dsp.render.pss < 1.0 )
-    {
-      dsp_render_buf_add ( l, r );
-      _dsp.render.pss+= _dsp.format.ratio;
-    }
-  while (_dsp.render.pss >= 1.0 )
-    _dsp.render.pss-= 1.0;
+  dsp_render_push ( l, r );
+  _dsp.render.flush= PC_RESAMPLER_TAPS;
   
 } // end dsp_render_resample_sample
 
@@ -3217,12 +3621,19 @@ dsp_dma16_write (
 
 
 static void
-dsp_get_next_44_1KHz_sample (
-                             int16_t *l,
-                             int16_t *r
-                             )
+dsp_get_next_sample (
+                     int16_t *l,
+                     int16_t *r
+                     )
 {
 
+  // Si no hi ha mostres però el remostrejador encara té mostres en
+  // l'historial, les trau amb zeros.
+  if ( _dsp.render.N == 0 && _dsp.render.flush > 0 )
+    {
+      dsp_render_push ( 0, 0 );
+      --_dsp.render.flush;
+    }
   
   if ( _dsp.render.N > 0 )
     {
@@ -3242,13 +3653,9 @@ dsp_get_next_44_1KHz_sample (
           dsp_dma16_update_dreq ();
         }
     }
-  else
-    {
-      *l= *r= 0;
-      _dsp.render.pss= 0.0; // Reseteja
-    }
+  else *l= *r= 0;
   
-} // end dsp_get_next_44_1KHz_sample
+} // end dsp_get_next_sample
 
 
 // MIXER ///////////////////////////////////////////////////////////////////////
@@ -3631,6 +4038,32 @@ mixer_write_data (
 } // end mixer_write_data
 
 
+// CD //////////////////////////////////////////////////////////////////////////
+
+static void
+cd_get_next_sample (
+                    int16_t *l,
+                    int16_t *r
+                    )
+{
+
+  int16_t in[2];
+  
+  
+  while ( _cd.N == 0 )
+    {
+      PC_piix4_ide_get_next_cd_audio_sample ( &in[0], &in[1] );
+      _cd.N= PC_resampler_push ( &_cd.rs, in, 1, _cd.buf );
+      _cd.p= 0;
+    }
+  *l= _cd.buf[2*_cd.p];
+  *r= _cd.buf[2*_cd.p+1];
+  ++_cd.p;
+  --_cd.N;
+  
+} // end cd_get_next_sample
+
+
 // GENERAL /////////////////////////////////////////////////////////////////////
 
 static void
@@ -3646,7 +4079,7 @@ update_cc_to_event (void)
   tmp= fm_cc_to_event ();
   if ( tmp > 0 && tmp < _timing.cctoEvent )
     _timing.cctoEvent= tmp;
-  // Una mostra a 44.1KHz
+  // Mostres de l'eixida
   tmpl=
     (_timing.cc_div*((long) PC_AUDIO_BUFFER_SIZE)) -
     (_timing.cc_remain + ((long) _timing.cc)*_timing.cc_mul)
@@ -3699,9 +4132,9 @@ run_sample (void)
 
   // Calcula el voice.
   voice_l= voice_r= 0;
-  fm_get_next_44_1KHz_sample ( &laux, &raux );
+  fm_get_next_sample ( &laux, &raux );
   voice_l+= (int32_t) laux; voice_r+= (int32_t) raux;
-  dsp_get_next_44_1KHz_sample ( &laux, &raux );
+  dsp_get_next_sample ( &laux, &raux );
   voice_l+= (int32_t) laux; voice_r+= (int32_t) raux;
   voice_l/= 2; voice_r/= 2;
   if      ( voice_l > 32767 )  voice_l= 32767;
@@ -3715,7 +4148,7 @@ run_sample (void)
   l+= (int32_t) (voice_l*DB_32l[_mixer.voice_vol_l]);
   r+= (int32_t) (voice_r*DB_32l[_mixer.voice_vol_r]);
   // --> CD
-  PC_piix4_ide_get_next_cd_audio_sample ( &laux, &raux );
+  cd_get_next_sample ( &laux, &raux );
   if ( (_mixer.out_switches&0x04) != 0x00 )
     l+= (int32_t) (laux*DB_32l[_mixer.cd_vol_l]);
   if ( (_mixer.out_switches&0x02) != 0x00 )
@@ -3790,11 +4223,12 @@ clock (
 void
 PC_sb16_init (
               PC_Warning *warning,
-              void       *udata
+              void       *udata,
+              const int   audio_freq
               )
 {
 
-  static const int DIVS[4]= {3,3,7,7};
+  static const int DIVS[4]= {2,3,5,7};
   int i;
 
   
@@ -3803,9 +4237,13 @@ PC_sb16_init (
   _udata= udata;
 
   // Estat.
+  _timing.freq= audio_freq;
   fm_init ();
   dsp_init ();
   mixer_init ();
+  PC_resampler_init ( &_cd.rs, 44100, audio_freq );
+  _cd.N= 0;
+  _cd.p= 0;
   _out.N= 0; // No es reseteja
   
   // Timing.
@@ -3813,12 +4251,11 @@ PC_sb16_init (
   _timing.cc= 0;
   _timing.cctoEvent= 0;
   _timing.cc_remain= 0;
-  assert ( PC_ClockFreq%100 == 0 );
-  _timing.cc_div= (long) (PC_ClockFreq/100);
-  _timing.cc_mul= 441; // 44.1Khz/100
+  _timing.cc_div= (long) PC_ClockFreq;
+  _timing.cc_mul= audio_freq;
   // --> Intenta ajustar un poc
   for ( i= 0; i < 4; ++i )
-    if ( _timing.cc_div%DIVS[i] == 0 )
+    while ( _timing.cc_div%DIVS[i] == 0 && _timing.cc_mul%DIVS[i] == 0 )
       {
         _timing.cc_div/= DIVS[i];
         _timing.cc_mul/= DIVS[i];
@@ -4313,6 +4750,78 @@ PC_sb16_dma16_write (
 } // end PC_sb16_dma16_write
 
 
+int
+PC_sb16_dma_write_block (
+                         const uint8_t *src,
+                         const int      n
+                         )
+{
+
+  int i;
+
+  
+  clock ( false );
+  for ( i= 0; i < n && _dsp.dma.dreq; ++i )
+    dsp_dma_write ( src[i] );
+  update_cc_to_event ();
+
+  return i;
+  
+} // end PC_sb16_dma_write_block
+
+
+int
+PC_sb16_dma16_write_block (
+                           const uint16_t *src,
+                           const int       n
+                           )
+{
+
+  int i;
+
+  
+  clock ( false );
+  for ( i= 0; i < n && _dsp.dma16.dreq; ++i )
+    dsp_dma16_write ( src[i] );
+  update_cc_to_event ();
+
+  return i;
+  
+} // end PC_sb16_dma16_write_block
+
+
+bool
+PC_sb16_dma_dreq (void)
+{
+
+  bool ret;
+
+  
+  clock ( false );
+  ret= _dsp.dma.dreq;
+  update_cc_to_event ();
+
+  return ret;
+  
+} // end PC_sb16_dma_dreq
+
+
+bool
+PC_sb16_dma16_dreq (void)
+{
+
+  bool ret;
+
+  
+  clock ( false );
+  ret= _dsp.dma16.dreq;
+  update_cc_to_event ();
+
+  return ret;
+  
+} // end PC_sb16_dma16_dreq
+
+
 void
 PC_sb16_mixer_set_addr (
                         const uint8_t addr
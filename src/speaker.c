@@ -72,7 +72,7 @@ static struct
   int cc;
   int cctoEvent;
 
-  // Per a passar a mostres a 44100Hz (cc*(cc_mul))/cc_div
+  // Per a passar a mostres de l'eixida (cc*(cc_mul))/cc_div
   long cc_mul;
   long cc_div;
   
@@ -204,11 +204,12 @@ clock (void)
 void
 PC_speaker_init (
                  PC_Warning *warning,
-                 void       *udata
+                 void       *udata,
+                 const int   audio_freq
                  )
 {
 
-  static const int DIVS[4]= {3,3,7,7};
+  static const int DIVS[4]= {2,3,5,7};
   int i;
 
   
@@ -229,12 +230,14 @@ PC_speaker_init (
   _timing.cc_used= 0;
   _timing.cc= 0;
   _timing.cctoEvent= 0;
-  assert ( PC_ClockFreq%100 == 0 );
-  _timing.cc_div= (long) (PC_ClockFreq/100);
-  _timing.cc_mul= 441; // 44.1Khz/100
+  // NOTA!! Cada mostra és la mitjana de l'eixida durant el seu
+  // període, així que es genera directament a la freqüència de
+  // l'eixida sense passar pel remostrejador.
+  _timing.cc_div= (long) PC_ClockFreq;
+  _timing.cc_mul= audio_freq;
   // --> Intenta ajustar un poc
   for ( i= 0; i < 4; ++i )
-    if ( _timing.cc_div%DIVS[i] == 0 )
+    while ( _timing.cc_div%DIVS[i] == 0 && _timing.cc_mul%DIVS[i] == 0 )
       {
         _timing.cc_div/= DIVS[i];
         _timing.cc_mul/= DIVS[i];
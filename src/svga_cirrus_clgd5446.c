@@ -23,12 +23,18 @@
  */
 
 
+#define _GNU_SOURCE // memfd_create
+
 #include <assert.h>
+#include <fcntl.h>
+#include <pthread.h>
 #include <stdbool.h>
 #include <stddef.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <sys/mman.h>
+#include <unistd.h>
 
 #include "PC.h"
 
@@ -44,9 +50,42 @@
 
 #define PLANE_MASK ((64*1024)-1)
 
+// Grandària màxima del framebuffer. El que es reserva depén de la
+// pantalla actual (fb_resize).
 #define FB_WIDTH (256*9)
 #define FB_HEIGHT (1024*2)
 
+// Pantalla inicial (mode text 80x25).
+#define FB_INIT_WIDTH  720
+#define FB_INIT_HEIGHT 400
+
+// Píxels d'una scanline abans de retallar-la a FB_WIDTH. H pot
+// arribar a 'horizontal_total'+5.
+#define LINE_WIDTH (260*9)
+
+// Formats de les dades que es passen al fil de rasterització.
+#define PIX_XRGB     0 // 0x00RRGGBB
+#define PIX_LUT8     1
+#define PIX_RGB555   2
+#define PIX_RGB565   3
+#define PIX_RGB888   4
+#define PIX_XRGB8888 5
+
+// Cua de treballs del fil de rasterització. És un anell de bytes on
+// cada treball és una capçalera 'job_t' seguida de les dades.
+#define RING_SIZE (16*1024*1024)
+#define JOB_ALIGN 64
+#define JOB_HDR_SIZE                                                    \
+  (((sizeof(job_t)+JOB_ALIGN-1)/JOB_ALIGN)*JOB_ALIGN)
+#define JOB_PAYLOAD(JOB) (((uint8_t *) (JOB)) + JOB_HDR_SIZE)
+
+#define JOB_WRAP    0
+#define JOB_PIXELS  1
+#define JOB_PANNING 2
+#define JOB_PAL     3
+#define JOB_PRESENT 4
+#define JOB_QUIT    5
+
 #define BIOS_READ8(ADDR) (_bios.v8[ADDR])
 #define BIOS_READ16(ADDR)                                                \
   PC_SWAP16((((const uint16_t *) (_bios.v8+((ADDR)&0x1)))[ADDR>>1]))
@@ -55,8 +94,66 @@
 #define BIOS_READ64(ADDR)                                               \
   PC_SWAP64(((const uint64_t *) (_bios.v8+((ADDR)&0x7)))[ADDR>>3])
 
-#define VRAM_SIZE (4*1024*1024)
-#define VRAM_MASK (VRAM_SIZE-1)
+// La VRAM pot ser de 1, 2 o 4MB. Cada obertura del 'linear frame
+// buffer' ocupa 4MB i si hi ha menys memòria es repetix.
+#define VRAM_MAX_SIZE (4*1024*1024)
+#define LFB_APERTURE_SIZE (4*1024*1024)
+
+// Seguiment de canvis. La VRAM es dividix en pàgines de 1K.
+#define DAMAGE_PAGE_BITS 10
+#define DAMAGE_NPAGES (VRAM_MAX_SIZE>>DAMAGE_PAGE_BITS)
+#define DAMAGE_PLANES_SIZE (256*1024) // Memòria dels modes VGA
+
+// Mode text. Les fonts estan en el planol 2.
+#define FONT_PLANE_BEGIN (2*64*1024)
+#define FONT_PLANE_END   (3*64*1024)
+#define TEXT_COLS (LINE_WIDTH/8)
+#define GLYPH_CACHE_BITS 10
+#define GLYPH_CACHE_SIZE (1<<GLYPH_CACHE_BITS)
+
+// Bucles d'espera sobre el registre d'estat (PC_CFG_SVGA_FAST_RETRACE).
+// Es considera un bucle quan es llig el mateix valor POLL_MIN_REPS
+// vegades seguides cada mateix nombre de cicles (com a molt
+// POLL_MAX_PERIOD).
+#define POLL_MAX_PERIOD 256
+#define POLL_MIN_REPS   4
+
+// BitBLT
+#define BLT_MAX_WIDTH 8192 // GR20,GR21 són 13 bits
+
+#define BLTMODE_BACKWARDS        0x01
+#define BLTMODE_MEMSYSDEST       0x02
+#define BLTMODE_MEMSYSSRC        0x04
+#define BLTMODE_TRANSPARENTCOMP  0x08
+#define BLTMODE_PATTERNCOPY      0x40
+#define BLTMODE_COLOREXPAND      0x80
+
+#define BLTMODEEXT_COLOREXPINV   0x02
+#define BLTMODEEXT_SOLIDFILL     0x04
+
+// Registres BitBLT mapejats en memòria en 0xB8000 (SR17).
+#define MMIO_LEGACY(ADDR)                                               \
+  (_regs.SR.r17.enable_mem_mapped_io &&                                 \
+   !_regs.SR.r17.mem_mapped_io_addr &&                                  \
+   ((ADDR)&0xFFFFFF00) == 0xB8000)
+
+// Registres BitBLT mapejats en els últims 256 bytes del 'linear
+// frame buffer' (SR17).
+#define MMIO_LINEAR(ADDR)                                               \
+  (_regs.SR.r17.enable_mem_mapped_io &&                                 \
+   _regs.SR.r17.mem_mapped_io_addr &&                                   \
+   _regs.misc.display_mem_enabled &&                                    \
+   _regs.SR.r7.linear_frame_buffer_enabled &&                           \
+   ((uint32_t) ((ADDR)&0xFE000000)) == _pci_regs.disp_mem_base_addr &&  \
+   ((ADDR)&_vram_mask) >= _vram_size-256)
+
+// Escriptures de la CPU en memòria de vídeo que són dades font d'un
+// BitBLT des del sistema.
+#define BLT_SYS_SRC(ADDR)                                               \
+  (_blt.active && _regs.misc.display_mem_enabled &&                     \
+   (((ADDR) >= _vga_mem.begin && (ADDR) < _vga_mem.end) ||              \
+    (_regs.SR.r7.linear_frame_buffer_enabled &&                         \
+     ((uint32_t) ((ADDR)&0xFE000000)) == _pci_regs.disp_mem_base_addr)))
 
 
 
@@ -67,8 +164,9 @@
 
 static void update_vclk (void);
 static void update_cc_to_event (void);
-static void clock ( const bool update_cc2event );
+static void svga_clock ( const bool update_cc2event );
 static void update_vga_mem (void);
+static void update_vga_mem_masks (void);
 static void misc_write (const uint8_t data,const bool update_clock,
                         const bool update_vclk);
 static void SR_write (const uint8_t data,const bool update_clock,
@@ -89,6 +187,29 @@ static void dac_addr_w_write (const uint8_t data);
 static void dac_addr_r_write (const uint8_t data);
 static void vga_mem_write (const uint64_t addr,const uint8_t data);
 static uint8_t vga_mem_read (const uint64_t addr);
+static void blt_reg_write (const int reg,const uint8_t data);
+static uint8_t blt_reg_read (const int reg);
+static void blt_sys_write (const uint8_t data);
+static void blt_mmio_write (const int offset,const uint8_t data);
+static uint8_t blt_mmio_read (const int offset);
+static void damage_before_write (const uint32_t addr,const int n);
+static void damage_mark (const uint32_t addr);
+static void damage_mark_range (const uint32_t addr,const int n);
+static void damage_regs (void);
+static void damage_cursor (const bool enabled,const int y,const int size);
+static void update_lfb_map (void);
+static int render_ext_bpp (void);
+static void render_flush (void);
+static void render_update_pal (void);
+static void thread_poll (void);
+static void thread_drain (void);
+static void thread_send_present (const int width,const int height,
+                                 const int nrects);
+static void update_crtc (void);
+static int calc_next_event_H (int *end_scanline,int *next_event_hblank,
+                              int *next_event_hretrace);
+static void init_damage (void);
+static bool fb_resize (const int width,const int height);
 static void init_pci_regs (void);
 static void init_regs (void);
 
@@ -110,6 +231,24 @@ static const uint8_t PI= 0x00;
 
 static const uint8_t HEDT= 0x00; // Inventada !!!
 
+// Expandix 4 bits (un per planol) a un byte per planol.
+static const uint32_t PLANES_EXPAND[16]= {
+  0x00000000, 0x000000FF, 0x0000FF00, 0x0000FFFF,
+  0x00FF0000, 0x00FF00FF, 0x00FFFF00, 0x00FFFFFF,
+  0xFF000000, 0xFF0000FF, 0xFF00FF00, 0xFF00FFFF,
+  0xFFFF0000, 0xFFFF00FF, 0xFFFFFF00, 0xFFFFFFFF
+};
+
+// Offset de cada font (SR3) en el planol 2.
+static const int PLANE2_OFFSETS[]= {
+  0, 16*1024, 32*1024, 48*1024,
+  8*1024, 24*1024, 40*1024, 56*1024
+};
+
+// Bytes que s'intercanvien en cada obertura del 'linear frame
+// buffer'. La 3 és l'obertura de vídeo, que no està implementada.
+static const uint32_t LFB_SWAP[4]= { 0, 1, 3, 0 };
+
 
 // NOTA !!! Aparentment el IRQ estava en EGA i alguna versió més, pero
 // rarament s'utilitza. Segons un foro l'únic joc que ho necessita és
@@ -124,6 +263,65 @@ static const uint8_t INTPN= 0x00;
 
 
 
+/*********/
+/* TIPUS */
+/*********/
+
+// Fila del cursor gràfic.
+typedef struct
+{
+
+  int      x;
+  int      size;
+  uint8_t  p0[8];
+  uint8_t  p1[8];
+  uint32_t fg;
+  uint32_t bg;
+  
+} cursor_t;
+
+// Píxels dels modes estesos tal i com estan en la VRAM.
+typedef struct
+{
+
+  int            kind; // PIX_*
+  const uint8_t *src;
+  int            n;
+  
+} ext_src_t;
+
+// Glif de la cau del mode text. Conté les files ja pintades
+// (0x00RRGGBB) d'un caràcter amb uns colors i una font.
+typedef struct
+{
+
+  uint32_t key; // 0 buit
+  uint32_t gen;
+  uint32_t rows; // Files ja calculades
+  uint32_t px[32][9];
+  
+} glyph_t;
+
+// Capçalera d'un treball del fil de rasterització.
+typedef struct
+{
+
+  int      type; // JOB_*
+  int      size; // Bytes que ocupa en l'anell (capçalera inclosa)
+  int      scanline;
+  int      x; // JOB_PRESENT: amplària. JOB_PANNING: panning
+  int      n; // Píxels amb dades. JOB_PRESENT: altura
+  int      total; // Píxels. JOB_PRESENT: rectangles
+  uint64_t cc; // JOB_PRESENT: cicles emulats
+  int      kind; // PIX_*
+  bool     cursor;
+  cursor_t cur;
+  
+} job_t;
+
+
+
+
 /*********/
 /* ESTAT */
 /*********/
@@ -131,6 +329,7 @@ static const uint8_t INTPN= 0x00;
 // Callbacks.
 static PC_Warning *_warning;
 static PC_UpdateScreen *_update_screen;
+static PC_UpdateScreenDamage *_update_screen_damage;
 static PC_VGAMemAccess *_vga_mem_access;
 static PC_VGAMemLinearAccess *_vga_mem_linear_access;
 static bool _trace_enabled;
@@ -147,6 +346,15 @@ static struct
   uint8_t intln; // No fa res
 } _pci_regs;
 
+// Obertures del 'linear frame buffer' publicades en el MTXC.
+static struct
+{
+  int      N;
+  uint32_t base;
+  uint32_t size;
+  bool     writable;
+} _lfb_map;
+
 // Bios.
 static struct
 {
@@ -186,6 +394,7 @@ static struct
   struct
   {
     int     index;
+    int     index_hi; // Bits 7:5 de l'índex (SR10,SR11)
     uint8_t reset;
     struct
     {
@@ -231,6 +440,8 @@ static struct
       bool    cursor_enable;
     }       r12;
     uint8_t r13_cursor_pat_addr_off;
+    int     cursor_x; // SR10
+    int     cursor_y; // SR11
     struct
     {
       uint8_t val;
@@ -314,6 +525,23 @@ static struct
       bool    blt_reset;
       bool    blt_start;
     }       r49;
+    uint8_t bg_color[3]; // Bytes 1-3 (GR10,GR12,GR14)
+    uint8_t fg_color[3]; // Bytes 1-3 (GR11,GR13,GR15)
+    struct
+    {
+      uint16_t width; // GR20,GR21
+      uint16_t height; // GR22,GR23
+      uint16_t dst_pitch; // GR24,GR25
+      uint16_t src_pitch; // GR26,GR27
+      uint32_t dst_addr; // GR28-GR2A
+      uint32_t src_addr; // GR2C-GR2E
+      uint8_t  write_mask; // GR2F
+      uint8_t  mode; // GR30
+      uint8_t  rop; // GR32
+      uint8_t  mode_ext; // GR33
+      uint16_t transp_color; // GR34,GR35
+      uint16_t transp_mask; // GR38,GR39
+    }       blt;
   } GR;
   struct
   {
@@ -496,10 +724,13 @@ static struct
   uint8_t buffer_w[3];
   int     buffer_r_off;
   uint8_t buffer_r[3];
+  uint8_t ext[16][3]; // Colors estesos (0: fons cursor, 15: cursor)
 } _dac;
 
-// Video ram (4MB - SVGA)
-static uint8_t _vram[VRAM_SIZE];
+// Video ram (1, 2 o 4MB - SVGA)
+static uint8_t *_vram= NULL;
+static uint32_t _vram_size;
+static uint32_t _vram_mask;
 
 // Gestiona mapa memòria VGA estàndard
 static struct
@@ -508,10 +739,48 @@ static struct
   uint64_t  begin;
   uint64_t  end;
   uint8_t  *p[4]; // Planols
-  uint8_t   latch[4];
+  
+  // Latches i registres del Graphics Controller empaquetats: el byte
+  // i (bits 8i..8i+7) correspon al planol i. Les màscares es
+  // recalculen quan canvien els registres (update_vga_mem_masks).
+  uint32_t  latch;
+  uint32_t  sr_val; // GR0
+  uint32_t  sr_mask; // GR1
+  uint32_t  cc_val; // GR2
+  uint32_t  cc_mask; // GR7
+  uint32_t  bit_mask; // GR8
   
 } _vga_mem;
 
+// Motor BitBLT
+static struct
+{
+
+  bool     active; // Esperant dades font del sistema
+  int      bpp; // Bytes per píxel
+  int      width; // En bytes
+  int      height;
+  int      dst_pitch;
+  int      src_pitch;
+  uint32_t dst; // Adreça destí de la fila actual
+  uint32_t src; // Adreça font de la fila actual
+  int      row; // Fila actual
+  int      pat_y; // Fila inicial del patró
+  int      pixel_skip; // Píxels a botar al principi de cada fila
+  int      byte_skip;
+  uint32_t fg;
+  uint32_t bg;
+  uint8_t  rop; // GR32, o SRC si no es coneix
+  int      sys_bytes; // Bytes a rebre abans de processar (font sistema)
+  int      sys_n;
+  uint8_t  sys_buf[BLT_MAX_WIDTH];
+  uint8_t  pat[256]; // Patró 8x8
+  uint8_t  srow[BLT_MAX_WIDTH]; // Fila font ja expandida
+  uint8_t  mrow[BLT_MAX_WIDTH]; // Màscara de transparència
+  uint8_t  drow[BLT_MAX_WIDTH];
+  
+} _blt;
+
 static struct
 {
   
@@ -519,20 +788,85 @@ static struct
   int cc;
   int cctoEvent;
   
-  // Per a passar a clocks de VGA cal fer (cc*(cc_mul))/cc_div
-  long cc_mul;
-  long cc_div;
-  long vcc_tmp; // Ací hi han cc*cc_mul que encara no han sigut
-                // dividits, i típicament no apleguen a cc_div. Però
-                // pot ser que siga més en un canvi.
+  // Els clocks de VGA per cicle són cc_mul/cc_div. Per a no dividir
+  // en cada crida es precalcula (update_vclk) la conversió en coma
+  // fixa 32.32: 'dpc' són dots per cicle i 'cpd' cicles per dot
+  // (arredonit cap amunt). 'vfrac' és la fracció de dot que encara no
+  // s'ha processat.
+  long     cc_mul;
+  long     cc_div;
+  uint64_t dpc;
+  uint64_t cpd;
+  uint64_t vfrac;
+  int      max_dots; // Dots en un segon
+
+  // Cicles de CPU des de l'inici. Marca de temps dels frames.
+  uint64_t cc_total;
   
 } _timing;
 
+// Posicions dels events del CRTC, en caràcters (H) i en línies (V).
+// Es recalculen cada vegada que s'escriu un registre del que depenen
+// (update_crtc).
+static struct
+{
+
+  int     dotsperchar;
+  int     end_scanline;
+  int     end_hdisplay;
+  int     hblank_start;
+  uint8_t hblank_end; // 6 bits
+  int     hretrace_start;
+  uint8_t hretrace_end; // 5 bits
+  int     vblank_start;
+  int     vblank_width;
+  int     vretrace_start;
+  uint8_t vretrace_end; // 4 bits
+  int     end_vdisplay;
+  int     last_V;
+  int     start_addr;
+
+  // Per a calc_cc_to_update_screen. En scanlines.
+  int     update_scanline;
+  int     last_scanline;
+  int     scanline_dots;
+  
+} _crtc;
+
+// Registre d'estat (0x3DA). Els bits de retraç i de display enable
+// sols poden canviar en un event horitzontal del CRTC, per tant
+// stat_read sols posa al dia el renderitzador quan s'arriba a
+// 'horizon' (cicle absolut, com _timing.cc_total, del següent
+// event). Els bits de diagnòstic es prenen del 'pixel_bus' en eixe
+// moment.
+static struct
+{
+
+  uint64_t horizon; // 0 vol dir que s'ha de tornar a calcular
+  uint8_t  val;
+  uint8_t  pixel_bus;
+
+  // Detecció de bucles d'espera.
+  bool     fast_retrace;
+  uint64_t last_cc;
+  uint64_t period;
+  int      nreps;
+  uint8_t  last_ret;
+  
+} _stat;
+
 static struct
 {
 
-  // Framebuffer
-  PC_RGB fb[FB_WIDTH*FB_HEIGHT];
+  // Framebuffer. Cada píxel ocupa 'fb_psize' bytes en el format
+  // 'fb_format'. Té la grandària de l'última pantalla presentada
+  // ('fb_width' també és el 'stride' en píxels) i es torna a reservar
+  // quan canvia (fb_resize).
+  uint8_t    *fb;
+  int         fb_width;
+  int         fb_height;
+  PC_FBFormat fb_format;
+  int         fb_psize;
   
   // Comptadors
   int     H;
@@ -549,9 +883,137 @@ static struct
   int     blink_counter;
   uint8_t pixel_bus;
   int     start_addr;
+
+  // Conversió de píxels. 'pal' és la paleta del DAC ja convertida
+  // (0x00RRGGBB) i es recalcula quan 'pal_dirty' és cert. Els
+  // renderitzadors pinten la scanline en 'line' (0x00RRGGBB) i
+  // render_store la passa al framebuffer.
+  uint32_t pal[256];
+  bool     pal_dirty;
+  uint32_t pal_gen; // S'incrementa cada vegada que canvia 'pal'
+  uint32_t line[LINE_WIDTH];
+  uint8_t  idx[LINE_WIDTH+16]; // render_chars_planar es passa fins a 15
+
+  // Paleta de l'Attribute Controller ja passada pel DAC
+  // (0x00RRGGBB). Es recalcula quan 'ar_pal_dirty' és cert.
+  uint32_t ar_pal[16];
+  bool     ar_pal_dirty;
+
+  // Trossos visibles de la scanline actual que encara no s'han
+  // renderitzat. Es van acumulant i es renderitzen tots junts
+  // (render_flush) al final de la scanline o abans que canvie alguna
+  // cosa que afecte al resultat.
+  int batch_H;
+  int batch_chars;
+  int batch_dotsperchar;
   
 } _render;
 
+// Expansió de planols. Per a cada byte d'un planol conté 8 bytes amb
+// els seus bits de més a menys significatiu en el bit 0. Amb una
+// consulta per planol es tenen els 8 índexs de 4 bits d'un byte.
+static uint64_t _planar_expand[256];
+
+// Zones de la pantalla que han canviat. Cada escriptura en VRAM
+// anota en la pàgina el valor actual de 'seq', i cada scanline
+// renderitzada incrementa 'seq'. Una scanline s'ha de tornar a
+// renderitzar si alguna pàgina que llig té un valor >= que el de
+// l'última vegada que es va renderitzar, o si han canviat els
+// registres ('gen').
+static struct
+{
+
+  uint64_t      seq;
+  uint64_t      pages[DAMAGE_NPAGES];
+  uint64_t      planes; // Última escriptura en DAMAGE_PLANES_SIZE
+  uint32_t      gen;
+  struct
+  {
+    uint64_t seq;
+    uint32_t gen;
+    int      begin; // Rang de VRAM (-1 memòria dels modes VGA)
+    int      end;
+  }             lines[FB_HEIGHT];
+  int           cur_line; // Scanline avaluada (-1 cap)
+  bool          cur_dirty;
+  bool          changed[FB_HEIGHT]; // Scanlines renderitzades en el frame
+  PC_ScreenRect rects[FB_HEIGHT];
+  int           width;
+  int           height;
+  
+} _damage;
+
+// Frames que es rasteritzen. Amb 'skip' > 1 sols es rasteritza un de
+// cada 'skip' frames i amb 0 sols els que demana el frontend. La
+// temporització del CRTC no canvia.
+static struct
+{
+
+  int      skip;
+  int      counter;
+  bool     requested;
+  bool     render; // Es rasteritza el frame actual
+  uint64_t rendered;
+  uint64_t skipped;
+  
+} _frames;
+
+// Mode text. La cau de glifs es buida quan canvia la font o la
+// paleta ('glyph_gen'). Per a cada cel·la de cada scanline es guarda
+// una signatura del que es va pintar per a no tornar-la a pintar si
+// no ha canviat. Les signatures d'una scanline sols valen si es van
+// guardar amb el 'sig_gen' actual, que canvia quan es modifica un
+// registre que afecta al que es mostra.
+static struct
+{
+
+  glyph_t  glyphs[GLYPH_CACHE_SIZE];
+  uint32_t glyph_gen;
+  uint32_t sig_gen;
+  uint32_t lines[FB_HEIGHT];
+  uint32_t sigs[FB_HEIGHT][TEXT_COLS];
+  
+} _text;
+
+// Rasterització en un altre fil. El fil de l'emulador fa tot el
+// treball que depén dels registres i la VRAM i encua en 'ring' les
+// dades de cada tros de scanline (ja copiades). El fil de
+// rasterització les converteix al format del framebuffer. Els frames
+// es passen al frontend sempre des del fil de l'emulador.
+static struct
+{
+
+  bool             enabled;
+  pthread_t        thread;
+  pthread_mutex_t  lock;
+  pthread_cond_t   cond;
+  uint8_t         *ring;
+  uint64_t         head; // Sols l'escriu el fil de l'emulador
+  uint64_t         tail; // Sols l'escriu el fil de rasterització
+  size_t           commit; // Bytes del treball que s'està preparant
+  int              pending; // Frames encuats sense presentar
+  bool             ready; // Hi ha un frame esperant a presentar-se
+  const job_t     *present;
+  uint32_t         pal_gen; // Última paleta enviada
+  uint32_t         pal[256]; // Paleta del fil de rasterització
+  uint32_t         line[LINE_WIDTH]; // Scanline del fil de rasterització
+  
+} _thread;
+
+// Exportació dels frames en memòria compartida. Cada buffer té les
+// files que li falten per estar al dia ('stale').
+static struct
+{
+
+  PC_SVGAShmHeader *hdr;
+  size_t            size;
+  int               fd;
+  char             *name; // NULL si és un memfd
+  uint64_t          frame;
+  bool              stale[2][FB_HEIGHT];
+  
+} _shm;
+
 
 
 
@@ -568,7 +1030,7 @@ pci_read8 (
   uint8_t ret;
 
 
-  clock ( true );
+  svga_clock ( true );
   
   switch ( addr )
     {
@@ -616,7 +1078,7 @@ pci_read16 (
   uint16_t ret;
   
 
-  clock ( true );
+  svga_clock ( true );
   
   switch ( addr )
     {
@@ -654,7 +1116,7 @@ pci_read32 (
   uint32_t ret;
   
 
-  clock ( true );
+  svga_clock ( true );
   
   switch ( addr )
     {
@@ -703,7 +1165,7 @@ pci_write8 (
             )
 {
 
-  clock ( true );
+  svga_clock ( true );
   
   switch ( addr )
     {
@@ -744,7 +1206,7 @@ pci_write16 (
              )
 {
 
-  clock ( true );
+  svga_clock ( true );
   
   switch ( addr )
     {
@@ -761,6 +1223,7 @@ pci_write16 (
                    "pci_write16 (SVGA CIRRUS CLGD5446) - s'ha intentat"
                    " habilitar el Enable DAC Shadowing, però no està"
                    " implementat" );
+      update_lfb_map ();
       break;
       
       // SCC i BASEC;
@@ -782,7 +1245,7 @@ pci_write32 (
              )
 {
 
-  clock ( true );
+  svga_clock ( true );
   
   switch ( addr )
     {
@@ -790,7 +1253,10 @@ pci_write32 (
     case 0x00: break;
 
       // PCI10: PCI Display Memory Base Address
-    case 0x04: _pci_regs.disp_mem_base_addr= data&0xFE000000; break;
+    case 0x04:
+      _pci_regs.disp_mem_base_addr= data&0xFE000000;
+      update_lfb_map ();
+      break;
       // PCI14: PCI VGA/BitBLT Register Base Address
     case 0x05: _pci_regs.vga_bb_reg_base_addr= data&0xFFFFF000; break;
       // PCI18: PCI GPIO Base Address
@@ -811,6 +1277,7 @@ pci_write32 (
                  data );
       */
       _pci_regs.erom= data&(_bios.mask|0x1);
+      update_lfb_map ();
       break;
       
     default:
@@ -878,7 +1345,7 @@ port_read8 (
 
     case 0x3c9: *data= dac_data_read (); break;
       
-    case 0x3cc: /*clock ( true );*/ *data= _regs.misc.val; break;
+    case 0x3cc: /*svga_clock ( true );*/ *data= _regs.misc.val; break;
       
     case 0x3ce: *data= _regs.GR.index; break;
     case 0x3cf: *data= GR_read ( true ); break;
@@ -957,6 +1424,9 @@ port_write8 (
   bool ret;
   
   
+  // Renderitza el pendent amb els registres actuals.
+  svga_clock ( false );
+  render_flush ();
   ret= true;
   switch ( port )
     {
@@ -973,7 +1443,10 @@ port_write8 (
     case 0x3c1: AR_write ( data, true ); break;
     case 0x3c2: misc_write ( data, true, true ); break;
       
-    case 0x3c4: _regs.SR.index= ((uint8_t) data)&0x1F; break;
+    case 0x3c4:
+      _regs.SR.index= ((uint8_t) data)&0x1F;
+      _regs.SR.index_hi= ((uint8_t) data)>>5;
+      break;
     case 0x3c5: SR_write ( data, true, true ); break;
     case 0x3c6: pixel_mask_write ( data, true ); break;
     case 0x3c7: dac_addr_r_write ( data ); break;
@@ -1013,6 +1486,9 @@ port_write16 (
   bool ret;
 
 
+  // Renderitza el pendent amb els registres actuals.
+  svga_clock ( false );
+  render_flush ();
   ret= true;
   switch ( port>>1 )
     {
@@ -1027,6 +1503,7 @@ port_write16 (
       
     case 0x3c4>>1:
       _regs.SR.index= ((uint8_t) data)&0x1F;
+      _regs.SR.index_hi= (data>>5)&0x7;
       SR_write ( (uint8_t) (data>>8), true, true );
       break;
       
@@ -1076,6 +1553,181 @@ static const PC_PCIPorts PORTS=
 /* MEM */
 /*******/
 
+// Accedix als registres mapejats en memòria. En la finestra PCI14
+// els primers 256 bytes corresponen als ports 0x3C0-0x3DF i la resta
+// als registres BitBLT. En la finestra de SR17 tot són registres
+// BitBLT.
+static uint64_t
+mmio_read (
+           const uint64_t addr,
+           const int      nbytes
+           )
+{
+
+  uint64_t ret,a;
+  uint32_t offset;
+  uint8_t tmp;
+  int i;
+  
+
+  ret= 0;
+  for ( i= 0; i < nbytes; ++i )
+    {
+      a= addr+i;
+      if ( ((uint32_t) (a&0xFFFFF000)) == _pci_regs.vga_bb_reg_base_addr )
+        {
+          offset= (uint32_t) (a&0xFFF);
+          if ( offset >= 0x100 ) tmp= blt_mmio_read ( (int) (offset-0x100) );
+          else if ( offset >= 0x20 ||
+                    !port_read8 ( (uint16_t) (0x3c0+offset), &tmp ) )
+            tmp= 0xff;
+        }
+      else tmp= blt_mmio_read ( (int) (a&0xFF) );
+      ret|= ((uint64_t) tmp)<<(i*8);
+    }
+  
+  return ret;
+  
+} // end mmio_read
+
+
+static void
+mmio_write (
+            const uint64_t addr,
+            const uint64_t data,
+            const int      nbytes
+            )
+{
+
+  uint64_t a;
+  uint32_t offset;
+  uint8_t tmp;
+  int i;
+  
+
+  for ( i= 0; i < nbytes; ++i )
+    {
+      a= addr+i;
+      tmp= (uint8_t) (data>>(i*8));
+      if ( ((uint32_t) (a&0xFFFFF000)) == _pci_regs.vga_bb_reg_base_addr )
+        {
+          offset= (uint32_t) (a&0xFFF);
+          if ( offset >= 0x100 ) blt_mmio_write ( (int) (offset-0x100), tmp );
+          else if ( offset < 0x20 )
+            port_write8 ( (uint16_t) (0x3c0+offset), tmp );
+        }
+      else blt_mmio_write ( (int) (a&0xFF), tmp );
+    }
+  
+} // end mmio_write
+
+
+// Torna el valor en little-endian. L'obertura de vídeo (3) no està
+// implementada i es llig tot a 1.
+static uint64_t
+lfb_read (
+          const uint64_t addr,
+          const int      aperture,
+          const int      nbytes
+          )
+{
+
+  uint64_t ret;
+  int i;
+  
+
+  if ( aperture == 3 ) return (~((uint64_t) 0))>>(64-8*nbytes);
+  ret= 0;
+  for ( i= nbytes-1; i >= 0; --i )
+    ret= (ret<<8) | _vram[((addr+i)&_vram_mask)^LFB_SWAP[aperture]];
+  
+  return ret;
+  
+} // end lfb_read
+
+
+static void
+lfb_write (
+           const uint64_t addr,
+           const int      aperture,
+           const uint32_t data,
+           const int      nbytes
+           )
+{
+
+  uint32_t first,last;
+  int i;
+  
+
+  if ( aperture == 3 ) return;
+  first= ((uint32_t) addr)&(~LFB_SWAP[aperture]);
+  last= ((uint32_t) (addr+nbytes-1))|LFB_SWAP[aperture];
+  damage_before_write ( first, (int) (last-first+1) );
+  for ( i= 0; i < nbytes; ++i )
+    _vram[((addr+i)&_vram_mask)^LFB_SWAP[aperture]]= (uint8_t) (data>>(8*i));
+  damage_mark_range ( first, (int) (last-first+1) );
+  
+} // end lfb_write
+
+
+// Publica en el MTXC les obertures 0-2 del 'linear frame buffer' per
+// a que la CPU hi accedisca sense passar per mem_read/mem_write. No
+// es publiquen quan els accessos s'han de tracejar o algun altre rang
+// podria tindre prioritat. Durant un BitBLT amb font en el sistema
+// les escriptures continuen passant per mem_write.
+static void
+update_lfb_map (void)
+{
+
+  PC_MemDirect maps[3];
+  uint32_t base,size;
+  bool writable;
+  int N,i;
+  
+
+  base= _pci_regs.disp_mem_base_addr;
+  size= _vram_size;
+  writable= !_blt.active;
+  if ( (_pci_regs.pcicmd&PCICMD_MEM) &&
+       _regs.misc.display_mem_enabled &&
+       _regs.SR.r7.linear_frame_buffer_enabled &&
+       base >= 0x00100000 && // No solapa les finestres VGA
+       !((_pci_regs.erom&0x1) && (_pci_regs.erom&0xFE000000) == base) &&
+       !(_trace_enabled && _vga_mem_linear_access != NULL) )
+    {
+      N= 3;
+      if ( _regs.SR.r17.enable_mem_mapped_io &&
+           _regs.SR.r17.mem_mapped_io_addr )
+        size-= 256;
+    }
+  else N= 0;
+
+  // Res a fer.
+  if ( N == _lfb_map.N &&
+       (N == 0 || (base == _lfb_map.base && size == _lfb_map.size &&
+                   writable == _lfb_map.writable)) )
+    return;
+
+  // Publica.
+  for ( i= 0; i < N; ++i )
+    {
+      maps[i].begin= ((uint64_t) base) + i*LFB_APERTURE_SIZE;
+      maps[i].end= maps[i].begin + size;
+      maps[i].mem= &(_vram[0]);
+      maps[i].swap= LFB_SWAP[i];
+      maps[i].writable= writable;
+      maps[i].writing= damage_before_write;
+      maps[i].written= damage_mark_range;
+    }
+  PC_mtxc_set_direct ( maps, N );
+  _lfb_map.N= N;
+  _lfb_map.base= base;
+  _lfb_map.size= size;
+  _lfb_map.writable= writable;
+  
+} // end update_lfb_map
+
+
 static bool
 mem_read8 (
            const uint64_t  addr,
@@ -1104,6 +1756,13 @@ mem_read8 (
       else ret= false;
     }
 
+  // BitBLT control registers (SR17)
+  else if ( MMIO_LEGACY(addr) || MMIO_LINEAR(addr) )
+    {
+      *data= (uint8_t) mmio_read ( addr, 1 );
+      ret= true;
+    }
+  
   // Display memorya (VGA mode)
   else if ( _regs.misc.display_mem_enabled &&
             addr >= _vga_mem.begin && addr < _vga_mem.end )
@@ -1118,20 +1777,10 @@ mem_read8 (
             ((uint32_t) (addr&0xFE000000)) == _pci_regs.disp_mem_base_addr )
     {
       aperture= (addr>>22)&0x3;
-      switch ( aperture )
-        {
-        case 0: // No swap
-          *data= _vram[addr&VRAM_MASK];
-          break;
-        default:
-          PC_MSGF("MEM_READ8 (SVGA_CIRRUS_CLGD5446"
-                  " - Display memory) addr: %016lX (aperture: %d)",
-                  addr,aperture);
-          exit(EXIT_FAILURE);
-        }
+      *data= (uint8_t) lfb_read ( addr, aperture, 1 );
       if ( _trace_enabled && _vga_mem_linear_access != NULL )
         _vga_mem_linear_access ( PC_READ8, aperture,
-                                 (uint32_t) (addr&VRAM_MASK),
+                                 (uint32_t) (addr&_vram_mask),
                                  (uint64_t) *data, _udata );
       ret= true;
     }
@@ -1139,11 +1788,8 @@ mem_read8 (
   // VGA I/O - BitBLT control registers
   else if ( ((uint32_t) (addr&0xFFFFF000)) == _pci_regs.vga_bb_reg_base_addr )
     {
-      PC_MSGF("MEM_READ8 (SVGA_CIRRUS_CLGD5446"
-              " - VGA I/O -- BitBLT control registers) addr: %016lX",addr);
-      *data= 0xFF;
+      *data= (uint8_t) mmio_read ( addr, 1 );
       ret= true;
-      exit(EXIT_FAILURE);
     }
   
   else ret= false;
@@ -1208,6 +1854,13 @@ mem_read16 (
       else ret= false;
     }
 
+  // BitBLT control registers (SR17)
+  else if ( MMIO_LEGACY(addr) || MMIO_LINEAR(addr) )
+    {
+      *data= (uint16_t) mmio_read ( addr, 2 );
+      ret= true;
+    }
+  
   // Display memorya (VGA mode)
   else if ( _regs.misc.display_mem_enabled &&
             addr >= _vga_mem.begin && addr < _vga_mem.end )
@@ -1225,23 +1878,10 @@ mem_read16 (
             ((uint32_t) (addr&0xFE000000)) == _pci_regs.disp_mem_base_addr )
     {
       aperture= (addr>>22)&0x3;
-      switch ( aperture )
-        {
-        case 0: // No swap
-          *data= ((uint16_t *) _vram)[(addr&VRAM_MASK)>>1];
-#if PC_BE
-          *data= PC_SWAP16(*data);
-#endif
-          break;
-        default:
-          PC_MSGF("MEM_READ16 (SVGA_CIRRUS_CLGD5446"
-                  " - Display memory) addr: %016lX (aperture: %d)",
-                  addr,aperture);
-          exit(EXIT_FAILURE);
-        }
+      *data= (uint16_t) lfb_read ( addr, aperture, 2 );
       if ( _trace_enabled && _vga_mem_linear_access != NULL )
         _vga_mem_linear_access ( PC_READ16, aperture,
-                                 (uint32_t) (addr&VRAM_MASK),
+                                 (uint32_t) (addr&_vram_mask),
                                  (uint64_t) *data, _udata );
       ret= true;
     }
@@ -1249,11 +1889,8 @@ mem_read16 (
   // VGA I/O - BitBLT control registers
   else if ( ((uint32_t) (addr&0xFFFFF000)) == _pci_regs.vga_bb_reg_base_addr )
     {
-      PC_MSGF("MEM_READ16 (SVGA_CIRRUS_CLGD5446"
-              " - VGA I/O -- BitBLT control registers) addr: %016lX",addr);
-      *data= 0xFFFF;
+      *data= (uint16_t) mmio_read ( addr, 2 );
       ret= true;
-      exit(EXIT_FAILURE);
     }
   
   else ret= false;
@@ -1316,6 +1953,13 @@ mem_read32 (
       else ret= false;
     }
 
+  // BitBLT control registers (SR17)
+  else if ( MMIO_LEGACY(addr) || MMIO_LINEAR(addr) )
+    {
+      *data= (uint32_t) mmio_read ( addr, 4 );
+      ret= true;
+    }
+  
   // Display memory (VGA mode)
   else if ( _regs.misc.display_mem_enabled &&
             addr >= _vga_mem.begin && addr < _vga_mem.end )
@@ -1335,23 +1979,10 @@ mem_read32 (
             ((uint32_t) (addr&0xFE000000)) == _pci_regs.disp_mem_base_addr )
     {
       aperture= (addr>>22)&0x3;
-      switch ( aperture )
-        {
-        case 0: // No swap
-          *data= ((uint32_t *) _vram)[(addr&VRAM_MASK)>>2];
-#if PC_BE
-          *data= PC_SWAP32(*data);
-#endif
-          break;
-        default:
-          PC_MSGF("MEM_READ32 (SVGA_CIRRUS_CLGD5446"
-                  " - Display memory) addr: %016lX (aperture: %d)",
-                  addr,aperture);
-          exit(EXIT_FAILURE);
-        }
+      *data= (uint32_t) lfb_read ( addr, aperture, 4 );
       if ( _trace_enabled && _vga_mem_linear_access != NULL )
         _vga_mem_linear_access ( PC_READ32, aperture,
-                                 (uint32_t) (addr&VRAM_MASK),
+                                 (uint32_t) (addr&_vram_mask),
                                  (uint64_t) *data, _udata );
       ret= true;
     }
@@ -1359,11 +1990,8 @@ mem_read32 (
   // VGA I/O - BitBLT control registers
   else if ( ((uint32_t) (addr&0xFFFFF000)) == _pci_regs.vga_bb_reg_base_addr )
     {
-      PC_MSGF("MEM_READ32 (SVGA_CIRRUS_CLGD5446"
-              " - VGA I/O -- BitBLT control registers) addr: %016lX",addr);
-      *data= 0xFFFFFFFF;
+      *data= (uint32_t) mmio_read ( addr, 4 );
       ret= true;
-      exit(EXIT_FAILURE);
     }
   
   else ret= false;
@@ -1405,6 +2033,7 @@ mem_read64 (
 {
   
   bool ret;
+  int aperture;
   uint32_t tmp;
   
 
@@ -1425,6 +2054,13 @@ mem_read64 (
       else ret= false;
     }
 
+  // BitBLT control registers (SR17)
+  else if ( MMIO_LEGACY(addr) || MMIO_LINEAR(addr) )
+    {
+      *data= (uint64_t) mmio_read ( addr, 8 );
+      ret= true;
+    }
+  
   // Display memorya (VGA mode)
   else if ( _regs.misc.display_mem_enabled &&
             addr >= _vga_mem.begin && addr < _vga_mem.end )
@@ -1440,18 +2076,19 @@ mem_read64 (
             _regs.SR.r7.linear_frame_buffer_enabled &&
             ((uint32_t) (addr&0xFE000000)) == _pci_regs.disp_mem_base_addr )
     {
-      PC_MSGF("MEM_READ64 (SVGA_CIRRUS_CLGD5446"
-              " - Display memory) addr: %016lX",addr);
-      *data= 0xFFFFFFFFFFFFFFFF;
+      aperture= (addr>>22)&0x3;
+      *data= lfb_read ( addr, aperture, 8 );
+      if ( _trace_enabled && _vga_mem_linear_access != NULL )
+        _vga_mem_linear_access ( PC_READ64, aperture,
+                                 (uint32_t) (addr&_vram_mask),
+                                 *data, _udata );
       ret= true;
     }
 
   // VGA I/O - BitBLT control registers
   else if ( ((uint32_t) (addr&0xFFFFF000)) == _pci_regs.vga_bb_reg_base_addr )
     {
-      PC_MSGF("MEM_READ64 (SVGA_CIRRUS_CLGD5446"
-              " - VGA I/O -- BitBLT control registers) addr: %016lX",addr);
-      *data= 0xFFFFFFFFFFFFFFFF;
+      *data= (uint64_t) mmio_read ( addr, 8 );
       ret= true;
     }
   
@@ -1485,6 +2122,20 @@ mem_write8 (
       ret= true;
     }
 
+  // BitBLT control registers (SR17)
+  else if ( MMIO_LEGACY(addr) || MMIO_LINEAR(addr) )
+    {
+      mmio_write ( addr, (uint64_t) data, 1 );
+      ret= true;
+    }
+
+  // Dades font d'un BitBLT des del sistema
+  else if ( BLT_SYS_SRC(addr) )
+    {
+      blt_sys_write ( data );
+      ret= true;
+    }
+
   // Display memory (VGA mode)
   else if ( _regs.misc.display_mem_enabled &&
             addr >= _vga_mem.begin && addr < _vga_mem.end )
@@ -1499,20 +2150,10 @@ mem_write8 (
             ((uint32_t) (addr&0xFE000000)) == _pci_regs.disp_mem_base_addr )
     {
       aperture= (addr>>22)&0x3;
-      switch ( aperture )
-        {
-        case 0: // No swap
-          _vram[addr&VRAM_MASK]= data;
-          break;
-        default:
-          PC_MSGF("MEM_WRITE8 (SVGA_CIRRUS_CLGD5446"
-                  " - Display memory) addr: %016lX data: %02X (aperture: %d)",
-                  addr,data,aperture);
-          exit(EXIT_FAILURE);
-        }
+      lfb_write ( addr, aperture, (uint32_t) data, 1 );
       if ( _trace_enabled && _vga_mem_linear_access != NULL )
         _vga_mem_linear_access ( PC_WRITE8, aperture,
-                                 (uint32_t) (addr&VRAM_MASK),
+                                 (uint32_t) (addr&_vram_mask),
                                  (uint64_t) data, _udata );
       ret= true;
     }
@@ -1520,9 +2161,7 @@ mem_write8 (
   // VGA I/O - BitBLT control registers
   else if ( ((uint32_t) (addr&0xFFFFF000)) == _pci_regs.vga_bb_reg_base_addr )
     {
-      PC_MSGF("MEM_WRITE8 (SVGA_CIRRUS_CLGD5446"
-              " - VGA I/O -- BitBLT control registers)"
-              " addr: %016lX data: %02X",addr,data);
+      mmio_write ( addr, (uint64_t) data, 1 );
       ret= true;
     }
   
@@ -1542,9 +2181,7 @@ mem_write16 (
 
   int aperture;
   bool ret;
-#if PC_BE
-  uint16_t data_tmp;
-#endif
+  
 
   // Comprova està habilitat.
   if ( (_pci_regs.pcicmd&PCICMD_MEM) == 0 ) ret= false;
@@ -1558,6 +2195,21 @@ mem_write16 (
       ret= true;
     }
 
+  // BitBLT control registers (SR17)
+  else if ( MMIO_LEGACY(addr) || MMIO_LINEAR(addr) )
+    {
+      mmio_write ( addr, (uint64_t) data, 2 );
+      ret= true;
+    }
+
+  // Dades font d'un BitBLT des del sistema
+  else if ( BLT_SYS_SRC(addr) )
+    {
+      blt_sys_write ( (uint8_t) (data&0xFF) );
+      blt_sys_write ( (uint8_t) ((data>>8)&0xFF) );
+      ret= true;
+    }
+
   // Display memory (VGA mode)
   else if ( _regs.misc.display_mem_enabled &&
             addr >= _vga_mem.begin && addr < _vga_mem.end )
@@ -1573,25 +2225,10 @@ mem_write16 (
             ((uint32_t) (addr&0xFE000000)) == _pci_regs.disp_mem_base_addr )
     {
       aperture= (addr>>22)&0x3;
-      switch ( aperture )
-        {
-        case 0: // No swap
-#if PC_BE
-          data_tmp= PC_SWAP16(data);
-          ((uint16_t *) _vram)[(addr&VRAM_MASK)>>1]= data_tmp;
-#else
-          ((uint16_t *) _vram)[(addr&VRAM_MASK)>>1]= data;
-#endif
-          break;
-        default:
-          PC_MSGF("MEM_WRITE16 (SVGA_CIRRUS_CLGD5446"
-                  " - Display memory) addr: %016lX data: %04X (aperture: %d)",
-                  addr,data,aperture);
-          exit(EXIT_FAILURE);
-        }
+      lfb_write ( addr, aperture, (uint32_t) data, 2 );
       if ( _trace_enabled && _vga_mem_linear_access != NULL )
         _vga_mem_linear_access ( PC_WRITE16, aperture,
-                                 (uint32_t) (addr&VRAM_MASK),
+                                 (uint32_t) (addr&_vram_mask),
                                  (uint64_t) data, _udata );
       ret= true;
     }
@@ -1599,9 +2236,7 @@ mem_write16 (
   // VGA I/O - BitBLT control registers
   else if ( ((uint32_t) (addr&0xFFFFF000)) == _pci_regs.vga_bb_reg_base_addr )
     {
-      PC_MSGF("MEM_WRITE16 (SVGA_CIRRUS_CLGD5446"
-              " - VGA I/O -- BitBLT control registers)"
-              " addr: %016lX data: %04X",addr,data);
+      mmio_write ( addr, (uint64_t) data, 2 );
       ret= true;
     }
   
@@ -1621,9 +2256,6 @@ mem_write32 (
 
   bool ret;
   int aperture;
-#if PC_BE
-  uint32_t data_tmp;
-#endif
   
 
   // Comprova està habilitat.
@@ -1638,6 +2270,23 @@ mem_write32 (
       ret= true;
     }
 
+  // BitBLT control registers (SR17)
+  else if ( MMIO_LEGACY(addr) || MMIO_LINEAR(addr) )
+    {
+      mmio_write ( addr, (uint64_t) data, 4 );
+      ret= true;
+    }
+
+  // Dades font d'un BitBLT des del sistema
+  else if ( BLT_SYS_SRC(addr) )
+    {
+      blt_sys_write ( (uint8_t) (data&0xFF) );
+      blt_sys_write ( (uint8_t) ((data>>8)&0xFF) );
+      blt_sys_write ( (uint8_t) ((data>>16)&0xFF) );
+      blt_sys_write ( (uint8_t) ((data>>24)&0xFF) );
+      ret= true;
+    }
+
   // Display memory (VGA mode)
   else if ( _regs.misc.display_mem_enabled &&
             addr >= _vga_mem.begin && addr < _vga_mem.end )
@@ -1655,25 +2304,10 @@ mem_write32 (
             ((uint32_t) (addr&0xFE000000)) == _pci_regs.disp_mem_base_addr )
     {
       aperture= (addr>>22)&0x3;
-      switch ( aperture )
-        {
-        case 0: // No swap
-#if PC_BE
-          data_tmp= PC_SWAP32(data);
-          ((uint32_t *) _vram)[(addr&VRAM_MASK)>>2]= data_tmp;
-#else
-          ((uint32_t *) _vram)[(addr&VRAM_MASK)>>2]= data;
-#endif
-          break;
-        default:
-          PC_MSGF("MEM_WRITE32 (SVGA_CIRRUS_CLGD5446"
-                  " - Display memory) addr: %016lX data: %08X (aperture: %d)",
-                  addr,data,aperture);
-          exit(EXIT_FAILURE);
-        }
+      lfb_write ( addr, aperture, (uint32_t) data, 4 );
       if ( _trace_enabled && _vga_mem_linear_access != NULL )
         _vga_mem_linear_access ( PC_WRITE32, aperture,
-                                 (uint32_t) (addr&VRAM_MASK),
+                                 (uint32_t) (addr&_vram_mask),
                                  (uint64_t) data, _udata );
       ret= true;
     }
@@ -1681,9 +2315,7 @@ mem_write32 (
   // VGA I/O - BitBLT control registers
   else if ( ((uint32_t) (addr&0xFFFFF000)) == _pci_regs.vga_bb_reg_base_addr )
     {
-      PC_MSGF("MEM_WRITE32 (SVGA_CIRRUS_CLGD5446"
-              " - VGA I/O -- BitBLT control registers)"
-              " addr: %016lX data: %08X",addr,data);
+      mmio_write ( addr, (uint64_t) data, 4 );
       ret= true;
     }
   
@@ -1738,10 +2370,12 @@ end_iter (void)
     {
       _timing.cc+= cc;
       _timing.cc_used+= cc;
+      _timing.cc_total+= cc;
       if ( _timing.cctoEvent && _timing.cc >= _timing.cctoEvent )
-        clock ( true );
+        svga_clock ( true );
     }
   _timing.cc_used= 0;
+  thread_poll ();
   
 } // end end_iter
 
@@ -1751,7 +2385,10 @@ set_mode_trace (
                 const bool enable
                 )
 {
+  
   _trace_enabled= enable;
+  update_lfb_map ();
+  
 } // end set_mode_trace
 
 
@@ -1759,14 +2396,18 @@ static void
 reset (void)
 {
 
-  clock ( false );
+  svga_clock ( false );
   
   // Timing.
   _timing.cctoEvent= 0;
-  _timing.vcc_tmp= 0;
+  _timing.vfrac= 0;
+  _stat.horizon= 0;
+  _stat.nreps= 0;
   
   // Rendering
-  memset ( _render.fb, 0, sizeof(_render.fb) );
+  thread_drain ();
+  memset ( _render.fb, 0,
+           ((size_t) _render.fb_width)*_render.fb_height*_render.fb_psize );
   _render.H= 0;
   _render.V= 0;
   _render.char_dots= 0;
@@ -1779,12 +2420,15 @@ reset (void)
   _render.vretrace_end= 0;
   _render.blink= false;
   _render.blink_counter= 0;
+  _render.batch_chars= 0;
+  init_damage ();
   
   // Altres
-  memset ( _vram, 0, sizeof(_vram) );
+  memset ( _vram, 0, _vram_size );
   init_pci_regs ();
   init_regs ();
   update_vclk ();
+  update_lfb_map ();
   
   update_cc_to_event ();
   
@@ -1847,6 +2491,19 @@ update_vga_mem (void)
 } // end update_vga_mem
 
 
+static void
+update_vga_mem_masks (void)
+{
+
+  _vga_mem.sr_val= PLANES_EXPAND[_regs.GR.r0.set_reset&0xF];
+  _vga_mem.sr_mask= PLANES_EXPAND[_regs.GR.r1.enable_sr&0xF];
+  _vga_mem.cc_val= PLANES_EXPAND[_regs.GR.color_compare&0xF];
+  _vga_mem.cc_mask= PLANES_EXPAND[_regs.GR.color_dont_care&0xF];
+  _vga_mem.bit_mask= ((uint32_t) _regs.GR.bit_mask)*0x01010101;
+  
+} // end update_vga_mem_masks
+
+
 static void
 misc_write (
             const uint8_t data,
@@ -1855,8 +2512,9 @@ misc_write (
             )
 {
 
-  if ( update_clock ) clock ( false );
+  if ( update_clock ) svga_clock ( false );
   
+  if ( _regs.misc.val != (data&0xEF) ) damage_regs ();
   _regs.misc.val= data&0xEF;
   _regs.misc.vertical_sync_is_high= ((data&0x80)!=0);
   PC_MSG("SVGA - MISC : Vertical Sync Polarity");
@@ -1867,6 +2525,7 @@ misc_write (
   _regs.misc.vlck_freq_ind= (data>>2)&0x3;
   _regs.misc.display_mem_enabled= ((data&0x02)!=0);
   _regs.misc.crtc_io_addr_mode_color= ((data&0x01)!=0);
+  update_lfb_map ();
   
   if ( update_vclk_ ) update_vclk ();
   
@@ -1883,8 +2542,17 @@ SR_write (
           )
 {
 
-  if ( update_clock ) clock ( false );
+  uint8_t old[sizeof(_regs.SR)];
+  bool cursor_enable;
+  int cursor_y,cursor_size;
+  
+
+  if ( update_clock ) svga_clock ( false );
   
+  memcpy ( old, &_regs.SR, sizeof(old) );
+  cursor_enable= _regs.SR.r12.cursor_enable;
+  cursor_y= _regs.SR.cursor_y;
+  cursor_size= _regs.SR.r12.cursor_size_is_32x32 ? 32 : 64;
   switch ( _regs.SR.index )
     {
     case 0x00: // Sequencer Reset
@@ -1904,6 +2572,7 @@ SR_write (
       _regs.SR.clocking_mode.shift_load= ((data>>3)&0x2) | ((data>>2)&0x1);
       PC_MSGF("SVGA - SR1 : Shift and Load: %X",
               _regs.SR.clocking_mode.shift_load);
+      update_crtc ();
       if ( update_vclk_ ) update_vclk ();
       break;
     case 0x02: // Sequencer Plane Mask
@@ -1930,6 +2599,7 @@ SR_write (
       _regs.SR.r7.linear_frame_buffer_enabled= ((data&0xF0)!=0);
       _regs.SR.r7.srt= (data>>1)&0x7;
       _regs.SR.r7.extended_display_modes_enabled= ((data&0x1)!=0);
+      update_lfb_map ();
       break;
     case 0x08: // DDC2B/EEPROM Control
       _regs.SR.r8.val= data;
@@ -1947,6 +2617,12 @@ SR_write (
       if ( update_vclk_ ) update_vclk ();
       break;
 
+    case 0x10: // Graphics Cursor X Position
+      _regs.SR.cursor_x= (((int) data)<<3) | _regs.SR.index_hi;
+      break;
+    case 0x11: // Graphics Cursor Y Position
+      _regs.SR.cursor_y= (((int) data)<<3) | _regs.SR.index_hi;
+      break;
     case 0x12: // Graphics Cursor Attribute
       _regs.SR.r12.val= data;
       _regs.SR.r12.overscan_color_protect= ((data&0x80)!=0);
@@ -1957,11 +2633,6 @@ SR_write (
       if ( _regs.SR.r12.allow_access_DAC_extended_colors )
         PC_MSG("SVGA - SR12 : Allow Access to DAC Extended Colors");
       _regs.SR.r12.cursor_enable= ((data&0x01)!=0);
-      if ( _regs.SR.r12.cursor_enable )
-        {
-          PC_MSG("SVGA - SR12 : Graphics Cursor Enable");
-          exit ( EXIT_FAILURE );
-        }
       break;
     case 0x13: // Graphics Cursor Pattern Address Offset
       _regs.SR.r13_cursor_pat_addr_off= data;
@@ -2001,6 +2672,7 @@ SR_write (
           PC_MSG("SVGA - SR17 : Enable DRAM Bank Swap");
           exit ( EXIT_FAILURE );
         }
+      update_lfb_map ();
       break;
       
     case 0x1b ... 0x1e: // VCLK Numerator
@@ -2022,6 +2694,23 @@ SR_write (
       if(update_clock)exit(EXIT_FAILURE);
     }
 
+  // Registres que afecten al que es mostra.
+  if ( memcmp ( old, &_regs.SR, sizeof(old) ) != 0 )
+    switch ( _regs.SR.index )
+      {
+      case 0x01: // Clocking Mode
+      case 0x03: // Character Map Select
+      case 0x07: // Extended Sequencer Mode
+        damage_regs ();
+        break;
+      case 0x10 ... 0x13: // Cursor gràfic
+        damage_cursor ( cursor_enable, cursor_y, cursor_size );
+        damage_cursor ( _regs.SR.r12.cursor_enable, _regs.SR.cursor_y,
+                        _regs.SR.r12.cursor_size_is_32x32 ? 32 : 64 );
+        break;
+      default: break;
+      }
+  
   if ( update_clock ) update_cc_to_event ();
   
 } // end SR_write
@@ -2036,7 +2725,7 @@ SR_read (
   uint8_t ret;
 
   
-  if ( update_clock ) clock ( true );
+  if ( update_clock ) svga_clock ( true );
 
   switch ( _regs.SR.index )
     {
@@ -2079,6 +2768,12 @@ SR_read (
       ret= _regs.SR.r15.val | 0x04;
       break;
 
+    case 0x10: // Graphics Cursor X Position
+      ret= (uint8_t) (_regs.SR.cursor_x>>3);
+      break;
+    case 0x11: // Graphics Cursor Y Position
+      ret= (uint8_t) (_regs.SR.cursor_y>>3);
+      break;
     case 0x12: // Graphics Cursor Attribute
       ret= _regs.SR.r12.val;
       break;
@@ -2118,8 +2813,12 @@ CR_write (
           )
 {
 
-  if ( update_clock ) clock ( false );
+  uint8_t old[sizeof(_regs.CR)];
+  
+  
+  if ( update_clock ) svga_clock ( false );
   
+  memcpy ( old, &_regs.CR, sizeof(old) );
   switch ( _regs.CR.index )
     {
     case 0x00: // CRTC Horizontal Total
@@ -2373,7 +3072,14 @@ CR_write (
                  _regs.CR.index,data );
       if(update_clock)exit(EXIT_FAILURE);
     }
+  update_crtc ();
 
+  // CR11 sols conté el timing del retraç vertical i els bits de la
+  // interrupció, que molts programes escriuen en cada frame.
+  if ( _regs.CR.index != 0x11 &&
+       memcmp ( old, &_regs.CR, sizeof(old) ) != 0 )
+    damage_regs ();
+  
   if ( update_clock ) update_cc_to_event ();
   
 } // end CR_write
@@ -2388,7 +3094,7 @@ CR_read (
   uint8_t ret;
 
   
-  if ( update_clock ) clock ( true );
+  if ( update_clock ) svga_clock ( true );
 
   switch ( _regs.CR.index )
     {
@@ -2515,11 +3221,8 @@ GR_write (
           const bool    update_clock
           )
 {
-
-  bool tmp;
-
-
-  if ( update_clock ) clock ( false );
+  
+  if ( update_clock ) svga_clock ( false );
   
   switch ( _regs.GR.index )
     {
@@ -2530,13 +3233,16 @@ GR_write (
                _regs.GR.r0.bg_colorb0 );
       */
       _regs.GR.r0.set_reset= data&0x0F;
+      update_vga_mem_masks ();
       break;
     case 0x01: // Set/Reset Enable / Foreground Color Byte 0
       _regs.GR.r1.fg_colorb0= data;
       _regs.GR.r1.enable_sr= data&0x0F;
+      update_vga_mem_masks ();
       break;
     case 0x02: // Color Compare
       _regs.GR.color_compare= data&0x0F;
+      update_vga_mem_masks ();
       break;
     case 0x03: // Data Rotate
       _regs.GR.data_rotate.val= data&0x1F;
@@ -2547,6 +3253,8 @@ GR_write (
       _regs.GR.read_map_select= data&0x3;
       break;
     case 0x05: // Graphics Controller Mode
+      // Sols els bits 6:5 afecten al que es mostra.
+      if ( ((_regs.GR.mode.val^data)&0x60) != 0 ) damage_regs ();
       _regs.GR.mode.val= data&0x7B;
       _regs.GR.mode.color256= ((data&0x40)!=0);
       _regs.GR.mode.shift_reg_mode_is_1= ((data&0x20)!=0);
@@ -2555,6 +3263,7 @@ GR_write (
       _regs.GR.mode.write_mode= data&0x03;
       break;
     case 0x06: // Miscellaneous
+      if ( ((_regs.GR.misc.val^data)&0x01) != 0 ) damage_regs ();
       _regs.GR.misc.val= data&0x0F;
       _regs.GR.misc.mem_map= (data>>2)&0x3;
       update_vga_mem ();
@@ -2565,9 +3274,11 @@ GR_write (
       break;
     case 0x07: // Color Don't Care
       _regs.GR.color_dont_care= data&0x0F;
+      update_vga_mem_masks ();
       break;
     case 0x08: // Bit Mask
       _regs.GR.bit_mask= data;
+      update_vga_mem_masks ();
       break;
     case 0x09: // Offset Register 0
       _regs.GR.offset0= data;
@@ -2602,25 +3313,11 @@ GR_write (
                  data );
       break;
       
-    case 0x31: // BLST Start/Status
-      _regs.GR.r49.val= data&0xE6;
-      _regs.GR.r49.enable_autostart= ((data&0x80)!=0);
-      if ( _regs.GR.r49.enable_autostart )
-        PC_MSG("SVGA - GR31 : Enable Autostart");
-      _regs.GR.r49.use_system_source_location= ((data&0x40)!=0);
-      if ( _regs.GR.r49.use_system_source_location )
-        PC_MSG("SVGA - GR31 : System Source Location");
-      _regs.GR.r49.pause= ((data&0x20)!=0);
-      if ( _regs.GR.r49.pause )
-        PC_MSG("SVGA - GR31 : Pause");
-      tmp= ((data&0x04)!=0);
-      if ( !_regs.GR.r49.blt_reset && tmp )
-        PC_MSG("SVGA - GR31 : BLT Reset !!!!!");
-      _regs.GR.r49.blt_reset= tmp;
-      tmp= ((data&0x02)!=0);
-      if ( !_regs.GR.r49.blt_start && tmp )
-        PC_MSG("SVGA - GR31 : BLT Start !!!!!");
-      _regs.GR.r49.blt_start= tmp;
+    case 0x10 ... 0x15: // Background/Foreground Color Byte 1-3
+    case 0x20 ... 0x2a: // BLT Width,Height,Pitch,Destination Start
+    case 0x2c ... 0x35: // BLT Source Start,Mode,ROP,Transparent Color
+    case 0x38 ... 0x39: // BLT Transparent Color Mask
+      blt_reg_write ( _regs.GR.index, data );
       break;
       
     default:
@@ -2643,7 +3340,7 @@ GR_read (
   uint8_t ret;
 
   
-  if ( update_clock ) clock ( true );
+  if ( update_clock ) svga_clock ( true );
 
   switch ( _regs.GR.index )
     {
@@ -2684,9 +3381,11 @@ GR_read (
       ret= _regs.GR.rb.val;
       break;
       
-    case 0x31: // BLT Start/Status
-      ret= _regs.GR.r49.val;
-      PC_MSG("BLT Start/Status - Falta Buffered Register Status,BLT Status,BLT Start");
+    case 0x10 ... 0x15: // Background/Foreground Color Byte 1-3
+    case 0x20 ... 0x2a: // BLT Width,Height,Pitch,Destination Start
+    case 0x2c ... 0x35: // BLT Source Start,Mode,ROP,Transparent Color
+    case 0x38 ... 0x39: // BLT Transparent Color Mask
+      ret= blt_reg_read ( _regs.GR.index );
       break;
       
     default:
@@ -2707,19 +3406,25 @@ AR_write (
           )
 {
 
-  if ( update_clock ) clock ( false );
+  uint8_t old[sizeof(_regs.AR)];
+  
+  
+  if ( update_clock ) svga_clock ( false );
   
   if ( _regs.AR.mode_data )
     {
       _regs.AR.index= data&0x1F;
+      if ( _regs.AR.display_enabled != ((data&0x20)!=0) ) damage_regs ();
       _regs.AR.display_enabled= ((data&0x20)!=0);
     }
   else
     {
+      memcpy ( old, &_regs.AR, sizeof(old) );
       switch ( _regs.AR.index )
         {
         case 0x00 ... 0x0F: // Attribute Controller Palette
           _regs.AR.pal[_regs.AR.index]= data&0x3F;
+          _render.ar_pal_dirty= true;
           break;
         case 0x10: // Attribute Controller Mode
           _regs.AR.attr_ctrl_mode.val= data&0xEF;
@@ -2767,6 +3472,7 @@ AR_write (
                     _regs.AR.index,data );
           if(update_clock)exit(EXIT_FAILURE);
         }
+      if ( memcmp ( old, &_regs.AR, sizeof(old) ) != 0 ) damage_regs ();
     }
   _regs.AR.mode_data= !_regs.AR.mode_data;
 
@@ -2784,7 +3490,7 @@ AR_read (
   uint8_t ret;
 
   
-  if ( update_clock ) clock ( true );
+  if ( update_clock ) svga_clock ( true );
   
   if ( _regs.AR.mode_data )
     ret= _regs.AR.index | (_regs.AR.display_enabled ? 0x20 : 0x00);
@@ -2830,11 +3536,12 @@ pixel_mask_write (
                   )
 {
 
-  if ( update_clock ) clock ( false );
+  if ( update_clock ) svga_clock ( false );
 
   if ( _regs.hdr.counter == 4 )
     {
       _regs.hdr.counter= 0;
+      if ( _regs.hdr.val != data ) damage_regs ();
       _regs.hdr.val= data;
       _regs.hdr.mode_555_enabled= ((data&0x80)!=0);
       _regs.hdr.all_ext_modes_enabled= ((data&0x40)!=0);
@@ -2844,8 +3551,10 @@ pixel_mask_write (
     }
   else
     {
+      if ( _regs.pixel_mask != data ) damage_regs ();
       _regs.pixel_mask= data;
       _regs.hdr.counter= 0;
+      _render.pal_dirty= true;
     }
 
   if ( update_clock ) update_cc_to_event ();
@@ -2862,7 +3571,7 @@ pixel_mask_read (
   uint8_t ret;
 
   
-  if ( update_clock ) clock ( true );
+  if ( update_clock ) svga_clock ( true );
 
   if ( _regs.hdr.counter == 4 )
     {
@@ -2880,35 +3589,111 @@ pixel_mask_read (
 } // end pixel_mask_read
 
 
+// Es crida just després de posar al dia el renderitzador. 'now' és
+// el cicle absolut actual.
+static void
+stat_update (
+             const uint64_t now
+             )
+{
+
+  int end_scanline,next_event_hblank,next_event_hretrace,dots;
+  uint64_t tmp;
+  
+
+  _stat.val=
+    (_render.in_vretrace ? 0x08 : 0x00) | // Vertical Retrace
+    ((_render.in_hblank || _render.in_vblank) ? 0x01 : 0x00) // Display Enable
+    ;
+  _stat.pixel_bus= _render.pixel_bus;
+
+  // Cicles fins al següent event. Com la fracció de dot es conserva
+  // (vfrac) no depén de com es repartisquen els cicles entre crides a
+  // svga_clock.
+  dots=
+    (calc_next_event_H ( &end_scanline, &next_event_hblank,
+                         &next_event_hretrace ) - _render.H) *
+    _crtc.dotsperchar - _render.char_dots;
+  tmp= (((uint64_t) dots)<<32) - _timing.vfrac;
+  _stat.horizon= now + (tmp + _timing.dpc-1)/_timing.dpc;
+  
+} // end stat_update
+
+
+// Si el programa està en un bucle que sols llig el registre d'estat
+// avança el rellotge fins a l'última lectura que tornaria el mateix
+// valor. Mai passa de PC_NextEventCC, per tant cap altre dispositiu
+// canvia d'estat en els cicles botats. No és precís si el bucle fa
+// alguna cosa més (per exemple comptar iteracions).
+static void
+stat_fast_forward (
+                   const uint64_t now,
+                   const uint8_t  val
+                   )
+{
+
+  uint64_t period,skip;
+  int max;
+  
+  
+  // Detecta el bucle.
+  period= now - _stat.last_cc;
+  if ( val == _stat.last_ret && period == _stat.period &&
+       period > 0 && period <= POLL_MAX_PERIOD )
+    {
+      if ( _stat.nreps < POLL_MIN_REPS ) ++_stat.nreps;
+    }
+  else _stat.nreps= 0;
+  _stat.last_cc= now;
+  _stat.period= period;
+  _stat.last_ret= val;
+  if ( _stat.nreps < POLL_MIN_REPS || _stat.horizon <= now ) return;
+
+  // Bota iteracions.
+  skip= (_stat.horizon-now-1)/period;
+  max= (PC_NextEventCC-1-PC_Clock)/((int) period);
+  if ( max <= 0 || skip == 0 ) return;
+  if ( skip > (uint64_t) max ) skip= (uint64_t) max;
+  PC_Clock+= (int) (skip*period);
+  _stat.last_cc+= skip*period;
+  
+} // end stat_fast_forward
+
+
 static uint8_t
 stat_read (void)
 {
 
   uint8_t ret,mux;
+  uint64_t now;
   
   
-  clock ( true );
-
+  now= _timing.cc_total + (uint64_t) (PC_Clock-_timing.cc_used);
+  if ( now >= _stat.horizon )
+    {
+      svga_clock ( true );
+      render_flush (); // pixel_bus
+      stat_update ( now );
+    }
+  
   switch ( _regs.AR.color_plane.video_status_mux )
     {
-    case 0: mux= (_render.pixel_bus&0x1)|((_render.pixel_bus>>1)&0x2); break;
-    case 1: mux= (_render.pixel_bus>>4)&0x3; break;
+    case 0: mux= (_stat.pixel_bus&0x1)|((_stat.pixel_bus>>1)&0x2); break;
+    case 1: mux= (_stat.pixel_bus>>4)&0x3; break;
     case 2:
-      mux= ((_render.pixel_bus>>1)&0x1)|((_render.pixel_bus>>2)&0x2);
+      mux= ((_stat.pixel_bus>>1)&0x1)|((_stat.pixel_bus>>2)&0x2);
       break;
-    case 3: mux= (_render.pixel_bus>>6)&0x3; break;
+    case 3: mux= (_stat.pixel_bus>>6)&0x3; break;
     default:
       fprintf ( stderr, "WTF - stat_read\n" );
       exit ( EXIT_FAILURE );
     }
-  ret=
-    (mux<<4) | // Diagnostic
-    (_render.in_vretrace ? 0x08 : 0x00) | // Vertical Retrace
-    ((_render.in_hblank || _render.in_vblank) ? 0x01 : 0x00) // Display Enable
-    ;
+  ret= (mux<<4) | _stat.val; // Diagnostic
   
   // NOTA!!! Açò ho he deduit de la BIOS però on està clar!!!
   _regs.AR.mode_data= true;
+
+  if ( _stat.fast_retrace ) stat_fast_forward ( now, ret );
   
   return ret;
   
@@ -2923,20 +3708,33 @@ dac_data_write (
 
   int i;
   uint8_t tmp;
+  bool changed;
   
 
-  clock ( false );
+  svga_clock ( false );
   _dac.buffer_w[_dac.buffer_w_off++]= data;
-  if ( _dac.buffer_w_off == 3 )
+  if ( _dac.buffer_w_off == 3 && _regs.SR.r12.allow_access_DAC_extended_colors )
+    {
+      if ( memcmp ( _dac.ext[_dac.addr_w&0xF], _dac.buffer_w, 3 ) != 0 )
+        damage_regs ();
+      memcpy ( _dac.ext[_dac.addr_w&0xF], _dac.buffer_w, 3 );
+      _dac.buffer_w_off= 0;
+      ++_dac.addr_w;
+    }
+  else if ( _dac.buffer_w_off == 3 )
     {
 
       // NOTA!!! No entenc si el pixel_mask funciona així !!!!!
+      changed= false;
       for ( i= 0; i < 3; ++i )
         {
           tmp= _dac.v[_dac.addr_w][i];
           _dac.v[_dac.addr_w][i]=
             (tmp&(~_regs.pixel_mask)) | (_dac.buffer_w[i]&_regs.pixel_mask);
+          if ( _dac.v[_dac.addr_w][i] != tmp ) changed= true;
         }
+      if ( changed ) damage_regs ();
+      _render.pal_dirty= true;
       _dac.buffer_w_off= 0;
       ++_dac.addr_w;
     }
@@ -2954,15 +3752,18 @@ dac_data_read (void)
   uint8_t ret;
   
 
-  clock ( true );
+  svga_clock ( true );
   
   ret= _dac.buffer_r[_dac.buffer_r_off++];
   if ( _dac.buffer_r_off == 3 )
     {
       // NOTA!!! No entenc si el pixel_mask funciona així !!!!!
       ++_dac.addr_r;
-      for ( i= 0; i < 3; ++i )
-        _dac.buffer_r[i]= _dac.v[_dac.addr_r][i]&_regs.pixel_mask;
+      if ( _regs.SR.r12.allow_access_DAC_extended_colors )
+        memcpy ( _dac.buffer_r, _dac.ext[_dac.addr_r&0xF], 3 );
+      else
+        for ( i= 0; i < 3; ++i )
+          _dac.buffer_r[i]= _dac.v[_dac.addr_r][i]&_regs.pixel_mask;
       _dac.buffer_r_off= 0;
     }
 
@@ -2977,7 +3778,7 @@ dac_addr_w_write (
                   )
 {
   
-  clock ( false );
+  svga_clock ( false );
   
   _dac.buffer_w_off= 0;
   _dac.addr_w= data;
@@ -2996,13 +3797,16 @@ dac_addr_r_write (
   int i;
   
   
-  clock ( false );
+  svga_clock ( false );
   
   _dac.buffer_r_off= 0;
   _dac.addr_r= data;
   // NOTA!! no sé si pixel_mask funciona així.
-  for ( i= 0; i < 3; ++i )
-    _dac.buffer_r[i]= _dac.v[_dac.addr_r][i]&_regs.pixel_mask;
+  if ( _regs.SR.r12.allow_access_DAC_extended_colors )
+    memcpy ( _dac.buffer_r, _dac.ext[_dac.addr_r&0xF], 3 );
+  else
+    for ( i= 0; i < 3; ++i )
+      _dac.buffer_r[i]= _dac.v[_dac.addr_r][i]&_regs.pixel_mask;
 
   update_cc_to_event ();
   
@@ -3047,86 +3851,98 @@ mem_addr2xma (
 } // mem_addr2xma
 
 
+// Desa en els planols seleccionats el byte corresponent de 'val'.
 static void
-vga_mem_write_mode0 (
-                     const uint16_t offset,
-                     const uint8_t  plane_sel,
-                     const uint8_t  data
-                     )
+vga_mem_store (
+               const uint16_t offset,
+               const uint8_t  planes,
+               const uint32_t val
+               )
 {
 
-  uint8_t val,planes,sr_mask,sr_val,tmp_val;
-  int shift,i;
+  int i;
+  uint8_t tmp_val;
   
   
-  // Rota el valor
-  if ( _regs.GR.data_rotate.count > 0 )
+  for ( i= 0; i < 4; ++i )
+    if ( planes&(1<<i) )
+      {
+        tmp_val= (uint8_t) (val>>(8*i));
+        _vga_mem.p[i][offset]= tmp_val;
+        if ( _trace_enabled && _vga_mem_access != NULL )
+          _vga_mem_access ( false, i, (uint32_t) offset, tmp_val, _udata );
+      }
+  
+} // end vga_mem_store
+
+
+// Aplica la funció lògica (GR3) amb els latches i la màscara de bits
+// (GR8).
+static uint32_t
+vga_mem_alu (
+             uint32_t val
+             )
+{
+
+  switch ( _regs.GR.data_rotate.func )
     {
-      shift= _regs.GR.data_rotate.count;
-      val= (data>>shift) | (data<<(8-shift));
+    case 0: break;
+    case 1: val&= _vga_mem.latch; break;
+    case 2: val|= _vga_mem.latch; break;
+    case 3: val^= _vga_mem.latch; break;
     }
-  else val= data;
+  
+  return (val&_vga_mem.bit_mask) | (_vga_mem.latch&~_vga_mem.bit_mask);
+  
+} // end vga_mem_alu
 
-  // Intenta desar en tots els plans
-  planes= plane_sel&_regs.SR.plane_mask;
-  sr_val= _regs.GR.r0.set_reset;
-  sr_mask= _regs.GR.r1.enable_sr;
-  for ( i= 0; i < 4; ++i )
+
+static uint8_t
+vga_mem_rotate (
+                const uint8_t data
+                )
+{
+
+  int shift;
+
+  
+  if ( _regs.GR.data_rotate.count > 0 )
     {
-      if ( planes&0x1 )
-        {
-          if ( sr_mask&0x1 ) tmp_val= sr_val&0x1 ? 0xff : 0x00;
-          else               tmp_val= val;
-          switch ( _regs.GR.data_rotate.func )
-            {
-            case 0: break;
-            case 1: tmp_val&= _vga_mem.latch[i]; break;
-            case 2: tmp_val|= _vga_mem.latch[i]; break;
-            case 3: tmp_val^= _vga_mem.latch[i]; break;
-            default:
-              printf("[EE] vga_mem_write_mode0 - WTF!!!\n");
-              exit(EXIT_FAILURE);
-            }
-          tmp_val=
-            (tmp_val&_regs.GR.bit_mask) |
-            (_vga_mem.latch[i]&(~_regs.GR.bit_mask));
-          _vga_mem.p[i][offset]= tmp_val;
-          if ( _trace_enabled && _vga_mem_access != NULL )
-            _vga_mem_access ( false, i, (uint32_t) offset, tmp_val, _udata );
-        }
-      planes>>= 1;
-      sr_mask>>= 1; sr_val>>= 1;
+      shift= _regs.GR.data_rotate.count;
+      return (uint8_t) ((data>>shift) | (data<<(8-shift)));
     }
+  else return data;
   
-} // end vga_mem_write_mode0
+} // end vga_mem_rotate
 
 
 static void
-vga_mem_write_mode1 (
+vga_mem_write_mode0 (
                      const uint16_t offset,
                      const uint8_t  plane_sel,
                      const uint8_t  data
                      )
 {
-  
-  uint8_t planes,tmp_val;
-  int i;
+
+  uint32_t val;
   
   
-  // Intenta desar en tots els plans
-  planes= plane_sel&_regs.SR.plane_mask;
-  for ( i= 0; i < 4; ++i )
-    {
-      if ( planes&0x1 )
-        {
-          tmp_val= _vga_mem.latch[i];
-          _vga_mem.p[i][offset]= tmp_val;
-          if ( _trace_enabled && _vga_mem_access != NULL )
-            _vga_mem_access ( false, i, (uint32_t) offset, tmp_val, _udata );
-        }
-      planes>>= 1;
-    }
+  val= ((uint32_t) vga_mem_rotate ( data ))*0x01010101;
+  val= (val&~_vga_mem.sr_mask) | (_vga_mem.sr_val&_vga_mem.sr_mask);
+  vga_mem_store ( offset, plane_sel&_regs.SR.plane_mask,
+                  vga_mem_alu ( val ) );
   
+} // end vga_mem_write_mode0
+
+
+static void
+vga_mem_write_mode1 (
+                     const uint16_t offset,
+                     const uint8_t  plane_sel,
+                     const uint8_t  data
+                     )
+{
+  vga_mem_store ( offset, plane_sel&_regs.SR.plane_mask, _vga_mem.latch );
 } // end vga_mem_write_mode1
 
 
@@ -3137,40 +3953,8 @@ vga_mem_write_mode2 (
                      const uint8_t  data
                      )
 {
-  
-  uint8_t planes,tmp_val,val;
-  int i;
-  
-  
-  // Intenta desar en tots els plans
-  planes= plane_sel&_regs.SR.plane_mask;
-  val= data;
-  for ( i= 0; i < 4; ++i )
-    {
-      if ( planes&0x1 )
-        {
-          tmp_val= (val&0x1)!=0 ? 0xff: 0x00;
-          switch ( _regs.GR.data_rotate.func )
-            {
-            case 0: break;
-            case 1: tmp_val&= _vga_mem.latch[i]; break;
-            case 2: tmp_val|= _vga_mem.latch[i]; break;
-            case 3: tmp_val^= _vga_mem.latch[i]; break;
-            default:
-              printf("[EE] vga_mem_write_mode2 - WTF!!!\n");
-              exit(EXIT_FAILURE);
-            }
-          tmp_val=
-            (tmp_val&_regs.GR.bit_mask) |
-            (_vga_mem.latch[i]&(~_regs.GR.bit_mask));
-          _vga_mem.p[i][offset]= tmp_val;
-          if ( _trace_enabled && _vga_mem_access != NULL )
-            _vga_mem_access ( false, i, (uint32_t) offset, tmp_val, _udata );
-        }
-      planes>>= 1;
-      val>>= 1;
-    }
-  
+  vga_mem_store ( offset, plane_sel&_regs.SR.plane_mask,
+                  vga_mem_alu ( PLANES_EXPAND[data&0xF] ) );
 } // end vga_mem_write_mode2
 
 
@@ -3182,37 +3966,14 @@ vga_mem_write_mode3 (
                      )
 {
   
-  uint8_t val,bit_mask,sr_val,planes,tmp_val;
-  int shift,i;
+  uint32_t bit_mask;
   
   
-  // Rota el valor i calcula bitmask
-  if ( _regs.GR.data_rotate.count > 0 )
-    {
-      shift= _regs.GR.data_rotate.count;
-      val= (data>>shift) | (data<<(8-shift));
-    }
-  else val= data;
-  bit_mask= val&_regs.GR.bit_mask;
-
-  // Intenta desar en tots els plans
-  planes= plane_sel&_regs.SR.plane_mask;
-  sr_val= _regs.GR.r0.set_reset;
-  for ( i= 0; i < 4; ++i )
-    {
-      if ( planes&0x1 )
-        {
-          tmp_val= sr_val&0x1 ? 0xff : 0x00;
-          tmp_val=
-            (tmp_val&bit_mask) |
-            (_vga_mem.latch[i]&(~bit_mask));
-          _vga_mem.p[i][offset]= tmp_val;
-          if ( _trace_enabled && _vga_mem_access != NULL )
-            _vga_mem_access ( false, i, (uint32_t) offset, tmp_val, _udata );
-        }
-      planes>>= 1;
-      sr_val>>= 1;
-    }
+  bit_mask=
+    ((uint32_t) (vga_mem_rotate ( data )&_regs.GR.bit_mask))*0x01010101;
+  vga_mem_store ( offset, plane_sel&_regs.SR.plane_mask,
+                  (_vga_mem.sr_val&bit_mask) |
+                  (_vga_mem.latch&~bit_mask) );
   
 } // end vga_mem_write_mode3
 
@@ -3227,6 +3988,7 @@ vga_mem_write_basic (
   uint64_t tmp;
   uint16_t offset;
   uint8_t plane_sel;
+  int i;
   
   
   // Descodifica adreça.
@@ -3252,6 +4014,9 @@ vga_mem_write_basic (
     }
   
   // Escriu
+  for ( i= 0; i < 4; ++i )
+    if ( plane_sel&(1<<i) )
+      damage_before_write ( ((uint32_t) i)*64*1024 + offset, 1 );
   switch ( _regs.GR.mode.write_mode )
     {
     case 0: vga_mem_write_mode0 ( offset, plane_sel, data ); break;
@@ -3263,6 +4028,9 @@ vga_mem_write_basic (
              _regs.GR.mode.write_mode);
       exit(EXIT_FAILURE);
     }
+  for ( i= 0; i < 4; ++i )
+    if ( plane_sel&(1<<i) )
+      damage_mark ( ((uint32_t) i)*64*1024 + offset );
   
 } // end vga_mem_write_basic
 
@@ -3280,9 +4048,11 @@ vga_mem_write_extended (
   // NOTA!! Açò caldria fer-ho també si la memòria extenguda no està
   // activada?
   xma= mem_addr2xma ( mem_addr );
-  _vram[xma&VRAM_MASK]= data;
+  damage_before_write ( xma, 1 );
+  _vram[xma&_vram_mask]= data;
+  damage_mark ( xma );
   if ( _trace_enabled && _vga_mem_access != NULL )
-    _vga_mem_access ( false, -1, xma&VRAM_MASK, data, _udata );
+    _vga_mem_access ( false, -1, xma&_vram_mask, data, _udata );
   
 } // end vga_mem_write_extended
 
@@ -3316,11 +4086,12 @@ vga_mem_read_basic (
                     )
 {
 
-  int i,plane;
+  int plane;
   uint64_t tmp;
   uint16_t offset;
   //uint8_t plane_sel;
-  uint8_t ret,tmp8;
+  uint8_t ret;
+  uint32_t diff;
   
   
   // NOTA!!! No està gens clar com es selecciona el plane en modo
@@ -3356,32 +4127,25 @@ vga_mem_read_basic (
 
   // NOTA!!! No tinc gens clar si el latch registre com funciona. De
   // moment interprete que de tots els planols es llig un byte.
-  for ( i= 0; i < 4; ++i )
-    _vga_mem.latch[i]= _vga_mem.p[i][offset];
+  _vga_mem.latch=
+    ((uint32_t) _vga_mem.p[0][offset]) |
+    (((uint32_t) _vga_mem.p[1][offset])<<8) |
+    (((uint32_t) _vga_mem.p[2][offset])<<16) |
+    (((uint32_t) _vga_mem.p[3][offset])<<24);
   
   // Llig
   if ( _regs.GR.mode.read_mode1 )
     {
-      ret= 0;
-      for ( i= 0; i < 8; ++i )
-        {
-          ret<<= 1;
-          tmp8=
-            (((_vga_mem.latch[0]<<i)&0x80)>>7) |
-            (((_vga_mem.latch[1]<<i)&0x80)>>6) |
-            (((_vga_mem.latch[2]<<i)&0x80)>>5) |
-            (((_vga_mem.latch[3]<<i)&0x80)>>4);
-          ret|=
-            ((tmp8&_regs.GR.color_dont_care) ==
-             (_regs.GR.color_compare&_regs.GR.color_dont_care));
-        }
+      // Un bit és 1 si en cap planol considerat difereix del color.
+      diff= (_vga_mem.latch^_vga_mem.cc_val)&_vga_mem.cc_mask;
+      ret= (uint8_t) ~(diff | (diff>>8) | (diff>>16) | (diff>>24));
       if ( _trace_enabled && _vga_mem_access != NULL )
         _vga_mem_access ( true, 0xff, (uint32_t) offset, ret, _udata );
     }
   else // MODE 0
     {
       // NOTA!!! En mode0 no es gasta el plane_sel. Es gasta read_map_select
-      ret= _vga_mem.latch[plane];
+      ret= (uint8_t) (_vga_mem.latch>>(8*plane));
       if ( _trace_enabled && _vga_mem_access != NULL )
         _vga_mem_access ( true, plane, (uint32_t) offset, ret, _udata );
     }
@@ -3404,9 +4168,9 @@ vga_mem_read_extended (
   // NOTA!! Açò caldria fer-ho també si la memòria extenguda no està
   // activada?
   xma= mem_addr2xma ( addr );
-  ret= _vram[xma&VRAM_MASK];
+  ret= _vram[xma&_vram_mask];
   if ( _trace_enabled && _vga_mem_access != NULL )
-    _vga_mem_access ( true, -1, xma&VRAM_MASK, ret, _udata );
+    _vga_mem_access ( true, -1, xma&_vram_mask, ret, _udata );
   
   return ret;
   
@@ -3441,102 +4205,765 @@ vga_mem_read (
 
 
 static void
-init_pci_regs (void)
+blt_read_vram (
+               uint8_t        *dst,
+               const uint32_t  addr,
+               const int       n
+               )
 {
 
-  _pci_regs.pcicmd= 0x0000;
-  _pci_regs.disp_mem_base_addr= 0x00000000;
-  _pci_regs.vga_bb_reg_base_addr= 0x00000000;
-  _pci_regs.erom= 0x00000000;
-  _pci_regs.intln= 0x00;
+  uint32_t a;
+  int n1;
   
-} // end init_pci_regs
+  
+  a= addr&_vram_mask;
+  if ( a + n <= _vram_size ) memcpy ( dst, &_vram[a], n );
+  else
+    {
+      n1= _vram_size-a;
+      memcpy ( dst, &_vram[a], n1 );
+      memcpy ( dst+n1, &_vram[0], n-n1 );
+    }
+  
+} // end blt_read_vram
 
 
 static void
-init_dac (void)
+blt_write_vram (
+                const uint32_t  addr,
+                const uint8_t  *src,
+                const int       n
+                )
 {
+
+  uint32_t a;
+  int n1;
   
-  memset ( _dac.v, 0, sizeof(_dac.v) );
-  _dac.addr_w= 0;
-  _dac.addr_r= 0;
-  _dac.buffer_w_off= 0;
-  memset ( _dac.buffer_w, 0, sizeof(_dac.buffer_w) );
-    _dac.buffer_r_off= 0;
-  memset ( _dac.buffer_r, 0, sizeof(_dac.buffer_r) );
   
-} // end init_dac
+  a= addr&_vram_mask;
+  if ( a + n <= _vram_size ) memcpy ( &_vram[a], src, n );
+  else
+    {
+      n1= _vram_size-a;
+      memcpy ( &_vram[a], src, n1 );
+      memcpy ( &_vram[0], src+n1, n-n1 );
+    }
+  
+} // end blt_write_vram
 
 
+// Aplica la ROP del BitBLT a tota una fila. Si 'm' no és NULL sols
+// s'escriuen els bytes amb m[i]!=0.
+#define ROP_LOOP(EXPR)                                                  \
+  if ( m == NULL )                                                      \
+    for ( i= 0; i < n; ++i ) d[i]= (uint8_t) (EXPR);                    \
+  else                                                                  \
+    for ( i= 0; i < n; ++i )                                            \
+      if ( m[i] ) d[i]= (uint8_t) (EXPR);                               \
+  break
 static void
-init_vga_mem (void)
+blt_apply_rop (
+               uint8_t       *d,
+               const uint8_t *s,
+               const uint8_t *m,
+               const int      n
+               )
 {
 
   int i;
+  
+  
+  switch ( _blt.rop )
+    {
+    case 0x00: ROP_LOOP(0x00); // 0
+    case 0x05: ROP_LOOP(s[i]&d[i]); // S AND D
+    case 0x06: break; // D
+    case 0x09: ROP_LOOP(s[i]&~d[i]); // S AND NOT D
+    case 0x0b: ROP_LOOP(~d[i]); // NOT D
+    case 0x0d: // S
+      if ( m == NULL ) memcpy ( d, s, n );
+      else
+        for ( i= 0; i < n; ++i )
+          if ( m[i] ) d[i]= s[i];
+      break;
+    case 0x0e: ROP_LOOP(0xff); // 1
+    case 0x50: ROP_LOOP(~s[i]&d[i]); // NOT S AND D
+    case 0x59: ROP_LOOP(s[i]^d[i]); // S XOR D
+    case 0x6d: ROP_LOOP(s[i]|d[i]); // S OR D
+    case 0x90: ROP_LOOP(~(s[i]|d[i])); // NOT S AND NOT D
+    case 0x95: ROP_LOOP(~(s[i]^d[i])); // NOT (S XOR D)
+    case 0xad: ROP_LOOP(s[i]|~d[i]); // S OR NOT D
+    case 0xd0: ROP_LOOP(~s[i]); // NOT S
+    case 0xd6: ROP_LOOP(~s[i]|d[i]); // NOT S OR D
+    case 0xda: ROP_LOOP(~(s[i]&d[i])); // NOT S OR NOT D
+    default:
+      _warning ( _udata,
+                 "PCI:CLGD5446.BitBLT: ROP desconeguda %02X,"
+                 " s'empra SRC\n", _blt.rop );
+      _blt.rop= 0x0d;
+      blt_apply_rop ( d, s, m, n );
+    }
+  
+} // end blt_apply_rop
+#undef ROP_LOOP
 
 
-  for ( i= 0; i < 4; ++i )
-    _vga_mem.p[i]= &_vram[i*64*1024];
-  memset ( _vga_mem.latch, 0, sizeof(_vga_mem.latch) );
-  update_vga_mem ();
+static void
+blt_put_color (
+               uint8_t        *p,
+               const uint32_t  color
+               )
+{
+
+  switch ( _blt.bpp )
+    {
+    case 4: p[3]= (uint8_t) (color>>24); // fall through
+    case 3: p[2]= (uint8_t) (color>>16); // fall through
+    case 2: p[1]= (uint8_t) (color>>8); // fall through
+    default: p[0]= (uint8_t) color;
+    }
   
-} // end init_vga_mem
+} // end blt_put_color
+
+
+// Prepara en _blt.srow la fila actual a partir de les dades font
+// 'src' (no s'empra amb patrons). Torna cert si cal aplicar la
+// màscara de transparència _blt.mrow.
+static bool
+blt_build_row (
+               const uint8_t *src
+               )
+{
+
+  const uint8_t *line;
+  uint8_t mode,pat_line,bit,xor,key_mask0,key_mask1,key0,key1;
+  int k,npix,stride,bpp;
+  bool transp;
+  
+  
+  mode= _regs.GR.blt.mode;
+  bpp= _blt.bpp;
+  npix= _blt.width/bpp;
+  
+  // Expansió de color.
+  if ( mode&BLTMODE_COLOREXPAND )
+    {
+      if ( (mode&BLTMODE_PATTERNCOPY) &&
+           (_regs.GR.blt.mode_ext&BLTMODEEXT_SOLIDFILL) )
+        {
+          for ( k= _blt.pixel_skip; k < npix; ++k )
+            blt_put_color ( &_blt.srow[k*bpp], _blt.fg );
+          return false;
+        }
+      pat_line= _blt.pat[(_blt.pat_y+_blt.row)&0x7];
+      transp= ((mode&BLTMODE_TRANSPARENTCOMP)!=0);
+      xor= (transp && (_regs.GR.blt.mode_ext&BLTMODEEXT_COLOREXPINV)) ?
+        0x1 : 0x0;
+      for ( k= _blt.pixel_skip; k < npix; ++k )
+        {
+          if ( mode&BLTMODE_PATTERNCOPY )
+            bit= (pat_line>>(7-(k&0x7)))&0x1;
+          else
+            bit= (src[k>>3]>>(7-(k&0x7)))&0x1;
+          bit^= xor;
+          if ( transp )
+            {
+              memset ( &_blt.mrow[k*bpp], bit, bpp );
+              if ( bit ) blt_put_color ( &_blt.srow[k*bpp], _blt.fg );
+            }
+          else
+            blt_put_color ( &_blt.srow[k*bpp], bit ? _blt.fg : _blt.bg );
+        }
+      return transp;
+    }
+
+  // Patró de color.
+  else if ( mode&BLTMODE_PATTERNCOPY )
+    {
+      stride= bpp==3 ? 32 : 8*bpp;
+      line= &_blt.pat[((_blt.pat_y+_blt.row)&0x7)*stride];
+      for ( k= _blt.pixel_skip; k < npix; ++k )
+        memcpy ( &_blt.srow[k*bpp], &line[(k&0x7)*bpp], bpp );
+      return false;
+    }
+
+  // Còpia.
+  else
+    {
+      if ( src != _blt.srow ) memcpy ( _blt.srow, src, _blt.width );
+      if ( !(mode&BLTMODE_TRANSPARENTCOMP) || bpp > 2 ) return false;
+      key0= (uint8_t) (_regs.GR.blt.transp_color&0xFF);
+      key1= (uint8_t) (_regs.GR.blt.transp_color>>8);
+      key_mask0= (uint8_t) ~(_regs.GR.blt.transp_mask&0xFF);
+      key_mask1= (uint8_t) ~(_regs.GR.blt.transp_mask>>8);
+      if ( bpp == 1 )
+        for ( k= 0; k < npix; ++k )
+          _blt.mrow[k]= ((_blt.srow[k]^key0)&key_mask0)!=0;
+      else
+        for ( k= 0; k < npix; ++k )
+          _blt.mrow[2*k]= _blt.mrow[2*k+1]=
+            ((_blt.srow[2*k]^key0)&key_mask0)!=0 ||
+            ((_blt.srow[2*k+1]^key1)&key_mask1)!=0;
+      return true;
+    }
+  
+} // end blt_build_row
 
 
+// Processa una fila i avança a la següent.
 static void
-init_regs (void)
+blt_do_row (
+            const uint8_t *src
+            )
 {
 
-  init_dac ();
-  misc_write ( 0x00, false, false );
-  pixel_mask_write ( 0xff, false );
-  pixel_mask_read ( false );
-  pixel_mask_read ( false );
-  pixel_mask_read ( false );
-  pixel_mask_read ( false );
-  pixel_mask_write ( 0x00, false );
-  _regs.SR.index= 0; SR_write ( 0x03, false, false );
-  _regs.SR.index= 1; SR_write ( 0x00, false, false );
-  _regs.SR.index= 2; SR_write ( 0x00, false, false );
-  _regs.SR.index= 3; SR_write ( 0x00, false, false );
-  _regs.SR.index= 4; SR_write ( 0x00, false, false );
-  _regs.SR.index= 6; SR_write ( 0x0f, false, false );
-  _regs.SR.index= 7; SR_write ( 0x00, false, false );
-  _regs.SR.index= 8; SR_write ( 0x00, false, false );
-  _regs.SR.index= 0x9; SR_write ( 0x00, false, false );
-  _regs.SR.index= 0xa; SR_write ( 0x00, false, false );
-  _regs.SR.index= 0xb; SR_write ( 0x66, false, false );
-  _regs.SR.index= 0xc; SR_write ( 0x5b, false, false );
-  _regs.SR.index= 0xd; SR_write ( 0x45, false, false );
-  _regs.SR.index= 0xe; SR_write ( 0x7e, false, false );
-  _regs.SR.index= 0xf; SR_write ( 0x00, false, false );
-  _regs.SR.index= 0x12; SR_write ( 0x00, false, false ); // Default 0x00 ???
-  _regs.SR.index= 0x13; SR_write ( 0x00, false, false ); // Default 0x00 ???
-  _regs.SR.index= 0x14; SR_write ( 0x00, false, false );
-  _regs.SR.index= 0x15; SR_write ( 0x00, false, false );
-  _regs.SR.index= 0x1b; SR_write ( 0x3b, false, false );
-  _regs.SR.index= 0x1c; SR_write ( 0x2f, false, false );
-  _regs.SR.index= 0x1d; SR_write ( 0x30, false, false );
-  _regs.SR.index= 0x1e; SR_write ( 0x33, false, false );
-  _regs.SR.index= 0;
-  _regs.GR.index= 0x00; GR_write ( 0x00, false );
-  _regs.GR.index= 0x01; GR_write ( 0x00, false );
-  _regs.GR.index= 0x02; GR_write ( 0x00, false );
-  _regs.GR.index= 0x03; GR_write ( 0x00, false );
-  _regs.GR.index= 0x04; GR_write ( 0x00, false );
-  _regs.GR.index= 0x05; GR_write ( 0x00, false );
-  _regs.GR.index= 0x06; GR_write ( 0x00, false );
-  _regs.GR.index= 0x07; GR_write ( 0x00, false );
-  _regs.GR.index= 0x08; GR_write ( 0x00, false );
-  _regs.GR.index= 0x09; GR_write ( 0x00, false );
-  _regs.GR.index= 0x0a; GR_write ( 0x00, false );
-  _regs.GR.index= 0x0b; GR_write ( 0x00, false );
-  _regs.GR.index= 0x31; GR_write ( 0x00, false );
-  _regs.GR.index= 0;
-  _regs.CR.index= 0x11; CR_write ( 0x00, false ); // IMPORTA L'ORDRE
-  _regs.CR.index= 0x00; CR_write ( 0x00, false );
-  _regs.CR.index= 0x01; CR_write ( 0x00, false );
-  _regs.CR.index= 0x02; CR_write ( 0x00, false );
+  uint32_t addr;
+  int n;
+  bool use_mask;
+  uint8_t *d;
+  
+  
+  use_mask= blt_build_row ( src );
+  addr= _blt.dst;
+  if ( _regs.GR.blt.mode&BLTMODE_BACKWARDS ) addr-= _blt.width-1;
+  addr= (addr+_blt.byte_skip)&_vram_mask;
+  n= _blt.width-_blt.byte_skip;
+  if ( n > 0 )
+    {
+      damage_before_write ( addr, n );
+      d= (addr+n <= _vram_size) ? &_vram[addr] : _blt.drow;
+      if ( d == _blt.drow ) blt_read_vram ( d, addr, n );
+      blt_apply_rop ( d, _blt.srow+_blt.byte_skip,
+                      use_mask ? _blt.mrow+_blt.byte_skip : NULL, n );
+      if ( d == _blt.drow ) blt_write_vram ( addr, d, n );
+      damage_mark_range ( addr, n );
+    }
+  
+  if ( _regs.GR.blt.mode&BLTMODE_BACKWARDS )
+    {
+      _blt.dst-= _blt.dst_pitch;
+      _blt.src-= _blt.src_pitch;
+    }
+  else
+    {
+      _blt.dst+= _blt.dst_pitch;
+      _blt.src+= _blt.src_pitch;
+    }
+  ++_blt.row;
+  
+} // end blt_do_row
+
+
+static void
+blt_end (void)
+{
+
+  _blt.active= false;
+  update_lfb_map ();
+  _regs.GR.r49.blt_start= false;
+  _regs.GR.r49.val&= ~0x02;
+  
+} // end blt_end
+
+
+static void
+blt_run (void)
+{
+
+  uint8_t mode;
+  int npix,pat_size;
+  uint32_t addr;
+  
+  
+  mode= _regs.GR.blt.mode;
+  _blt.bpp= ((mode>>4)&0x3)+1;
+  _blt.width= _regs.GR.blt.width+1;
+  _blt.height= _regs.GR.blt.height+1;
+  _blt.dst_pitch= _regs.GR.blt.dst_pitch;
+  _blt.src_pitch= _regs.GR.blt.src_pitch;
+  _blt.dst= _regs.GR.blt.dst_addr;
+  _blt.src= _regs.GR.blt.src_addr;
+  _blt.row= 0;
+  _blt.pat_y= _blt.src&0x7;
+  _blt.rop= _regs.GR.blt.rop;
+  _blt.fg=
+    ((uint32_t) _regs.GR.r1.fg_colorb0) |
+    (((uint32_t) _regs.GR.fg_color[0])<<8) |
+    (((uint32_t) _regs.GR.fg_color[1])<<16) |
+    (((uint32_t) _regs.GR.fg_color[2])<<24);
+  _blt.bg=
+    ((uint32_t) _regs.GR.r0.bg_colorb0) |
+    (((uint32_t) _regs.GR.bg_color[0])<<8) |
+    (((uint32_t) _regs.GR.bg_color[1])<<16) |
+    (((uint32_t) _regs.GR.bg_color[2])<<24);
+  npix= _blt.width/_blt.bpp;
+  pat_size= 0;
+  if ( mode&(BLTMODE_COLOREXPAND|BLTMODE_PATTERNCOPY) )
+    {
+      if ( _blt.bpp == 3 )
+        {
+          _blt.byte_skip= _regs.GR.blt.write_mask&0x1F;
+          _blt.pixel_skip= _blt.byte_skip/3;
+        }
+      else
+        {
+          _blt.pixel_skip= _regs.GR.blt.write_mask&0x07;
+          _blt.byte_skip= _blt.pixel_skip*_blt.bpp;
+        }
+      _blt.width= npix*_blt.bpp;
+      if ( _blt.byte_skip > _blt.width ) _blt.byte_skip= _blt.width;
+      if ( mode&BLTMODE_PATTERNCOPY )
+        pat_size= (mode&BLTMODE_COLOREXPAND) ?
+          8 : 8*(_blt.bpp==3 ? 32 : 8*_blt.bpp);
+      else _blt.src_pitch= (npix+7)>>3; // Bits consecutius
+    }
+  else
+    {
+      _blt.pixel_skip= 0;
+      _blt.byte_skip= 0;
+    }
+  
+  // Destí sistema.
+  if ( mode&BLTMODE_MEMSYSDEST )
+    {
+      _warning ( _udata,
+                 "PCI:CLGD5446.BitBLT: destí sistema no implementat\n" );
+      blt_end ();
+      return;
+    }
+
+  // Font sistema. S'espera a rebre les dades.
+  if ( (mode&BLTMODE_MEMSYSSRC) &&
+       !((mode&BLTMODE_PATTERNCOPY) && (mode&BLTMODE_COLOREXPAND) &&
+         (_regs.GR.blt.mode_ext&BLTMODEEXT_SOLIDFILL)) )
+    {
+      // Cada fila s'alinea a 32 bits.
+      if ( pat_size > 0 ) _blt.sys_bytes= pat_size;
+      else if ( mode&BLTMODE_COLOREXPAND )
+        _blt.sys_bytes= ((_blt.src_pitch)+3)&(~3);
+      else _blt.sys_bytes= (_blt.width+3)&(~3);
+      _blt.sys_n= 0;
+      _blt.active= true;
+      update_lfb_map ();
+      return;
+    }
+
+  // Font en memòria de vídeo.
+  if ( pat_size > 0 )
+    {
+      blt_read_vram ( _blt.pat, _blt.src&(~0x7), pat_size );
+      while ( _blt.row < _blt.height )
+        blt_do_row ( NULL );
+    }
+  else if ( mode&BLTMODE_COLOREXPAND )
+    while ( _blt.row < _blt.height )
+      {
+        blt_read_vram ( _blt.sys_buf, _blt.src, _blt.src_pitch );
+        blt_do_row ( _blt.sys_buf );
+      }
+  else
+    while ( _blt.row < _blt.height )
+      {
+        addr= _blt.src;
+        if ( mode&BLTMODE_BACKWARDS ) addr-= _blt.width-1;
+        blt_read_vram ( _blt.srow, addr, _blt.width );
+        blt_do_row ( _blt.srow );
+      }
+  blt_end ();
+  
+} // end blt_run
+
+
+// Rep un byte de dades font des del sistema.
+static void
+blt_sys_write (
+               const uint8_t data
+               )
+{
+
+  _blt.sys_buf[_blt.sys_n++]= data;
+  if ( _blt.sys_n == _blt.sys_bytes )
+    {
+      _blt.sys_n= 0;
+      if ( _regs.GR.blt.mode&BLTMODE_PATTERNCOPY )
+        {
+          memcpy ( _blt.pat, _blt.sys_buf, _blt.sys_bytes );
+          while ( _blt.row < _blt.height )
+            blt_do_row ( NULL );
+        }
+      else blt_do_row ( _blt.sys_buf );
+      if ( _blt.row == _blt.height ) blt_end ();
+    }
+  
+} // end blt_sys_write
+
+
+static void
+blt_reg_write (
+               const int     reg,
+               const uint8_t data
+               )
+{
+
+  switch ( reg )
+    {
+    case 0x10: // Background Color Byte 1
+    case 0x12: // Background Color Byte 2
+    case 0x14: // Background Color Byte 3
+      _regs.GR.bg_color[(reg-0x10)>>1]= data;
+      break;
+    case 0x11: // Foreground Color Byte 1
+    case 0x13: // Foreground Color Byte 2
+    case 0x15: // Foreground Color Byte 3
+      _regs.GR.fg_color[(reg-0x11)>>1]= data;
+      break;
+      
+    case 0x20: // BLT Width Low
+      _regs.GR.blt.width= (_regs.GR.blt.width&0x1F00) | data;
+      break;
+    case 0x21: // BLT Width High
+      _regs.GR.blt.width=
+        (_regs.GR.blt.width&0x00FF) | (((uint16_t) (data&0x1F))<<8);
+      break;
+    case 0x22: // BLT Height Low
+      _regs.GR.blt.height= (_regs.GR.blt.height&0x0700) | data;
+      break;
+    case 0x23: // BLT Height High
+      _regs.GR.blt.height=
+        (_regs.GR.blt.height&0x00FF) | (((uint16_t) (data&0x07))<<8);
+      break;
+    case 0x24: // BLT Destination Pitch Low
+      _regs.GR.blt.dst_pitch= (_regs.GR.blt.dst_pitch&0x1F00) | data;
+      break;
+    case 0x25: // BLT Destination Pitch High
+      _regs.GR.blt.dst_pitch=
+        (_regs.GR.blt.dst_pitch&0x00FF) | (((uint16_t) (data&0x1F))<<8);
+      break;
+    case 0x26: // BLT Source Pitch Low
+      _regs.GR.blt.src_pitch= (_regs.GR.blt.src_pitch&0x1F00) | data;
+      break;
+    case 0x27: // BLT Source Pitch High
+      _regs.GR.blt.src_pitch=
+        (_regs.GR.blt.src_pitch&0x00FF) | (((uint16_t) (data&0x1F))<<8);
+      break;
+    case 0x28: // BLT Destination Start Low
+      _regs.GR.blt.dst_addr= (_regs.GR.blt.dst_addr&0x3FFF00) | data;
+      break;
+    case 0x29: // BLT Destination Start Mid
+      _regs.GR.blt.dst_addr=
+        (_regs.GR.blt.dst_addr&0x3F00FF) | (((uint32_t) data)<<8);
+      break;
+    case 0x2a: // BLT Destination Start High
+      _regs.GR.blt.dst_addr=
+        (_regs.GR.blt.dst_addr&0x00FFFF) | (((uint32_t) (data&0x3F))<<16);
+      if ( _regs.GR.r49.enable_autostart )
+        {
+          _regs.GR.r49.blt_start= true;
+          _regs.GR.r49.val|= 0x02;
+          blt_run ();
+        }
+      break;
+    case 0x2c: // BLT Source Start Low
+      _regs.GR.blt.src_addr= (_regs.GR.blt.src_addr&0x3FFF00) | data;
+      break;
+    case 0x2d: // BLT Source Start Mid
+      _regs.GR.blt.src_addr=
+        (_regs.GR.blt.src_addr&0x3F00FF) | (((uint32_t) data)<<8);
+      break;
+    case 0x2e: // BLT Source Start High
+      _regs.GR.blt.src_addr=
+        (_regs.GR.blt.src_addr&0x00FFFF) | (((uint32_t) (data&0x3F))<<16);
+      break;
+    case 0x2f: // BLT Destination Write Mask
+      _regs.GR.blt.write_mask= data;
+      break;
+    case 0x30: // BLT Mode
+      _regs.GR.blt.mode= data;
+      break;
+      
+    case 0x31: // BLT Start/Status
+      _regs.GR.r49.val= data&0xE6;
+      _regs.GR.r49.enable_autostart= ((data&0x80)!=0);
+      _regs.GR.r49.use_system_source_location= ((data&0x40)!=0);
+      _regs.GR.r49.pause= ((data&0x20)!=0);
+      if ( _regs.GR.r49.pause )
+        PC_MSG("SVGA - GR31 : Pause");
+      _regs.GR.r49.blt_reset= ((data&0x04)!=0);
+      if ( _regs.GR.r49.blt_reset ) blt_end ();
+      else if ( (data&0x02) != 0 )
+        {
+          _regs.GR.r49.blt_start= true;
+          blt_run ();
+        }
+      break;
+      
+    case 0x32: // BLT Raster Operation
+      _regs.GR.blt.rop= data;
+      break;
+    case 0x33: // BLT Mode Extensions
+      _regs.GR.blt.mode_ext= data;
+      break;
+    case 0x34: // Transparent Color Low
+      _regs.GR.blt.transp_color= (_regs.GR.blt.transp_color&0xFF00) | data;
+      break;
+    case 0x35: // Transparent Color High
+      _regs.GR.blt.transp_color=
+        (_regs.GR.blt.transp_color&0x00FF) | (((uint16_t) data)<<8);
+      break;
+    case 0x38: // Transparent Color Mask Low
+      _regs.GR.blt.transp_mask= (_regs.GR.blt.transp_mask&0xFF00) | data;
+      break;
+    case 0x39: // Transparent Color Mask High
+      _regs.GR.blt.transp_mask=
+        (_regs.GR.blt.transp_mask&0x00FF) | (((uint16_t) data)<<8);
+      break;
+    }
+  
+} // end blt_reg_write
+
+
+static uint8_t
+blt_reg_read (
+              const int reg
+              )
+{
+
+  uint8_t ret;
+  
+  
+  switch ( reg )
+    {
+    case 0x10:
+    case 0x12:
+    case 0x14: ret= _regs.GR.bg_color[(reg-0x10)>>1]; break;
+    case 0x11:
+    case 0x13:
+    case 0x15: ret= _regs.GR.fg_color[(reg-0x11)>>1]; break;
+    case 0x20: ret= (uint8_t) _regs.GR.blt.width; break;
+    case 0x21: ret= (uint8_t) (_regs.GR.blt.width>>8); break;
+    case 0x22: ret= (uint8_t) _regs.GR.blt.height; break;
+    case 0x23: ret= (uint8_t) (_regs.GR.blt.height>>8); break;
+    case 0x24: ret= (uint8_t) _regs.GR.blt.dst_pitch; break;
+    case 0x25: ret= (uint8_t) (_regs.GR.blt.dst_pitch>>8); break;
+    case 0x26: ret= (uint8_t) _regs.GR.blt.src_pitch; break;
+    case 0x27: ret= (uint8_t) (_regs.GR.blt.src_pitch>>8); break;
+    case 0x28: ret= (uint8_t) _regs.GR.blt.dst_addr; break;
+    case 0x29: ret= (uint8_t) (_regs.GR.blt.dst_addr>>8); break;
+    case 0x2a: ret= (uint8_t) (_regs.GR.blt.dst_addr>>16); break;
+    case 0x2c: ret= (uint8_t) _regs.GR.blt.src_addr; break;
+    case 0x2d: ret= (uint8_t) (_regs.GR.blt.src_addr>>8); break;
+    case 0x2e: ret= (uint8_t) (_regs.GR.blt.src_addr>>16); break;
+    case 0x2f: ret= _regs.GR.blt.write_mask; break;
+    case 0x30: ret= _regs.GR.blt.mode; break;
+    case 0x31: // BLT Status (bit 0) = esperant dades del sistema
+      ret= _regs.GR.r49.val | (_blt.active ? 0x01 : 0x00);
+      break;
+    case 0x32: ret= _regs.GR.blt.rop; break;
+    case 0x33: ret= _regs.GR.blt.mode_ext; break;
+    case 0x34: ret= (uint8_t) _regs.GR.blt.transp_color; break;
+    case 0x35: ret= (uint8_t) (_regs.GR.blt.transp_color>>8); break;
+    case 0x38: ret= (uint8_t) _regs.GR.blt.transp_mask; break;
+    case 0x39: ret= (uint8_t) (_regs.GR.blt.transp_mask>>8); break;
+    default: ret= 0xff;
+    }
+  
+  return ret;
+  
+} // end blt_reg_read
+
+
+// Torna el registre GR corresponent a un desplaçament dins dels
+// registres BitBLT mapejats en memòria, o -1.
+static int
+blt_mmio2gr (
+             const int offset
+             )
+{
+
+  int ret;
+
+  
+  switch ( offset )
+    {
+    case 0x00: ret= 0x00; break;
+    case 0x01: ret= 0x10; break;
+    case 0x02: ret= 0x12; break;
+    case 0x03: ret= 0x14; break;
+    case 0x04: ret= 0x01; break;
+    case 0x05: ret= 0x11; break;
+    case 0x06: ret= 0x13; break;
+    case 0x07: ret= 0x15; break;
+    case 0x08 ... 0x12: ret= 0x20 + (offset-0x08); break;
+    case 0x14 ... 0x18: ret= 0x2c + (offset-0x14); break;
+    case 0x1a ... 0x1d: ret= 0x32 + (offset-0x1a); break;
+    case 0x20: ret= 0x38; break;
+    case 0x21: ret= 0x39; break;
+    case 0x40: ret= 0x31; break;
+    default: ret= -1;
+    }
+
+  return ret;
+  
+} // end blt_mmio2gr
+
+
+static void
+blt_mmio_write (
+                const int     offset,
+                const uint8_t data
+                )
+{
+
+  int reg,tmp;
+  
+  
+  reg= blt_mmio2gr ( offset );
+  if ( reg == 0x00 || reg == 0x01 )
+    {
+      tmp= _regs.GR.index;
+      _regs.GR.index= reg;
+      GR_write ( data, false );
+      _regs.GR.index= tmp;
+    }
+  else if ( reg != -1 ) blt_reg_write ( reg, data );
+  
+} // end blt_mmio_write
+
+
+static uint8_t
+blt_mmio_read (
+               const int offset
+               )
+{
+
+  uint8_t ret;
+  int reg;
+  
+  
+  reg= blt_mmio2gr ( offset );
+  if ( reg == 0x00 ) ret= _regs.GR.r0.bg_colorb0;
+  else if ( reg == 0x01 ) ret= _regs.GR.r1.fg_colorb0;
+  else if ( reg != -1 ) ret= blt_reg_read ( reg );
+  else ret= 0xff;
+
+  return ret;
+  
+} // end blt_mmio_read
+
+
+static void
+init_pci_regs (void)
+{
+
+  _pci_regs.pcicmd= 0x0000;
+  _pci_regs.disp_mem_base_addr= 0x00000000;
+  _pci_regs.vga_bb_reg_base_addr= 0x00000000;
+  _pci_regs.erom= 0x00000000;
+  _pci_regs.intln= 0x00;
+  
+} // end init_pci_regs
+
+
+static void
+init_dac (void)
+{
+  
+  memset ( _dac.v, 0, sizeof(_dac.v) );
+  memset ( _dac.ext, 0, sizeof(_dac.ext) );
+  _render.pal_dirty= true;
+  _dac.addr_w= 0;
+  _dac.addr_r= 0;
+  _dac.buffer_w_off= 0;
+  memset ( _dac.buffer_w, 0, sizeof(_dac.buffer_w) );
+    _dac.buffer_r_off= 0;
+  memset ( _dac.buffer_r, 0, sizeof(_dac.buffer_r) );
+  
+} // end init_dac
+
+
+static void
+init_vga_mem (void)
+{
+
+  int i;
+
+
+  for ( i= 0; i < 4; ++i )
+    _vga_mem.p[i]= &_vram[i*64*1024];
+  _vga_mem.latch= 0;
+  update_vga_mem ();
+  
+} // end init_vga_mem
+
+
+static void
+init_regs (void)
+{
+
+  init_dac ();
+  misc_write ( 0x00, false, false );
+  pixel_mask_write ( 0xff, false );
+  pixel_mask_read ( false );
+  pixel_mask_read ( false );
+  pixel_mask_read ( false );
+  pixel_mask_read ( false );
+  pixel_mask_write ( 0x00, false );
+  _regs.SR.index= 0; SR_write ( 0x03, false, false );
+  _regs.SR.index= 1; SR_write ( 0x00, false, false );
+  _regs.SR.index= 2; SR_write ( 0x00, false, false );
+  _regs.SR.index= 3; SR_write ( 0x00, false, false );
+  _regs.SR.index= 4; SR_write ( 0x00, false, false );
+  _regs.SR.index= 6; SR_write ( 0x0f, false, false );
+  _regs.SR.index= 7; SR_write ( 0x00, false, false );
+  _regs.SR.index= 8; SR_write ( 0x00, false, false );
+  _regs.SR.index= 0x9; SR_write ( 0x00, false, false );
+  _regs.SR.index= 0xa; SR_write ( 0x00, false, false );
+  _regs.SR.index= 0xb; SR_write ( 0x66, false, false );
+  _regs.SR.index= 0xc; SR_write ( 0x5b, false, false );
+  _regs.SR.index= 0xd; SR_write ( 0x45, false, false );
+  _regs.SR.index= 0xe; SR_write ( 0x7e, false, false );
+  // DRAM Control. Les escriptures no estan implementades però la BIOS
+  // llig en els bits 4:3 i 7 la quantitat de memòria instal·lada.
+  if ( _vram_size == 1024*1024 )        _regs.SR.r15.val= 0x10;
+  else if ( _vram_size == 2*1024*1024 ) _regs.SR.r15.val= 0x18;
+  else                                  _regs.SR.r15.val= 0x98; // 4MB
+  _regs.SR.r15.dram_bank_switch= ((_regs.SR.r15.val&0x80)!=0);
+  _regs.SR.r15.fast_page_detection_disabled= false;
+  _regs.SR.r15.dram_data_bus_width= (_regs.SR.r15.val>>3)&0x3;
+  _regs.SR.index_hi= 0;
+  _regs.SR.index= 0x10; SR_write ( 0x00, false, false );
+  _regs.SR.index= 0x11; SR_write ( 0x00, false, false );
+  _regs.SR.index= 0x12; SR_write ( 0x00, false, false ); // Default 0x00 ???
+  _regs.SR.index= 0x13; SR_write ( 0x00, false, false ); // Default 0x00 ???
+  _regs.SR.index= 0x14; SR_write ( 0x00, false, false );
+  _regs.SR.index= 0x15; SR_write ( 0x00, false, false );
+  _regs.SR.index= 0x1b; SR_write ( 0x3b, false, false );
+  _regs.SR.index= 0x1c; SR_write ( 0x2f, false, false );
+  _regs.SR.index= 0x1d; SR_write ( 0x30, false, false );
+  _regs.SR.index= 0x1e; SR_write ( 0x33, false, false );
+  _regs.SR.index= 0;
+  _regs.GR.index= 0x00; GR_write ( 0x00, false );
+  _regs.GR.index= 0x01; GR_write ( 0x00, false );
+  _regs.GR.index= 0x02; GR_write ( 0x00, false );
+  _regs.GR.index= 0x03; GR_write ( 0x00, false );
+  _regs.GR.index= 0x04; GR_write ( 0x00, false );
+  _regs.GR.index= 0x05; GR_write ( 0x00, false );
+  _regs.GR.index= 0x06; GR_write ( 0x00, false );
+  _regs.GR.index= 0x07; GR_write ( 0x00, false );
+  _regs.GR.index= 0x08; GR_write ( 0x00, false );
+  _regs.GR.index= 0x09; GR_write ( 0x00, false );
+  _regs.GR.index= 0x0a; GR_write ( 0x00, false );
+  _regs.GR.index= 0x0b; GR_write ( 0x00, false );
+  _regs.GR.index= 0x31; GR_write ( 0x00, false );
+  _regs.GR.index= 0;
+  memset ( _regs.GR.bg_color, 0, sizeof(_regs.GR.bg_color) );
+  memset ( _regs.GR.fg_color, 0, sizeof(_regs.GR.fg_color) );
+  memset ( &_regs.GR.blt, 0, sizeof(_regs.GR.blt) );
+  _blt.active= false;
+  _regs.CR.index= 0x11; CR_write ( 0x00, false ); // IMPORTA L'ORDRE
+  _regs.CR.index= 0x00; CR_write ( 0x00, false );
+  _regs.CR.index= 0x01; CR_write ( 0x00, false );
+  _regs.CR.index= 0x02; CR_write ( 0x00, false );
   _regs.CR.index= 0x03; CR_write ( 0x00, false );
   _regs.CR.index= 0x04; CR_write ( 0x00, false );
   _regs.CR.index= 0x05; CR_write ( 0x00, false );
@@ -3574,6 +5001,7 @@ init_regs (void)
   _regs.AR.index= 0;
   _regs.AR.display_enabled= false;
   memset ( _regs.AR.pal, 0, sizeof(_regs.AR.pal) );
+  _render.ar_pal_dirty= true;
   _regs.AR.overscan_color= 0;
 
   // Altres.
@@ -3582,150 +5010,1260 @@ init_regs (void)
 } // end init_regs
 
 
-static void
-update_vclk (void)
+static void
+update_vclk (void)
+{
+
+  // INCLOU LA MULT PER 10K QUE FAIG
+  static const double REFERENCE= 14.31818*10000.0;
+
+  uint8_t den;
+  double tmp;
+  
+  
+  // Actualitza cc_mul
+  den= _regs.SR.vclk[_regs.misc.vlck_freq_ind].den;
+  if ( den <= 1 )
+    {
+      _timing.cc_mul= 251800;
+      _warning ( _udata,
+                 "[VGA] update_vclk - el denominador és 0, "
+                 "CC_MUL fixat a 251800" );
+    }
+  else
+    {
+      tmp=
+        REFERENCE *
+        ((double) (_regs.SR.vclk[_regs.misc.vlck_freq_ind].num&0x7f));
+      tmp/= (den&0x1)!=0 ? (((double) (den>>1))*2.0) : ((double) (den>>1));
+      _timing.cc_mul= (long) tmp;
+      if ( _timing.cc_mul < 100 )
+        {
+          _timing.cc_mul= 251800;
+          _warning ( _udata,
+                     "[VGA] update_vclk - el valor de CC_MUL és molt menut, "
+                     "CC_MUL fixat a 251800" );
+        }
+    }
+  /* // HO DEIXE COM A REFERÈNCIA (AÇÒ SERIA VGA BASIC)
+  switch ( _regs.misc.vlck_freq_ind )
+    {
+    case 0: // 25.180 MHz
+      _timing.cc_mul= 251800;
+      break;
+    case 1: // 28.325 MHz
+      _timing.cc_mul= 283250;
+      break;
+    case 2: // 41.165 MHz
+      _timing.cc_mul= 411650;
+      break;
+    case 3: // 36.082 MHz
+      _timing.cc_mul= 360820;
+      break;
+    default: // WTF
+      fprintf ( stderr, "update_vclk - WTF !!! \n" );
+      exit ( EXIT_FAILURE );
+      break;
+    }
+  */
+  if ( _regs.SR.clocking_mode.dot_clock_div2 )
+    _timing.cc_mul/= 2;
+  
+  // Conversió en coma fixa. La fracció de dot pendent ('vfrac') no
+  // depén de la freqüència.
+  _timing.dpc= (((uint64_t) _timing.cc_mul)<<32)/_timing.cc_div;
+  _timing.cpd= ((((uint64_t) _timing.cc_div)<<32) + _timing.cc_mul-1) /
+    _timing.cc_mul;
+  _timing.max_dots= (int) ((((uint64_t) PC_ClockFreq)*_timing.dpc)>>32);
+  _stat.horizon= 0;
+  
+} // end update_vclk
+
+
+static void
+update_crtc (void)
+{
+
+  int tmp;
+  
+
+  // Horitzontal.
+  _crtc.dotsperchar= _regs.SR.clocking_mode.dot_clock_8_9 ? 8 : 9;
+  _crtc.end_scanline= ((int) _regs.CR.horizontal_total) + 5;
+  _crtc.end_hdisplay= ((int) _regs.CR.horizontal_display_end) + 1;
+  _crtc.hblank_start= (int) _regs.CR.horizontal_blanking_start;
+  _crtc.hblank_end=
+    _regs.CR.horizontal_blanking_end.horizontal_blanking_end |
+    _regs.CR.horizontal_sync_end.horizontal_blanking_end;
+  _crtc.hretrace_start=
+    (int) (_regs.CR.horizontal_sync_start +
+           _regs.CR.horizontal_sync_end.horizontal_sync_delay);
+  _crtc.hretrace_end= _regs.CR.horizontal_sync_end.horizontal_sync_end;
+
+  // Vertical.
+  _crtc.vblank_start=
+    (int ) (_regs.CR.char_cell_height.vertical_blank_start |
+            _regs.CR.overflow.vertical_blanking_start |
+            _regs.CR.vertical_blank_start);
+  tmp= (int) _regs.CR.vertical_blank_end;
+  if ( _regs.CR.ext_disp_ctrl.blanking_control_is_1 ||
+       _regs.CR.ext_disp_ctrl.blank_end_extensions_enabled )
+    tmp|= (int) _regs.CR.misc_ctrl.vblank_end;
+  _crtc.vblank_width= tmp;
+  _crtc.vretrace_start=
+    (int) (_regs.CR.overflow.vertical_retrace_start |
+           _regs.CR.vertical_sync_start);
+  _crtc.vretrace_end= _regs.CR.vertical_sync_end.vertical_sync_end;
+  _crtc.end_vdisplay=
+    ((int) (_regs.CR.overflow.vertical_display_end |
+            _regs.CR.vertical_display_end)) + 1;
+  _crtc.last_V=
+    ((int) (_regs.CR.overflow.vertical_total |
+            _regs.CR.vertical_total)) + 2;
+  _crtc.start_addr= (int)
+    (_regs.CR.ov_ext_ctrl.screen_start_a_addr |
+     _regs.CR.ext_disp_ctrl.screen_start_a_addr |
+     _regs.CR.ext_disp_ctrl.ext_disp_start_addr |
+     ((uint32_t) _regs.CR.screen_start_a_addrH) |
+     ((uint32_t) _regs.CR.screen_start_a_addrL));
+  
+  // Update.
+  _crtc.update_scanline= _crtc.end_vdisplay;
+  _crtc.last_scanline= _crtc.last_V;
+  if ( _regs.CR.mode.vregs_by_two )
+    {
+      _crtc.update_scanline*= 2;
+      _crtc.last_scanline*= 2;
+    }
+  _crtc.scanline_dots= _crtc.end_scanline*_crtc.dotsperchar;
+  _stat.horizon= 0;
+  
+} // end update_crtc
+
+
+static int
+calc_cc_to_update_screen (void)
+{
+  
+  int dots,tmp,cline,end_vdisplay,last_scanline;
+  
+
+  // Preparació.
+  end_vdisplay= _crtc.update_scanline;
+  last_scanline= _crtc.last_scanline;
+  
+  // Dots per a acabar scanline actual.
+  tmp= _crtc.end_scanline <= _render.H ? 1 : (_crtc.end_scanline-_render.H);
+  dots= tmp*_crtc.dotsperchar;
+  
+  // Línies que falten per a aplegar a l'update.
+  cline= _render.scanline+1; // La línia anterior ha acabat.
+  if ( cline > last_scanline ) // Cas extrem !!!
+    {
+      last_scanline= 2048;
+      if ( cline > last_scanline ) cline= last_scanline;
+    }
+  if ( cline > end_vdisplay )
+    {
+      tmp= (last_scanline-cline) + end_vdisplay;
+    }
+  else tmp= end_vdisplay-cline;
+  dots+= tmp*_crtc.scanline_dots;
+
+  // Resta dots ja processats.
+  dots-= _render.char_dots;
+
+  // Transforma a cicles cpu. Més d'un segon no fa falta.
+  if ( dots >= _timing.max_dots ) return PC_ClockFreq;
+  
+  return (int) ((((uint64_t) dots)*_timing.cpd + 0xFFFFFFFF)>>32);
+  
+} // end calc_cc_to_update_screen
+
+
+static void
+update_cc_to_event (void)
+{
+
+  int cc,tmp;
+
+  
+  // Per defecte 1s
+  _timing.cctoEvent= PC_ClockFreq;
+  // --> Update screen
+  tmp= calc_cc_to_update_screen ();
+  assert ( tmp > 0 );
+  if ( tmp < _timing.cctoEvent ) _timing.cctoEvent= tmp;
+  
+  // Actualitza PC_NextEventCC
+  cc= next_event_cc ();
+  cc+= PC_Clock; // Medim sempre des de que PC_Clock és 0
+  if ( cc < PC_NextEventCC )
+    PC_NextEventCC= cc;
+  
+} // end update_cc_to_event
+
+
+// Ha canviat un registre que afecta al que es mostra. Cal tornar a
+// renderitzar totes les scanlines.
+static void
+damage_regs (void)
+{
+
+  ++_damage.gen;
+  ++_text.sig_gen;
+  
+} // end damage_regs
+
+
+// Força renderitzar les scanlines [y,y+size) on està o estava el
+// cursor gràfic.
+static void
+damage_cursor (
+               const bool enabled,
+               const int  y,
+               const int  size
+               )
+{
+
+  int i,end;
+  
+  
+  if ( !enabled ) return;
+  end= y+size > FB_HEIGHT ? FB_HEIGHT : y+size;
+  for ( i= y; i < end; ++i )
+    _damage.lines[i].gen= _damage.gen-1;
+  
+} // end damage_cursor
+
+
+// Si l'escriptura toca la memòria que llig la part pendent de la
+// scanline actual la renderitza abans.
+static void
+damage_check_batch (
+                    const uint32_t addr,
+                    const int      n
+                    )
+{
+
+  int begin,end;
+
+  
+  begin= _damage.lines[_render.scanline].begin;
+  end= _damage.lines[_render.scanline].end;
+  if ( begin < 0 || ((int) addr < end && (int) addr+n > begin) )
+    render_flush ();
+  
+} // end damage_check_batch
+
+
+// S'ha de cridar abans de modificar [addr,addr+n) de la VRAM, per a
+// que la part pendent de la scanline es renderitze amb el contingut
+// que tenia quan el CRTC la va llegir. Després de l'escriptura cal
+// marcar-la amb damage_mark/damage_mark_range.
+static void
+damage_before_write (
+                     const uint32_t addr,
+                     const int      n
+                     )
+{
+  
+  if ( n > 0 && _render.batch_chars > 0 )
+    damage_check_batch ( addr&_vram_mask, n );
+  
+} // end damage_before_write
+
+
+// Buida la cau de glifs i invalida les signatures del mode text.
+static void
+text_invalidate (void)
+{
+
+  ++_text.glyph_gen;
+  ++_text.sig_gen;
+  
+} // end text_invalidate
+
+
+static void
+damage_mark (
+             const uint32_t addr
+             )
+{
+
+  uint32_t a;
+  
+  
+  a= addr&_vram_mask;
+  _damage.pages[a>>DAMAGE_PAGE_BITS]= _damage.seq;
+  if ( a < DAMAGE_PLANES_SIZE ) _damage.planes= _damage.seq;
+  if ( a >= FONT_PLANE_BEGIN && a < FONT_PLANE_END ) text_invalidate ();
+  
+} // end damage_mark
+
+
+static void
+damage_mark_range (
+                   const uint32_t addr,
+                   const int      n
+                   )
+{
+
+  uint32_t p,last;
+  
+  
+  if ( n <= 0 ) return;
+  p= (addr&_vram_mask)>>DAMAGE_PAGE_BITS;
+  last= ((addr+n-1)&_vram_mask)>>DAMAGE_PAGE_BITS;
+  for (;;)
+    {
+      _damage.pages[p]= _damage.seq;
+      if ( p == last ) break;
+      p= (p+1)&(DAMAGE_NPAGES-1);
+    }
+  if ( (addr&_vram_mask) < DAMAGE_PLANES_SIZE ||
+       ((addr+n-1)&_vram_mask) < DAMAGE_PLANES_SIZE )
+    _damage.planes= _damage.seq;
+  if ( (addr&_vram_mask) < FONT_PLANE_END &&
+       (addr&_vram_mask)+n > FONT_PLANE_BEGIN )
+    text_invalidate ();
+  
+} // end damage_mark_range
+
+
+// Torna cert si alguna pàgina de [begin,end) s'ha escrit després de
+// 'seq'.
+static bool
+damage_range_written (
+                      const int      begin,
+                      const int      end,
+                      const uint64_t seq
+                      )
+{
+
+  uint32_t p,last;
+  
+  
+  if ( begin >= end ) return false;
+  p= (((uint32_t) begin)&_vram_mask)>>DAMAGE_PAGE_BITS;
+  last= (((uint32_t) (end-1))&_vram_mask)>>DAMAGE_PAGE_BITS;
+  for (;;)
+    {
+      if ( _damage.pages[p] >= seq ) return true;
+      if ( p == last ) break;
+      p= (p+1)&(DAMAGE_NPAGES-1);
+    }
+  
+  return false;
+  
+} // end damage_range_written
+
+
+// Rang de VRAM que llig la scanline actual. En els modes VGA torna
+// -1 (tota la memòria dels planols), i fora de la zona visible un
+// rang buit.
+static void
+damage_line_range (
+                   const int  dotsperchar,
+                   int       *begin,
+                   int       *end
+                   )
+{
+
+  int end_vdisplay,end_hdisplay,scanline_src,height,bytesperline,bpp;
+  
+  
+  end_vdisplay= ((int) (_regs.CR.overflow.vertical_display_end |
+                        _regs.CR.vertical_display_end)) + 1;
+  if ( !_regs.AR.display_enabled || _render.in_vblank ||
+       _render.in_vretrace || _render.V >= end_vdisplay )
+    *begin= *end= 0;
+  else if ( _regs.GR.misc.apa_mode && _regs.GR.mode.color256 &&
+            _regs.SR.r7.extended_display_modes_enabled )
+    {
+      scanline_src=
+        _regs.CR.char_cell_height.scan_double ?
+        _render.scanline>>1 : _render.scanline;
+      height= ((int) _regs.CR.char_cell_height.char_cell_height) + 1;
+      bytesperline= ((int) (_regs.CR.ext_disp_ctrl.offset_overflow |
+                            (uint16_t) _regs.CR.offset))<<3;
+      end_hdisplay= ((int) _regs.CR.horizontal_display_end) + 1;
+      bpp= render_ext_bpp ();
+      *begin= bpp*_render.start_addr + (scanline_src/height)*bytesperline;
+      *end= *begin + bpp*end_hdisplay*dotsperchar;
+    }
+  else *begin= *end= -1;
+  
+} // end damage_line_range
+
+
+// Decidix si cal renderitzar la scanline actual.
+static void
+damage_begin_line (
+                   const int dotsperchar
+                   )
+{
+
+  int begin,end,size;
+  bool dirty;
+  
+  
+  damage_line_range ( dotsperchar, &begin, &end );
+  dirty=
+    _damage.lines[_render.scanline].gen != _damage.gen ||
+    _damage.lines[_render.scanline].begin != begin ||
+    _damage.lines[_render.scanline].end != end;
+  if ( !dirty )
+    {
+      if ( begin == -1 )
+        dirty= _damage.planes >= _damage.lines[_render.scanline].seq;
+      else
+        dirty= damage_range_written ( begin, end,
+                                      _damage.lines[_render.scanline].seq );
+    }
+  
+  // Cursor gràfic.
+  if ( !dirty && _regs.SR.r12.cursor_enable )
+    {
+      size= _regs.SR.r12.cursor_size_is_32x32 ? 32 : 64;
+      if ( _render.scanline >= _regs.SR.cursor_y &&
+           _render.scanline < _regs.SR.cursor_y+size )
+        dirty= damage_range_written ( _vram_size-16*1024, _vram_size,
+                                      _damage.lines[_render.scanline].seq );
+    }
+  
+  _damage.cur_line= _render.scanline;
+  _damage.cur_dirty= dirty;
+  if ( dirty )
+    {
+      _damage.lines[_render.scanline].seq= ++_damage.seq;
+      _damage.lines[_render.scanline].gen= _damage.gen;
+      _damage.lines[_render.scanline].begin= begin;
+      _damage.lines[_render.scanline].end= end;
+      _damage.changed[_render.scanline]= true;
+    }
+  
+} // end damage_begin_line
+
+
+static void
+shm_close (void)
+{
+
+  if ( _shm.hdr == NULL ) return;
+  munmap ( _shm.hdr, _shm.size );
+  close ( _shm.fd );
+  if ( _shm.name != NULL )
+    {
+      shm_unlink ( _shm.name );
+      free ( _shm.name );
+      _shm.name= NULL;
+    }
+  _shm.hdr= NULL;
+  
+} // end shm_close
+
+
+// Copia el frame en el buffer que no està publicat i el publica. Sols
+// es copien les files que han canviat des de l'última vegada que es
+// va escriure en eixe buffer.
+//
+// NOTA!! La còpia és volguda. No es renderitza directament en el
+// buffer compartit perquè les scanlines que no canvien no es tornen
+// a renderitzar (damage), i en alternar buffers caldria copiar-les
+// igualment des de l'altre. A més _render.fb el continuen llegint el
+// frontend, la captura, el panning i fb_resize.
+static void
+shm_present (
+             const int            width,
+             const int            height,
+             const PC_ScreenRect *rects,
+             const int            nrects
+             )
+{
+
+  PC_SVGAShmBuffer *buf;
+  uint8_t *dst;
+  const uint8_t *src;
+  size_t stride,src_stride,row;
+  uint64_t seq;
+  int b,i,y;
+  
+  
+  // Files que han canviat.
+  for ( i= 0; i < nrects; ++i )
+    for ( y= rects[i].y; y < rects[i].y+rects[i].height; ++y )
+      _shm.stale[0][y]= _shm.stale[1][y]= true;
+
+  // Marca el buffer com en escriptura.
+  b= _shm.hdr->front^1;
+  buf= &(_shm.hdr->buf[b]);
+  seq= buf->seq;
+  __atomic_store_n ( &buf->seq, seq+1, __ATOMIC_RELAXED );
+  __atomic_thread_fence ( __ATOMIC_RELEASE );
+  
+  // Píxels.
+  stride= FB_WIDTH*_render.fb_psize;
+  src_stride= _render.fb_width*_render.fb_psize;
+  row= width*_render.fb_psize;
+  dst= ((uint8_t *) _shm.hdr) + _shm.hdr->buffer_offset +
+    b*_shm.hdr->buffer_size;
+  src= _render.fb;
+  for ( y= 0; y < height && y < FB_HEIGHT; ++y )
+    if ( _shm.stale[b][y] )
+      {
+        memcpy ( dst + y*stride, src + y*src_stride, row );
+        _shm.stale[b][y]= false;
+      }
+
+  // Capçalera. Si no caben els rectangles s'envia el que els conté.
+  buf->frame= ++_shm.frame;
+  buf->width= width;
+  buf->height= height;
+  buf->stride= (int32_t) stride;
+  if ( nrects <= PC_SVGA_SHM_MAX_RECTS )
+    {
+      memcpy ( buf->rects, rects, nrects*sizeof(PC_ScreenRect) );
+      buf->nrects= nrects;
+    }
+  else
+    {
+      buf->rects[0].x= 0;
+      buf->rects[0].y= rects[0].y;
+      buf->rects[0].width= width;
+      buf->rects[0].height=
+        rects[nrects-1].y + rects[nrects-1].height - rects[0].y;
+      buf->nrects= 1;
+    }
+  __atomic_store_n ( &buf->seq, seq+2, __ATOMIC_RELEASE );
+  __atomic_store_n ( &_shm.hdr->front, (uint32_t) b, __ATOMIC_RELEASE );
+  
+} // end shm_present
+
+
+// Passa el frame a la memòria compartida i a la captura de vídeo.
+static void
+export_frame (
+              const int            width,
+              const int            height,
+              const PC_ScreenRect *rects,
+              const int            nrects,
+              const uint64_t       cc
+              )
+{
+
+  uint64_t ns;
+  
+  
+  if ( _shm.hdr != NULL ) shm_present ( width, height, rects, nrects );
+  if ( PC_capture_enabled () )
+    {
+      ns= (cc/PC_ClockFreq)*1000000000 +
+        ((cc%PC_ClockFreq)*1000000000)/PC_ClockFreq;
+      PC_capture_frame ( _render.fb, _render.fb_format, width, height,
+                         _render.fb_width, rects, nrects, ns );
+    }
+  
+} // end export_frame
+
+
+// Grandària en píxels de la pantalla que programen els registres del
+// CRTC.
+static void
+crtc_display_size (
+                   int *width,
+                   int *height
+                   )
+{
+
+  *width= _crtc.end_hdisplay*_crtc.dotsperchar;
+  // NOTA!!! Açò és una nyapa. No tinc clar què fer quan els modes
+  // extended estan activats. Però en el FIFA96 no es veu bé si
+  // s'aplica açò amb el mode activat.
+  if ( _regs.AR.attr_ctrl_mode.pixel_double_clock &&
+       !_regs.SR.r7.extended_display_modes_enabled )
+    *width/= 2;
+  *height= _crtc.end_vdisplay;
+  
+} // end crtc_display_size
+
+
+// Passa el frame al frontend junt amb les files que han canviat.
+static void
+damage_update_screen (
+                      const int width_,
+                      const int height_
+                      )
+{
+
+  int y,n,width,height;
+  bool full;
+  
+  
+  // Framebuffer. Si no es pot reservar es passa el que hi ha.
+  width= width_;
+  height= height_;
+  if ( width != _render.fb_width || height != _render.fb_height )
+    {
+      thread_drain ();
+      if ( !fb_resize ( width, height ) )
+        {
+          if ( width > _render.fb_width ) width= _render.fb_width;
+          if ( height > _render.fb_height ) height= _render.fb_height;
+        }
+    }
+  
+  // Rectangles
+  full= (width != _damage.width || height != _damage.height);
+  n= 0;
+  for ( y= 0; y < height && y < FB_HEIGHT; ++y )
+    if ( full || _damage.changed[y] )
+      {
+        if ( n > 0 &&
+             _damage.rects[n-1].y+_damage.rects[n-1].height == y )
+          ++_damage.rects[n-1].height;
+        else
+          {
+            _damage.rects[n].x= 0;
+            _damage.rects[n].y= y;
+            _damage.rects[n].width= width;
+            _damage.rects[n].height= 1;
+            ++n;
+          }
+      }
+  _damage.width= width;
+  _damage.height= height;
+
+  // Passa el frame
+  if ( _thread.enabled )
+    thread_send_present ( width, height, n );
+  else if ( _update_screen_damage == NULL )
+    _update_screen ( _udata, _render.fb, width, height, _render.fb_width );
+  else
+    _update_screen_damage ( _udata, _render.fb, width, height,
+                            _render.fb_width,
+                            _damage.rects, n );
+  if ( !_thread.enabled )
+    export_frame ( width, height, _damage.rects, n, _timing.cc_total );
+  memset ( _damage.changed, 0, sizeof(_damage.changed) );
+  
+} // end damage_update_screen
+
+
+// Decidix si es rasteritza el frame que comença.
+static void
+frames_next (void)
+{
+
+  if ( _frames.skip > 0 && ++_frames.counter >= _frames.skip )
+    {
+      _frames.counter= 0;
+      _frames.render= true;
+    }
+  else _frames.render= false;
+  if ( _frames.requested )
+    {
+      _frames.requested= false;
+      _frames.render= true;
+    }
+  
+} // end frames_next
+
+
+static void
+init_planar_expand (void)
+{
+
+  int b,i;
+  uint8_t tmp[8];
+  
+
+  for ( b= 0; b < 256; ++b )
+    {
+      for ( i= 0; i < 8; ++i )
+        tmp[i]= (uint8_t) ((b>>(7-i))&0x1);
+      memcpy ( &_planar_expand[b], tmp, sizeof(tmp) );
+    }
+  
+} // end init_planar_expand
+
+
+static void
+init_damage (void)
+{
+
+  memset ( &_damage, 0, sizeof(_damage) );
+  _damage.gen= 1; // Força renderitzar totes les scanlines
+  _damage.cur_line= -1;
+  text_invalidate ();
+  
+} // end init_damage
+
+
+// Torna a reservar el framebuffer per a una pantalla de
+// 'width'x'height' píxels conservant el contingut que cap. Les
+// scanlines que s'han retallat es tornen a renderitzar en el següent
+// frame. No pot haver-hi treballs pendents en el fil de
+// rasterització.
+static bool
+fb_resize (
+           const int width,
+           const int height
+           )
+{
+
+  uint8_t *fb;
+  size_t psize;
+  int y,w,h;
+  
+  
+  if ( width == _render.fb_width && height == _render.fb_height )
+    return true;
+  if ( width <= 0 || height <= 0 ) return false;
+  psize= (size_t) _render.fb_psize;
+  fb= (uint8_t *) calloc ( ((size_t) width)*height, psize );
+  if ( fb == NULL )
+    {
+      _warning ( _udata,
+                 "SVGA: no s'ha pogut reservar memòria per al"
+                 " framebuffer de %dx%d", width, height );
+      return false;
+    }
+  if ( _render.fb != NULL )
+    {
+      w= width < _render.fb_width ? width : _render.fb_width;
+      h= height < _render.fb_height ? height : _render.fb_height;
+      for ( y= 0; y < h; ++y )
+        memcpy ( fb + y*width*psize,
+                 _render.fb + y*_render.fb_width*psize,
+                 w*psize );
+      free ( _render.fb );
+    }
+  _render.fb= fb;
+  _render.fb_width= width;
+  _render.fb_height= height;
+  ++_damage.gen;
+  text_invalidate ();
+  
+  return true;
+  
+} // end fb_resize
+
+
+static void
+fb_free (void)
+{
+
+  free ( _render.fb );
+  _render.fb= NULL;
+  _render.fb_width= 0;
+  _render.fb_height= 0;
+  
+} // end fb_free
+
+
+// Escriu en la posició 'x' de la scanline 'y' del framebuffer 'n'
+// píxels 0x00RRGGBB.
+static void
+render_fb_store (
+                 const int       y,
+                 const int       x,
+                 const uint32_t *src,
+                 const int       n
+                 )
+{
+
+  int len;
+  uint8_t *dst;
+
+  
+  if ( x >= _render.fb_width || n <= 0 || y >= _render.fb_height ) return;
+  len= x+n > _render.fb_width ? _render.fb_width-x : n;
+  dst= _render.fb + (y*_render.fb_width + x)*_render.fb_psize;
+  PC_pixels_store ( dst, src, len, _render.fb_format );
+  
+} // end render_fb_store
+
+
+// Desplaça la scanline 'y' del framebuffer 'panning' píxels cap a
+// l'esquerra.
+static void
+render_fb_panning (
+                   const int y,
+                   const int panning
+                   )
+{
+
+  uint8_t *line;
+
+
+  if ( y >= _render.fb_height || panning >= _render.fb_width ) return;
+  line= _render.fb + y*_render.fb_width*_render.fb_psize;
+  memmove ( line, line + panning*_render.fb_psize,
+            (_render.fb_width-panning)*_render.fb_psize );
+  
+} // end render_fb_panning
+
+
+// Converteix a 0x00RRGGBB 'n' píxels de 'src' en format 'kind' i
+// completa amb negre fins a 'total'.
+static void
+render_convert (
+                uint32_t       *dst,
+                const int       kind,
+                const uint8_t  *src,
+                const int       n,
+                const int       total,
+                const uint32_t *pal
+                )
+{
+
+  int i;
+  
+  
+  switch ( kind )
+    {
+    case PIX_XRGB:
+      if ( (const uint8_t *) dst != src )
+        memcpy ( dst, src, n*sizeof(uint32_t) );
+      break;
+    case PIX_LUT8: PC_pixels_lut8 ( dst, src, pal, n ); break;
+    case PIX_RGB555:
+      PC_pixels_rgb555 ( dst, (const uint16_t *) src, n );
+      break;
+    case PIX_RGB565:
+      PC_pixels_rgb565 ( dst, (const uint16_t *) src, n );
+      break;
+    case PIX_RGB888: PC_pixels_rgb888 ( dst, src, n ); break;
+    case PIX_XRGB8888:
+      PC_pixels_xrgb8888 ( dst, (const uint32_t *) src, n );
+      break;
+    }
+  for ( i= n; i < total; ++i )
+    dst[i]= 0;
+  
+} // end render_convert
+
+
+// Superposa el cursor 'c' sobre els píxels [x0,x0+n) de 'line'.
+static void
+render_cursor_apply (
+                     uint32_t       *line,
+                     const int       x0,
+                     const int       n,
+                     const cursor_t *c
+                     )
+{
+
+  int x,end,cx;
+  uint8_t bits;
+  
+  
+  x= x0 > c->x ? x0 : c->x;
+  end= x0+n;
+  if ( end > c->x+c->size ) end= c->x+c->size;
+  if ( end > FB_WIDTH ) end= FB_WIDTH;
+  for ( ; x < end; ++x )
+    {
+      cx= x-c->x;
+      bits=
+        ((c->p0[cx>>3]>>(7-(cx&0x7)))&0x1) |
+        (((c->p1[cx>>3]>>(7-(cx&0x7)))&0x1)<<1);
+      switch ( bits )
+        {
+        case 0: break; // Transparent
+        case 1: line[x]^= 0x00FFFFFF; break; // Inverteix
+        case 2: line[x]= c->bg; break;
+        case 3: line[x]= c->fg; break;
+        }
+    }
+  
+} // end render_cursor_apply
+
+
+// Passa al frontend el frame del treball PRESENT que està esperant el
+// fil de rasterització i el deixa continuar. Sempre s'executa en el
+// fil de l'emulador.
+static void
+thread_present (void)
+{
+
+  const job_t *job;
+  const PC_ScreenRect *rects;
+  
+  
+  job= _thread.present;
+  rects= (const PC_ScreenRect *) JOB_PAYLOAD(job);
+  if ( _update_screen_damage == NULL )
+    _update_screen ( _udata, _render.fb, job->x, job->n, _render.fb_width );
+  else
+    _update_screen_damage ( _udata, _render.fb, job->x, job->n,
+                            _render.fb_width,
+                            rects, job->total );
+  export_frame ( job->x, job->n, rects, job->total, job->cc );
+  pthread_mutex_lock ( &_thread.lock );
+  __atomic_store_n ( &_thread.ready, false, __ATOMIC_RELEASE );
+  --_thread.pending;
+  pthread_cond_broadcast ( &_thread.cond );
+  pthread_mutex_unlock ( &_thread.lock );
+  
+} // end thread_present
+
+
+// Espera que el fil de rasterització avance. S'ha de cridar amb
+// 'lock' agafat. Si el fil està esperant que es presente un frame,
+// el presenta.
+static void
+thread_wait (void)
+{
+
+  if ( __atomic_load_n ( &_thread.ready, __ATOMIC_ACQUIRE ) )
+    {
+      pthread_mutex_unlock ( &_thread.lock );
+      thread_present ();
+      pthread_mutex_lock ( &_thread.lock );
+    }
+  else pthread_cond_wait ( &_thread.cond, &_thread.lock );
+  
+} // end thread_wait
+
+
+static void *
+thread_main (
+             void *arg
+             )
 {
 
-  // INCLOU LA MULT PER 10K QUE FAIG
-  static const double REFERENCE= 14.31818*10000.0;
-
-  long old_mul;
-  uint8_t den;
-  double tmp;
+  const job_t *job;
+  const uint8_t *payload;
+  bool stop;
   
   
-  // És impossible fer la conversió completa dels clocks en tmp, però
-  // farem el millor possible.
-  old_mul= _timing.cc_mul;
-  assert ( old_mul > 0 );
-
-  // Actualitza cc_mul
-  den= _regs.SR.vclk[_regs.misc.vlck_freq_ind].den;
-  if ( den <= 1 )
-    {
-      _timing.cc_mul= 251800;
-      _warning ( _udata,
-                 "[VGA] update_vclk - el denominador és 0, "
-                 "CC_MUL fixat a 251800" );
-    }
-  else
+  stop= false;
+  while ( !stop )
     {
-      tmp=
-        REFERENCE *
-        ((double) (_regs.SR.vclk[_regs.misc.vlck_freq_ind].num&0x7f));
-      tmp/= (den&0x1)!=0 ? (((double) (den>>1))*2.0) : ((double) (den>>1));
-      _timing.cc_mul= (long) tmp;
-      if ( _timing.cc_mul < 100 )
+      
+      // Següent treball.
+      pthread_mutex_lock ( &_thread.lock );
+      while ( _thread.head == _thread.tail )
+        pthread_cond_wait ( &_thread.cond, &_thread.lock );
+      job= (const job_t *) &_thread.ring[_thread.tail%RING_SIZE];
+      pthread_mutex_unlock ( &_thread.lock );
+      payload= JOB_PAYLOAD(job);
+
+      // Executa.
+      switch ( job->type )
         {
-          _timing.cc_mul= 251800;
-          _warning ( _udata,
-                     "[VGA] update_vclk - el valor de CC_MUL és molt menut, "
-                     "CC_MUL fixat a 251800" );
+        case JOB_PIXELS:
+          if ( job->kind == PIX_XRGB && job->n == job->total && !job->cursor )
+            render_fb_store ( job->scanline, job->x,
+                              (const uint32_t *) payload, job->n );
+          else
+            {
+              render_convert ( &_thread.line[job->x], job->kind, payload,
+                               job->n, job->total, _thread.pal );
+              if ( job->cursor )
+                render_cursor_apply ( _thread.line, job->x, job->total,
+                                      &job->cur );
+              render_fb_store ( job->scanline, job->x,
+                                &_thread.line[job->x], job->total );
+            }
+          break;
+        case JOB_PANNING:
+          render_fb_panning ( job->scanline, job->x );
+          break;
+        case JOB_PAL:
+          memcpy ( _thread.pal, payload, sizeof(_thread.pal) );
+          break;
+        case JOB_PRESENT:
+          pthread_mutex_lock ( &_thread.lock );
+          _thread.present= job;
+          __atomic_store_n ( &_thread.ready, true, __ATOMIC_RELEASE );
+          pthread_cond_broadcast ( &_thread.cond );
+          while ( __atomic_load_n ( &_thread.ready, __ATOMIC_ACQUIRE ) )
+            pthread_cond_wait ( &_thread.cond, &_thread.lock );
+          pthread_mutex_unlock ( &_thread.lock );
+          break;
+        case JOB_QUIT: stop= true; break;
+        default: break; // JOB_WRAP
         }
+      
+      // Allibera.
+      pthread_mutex_lock ( &_thread.lock );
+      _thread.tail+= job->size;
+      pthread_cond_broadcast ( &_thread.cond );
+      pthread_mutex_unlock ( &_thread.lock );
+      
     }
-  /* // HO DEIXE COM A REFERÈNCIA (AÇÒ SERIA VGA BASIC)
-  switch ( _regs.misc.vlck_freq_ind )
+  
+  return NULL;
+  
+} // end thread_main
+
+
+// Reserva en la cua un treball amb 'payload' bytes de dades. Quan
+// està complet s'ha de confirmar amb thread_job_end.
+static job_t *
+thread_job_begin (
+                  const int    type,
+                  const size_t payload
+                  )
+{
+
+  job_t *job;
+  size_t size,pos,pad;
+  
+  
+  size= JOB_HDR_SIZE + ((payload+JOB_ALIGN-1)/JOB_ALIGN)*JOB_ALIGN;
+  pos= (size_t) (_thread.head%RING_SIZE);
+  pad= pos+size > RING_SIZE ? RING_SIZE-pos : 0;
+  
+  // Espera que hi haja lloc.
+  pthread_mutex_lock ( &_thread.lock );
+  while ( RING_SIZE-(_thread.head-_thread.tail) < pad+size )
+    thread_wait ();
+  pthread_mutex_unlock ( &_thread.lock );
+  
+  // Bota al principi de l'anell. Del JOB_WRAP sols es lligen 'type'
+  // i 'size', que sempre caben.
+  if ( pad > 0 )
     {
-    case 0: // 25.180 MHz
-      _timing.cc_mul= 251800;
-      break;
-    case 1: // 28.325 MHz
-      _timing.cc_mul= 283250;
-      break;
-    case 2: // 41.165 MHz
-      _timing.cc_mul= 411650;
-      break;
-    case 3: // 36.082 MHz
-      _timing.cc_mul= 360820;
-      break;
-    default: // WTF
-      fprintf ( stderr, "update_vclk - WTF !!! \n" );
-      exit ( EXIT_FAILURE );
-      break;
+      job= (job_t *) &_thread.ring[pos];
+      job->type= JOB_WRAP;
+      job->size= (int) pad;
+      pos= 0;
     }
-  */
-  if ( _regs.SR.clocking_mode.dot_clock_div2 )
-    _timing.cc_mul/= 2;
+  job= (job_t *) &_thread.ring[pos];
+  job->type= type;
+  job->size= (int) size;
+  job->cursor= false;
+  _thread.commit= pad+size;
   
-  // Acaba de fer la conversió de vcc_tmp
-  // NOTA!! No és perfecta, però més no es pot fer.
-  _timing.vcc_tmp= (_timing.vcc_tmp*_timing.cc_mul)/old_mul;
+  return job;
   
-} // end update_vclk
+} // end thread_job_begin
 
 
-static int
-calc_cc_to_update_screen (void)
+static void
+thread_job_end (void)
+{
+
+  pthread_mutex_lock ( &_thread.lock );
+  _thread.head+= _thread.commit;
+  pthread_cond_broadcast ( &_thread.cond );
+  pthread_mutex_unlock ( &_thread.lock );
+  
+} // end thread_job_end
+
+
+// Envia la paleta si ha canviat des de l'última vegada.
+static void
+thread_send_pal (void)
 {
+
+  job_t *job;
   
-  int dotsperchar,end_scanline,dots,tmp,cline,end_vdisplay,last_scanline,ret;
-  long tmpl;
   
+  if ( _render.pal_dirty ) render_update_pal ();
+  if ( _thread.pal_gen == _render.pal_gen ) return;
+  job= thread_job_begin ( JOB_PAL, sizeof(_render.pal) );
+  memcpy ( JOB_PAYLOAD(job), _render.pal, sizeof(_render.pal) );
+  thread_job_end ();
+  _thread.pal_gen= _render.pal_gen;
+  
+} // end thread_send_pal
 
-  // Preparació.
-  dotsperchar= _regs.SR.clocking_mode.dot_clock_8_9 ? 8 : 9;
-  end_scanline= ((int) _regs.CR.horizontal_total) + 5;
-  end_vdisplay= ((int) (_regs.CR.overflow.vertical_display_end |
-                        _regs.CR.vertical_display_end)) + 1;
-  last_scanline= ((int) (_regs.CR.overflow.vertical_total |
-                         _regs.CR.vertical_total)) + 2;
-  if ( _regs.CR.mode.vregs_by_two )
+
+// Encua la conversió dels píxels [x,x+n) de la scanline actual. Es
+// copien les dades de la font, per tant la VRAM pot canviar abans que
+// el fil les processe.
+static void
+thread_send_pixels (
+                    const int        x,
+                    const int        n,
+                    const ext_src_t *s,
+                    const cursor_t  *cursor
+                    )
+{
+
+  static const int BPP[]= { 4, 1, 2, 2, 3, 4 };
+  
+  job_t *job;
+  size_t nbytes;
+  
+  
+  if ( x >= FB_WIDTH || n <= 0 || _render.scanline >= FB_HEIGHT ) return;
+  if ( s->kind == PIX_LUT8 ) thread_send_pal ();
+  nbytes= (size_t) (BPP[s->kind]*s->n);
+  job= thread_job_begin ( JOB_PIXELS, nbytes );
+  job->scanline= _render.scanline;
+  job->x= x;
+  job->n= s->n;
+  job->total= n;
+  job->kind= s->kind;
+  if ( cursor != NULL )
     {
-      end_vdisplay*= 2;
-      last_scanline*= 2;
+      job->cursor= true;
+      job->cur= *cursor;
     }
+  memcpy ( JOB_PAYLOAD(job), s->src, nbytes );
+  thread_job_end ();
   
-  // Dots per a acabar scanline actual.
-  tmp= end_scanline <= _render.H ? 1 : (end_scanline-_render.H);
-  dots= tmp*dotsperchar;
+} // end thread_send_pixels
+
+
+static void
+thread_send_panning (
+                     const int panning
+                     )
+{
+
+  job_t *job;
   
-  // Línies que falten per a aplegar a l'update.
-  cline= _render.scanline+1; // La línia anterior ha acabat.
-  if ( cline > last_scanline ) // Cas extrem !!!
+  
+  job= thread_job_begin ( JOB_PANNING, 0 );
+  job->scanline= _render.scanline;
+  job->x= panning;
+  thread_job_end ();
+  
+} // end thread_send_panning
+
+
+// Encua el final del frame amb els primers 'nrects' rectangles de
+// '_damage.rects'. L'emulador sols es bloqueja si el frame anterior
+// encara no s'ha presentat, és a dir, si va més d'un frame avançat.
+static void
+thread_send_present (
+                     const int width,
+                     const int height,
+                     const int nrects
+                     )
+{
+
+  job_t *job;
+  
+  
+  pthread_mutex_lock ( &_thread.lock );
+  while ( _thread.pending > 0 )
+    thread_wait ();
+  ++_thread.pending;
+  pthread_mutex_unlock ( &_thread.lock );
+  job= thread_job_begin ( JOB_PRESENT, nrects*sizeof(PC_ScreenRect) );
+  job->x= width;
+  job->n= height;
+  job->total= nrects;
+  job->cc= _timing.cc_total;
+  memcpy ( JOB_PAYLOAD(job), _damage.rects, nrects*sizeof(PC_ScreenRect) );
+  thread_job_end ();
+  
+} // end thread_send_present
+
+
+// Presenta el frame que ha acabat el fil de rasterització, si n'hi
+// ha. Es crida periòdicament des del fil de l'emulador.
+static void
+thread_poll (void)
+{
+
+  if ( _thread.enabled &&
+       __atomic_load_n ( &_thread.ready, __ATOMIC_ACQUIRE ) )
+    thread_present ();
+  
+} // end thread_poll
+
+
+// Espera que el fil de rasterització acabe tots els treballs.
+static void
+thread_drain (void)
+{
+
+  if ( !_thread.enabled ) return;
+  pthread_mutex_lock ( &_thread.lock );
+  while ( _thread.head != _thread.tail )
+    thread_wait ();
+  pthread_mutex_unlock ( &_thread.lock );
+  
+} // end thread_drain
+
+
+static void
+thread_start (void)
+{
+
+  _thread.ring= (uint8_t *) aligned_alloc ( JOB_ALIGN, RING_SIZE );
+  if ( _thread.ring == NULL )
     {
-      last_scanline= 2048;
-      if ( cline > last_scanline ) cline= last_scanline;
+      _warning ( _udata,
+                 "SVGA: no s'ha pogut reservar memòria per a la"
+                 " rasterització en un altre fil" );
+      return;
     }
-  if ( cline > end_vdisplay )
+  _thread.head= 0;
+  _thread.tail= 0;
+  _thread.pending= 0;
+  _thread.ready= false;
+  _thread.present= NULL;
+  _thread.pal_gen= _render.pal_gen-1;
+  pthread_mutex_init ( &_thread.lock, NULL );
+  pthread_cond_init ( &_thread.cond, NULL );
+  if ( pthread_create ( &_thread.thread, NULL, thread_main, NULL ) != 0 )
     {
-      tmp= (last_scanline-cline) + end_vdisplay;
+      _warning ( _udata,
+                 "SVGA: no s'ha pogut crear el fil de rasterització,"
+                 " es rasteritzarà en el fil principal" );
+      pthread_cond_destroy ( &_thread.cond );
+      pthread_mutex_destroy ( &_thread.lock );
+      free ( _thread.ring );
+      _thread.ring= NULL;
+      return;
     }
-  else tmp= end_vdisplay-cline;
-  dots+= tmp*end_scanline*dotsperchar;
+  _thread.enabled= true;
+  
+} // end thread_start
 
-  // Resta dots ja processats.
-  dots-= _render.char_dots;
 
-  // Transforma a cicles cpu.
-  tmpl= ((long) dots)*_timing.cc_div;
-  ret= (int) (tmpl / _timing.cc_mul) + ((tmpl%_timing.cc_mul)!=0);
-  
-  return ret;
+static void
+thread_stop (void)
+{
+
+  if ( !_thread.enabled ) return;
+  thread_job_begin ( JOB_QUIT, 0 );
+  thread_job_end ();
+  thread_drain ();
+  pthread_join ( _thread.thread, NULL );
+  pthread_cond_destroy ( &_thread.cond );
+  pthread_mutex_destroy ( &_thread.lock );
+  free ( _thread.ring );
+  _thread.ring= NULL;
+  _thread.enabled= false;
   
-} // end calc_cc_to_update_screen
+} // end thread_stop
 
 
+// Passa els píxels [x,x+n) de 'line' al framebuffer.
 static void
-update_cc_to_event (void)
+render_store (
+              const int x,
+              const int n
+              )
 {
 
-  int cc,tmp;
+  ext_src_t s;
+  int len;
 
   
-  // Per defecte 1s
-  _timing.cctoEvent= PC_ClockFreq;
-  // --> Update screen
-  tmp= calc_cc_to_update_screen ();
-  assert ( tmp > 0 );
-  if ( tmp < _timing.cctoEvent ) _timing.cctoEvent= tmp;
-  
-  // Actualitza PC_NextEventCC
-  cc= next_event_cc ();
-  cc+= PC_Clock; // Medim sempre des de que PC_Clock és 0
-  if ( cc < PC_NextEventCC )
-    PC_NextEventCC= cc;
+  if ( x >= FB_WIDTH || n <= 0 || _render.scanline >= FB_HEIGHT ) return;
+  len= x+n > FB_WIDTH ? FB_WIDTH-x : n;
+  if ( _thread.enabled )
+    {
+      s.kind= PIX_XRGB;
+      s.src= (const uint8_t *) &_render.line[x];
+      s.n= len;
+      thread_send_pixels ( x, len, &s, NULL );
+    }
+  else render_fb_store ( _render.scanline, x, &_render.line[x], len );
   
-} // end update_cc_to_event
+} // end render_store
 
 
 static void
@@ -3738,55 +6276,117 @@ render_chars_black (
   int begin,end,i;
 
   
-  begin= _render.scanline*FB_WIDTH + _render.H*dotsperchar;
+  begin= _render.H*dotsperchar;
   end= begin + chars*dotsperchar;
   for ( i= begin; i < end; ++i )
-    {
-      _render.fb[i].r= 0;
-      _render.fb[i].g= 0;
-      _render.fb[i].b= 0;
-    }
+    _render.line[i]= 0;
+  render_store ( begin, end-begin );
   
 } // end render_chars_black
 
 
+// Recalcula la paleta convertida.
 static void
-get_color_dac (
-               const uint8_t  index,
-               uint8_t       *r,
-               uint8_t       *g,
-               uint8_t       *b
-               )
+render_update_pal (void)
 {
 
   // No és ùna conversió de color perfecta, però és molt més eficient
   // que multiplicar o consultar una taula. Si vull que siga perfecte taula
   
-  uint8_t tmp;
+  int i;
+  uint8_t r,g,b;
+  
   
-
   // NOTA!! No entenc si el pixel_mask es gasta ací.
-  tmp= _dac.v[index][0]&_regs.pixel_mask;
-  *r= (tmp<<2);
-  tmp= _dac.v[index][1]&_regs.pixel_mask;
-  *g= (tmp<<2);
-  tmp= _dac.v[index][2]&_regs.pixel_mask;
-  *b= (tmp<<2);
+  for ( i= 0; i < 256; ++i )
+    {
+      r= (uint8_t) ((_dac.v[i][0]&_regs.pixel_mask)<<2);
+      g= (uint8_t) ((_dac.v[i][1]&_regs.pixel_mask)<<2);
+      b= (uint8_t) ((_dac.v[i][2]&_regs.pixel_mask)<<2);
+      _render.pal[i]= (((uint32_t) r)<<16) | (((uint32_t) g)<<8) | b;
+    }
+  _render.pal_dirty= false;
+  ++_render.pal_gen;
+  _render.ar_pal_dirty= true;
+  
+} // end render_update_pal
+
+
+static uint32_t
+get_color_dac (
+               const uint8_t index
+               )
+{
+  
+  if ( _render.pal_dirty ) render_update_pal ();
+  _render.pixel_bus= index;
   
-  _render.pixel_bus= (uint8_t) index;
+  return _render.pal[index];
   
 } // end get_color_dac
 
 
+// Pinta en 'line' 'n' índexs de color a través del DAC.
+static void
+render_lut8 (
+             const int      x,
+             const uint8_t *src,
+             const int      n
+             )
+{
+
+  if ( n <= 0 ) return;
+  if ( _render.pal_dirty ) render_update_pal ();
+  PC_pixels_lut8 ( &_render.line[x], src, _render.pal, n );
+  _render.pixel_bus= src[n-1];
+  
+} // end render_lut8
+
+
+// Bytes per píxel en els modes estesos.
+static int
+render_ext_bpp (void)
+{
+
+  if ( !_regs.hdr.mode_555_enabled ) return 1;
+  switch ( _regs.SR.r7.srt )
+    {
+    case 0x02: return 3;
+    case 0x04: return 4;
+    default: return 2;
+    }
+  
+} // end render_ext_bpp
+
+
+// Recalcula la paleta de l'Attribute Controller.
 static void
+render_update_ar_pal (void)
+{
+
+  int i;
+
+  
+  if ( _render.pal_dirty ) render_update_pal ();
+  for ( i= 0; i < 16; ++i )
+    _render.ar_pal[i]= _render.pal[_regs.AR.pal[i]];
+  _render.ar_pal_dirty= false;
+  text_invalidate ();
+  
+} // end render_update_ar_pal
+
+
+static uint32_t
 get_color_palette (
-                   const uint8_t  index,
-                   uint8_t       *r,
-                   uint8_t       *g,
-                   uint8_t       *b
+                   const uint8_t index
                    )
 {
-  get_color_dac ( _regs.AR.pal[index&0xF], r, g, b );
+
+  if ( _render.pal_dirty || _render.ar_pal_dirty ) render_update_ar_pal ();
+  _render.pixel_bus= _regs.AR.pal[index&0xF];
+  
+  return _render.ar_pal[index&0xF];
+  
 } // end get_color_palette
 
 
@@ -3798,21 +6398,18 @@ render_chars_overscan (
 {
   
   int begin,end,i;
-  uint8_t r,g,b;
+  uint32_t color;
 
 
   // NOTA!! No entenc el significat de Secondary Red, Secondary Green,
   // etc. Simplement ho vaig a emprar com un índex en la entrada de
   // colors del DAC.
-  get_color_dac ( _regs.AR.overscan_color, &r, &g, &b );
-  begin= _render.scanline*FB_WIDTH + _render.H*dotsperchar;
+  color= get_color_dac ( _regs.AR.overscan_color );
+  begin= _render.H*dotsperchar;
   end= begin + chars*dotsperchar;
   for ( i= begin; i < end; ++i )
-    {
-      _render.fb[i].r= r;
-      _render.fb[i].g= g;
-      _render.fb[i].b= b;
-    }
+    _render.line[i]= color;
+  render_store ( begin, end-begin );
   
 } // end render_chars_overscan
 
@@ -3863,8 +6460,9 @@ render_addr2pos (
 } // end render_addr2pos
 
 
-static void
-render_apply_panning (void)
+// Píxels que s'ha de desplaçar la scanline pel 'pixel panning'.
+static int
+render_panning (void)
 {
 
   static const int PANNING_MODE13[16]=
@@ -3874,45 +6472,94 @@ render_apply_panning (void)
   static const int PANNING_8BIT[16]=
     { 0, 1, 2, 3, 4, 5, 6, 7, 1, 1, 1, 1, 1, 1, 1, 1 };
   
-  int panning,i;
-  PC_RGB *line;
-  
 
-  // Obté panning
   if ( _regs.GR.misc.apa_mode && _regs.GR.mode.color256 )
-    panning= PANNING_MODE13[_regs.AR.pixel_panning];
+    return PANNING_MODE13[_regs.AR.pixel_panning];
   else if ( _regs.SR.clocking_mode.dot_clock_8_9 )
-    panning= PANNING_8BIT[_regs.AR.pixel_panning];
+    return PANNING_8BIT[_regs.AR.pixel_panning];
   else
-    panning= PANNING_9BIT[_regs.AR.pixel_panning];
+    return PANNING_9BIT[_regs.AR.pixel_panning];
+  
+} // end render_panning
+
+
+static void
+render_apply_panning (void)
+{
+
+  int panning;
+  
 
-  // Aplica
+  panning= render_panning ();
   if ( panning > 0 )
     {
-      line= &_render.fb[_render.scanline*FB_WIDTH];
-      for ( i= 0; i < FB_WIDTH-panning; ++i )
-        line[i]= line[i+panning];
+      if ( _thread.enabled ) thread_send_panning ( panning );
+      else render_fb_panning ( _render.scanline, panning );
     }
   
 } // end render_apply_panning
 
 
+// Torna la fila 'row' del glif 'key' (vore render_chars_text). La
+// calcula si no està en la cau.
+static const uint32_t *
+render_glyph_row (
+                  const uint32_t key,
+                  const int      row
+                  )
+{
+
+  glyph_t *g;
+  uint32_t fg,bg,*p;
+  uint8_t index,pattern;
+  int j;
+  
+  
+  g= &_text.glyphs[(key*0x9E3779B1)>>(32-GLYPH_CACHE_BITS)];
+  if ( g->key != key || g->gen != _text.glyph_gen )
+    {
+      g->key= key;
+      g->gen= _text.glyph_gen;
+      g->rows= 0;
+    }
+  p= g->px[row];
+  if ( (g->rows&(1u<<row)) == 0 )
+    {
+      index= (uint8_t) (key&0xFF);
+      fg= _render.ar_pal[(key>>8)&0xF];
+      bg= _render.ar_pal[(key>>12)&0xF];
+      pattern= _vga_mem.p[2][PLANE2_OFFSETS[(key>>16)&0x7] +
+                             ((int) index)*32 + row];
+      // --> Patró (8 bits)
+      for ( j= 0; j < 8; ++j )
+        {
+          p[j]= (pattern&0x80) != 0 ? fg : bg;
+          pattern<<= 1;
+        }
+      // --> Bit 9
+      if ( (key&0x00080000) != 0 && index >= 0xc0 && index <= 0xdf )
+        p[8]= p[7];
+      else p[8]= bg;
+      g->rows|= 1u<<row;
+    }
+
+  return p;
+  
+} // end render_glyph_row
+
+
 static void
 render_chars_text (
                    const int chars,
                    const int dotsperchar
                    )
 {
-
-  static const int PLANE2_OFFSETS[]= {
-    0, 16*1024, 32*1024, 48*1024,
-    8*1024, 24*1024, 40*1024, 56*1024
-  };
   
-  int height,charsperline,off,i,pos,char_y,j,p2_offset,cursor_pos,
-    scanline_src;
-  uint8_t index,attr,r_bg,g_bg,b_bg,r_fg,g_fg,b_fg,pattern;
-  PC_RGB *p;
+  int height,charsperline,off,i,j,pos,char_y,cursor_pos,scanline_src,x,
+    cell,run;
+  uint8_t index,attr,fg,bg;
+  uint32_t key,sig,color,*p,*sigs;
+  bool skip;
   
 
   // NOTA!!! Pixel double clock pot estar per un temps actiu abans
@@ -3932,14 +6579,50 @@ render_chars_text (
                         (uint16_t) _regs.CR.offset))<<1;
   off= _render.start_addr + (scanline_src/height)*charsperline + _render.H;
   char_y= scanline_src%height;
-  p= &_render.fb[_render.scanline*FB_WIDTH + _render.H*dotsperchar];
-  for ( i= 0; i < chars; ++i )
+  if ( _render.pal_dirty || _render.ar_pal_dirty ) render_update_ar_pal ();
+
+  // Prepara informació cursor
+  // NOTA!! Aparentment en text mode s'accedeixen a posicions
+  // parelles.  O millor dit, l'adreça és multiplica per 2 (no sé
+  // per què), açò també afecta a l'adreça del cursor.
+  if ( !_regs.CR.text_cursor_start.text_cursor_disabled )
+    {
+      cursor_pos=
+        ((int)
+         ((((uint32_t) _regs.CR.text_cursor_locH)) |
+          ((uint32_t) _regs.CR.text_cursor_locL))) +
+        ((int) (_regs.CR.text_cursor_end.text_cursor_skew))*2; // odd/even
+      cursor_pos= render_addr2pos ( cursor_pos, scanline_src );
+    }
+  else cursor_pos= 0;
+
+  // Signatures de la scanline. Amb panning no es poden reaprofitar
+  // les cel·les perquè el framebuffer ja està desplaçat.
+  if ( _render.scanline < FB_HEIGHT )
+    {
+      sigs= _text.sigs[_render.scanline];
+      if ( _text.lines[_render.scanline] != _text.sig_gen )
+        {
+          memset ( sigs, 0, sizeof(_text.sigs[0]) );
+          _text.lines[_render.scanline]= _text.sig_gen;
+        }
+      skip= (render_panning () == 0);
+    }
+  else
+    {
+      sigs= NULL;
+      skip= false;
+    }
+  
+  // Pinta
+  x= _render.H*dotsperchar;
+  p= &_render.line[x];
+  run= 0; // Cel·les pintades pendents de passar al framebuffer
+  for ( i= 0; i < chars; ++i, p+= dotsperchar )
     {
-
-      // NOTA!! Aparentment en text mode s'accedeixen a posicions
-      // parelles.  O millor dit, l'adreça és multiplica per 2 (no sé
-      // per què), açò també afecta a l'adreça del cursor.
+      
       // Obté índex/atribut
+      cell= _render.H+i;
       pos= render_addr2pos ( off+i, scanline_src );
       index= _vga_mem.p[0][pos];
       attr= _vga_mem.p[1][pos];
@@ -3947,79 +6630,66 @@ render_chars_text (
       // Obté colors
       if ( _regs.AR.attr_ctrl_mode.blink_enabled )
         {
-          get_color_palette ( (attr>>4)&0x7, &r_bg, &g_bg, &b_bg );
-          if ( (attr&0x80)!=0 && _render.blink )
-            { r_fg= r_bg; g_fg= g_bg; b_fg= b_bg; }
-          else
-            get_color_palette ( attr&0xF, &r_fg, &g_fg, &b_fg );
+          bg= (attr>>4)&0x7;
+          fg= ((attr&0x80)!=0 && _render.blink) ? bg : (attr&0xF);
         }
       else
         {
-          get_color_palette ( attr>>4, &r_bg, &g_bg, &b_bg );
-          get_color_palette ( attr&0xF, &r_fg, &g_fg, &b_fg );
+          bg= attr>>4;
+          fg= attr&0xF;
         }
-
-      // Prepara informació cursor
-      if ( !_regs.CR.text_cursor_start.text_cursor_disabled )
+      _render.pixel_bus= _regs.AR.pal[fg];
+      
+      // Signatura: cursor o subratllat (tot fg) o fila d'un glif.
+      key= 0;
+      if ( (!_regs.CR.text_cursor_start.text_cursor_disabled &&
+            !_render.blink &&
+            cursor_pos == pos &&
+            _regs.CR.text_cursor_start.text_cursor_start <= char_y &&
+            char_y <= _regs.CR.text_cursor_end.text_cursor_end) ||
+           ((attr&0x77) == 0x01 &&
+            ((int) _regs.CR.underline_scanline.underline_scanline) == char_y) )
+        sig= 0xC0000000 | (((uint32_t) fg)<<8);
+      else
         {
-          cursor_pos=
-            ((int)
-             ((((uint32_t) _regs.CR.text_cursor_locH)) |
-              ((uint32_t) _regs.CR.text_cursor_locL))) +
-            ((int) (_regs.CR.text_cursor_end.text_cursor_skew))*2; // odd/even
-          cursor_pos= render_addr2pos ( cursor_pos, scanline_src );
+          key=
+            0x80000000 | ((uint32_t) index) |
+            (((uint32_t) fg)<<8) | (((uint32_t) bg)<<12) |
+            (((uint32_t) (((attr&0x08)!=0) ?
+                          _regs.SR.char_map.secondary_map :
+                          _regs.SR.char_map.primary_map))<<16) |
+            (_regs.AR.attr_ctrl_mode.line_graphics_enabled ? 0x00080000 : 0);
+          sig= key | (((uint32_t) char_y)<<20);
         }
-      else cursor_pos= 0;
+      if ( dotsperchar == 9 ) sig|= 0x02000000;
       
-      // Pinta cursor si cal
-      if ( !_regs.CR.text_cursor_start.text_cursor_disabled &&
-           !_render.blink &&
-           cursor_pos == pos &&
-           _regs.CR.text_cursor_start.text_cursor_start <= char_y &&
-           char_y <= _regs.CR.text_cursor_end.text_cursor_end )
+      // Cel·la sense canvis.
+      if ( skip && cell < TEXT_COLS && sigs[cell] == sig )
         {
-          for ( j= 0; j < dotsperchar; ++j, ++p )
-            { p->r= r_fg; p->g= g_fg; p->b= b_fg; }
+          if ( run > 0 )
+            {
+              render_store ( x+(i-run)*dotsperchar, run*dotsperchar );
+              run= 0;
+            }
+          continue;
         }
-      // Pinta subrallat si és el cas
-      else if ( (attr&0x77) == 0x01 &&
-           ((int) _regs.CR.underline_scanline.underline_scanline) == char_y )
+      
+      // Pinta cel·la
+      if ( key == 0 )
         {
-          for ( j= 0; j < dotsperchar; ++j, ++p )
-            { p->r= r_fg; p->g= g_fg; p->b= b_fg; }
+          color= _render.ar_pal[fg];
+          for ( j= 0; j < dotsperchar; ++j )
+            p[j]= color;
         }
-      // Pinta contingut
       else
-        {
-
-          // Obté patró
-          p2_offset= PLANE2_OFFSETS[((attr&0x08)!=0) ?
-                                    _regs.SR.char_map.secondary_map :
-                                    _regs.SR.char_map.primary_map];
-          p2_offset+= ((int) index)*32 + char_y;
-          pattern= _vga_mem.p[2][p2_offset];
-            
-          // Dibuixa
-          // --> Patró (8 bits)
-          for ( j= 0; j < 8; ++j, ++p )
-            {
-              if ( (pattern&0x80) != 0 ) { p->r= r_fg; p->g= g_fg; p->b= b_fg; }
-              else                       { p->r= r_bg; p->g= g_bg; p->b= b_bg; }
-              pattern<<= 1;
-            }
-          // --> Bit 9 si cal
-          if ( dotsperchar == 9 )
-            {
-              if ( _regs.AR.attr_ctrl_mode.line_graphics_enabled &&
-                   index >= 0xc0 && index <= 0xdf )
-                *p= *(p-1);
-              else { p->r= r_bg; p->g= g_bg; p->b= b_bg; }
-              ++p;
-            }
-          
-        }
+        memcpy ( p, render_glyph_row ( key, char_y ),
+                 dotsperchar*sizeof(uint32_t) );
+      if ( sigs != NULL && cell < TEXT_COLS ) sigs[cell]= sig;
+      ++run;
       
     }
+  if ( run > 0 )
+    render_store ( x+(chars-run)*dotsperchar, run*dotsperchar );
   
 } // end render_chars_text
 
@@ -4031,10 +6701,11 @@ render_chars_planar (
                      )
 {
   
-  int bytesperline,off,i,pos,j,tmp,bytes_H,off_H,height,
-    scanline_src;
-  uint8_t b0,b1,b2,b3,color;
-  PC_RGB *p;
+  int bytesperline,off,i,pos,tmp,bytes_H,off_H,height,scanline_src,n,
+    nbytes;
+  uint64_t mask,v;
+  const uint8_t *idx;
+  uint32_t *p;
   
   
   // Comprovacions
@@ -4057,38 +6728,33 @@ render_chars_planar (
   tmp= _render.H*dotsperchar;
   bytes_H= tmp>>3; off_H= tmp&0x7;
   off= _render.start_addr + (scanline_src/height)*bytesperline + bytes_H;
-  p= &_render.fb[_render.scanline*FB_WIDTH + _render.H*dotsperchar];
+  p= &_render.line[tmp];
+  n= chars*dotsperchar;
+  if ( n <= 0 ) return;
+  
+  // Índexs. Cada byte de VRAM són 8 píxels, els primers 'off_H' no
+  // es pinten.
+  mask= 0x0101010101010101ULL*(_regs.AR.color_plane.enable&0xF);
+  nbytes= (off_H+n+7)>>3;
+  for ( i= 0; i < nbytes; ++i )
+    {
+      pos= render_addr2pos ( off+i, scanline_src );
+      v=
+        _planar_expand[_vga_mem.p[0][pos]] |
+        (_planar_expand[_vga_mem.p[1][pos]]<<1) |
+        (_planar_expand[_vga_mem.p[2][pos]]<<2) |
+        (_planar_expand[_vga_mem.p[3][pos]]<<3);
+      v&= mask;
+      memcpy ( &_render.idx[i<<3], &v, sizeof(v) );
+    }
+  idx= &_render.idx[off_H];
   
   // Dibuixa
-  // --> Llig primer byte.
-  pos= render_addr2pos ( off, scanline_src );
-  b0= _vga_mem.p[0][pos]<<off_H;
-  b1= _vga_mem.p[1][pos]<<off_H;
-  b2= _vga_mem.p[2][pos]<<off_H;
-  b3= _vga_mem.p[3][pos]<<off_H;
-  // --> Itera
-  for ( i= 0; i < chars; ++i )
-    for ( j= 0; j < dotsperchar; ++j, ++p )
-      {
-
-        // Pinta píxel
-        color= (b0>>7)|((b1&0x80)>>6)|((b2&0x80)>>5)|((b3&0x80)>>4);
-        color&= _regs.AR.color_plane.enable;
-        get_color_palette ( color, &(p->r), &(p->g), &(p->b) );
-        
-        // Següent pixel
-        if ( ++off_H == 8 )
-          {
-            pos= render_addr2pos ( ++off, scanline_src );
-            b0= _vga_mem.p[0][pos];
-            b1= _vga_mem.p[1][pos];
-            b2= _vga_mem.p[2][pos];
-            b3= _vga_mem.p[3][pos];
-            off_H= 0;
-          }
-        else { b0<<= 1; b1<<= 1; b2<<= 1; b3<<= 1; }
-        
-      }
+  if ( _render.pal_dirty || _render.ar_pal_dirty ) render_update_ar_pal ();
+  for ( i= 0; i < n; ++i )
+    p[i]= _render.ar_pal[idx[i]];
+  _render.pixel_bus= _regs.AR.pal[idx[n-1]];
+  render_store ( tmp, n );
   
 } // end render_chars_planar
 
@@ -4104,7 +6770,7 @@ render_chars_packed (
     scanline_src;
   uint8_t b0,b2,color,plane_enable_02,plane_enable_13,plane_enable;
   bool pair_02;
-  PC_RGB *p;
+  uint32_t *p;
   
   
   // Comprovacions
@@ -4125,7 +6791,7 @@ render_chars_packed (
   if ( off_H >= 4 ) { off_H-= 4; pair_02= false; }
   else              pair_02= true;
   off= _render.start_addr + (scanline_src/height)*bytesperline + bytes_H;
-  p= &_render.fb[_render.scanline*FB_WIDTH + _render.H*dotsperchar];
+  p= &_render.line[_render.H*dotsperchar];
   // --> Plane enable
   plane_enable_02=
     ((_regs.AR.color_plane.enable&0x1)!=0 ? 0x3 : 0x0) |
@@ -4149,7 +6815,7 @@ render_chars_packed (
         // Pinta píxel
         color= (b0>>6)|((b2&0xC0)>>4);
         color&= plane_enable;
-        get_color_palette ( color, &(p->r), &(p->g), &(p->b) );
+        *p= get_color_palette ( color );
         
         // Següent pixel
         if ( ++off_H == 4 )
@@ -4174,6 +6840,7 @@ render_chars_packed (
         else { b0<<= 2; b2<<= 2; }
         
       }
+  render_store ( _render.H*dotsperchar, chars*dotsperchar );
   
 } // end render_chars_packed
 
@@ -4186,10 +6853,9 @@ render_chars_256color (
 {
   
   int bytesperline,off,i,pos,j,tmp,bytes_H,off_H,height,
-    scanline_src;
-  uint8_t plane,color;
+    scanline_src,n,x;
+  uint8_t plane;
   bool even;
-  PC_RGB *p;
   
   
   // Comprovacions
@@ -4214,7 +6880,7 @@ render_chars_256color (
   even= (off_H&0x1)==0;
   plane= off_H>>1;
   off= _render.start_addr + (scanline_src/height)*bytesperline + bytes_H;
-  p= &_render.fb[_render.scanline*FB_WIDTH + ((_render.H*dotsperchar)>>1)];
+  x= (_render.H*dotsperchar)>>1;
   // NOTA!!! Pixel Double Clock Select --> Palette registers, AR0–ARF,
   // are bypassed. Per tant, deduisc que el plane enable ací no té efecte.
   
@@ -4222,15 +6888,14 @@ render_chars_256color (
   // --> Inicialitza pos
   pos= render_addr2pos ( off, scanline_src );
   // --> Itera
+  n= 0;
   for ( i= 0; i < chars; ++i )
     for ( j= 0; j < dotsperchar; ++j )
       if ( !even ) // odd
         {
           
-          // Pinta píxel
-          color= _vga_mem.p[plane][pos];
-          get_color_dac ( color, &(p->r), &(p->g), &(p->b) );
-          ++p;
+          // Píxel
+          _render.idx[n++]= _vga_mem.p[plane][pos];
           
           // Següent pixel
           if ( ++plane == 4 )
@@ -4242,20 +6907,28 @@ render_chars_256color (
           
         }
       else even= false;
+  // --> Pinta
+  render_lut8 ( x, _render.idx, n );
+  render_store ( x, n );
   
 } // end render_chars_256color
 
 
+// Localitza en la VRAM els píxels [x,x+n) de la scanline actual en
+// els modes estesos, on cada píxel ocupa 'bpp' bytes. Els que cauen
+// fora de la VRAM no es lligen (s->n < n).
 static void
-render_chars_vga_lut (
-                      const int chars,
-                      const int dotsperchar
-                      )
+render_ext_source (
+                   ext_src_t *s,
+                   const int  kind,
+                   const int  bpp,
+                   const int  x,
+                   const int  n
+                   )
 {
   
-  int bytesperline,off,i,j,tmp,height,scanline_src;
-  uint8_t color;
-  PC_RGB *p;
+  int bytesperline,height,scanline_src;
+  uint32_t off;
   
   
   // Obté offsets i valors
@@ -4265,105 +6938,126 @@ render_chars_vga_lut (
   height= ((int) _regs.CR.char_cell_height.char_cell_height) + 1;
   bytesperline= ((int) (_regs.CR.ext_disp_ctrl.offset_overflow |
                         (uint16_t) _regs.CR.offset))<<3;
-  tmp= _render.H*dotsperchar;
+  off= (uint32_t) (bpp*(_render.start_addr + x) +
+                   (scanline_src/height)*bytesperline);
   
-  // 1 pixel per byte
-  off= _render.start_addr + (scanline_src/height)*bytesperline + tmp;
-  p= &_render.fb[_render.scanline*FB_WIDTH + tmp];
-  
-  // Dibuixa
-  for ( i= 0; i < chars; ++i )
-    for ( j= 0; j < dotsperchar; ++j )
-      {
-        color= _vram[off++];
-        get_color_dac ( color, &(p->r), &(p->g), &(p->b) );
-        ++p;
-      }
+  // Retalla
+  s->kind= kind;
+  if ( off >= _vram_size )
+    {
+      s->src= _vram;
+      s->n= 0;
+    }
+  else
+    {
+      s->src= &_vram[off];
+      s->n= off + (uint32_t) (bpp*n) > _vram_size ?
+        (int) ((_vram_size-off)/(uint32_t) bpp) : n;
+    }
   
-} // end render_chars_vga_lut
+} // end render_ext_source
 
 
+// RGB555 amb 'control_32k_color_enabled'. Els píxels amb el bit 15
+// actiu són índexs del DAC, per tant es resolen ací en 'line' i la
+// font passa a ser PIX_XRGB.
 static void
-render_chars_rgb565 (
-                     const int chars,
-                     const int dotsperchar
-                     )
+render_ext_rgb555_32k (
+                       ext_src_t *s,
+                       const int  x
+                       )
 {
-  
-  int bytesperline,off,i,j,tmp,height,scanline_src;
+
+  const uint16_t *src;
+  uint32_t *p;
   uint16_t color;
-  PC_RGB *p;
+  int i;
   
   
-  // Obté offsets i valors
-  scanline_src=
-    _regs.CR.char_cell_height.scan_double ?
-    _render.scanline>>1 : _render.scanline;
-  height= ((int) _regs.CR.char_cell_height.char_cell_height) + 1;
-  bytesperline= ((int) (_regs.CR.ext_disp_ctrl.offset_overflow |
-                        (uint16_t) _regs.CR.offset))<<3;
-  tmp= _render.H*dotsperchar;
+  src= (const uint16_t *) s->src;
+  p= &_render.line[x];
+  for ( i= 0; i < s->n; ++i )
+    {
+      color= src[i];
+      if ( (color&0x8000) != 0 )
+        p[i]= get_color_dac ( (uint8_t) (color&0xFF) );
+      else PC_pixels_rgb555 ( &p[i], &color, 1 );
+    }
+  s->kind= PIX_XRGB;
+  s->src= (const uint8_t *) p;
+  
+} // end render_ext_rgb555_32k
+
+
+// Color estés del DAC (cursor gràfic).
+static uint32_t
+render_ext_color (
+                  const int i
+                  )
+{
+
+  uint8_t r,g,b;
+
   
-  // 1 pixel cada 2 bytes (1 uint16_t)
-  off= _render.start_addr + (scanline_src/height)*(bytesperline/2) + tmp;
-  p= &_render.fb[_render.scanline*FB_WIDTH + tmp];
+  r= _dac.ext[i][0]<<2;
+  g= _dac.ext[i][1]<<2;
+  b= _dac.ext[i][2]<<2;
   
-  // Dibuixa
-  for ( i= 0; i < chars; ++i )
-    for ( j= 0; j < dotsperchar; ++j )
-      {
-        color= ((const uint16_t *) _vram)[off++];
-        p->r= ((color>>11)&0x1F)<<3;
-        p->g= ((color>>5)&0x3F)<<2;
-        p->b= (color&0x1F)<<3;
-        ++p;
-      }
+  return (((uint32_t) r)<<16) | (((uint32_t) g)<<8) | b;
   
-} // end render_chars_rgb565
+} // end render_ext_color
 
 
-static void
-render_chars_rgb555 (
-                     const int chars,
-                     const int dotsperchar
-                     )
+// Copia en 'c' la fila del cursor gràfic (SR12,SR13) de la scanline
+// actual. Torna false si el cursor no toca els píxels [x0,x0+n).
+static bool
+render_cursor_prepare (
+                       cursor_t  *c,
+                       const int  x0,
+                       const int  n
+                       )
 {
-  
-  int bytesperline,off,i,j,tmp,height,scanline_src;
-  uint16_t color;
-  PC_RGB *p;
+
+  const uint8_t *p0,*p1;
+  int size,y;
+  uint32_t base;
   
   
-  // Obté offsets i valors
-  scanline_src=
-    _regs.CR.char_cell_height.scan_double ?
-    _render.scanline>>1 : _render.scanline;
-  height= ((int) _regs.CR.char_cell_height.char_cell_height) + 1;
-  bytesperline= ((int) (_regs.CR.ext_disp_ctrl.offset_overflow |
-                        (uint16_t) _regs.CR.offset))<<3;
-  tmp= _render.H*dotsperchar;
+  // Fila del cursor
+  size= _regs.SR.r12.cursor_size_is_32x32 ? 32 : 64;
+  y= _render.scanline - _regs.SR.cursor_y;
+  if ( y < 0 || y >= size ) return false;
+  if ( x0 >= _regs.SR.cursor_x+size || x0+n <= _regs.SR.cursor_x )
+    return false;
   
-  // 1 pixel cada 2 bytes (1 uint16_t)
-  off= _render.start_addr + (scanline_src/height)*(bytesperline/2) + tmp;
-  p= &_render.fb[_render.scanline*FB_WIDTH + tmp];
+  // Patró. Està en els últims 16K de la memòria de vídeo. En 32x32
+  // el planol 1 va 128 bytes després del 0, en 64x64 cada fila té 8
+  // bytes del planol 0 seguits de 8 bytes del planol 1.
+  base= _vram_size-16*1024;
+  if ( size == 32 )
+    {
+      base+= ((uint32_t) (_regs.SR.r13_cursor_pat_addr_off&0x3F))*256;
+      p0= &_vram[base + y*4];
+      p1= p0 + 128;
+    }
+  else
+    {
+      base+= ((uint32_t) (_regs.SR.r13_cursor_pat_addr_off&0x3C))*256;
+      p0= &_vram[base + y*16];
+      p1= p0 + 8;
+    }
+  c->x= _regs.SR.cursor_x;
+  c->size= size;
+  memcpy ( c->p0, p0, size/8 );
+  memcpy ( c->p1, p1, size/8 );
   
-  // Dibuixa
-  for ( i= 0; i < chars; ++i )
-    for ( j= 0; j < dotsperchar; ++j )
-      {
-        color= ((const uint16_t *) _vram)[off++];
-        if ( _regs.hdr.control_32k_color_enabled && (color&0x8000) != 0 )
-          get_color_dac ( (uint8_t) (color&0xFF) , &(p->r), &(p->g), &(p->b) );
-        else
-          {
-            p->r= ((color>>10)&0x1F)<<3;
-            p->g= ((color>>5)&0x1F)<<3;
-            p->b= (color&0x1F)<<3;
-          }
-        ++p;
-      }
+  // Colors
+  c->bg= render_ext_color ( 0 );
+  c->fg= render_ext_color ( 15 );
+
+  return true;
   
-} // end render_chars_rgb555
+} // end render_cursor_prepare
 
 
 static void
@@ -4373,6 +7067,14 @@ render_chars_extended_modes (
                              )
 {
 
+  ext_src_t s;
+  cursor_t cursor;
+  bool has_cursor;
+  int x,n;
+  
+  
+  x= _render.H*dotsperchar;
+  n= chars*dotsperchar;
   if ( _regs.hdr.mode_555_enabled )
     {
       if ( _regs.hdr.all_ext_modes_enabled )
@@ -4381,11 +7083,19 @@ render_chars_extended_modes (
             {
               switch ( _regs.hdr.ext_mode )
                 {
-                case 0: render_chars_rgb555 ( chars, dotsperchar ); break;
-                case 1: render_chars_rgb565 ( chars, dotsperchar ); break;
+                case 0:
+                  render_ext_source ( &s, PIX_RGB555, 2, x, n );
+                  if ( _regs.hdr.control_32k_color_enabled )
+                    render_ext_rgb555_32k ( &s, x );
+                  break;
+                case 1: render_ext_source ( &s, PIX_RGB565, 2, x, n ); break;
                 default: goto todo;
                 }
             }
+          else if ( _regs.SR.r7.srt == 0x02 && _regs.hdr.ext_mode == 5 )
+            render_ext_source ( &s, PIX_RGB888, 3, x, n );
+          else if ( _regs.SR.r7.srt == 0x04 && _regs.hdr.ext_mode == 5 )
+            render_ext_source ( &s, PIX_XRGB8888, 4, x, n );
           else goto todo;
         }
       else
@@ -4396,10 +7106,29 @@ render_chars_extended_modes (
   else
     {
       if ( _regs.SR.r7.srt == 0x00 && !_regs.hdr.clocking_mode_is_1 )
-        render_chars_vga_lut ( chars, dotsperchar );
+        {
+          render_ext_source ( &s, PIX_LUT8, 1, x, n );
+          if ( s.n > 0 ) _render.pixel_bus= s.src[s.n-1];
+        }
       else goto todo;
     }
 
+  // Cursor gràfic.
+  has_cursor=
+    _regs.SR.r12.cursor_enable && render_cursor_prepare ( &cursor, x, n );
+
+  // Converteix.
+  if ( _thread.enabled )
+    thread_send_pixels ( x, n, &s, has_cursor ? &cursor : NULL );
+  else
+    {
+      if ( _render.pal_dirty ) render_update_pal ();
+      render_convert ( &_render.line[x], s.kind, s.src, s.n, n,
+                       _render.pal );
+      if ( has_cursor ) render_cursor_apply ( _render.line, x, n, &cursor );
+      render_store ( x, n );
+    }
+  
   // Pot sobreescriure part de la línia.
   // IMPORTANT!!! En realitat si s'activa, té efecte en el VSYNC. Quan
   // s'active ja ho canviaré ficant un camp en _render.
@@ -4424,6 +7153,54 @@ render_chars_extended_modes (
 } // end render_chars_extended_modes
 
 
+// Renderitza la part visible.
+static void
+render_chars_display (
+                      const int chars,
+                      const int dotsperchar
+                      )
+{
+
+  if ( !_regs.GR.misc.apa_mode )
+    render_chars_text ( chars, dotsperchar );
+  else if ( !_regs.GR.mode.color256 )
+    {
+      if ( !_regs.GR.mode.shift_reg_mode_is_1 )
+        render_chars_planar ( chars, dotsperchar );
+      else
+        render_chars_packed ( chars, dotsperchar );
+    }
+  else
+    {
+      if ( !_regs.SR.r7.extended_display_modes_enabled )
+        render_chars_256color ( chars, dotsperchar );
+      else
+        render_chars_extended_modes ( chars, dotsperchar );
+    }
+  
+} // end render_chars_display
+
+
+// Renderitza els trossos pendents de la scanline actual.
+static void
+render_flush (void)
+{
+
+  int H;
+
+  
+  if ( _render.batch_chars == 0 ) return;
+  H= _render.H;
+  _render.H= _render.batch_H;
+  render_chars_display ( _render.batch_chars, _render.batch_dotsperchar );
+  _render.H= H;
+  _render.batch_chars= 0;
+  
+} // end render_flush
+
+
+// Els trossos visibles no es renderitzen directament, s'acumulen fins
+// a render_flush.
 static void
 render_chars (
               const int chars,
@@ -4432,21 +7209,57 @@ render_chars (
 {
 
   int end_vdisplay,end_hdisplay;
+  bool display;
 
   
   if ( chars == 0 ) return;
 
-  // Cada vegada que s'intenta renderitzar algo es fica el pixel_bus a
-  // 0 i si finalment es renderitza alguna cosa es modifica. Açò en
-  // realitat no és molt important.
-  _render.pixel_bus= 0x00;
+  // Frame botat.
+  if ( !_frames.render )
+    {
+      _render.pixel_bus= 0x00;
+      return;
+    }
   
   // NOTA!! No vaig a pintar el overscan però ja que hi ha color ho
   // pinte.
   end_vdisplay= ((int) (_regs.CR.overflow.vertical_display_end |
                         _regs.CR.vertical_display_end)) + 1;
   end_hdisplay= ((int) _regs.CR.horizontal_display_end) + 1;
-  if ( !_regs.AR.display_enabled )
+  display=
+    _regs.AR.display_enabled &&
+    !_render.in_vblank && !_render.in_vretrace &&
+    _render.V < end_vdisplay &&
+    !_render.in_hblank && !_render.in_hretrace &&
+    _render.H < end_hdisplay;
+  
+  // Si no és continuació del pendent el renderitza abans.
+  if ( _render.batch_chars > 0 &&
+       (!display ||
+        _render.batch_H+_render.batch_chars != _render.H ||
+        _render.batch_dotsperchar != dotsperchar) )
+    render_flush ();
+  
+  // Cada vegada que s'intenta renderitzar algo es fica el pixel_bus a
+  // 0 i si finalment es renderitza alguna cosa es modifica. Açò en
+  // realitat no és molt important.
+  _render.pixel_bus= 0x00;
+
+  // Scanlines que no han canviat des de l'últim frame.
+  if ( _damage.cur_line != _render.scanline )
+    damage_begin_line ( dotsperchar );
+  if ( !_damage.cur_dirty ) return;
+  
+  if ( display )
+    {
+      if ( _render.batch_chars == 0 )
+        {
+          _render.batch_H= _render.H;
+          _render.batch_dotsperchar= dotsperchar;
+        }
+      _render.batch_chars+= chars;
+    }
+  else if ( !_regs.AR.display_enabled )
     render_chars_overscan ( chars, dotsperchar );
   else if ( _render.in_vblank || _render.in_vretrace )
     {
@@ -4462,61 +7275,42 @@ render_chars (
       // pantalla visible.
       if ( _render.H < end_hdisplay ) render_chars_black ( chars, dotsperchar );
     }
-  else if ( _render.H >= end_hdisplay )
+  else // _render.H >= end_hdisplay
     render_chars_overscan ( chars, dotsperchar );
-  else if ( !_regs.GR.misc.apa_mode )
-    render_chars_text ( chars, dotsperchar );
-  else if ( !_regs.GR.mode.color256 )
-    {
-      if ( !_regs.GR.mode.shift_reg_mode_is_1 )
-        render_chars_planar ( chars, dotsperchar );
-      else
-        render_chars_packed ( chars, dotsperchar );
-    }
-  else
-    {
-      if ( !_regs.SR.r7.extended_display_modes_enabled )
-        render_chars_256color ( chars, dotsperchar );
-      else
-        render_chars_extended_modes ( chars, dotsperchar );
-    }
     
 } // end render_chars
 
 
-// Torna cicles (dot clocks) pendents
+// Calcula el següent event horitzontal a partir de la posició actual.
 static int
-run_render__ (
-              int       dots,
-              const int dotsperchar
-              )
+calc_next_event_H (
+                   int *end_scanline_,
+                   int *next_event_hblank_,
+                   int *next_event_hretrace_
+                   )
 {
-  
+
   int end_scanline,next_event_H,end_display,next_event_hblank,
-    next_event_hretrace,available_dots,required_dots,ret,new_H,tmp,
-    width,height;
+    next_event_hretrace;
   uint8_t tmp8;
   
   
-  // Calcula següent event horizontal (next_event_H)
   // NOTA!! end_h vol dir que apleguem a que _render.H= next_event_H però el
   // comptador de dots està a 0, és a dir, estem al principi del
   // caràcter next_event_H.
   // --> scanline end
-  end_scanline= ((int) _regs.CR.horizontal_total) + 5;
+  end_scanline= _crtc.end_scanline;
   // Açò és per si modifiquen paràmetres a meitat renderitzat.
   if ( end_scanline <= _render.H ) end_scanline= _render.H+1;
   next_event_H= end_scanline;
   // --> display end
-  end_display= ((int) _regs.CR.horizontal_display_end) + 1;
+  end_display= _crtc.end_hdisplay;
   if ( end_display < next_event_H && end_display > _render.H )
     next_event_H= end_display;
   // --> horizontal blanking
   if ( _render.in_hblank )
     {
-      tmp8= // 6 bits
-        _regs.CR.horizontal_blanking_end.horizontal_blanking_end |
-        _regs.CR.horizontal_sync_end.horizontal_blanking_end;
+      tmp8= _crtc.hblank_end;
       next_event_hblank= (int) ((_render.H&(~0x3F))|tmp8);
       if ( (_render.H&0x3F) >= tmp8 ) next_event_hblank+= 0x40;
       // NOTA!! No queda clar si pot passar de línia o no. El manual
@@ -4530,27 +7324,48 @@ run_render__ (
       // de línia i sols mostra mitja pantalla. Així que...
       if ( next_event_hblank > end_scanline ) next_event_hblank= end_scanline;
     }
-  else next_event_hblank= (int) _regs.CR.horizontal_blanking_start;
+  else next_event_hblank= _crtc.hblank_start;
   if ( next_event_hblank < next_event_H && next_event_hblank > _render.H )
     next_event_H= next_event_hblank;
   // --> horizontal retracing
   if ( _render.in_hretrace )
     {
-      tmp8= // 5 bits
-        _regs.CR.horizontal_sync_end.horizontal_sync_end;
+      tmp8= _crtc.hretrace_end;
       next_event_hretrace= (int) ((_render.H&(~0x1F))|tmp8);
       if ( (_render.H&0x1F) >= tmp8 ) next_event_hretrace+= 0x20;
       // Repetisc jugada
       if ( next_event_hretrace > end_scanline )
         next_event_hretrace= end_scanline;
     }
-  else
-    next_event_hretrace=
-      (int) (_regs.CR.horizontal_sync_start +
-             _regs.CR.horizontal_sync_end.horizontal_sync_delay);
+  else next_event_hretrace= _crtc.hretrace_start;
   if ( next_event_hretrace < next_event_H && next_event_hretrace > _render.H )
     next_event_H= next_event_hretrace;
   
+  *end_scanline_= end_scanline;
+  *next_event_hblank_= next_event_hblank;
+  *next_event_hretrace_= next_event_hretrace;
+  
+  return next_event_H;
+  
+} // end calc_next_event_H
+
+
+// Torna cicles (dot clocks) pendents
+static int
+run_render__ (
+              int       dots,
+              const int dotsperchar
+              )
+{
+  
+  int end_scanline,next_event_H,next_event_hblank,next_event_hretrace,
+    available_dots,required_dots,ret,new_H,width,height;
+  
+  
+  // Calcula següent event horizontal (next_event_H)
+  next_event_H= calc_next_event_H ( &end_scanline, &next_event_hblank,
+                                    &next_event_hretrace );
+  
   // Processa els ciles
   available_dots= _render.char_dots + dots;
   assert ( _render.H < next_event_H );
@@ -4583,9 +7398,12 @@ run_render__ (
       if ( new_H == end_scanline )
         {
 
-          // Aplica panning
-          if ( !_render.in_vblank && !_render.in_vretrace )
+          // Aplica panning (sols si s'ha renderitzat la scanline)
+          render_flush ();
+          if ( !_render.in_vblank && !_render.in_vretrace &&
+               _damage.cur_line == _render.scanline && _damage.cur_dirty )
             render_apply_panning ();
+          thread_poll ();
           
           // Reseteja H.
           new_H= 0;
@@ -4614,76 +7432,59 @@ run_render__ (
             }
           else
             {
-              tmp=
-                (int ) (_regs.CR.char_cell_height.vertical_blank_start |
-                        _regs.CR.overflow.vertical_blanking_start |
-                        _regs.CR.vertical_blank_start);
               /* // IMPLEMENTACIÓ ANTIGA!!! COMPTE!!!
-              if ( _render.V == tmp ) _render.in_vblank= true;
+              if ( _render.V == _crtc.vblank_start ) _render.in_vblank= true;
               */
               // IMPLEMENTACIÓ ASSUMINT QUE EL END ÉS WIDTH!!!
-              if ( _render.V == tmp )
+              if ( _render.V == _crtc.vblank_start )
                 {
                   _render.in_vblank= true;
-                  _render.vblank_end= tmp;
-                  tmp= (int) _regs.CR.vertical_blank_end;
-                  if ( _regs.CR.ext_disp_ctrl.blanking_control_is_1 ||
-                       _regs.CR.ext_disp_ctrl.blank_end_extensions_enabled )
-                    tmp|= (int) _regs.CR.misc_ctrl.vblank_end;
-                  _render.vblank_end+= tmp;
+                  _render.vblank_end= _crtc.vblank_start + _crtc.vblank_width;
                 }
             }
           // --> vretrace
           if ( _render.in_vretrace )
             {
-              if ( (_render.V&0xF) ==
-                   _regs.CR.vertical_sync_end.vertical_sync_end )
+              if ( (_render.V&0xF) == _crtc.vretrace_end )
                 _render.in_vretrace= false;
             }
-          else
+          else if ( _render.V == _crtc.vretrace_start )
             {
-              tmp=
-                (int) (_regs.CR.overflow.vertical_retrace_start |
-                       _regs.CR.vertical_sync_start);
-              if ( _render.V == tmp )
-                {
-                  _render.start_addr= (int)
-                    (_regs.CR.ov_ext_ctrl.screen_start_a_addr |
-                     _regs.CR.ext_disp_ctrl.screen_start_a_addr |
-                     _regs.CR.ext_disp_ctrl.ext_disp_start_addr |
-                     ((uint32_t) _regs.CR.screen_start_a_addrH) |
-                     ((uint32_t) _regs.CR.screen_start_a_addrL));
-                  _render.in_vretrace= true;
-                }
+              _render.start_addr= _crtc.start_addr;
+              _render.in_vretrace= true;
             }
           // --> display end
-          tmp=
-            ((int) (_regs.CR.overflow.vertical_display_end |
-                    _regs.CR.vertical_display_end)) + 1;
-          if ( _render.V == tmp )
+          if ( _render.V == _crtc.end_vdisplay )
             {
-              width= end_display*dotsperchar;
-              // NOTA!!! Açò és una nyapa. No tinc clar què fer quan
-              // els modes extended estan activats. Però en el FIFA96
-              // no es veu bé si s'aplica açò amb el mode activat.
-              if ( _regs.AR.attr_ctrl_mode.pixel_double_clock &&
-                   !_regs.SR.r7.extended_display_modes_enabled )
-                width/= 2;
-              height= tmp;
-              _update_screen ( _udata, _render.fb, width, height, FB_WIDTH );
+              crtc_display_size ( &width, &height );
+              if ( _frames.render )
+                {
+                  damage_update_screen ( width, height );
+                  ++_frames.rendered;
+                }
+              else ++_frames.skipped;
             }
           // --> Última scanline
-          tmp=
-            ((int) (_regs.CR.overflow.vertical_total |
-                    _regs.CR.vertical_total)) + 2;
-          if ( _render.V == tmp || _render.scanline >= 2048 )
+          if ( _render.V == _crtc.last_V || _render.scanline >= 2048 )
             {
               _render.V= 0;
               _render.scanline= 0;
+              _damage.cur_line= -1;
+              frames_next ();
+              // El framebuffer s'ajusta a la geometria actual abans de
+              // renderitzar el frame, no quan ja s'ha retallat.
+              crtc_display_size ( &width, &height );
+              if ( _frames.render &&
+                   (width != _render.fb_width || height != _render.fb_height) )
+                {
+                  thread_drain ();
+                  fb_resize ( width, height );
+                }
               if ( ++_render.blink_counter == 16 )
                 {
                   _render.blink_counter= 0;
                   _render.blink= !_render.blink;
+                  ++_damage.gen;
                 }
               // IMPLEMENTACIÓ NOVA!!!
               _render.in_vblank= false;
@@ -4711,7 +7512,7 @@ run_render (
   int dotsperchar,tmp,ret;
 
 
-  dotsperchar= _regs.SR.clocking_mode.dot_clock_8_9 ? 8 : 9;
+  dotsperchar= _crtc.dotsperchar;
   tmp= _render.char_dots + dots;
   if ( tmp < dotsperchar ) // Cas ràpid
     {
@@ -4726,23 +7527,28 @@ run_render (
 
 
 static void
-clock (
+svga_clock (
          const bool update_cc2event
          )
 {
 
   int cc,vcc;
-  long tmp;
+  uint64_t tmp;
   
   
   // Processa cicles
   cc= PC_Clock-_timing.cc_used;
-  if ( cc > 0 ) { _timing.cc+= cc; _timing.cc_used+= cc; }
+  if ( cc > 0 )
+    {
+      _timing.cc+= cc;
+      _timing.cc_used+= cc;
+      _timing.cc_total+= cc;
+    }
   
   // Processa cicles
-  tmp= ((long) _timing.cc)*_timing.cc_mul + _timing.vcc_tmp;
-  vcc= (int) (tmp / _timing.cc_div);
-  _timing.vcc_tmp= tmp % _timing.cc_div;
+  tmp= ((uint64_t) _timing.cc)*_timing.dpc + _timing.vfrac;
+  vcc= (int) (tmp>>32);
+  _timing.vfrac= tmp&0xFFFFFFFF;
   _timing.cc= 0;
   while ( vcc > 0 )
     vcc= run_render ( vcc );
@@ -4751,7 +7557,7 @@ clock (
   if ( update_cc2event )
     update_cc_to_event ();
 
-} // end clock
+} // end svga_clock
 
 
 
@@ -4764,6 +7570,11 @@ PC_Error
 PC_svga_cirrus_clgd5446_init (
                               PC_Warning            *warning,
                               PC_UpdateScreen       *update_screen,
+                              PC_UpdateScreenDamage *update_screen_damage,
+                              const PC_FBFormat      fb_format,
+                              const bool             render_thread,
+                              const bool             fast_retrace,
+                              const uint32_t         vram_size,
                               PC_VGAMemAccess       *vga_mem_access,
                               PC_VGAMemLinearAccess *vga_mem_linear_access,
                               uint8_t               *optrom,
@@ -4774,10 +7585,12 @@ PC_svga_cirrus_clgd5446_init (
   
   _warning= warning;
   _update_screen= update_screen;
+  _update_screen_damage= update_screen_damage;
   _vga_mem_access= vga_mem_access;
   _vga_mem_linear_access= vga_mem_linear_access;
   _udata= udata;
   _trace_enabled= false;
+  _lfb_map.N= 0;
 
   // BIOS. Segons el manual la bios es de 32K pero la de SeaBIOS és
   // més gran (38K).
@@ -4790,17 +7603,47 @@ PC_svga_cirrus_clgd5446_init (
   _bios.size_3= optrom_size-3;
   _bios.size_7= optrom_size-7;
 
+  // Conversió de píxels.
+  PC_pixels_init ();
+  _render.fb_format= fb_format;
+  _render.fb_psize= PC_pixels_size ( fb_format );
+  if ( _render.fb_psize == 0 ) return PC_BAD_FB_FORMAT;
+  
   // Timing.
   _timing.cc_used= 0;
   _timing.cc= 0;
   _timing.cctoEvent= 0;
   assert ( PC_ClockFreq%100 == 0 ); // gaste MHz*10000
   _timing.cc_div= (long) (PC_ClockFreq/100);
-  _timing.cc_mul= 1; // La primera vegada no importa molt, però és necessari
-  _timing.vcc_tmp= 0;
+  _timing.cc_mul= 1; // Es calcula en update_vclk
+  _timing.vfrac= 0;
+  _timing.cc_total= 0;
+
+  // Registre d'estat.
+  _stat.horizon= 0;
+  _stat.fast_retrace= fast_retrace;
+  _stat.last_cc= 0;
+  _stat.period= 0;
+  _stat.nreps= 0;
+  _stat.last_ret= 0x00;
+  
+  // VRAM.
+  assert ( vram_size >= 1024*1024 && vram_size <= VRAM_MAX_SIZE &&
+           (vram_size&(vram_size-1)) == 0 );
+  thread_stop ();
+  if ( _vram == NULL || vram_size != _vram_size )
+    {
+      free ( _vram );
+      _vram= (uint8_t *) malloc ( vram_size );
+      if ( _vram == NULL ) return PC_NOMEM;
+      _vram_size= vram_size;
+      _vram_mask= vram_size-1;
+    }
   
   // Rendering
-  memset ( _render.fb, 0, sizeof(_render.fb) );
+  shm_close ();
+  fb_free ();
+  if ( !fb_resize ( FB_INIT_WIDTH, FB_INIT_HEIGHT ) ) return PC_NOMEM;
   _render.H= 0;
   _render.V= 0;
   _render.char_dots= 0;
@@ -4813,9 +7656,21 @@ PC_svga_cirrus_clgd5446_init (
   _render.blink_counter= 0;
   _render.pixel_bus= 0x00;
   _render.start_addr= 0;
+  _render.batch_chars= 0;
+  _frames.skip= 1;
+  _frames.counter= 0;
+  _frames.requested= false;
+  _frames.render= true;
+  _frames.rendered= 0;
+  _frames.skipped= 0;
+  init_planar_expand ();
+  init_damage ();
+
+  // Fil de rasterització.
+  if ( render_thread ) thread_start ();
   
   // Altres
-  memset ( _vram, 0, sizeof(_vram) );
+  memset ( _vram, 0, _vram_size );
   init_pci_regs ();
   init_regs ();
 
@@ -4827,8 +7682,114 @@ PC_svga_cirrus_clgd5446_init (
 } // end PC_svga_cirrus_clgd5446_init
 
 
+void
+PC_svga_cirrus_clgd5446_close (void)
+{
+  
+  thread_stop ();
+  shm_close ();
+  fb_free ();
+  free ( _vram );
+  _vram= NULL;
+  
+} // end PC_svga_cirrus_clgd5446_close
+
+
+int
+PC_svga_cirrus_clgd5446_export_shm (
+                                    const char *name
+                                    )
+{
+
+  size_t hdr_size,buf_size;
+  void *mem;
+  int fd;
+  
+  
+  // Obri la memòria.
+  thread_drain ();
+  shm_close ();
+  if ( name == NULL ) fd= memfd_create ( "PC_svga_fb", MFD_CLOEXEC );
+  else fd= shm_open ( name, O_CREAT|O_RDWR|O_TRUNC, 0600 );
+  if ( fd == -1 ) return -1;
+  // Els buffers tenen la grandària màxima perquè no canvien mentre
+  // dura l'exportació. Sols ocupen memòria les pàgines escrites.
+  hdr_size= (sizeof(PC_SVGAShmHeader)+4095)&(~((size_t) 4095));
+  buf_size= ((size_t) FB_WIDTH)*FB_HEIGHT*_render.fb_psize;
+  if ( ftruncate ( fd, hdr_size + 2*buf_size ) == -1 ) goto error;
+  if ( name != NULL && (_shm.name= strdup ( name )) == NULL ) goto error;
+  mem= mmap ( NULL, hdr_size + 2*buf_size, PROT_READ|PROT_WRITE,
+              MAP_SHARED, fd, 0 );
+  if ( mem == MAP_FAILED ) goto error;
+  
+  // Inicialitza. El primer frame va al buffer 0.
+  _shm.hdr= (PC_SVGAShmHeader *) mem;
+  _shm.size= hdr_size + 2*buf_size;
+  _shm.fd= fd;
+  _shm.frame= 0;
+  memset ( _shm.stale, 1, sizeof(_shm.stale) );
+  memset ( _shm.hdr, 0, sizeof(PC_SVGAShmHeader) );
+  _shm.hdr->magic= PC_SVGA_SHM_MAGIC;
+  _shm.hdr->format= (uint32_t) _render.fb_format;
+  _shm.hdr->buffer_offset= hdr_size;
+  _shm.hdr->buffer_size= buf_size;
+  _shm.hdr->front= 1;
+  
+  return fd;
+
+ error:
+  close ( fd );
+  if ( name != NULL ) shm_unlink ( name );
+  free ( _shm.name );
+  _shm.name= NULL;
+  return -1;
+  
+} // end PC_svga_cirrus_clgd5446_export_shm
+
+
+void
+PC_svga_cirrus_clgd5446_export_shm_close (void)
+{
+
+  thread_drain ();
+  shm_close ();
+  
+} // end PC_svga_cirrus_clgd5446_export_shm_close
+
+
 const uint8_t *
 PC_svga_cirrus_clgd5446_get_vram (void)
 {
   return &(_vram[0]);
 } // end PC_svga_cirrus_clgd5446_get_vram
+
+
+void
+PC_svga_cirrus_clgd5446_set_frame_skip (
+                                        const int skip
+                                        )
+{
+
+  _frames.skip= skip < 0 ? 0 : skip;
+  _frames.counter= 0;
+  
+} // end PC_svga_cirrus_clgd5446_set_frame_skip
+
+
+void
+PC_svga_cirrus_clgd5446_request_frame (void)
+{
+  _frames.requested= true;
+} // end PC_svga_cirrus_clgd5446_request_frame
+
+
+void
+PC_svga_cirrus_clgd5446_get_frame_stats (
+                                         PC_SVGAFrameStats *stats
+                                         )
+{
+
+  stats->rendered= _frames.rendered;
+  stats->skipped= _frames.skipped;
+  
+} // end PC_svga_cirrus_clgd5446_get_frame_stats
@@ -0,0 +1,264 @@
+/*
+ * Copyright 2025 Adrià Giménez Pastor.
+ *
+ * This file is part of adriagipas/PC.
+ *
+ * adriagipas/PC is free software: you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as
+ * published by the Free Software Foundation, either version 3 of the
+ * License, or (at your option) any later version.
+ *
+ * adriagipas/PC is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with adriagipas/PC.  If not, see <https://www.gnu.org/licenses/>.
+ */
+/*
+ *  pixels_bench.c - Micro-benchmark de les conversions de pixels.c.
+ *
+ *  Renderitza frames de 1024x768 com ho fa la targeta: cada scanline
+ *  es passa de la profunditat de la VRAM a 0x00RRGGBB i després al
+ *  format del framebuffer. Es mesura cada implementació (escalar,
+ *  SSE2 i AVX2 si la CPU les té) i es comprova que totes donen el
+ *  mateix resultat que l'escalar. Torna 0 si tot és correcte.
+ *
+ *  Es compila i s'executa amb 'make -C test bench'. Opcionalment el
+ *  primer argument és el número de frames.
+ *
+ */
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "PC.h"
+
+
+
+
+/**********/
+/* MACROS */
+/**********/
+
+#define WIDTH  1024
+#define HEIGHT 768
+
+#define NFRAMES_DEFAULT 200
+
+
+
+
+/*********/
+/* TIPUS */
+/*********/
+
+typedef enum
+  {
+    SRC_LUT8= 0,
+    SRC_RGB555,
+    SRC_RGB565,
+    SRC_RGB888,
+    SRC_XRGB8888,
+    SRC_SENTINEL
+  } src_t;
+
+
+
+
+/*********/
+/* ESTAT */
+/*********/
+
+static const char *SRC_NAMES[SRC_SENTINEL]=
+  { "lut8", "rgb555", "rgb565", "rgb888", "xrgb8888" };
+
+static const PC_FBFormat FB_FORMATS[]=
+  { PC_FB_RGB, PC_FB_XRGB8888, PC_FB_BGRX8888, PC_FB_RGB565 };
+
+static const char *FB_NAMES[]=
+  { "rgb", "xrgb8888", "bgrx8888", "rgb565" };
+
+#define NFB_FORMATS ((int) (sizeof(FB_FORMATS)/sizeof(FB_FORMATS[0])))
+
+static uint8_t *_vram;
+static uint32_t _pal[256];
+static uint32_t _line[WIDTH];
+static uint8_t *_fb;
+static uint8_t *_fb_ref;
+
+
+
+
+/*********************/
+/* FUNCIONS PRIVADES */
+/*********************/
+
+static double
+now (void)
+{
+
+  struct timespec ts;
+
+
+  clock_gettime ( CLOCK_MONOTONIC, &ts );
+
+  return ts.tv_sec + ts.tv_nsec*1e-9;
+
+} // end now
+
+
+static int
+src_bpp (
+         const src_t src
+         )
+{
+
+  switch ( src )
+    {
+    case SRC_LUT8: return 1;
+    case SRC_RGB555:
+    case SRC_RGB565: return 2;
+    case SRC_RGB888: return 3;
+    default: return 4;
+    }
+
+} // end src_bpp
+
+
+static void
+render_frame (
+              const src_t       src,
+              const PC_FBFormat format,
+              uint8_t          *fb
+              )
+{
+
+  const uint8_t *p;
+  size_t bpp,psize;
+  int y;
+
+
+  bpp= (size_t) src_bpp ( src );
+  psize= (size_t) PC_pixels_size ( format );
+  for ( y= 0; y < HEIGHT; ++y )
+    {
+      p= _vram + y*WIDTH*bpp;
+      switch ( src )
+        {
+        case SRC_LUT8: PC_pixels_lut8 ( _line, p, _pal, WIDTH ); break;
+        case SRC_RGB555:
+          PC_pixels_rgb555 ( _line, (const uint16_t *) p, WIDTH );
+          break;
+        case SRC_RGB565:
+          PC_pixels_rgb565 ( _line, (const uint16_t *) p, WIDTH );
+          break;
+        case SRC_RGB888: PC_pixels_rgb888 ( _line, p, WIDTH ); break;
+        default:
+          PC_pixels_xrgb8888 ( _line, (const uint32_t *) p, WIDTH );
+        }
+      PC_pixels_store ( fb + y*WIDTH*psize, _line, WIDTH, format );
+    }
+
+} // end render_frame
+
+
+static bool
+bench (
+       const char *impl,
+       const int   nframes
+       )
+{
+
+  double t0,t;
+  size_t size;
+  int s,f,i;
+  bool ok;
+
+
+  if ( !PC_pixels_set_impl ( impl ) ) return true;
+  ok= true;
+  printf ( "%s\n", impl );
+  for ( s= 0; s < SRC_SENTINEL; ++s )
+    for ( f= 0; f < NFB_FORMATS; ++f )
+      {
+        size= ((size_t) WIDTH)*HEIGHT*PC_pixels_size ( FB_FORMATS[f] );
+        PC_pixels_set_impl ( "scalar" );
+        render_frame ( (src_t) s, FB_FORMATS[f], _fb_ref );
+        PC_pixels_set_impl ( impl );
+        memset ( _fb, 0, size );
+        render_frame ( (src_t) s, FB_FORMATS[f], _fb );
+        if ( memcmp ( _fb, _fb_ref, size ) != 0 )
+          {
+            printf ( "  %-8s -> %-8s  DIFERENT de l'escalar\n",
+                     SRC_NAMES[s], FB_NAMES[f] );
+            ok= false;
+            continue;
+          }
+        t0= now ();
+        for ( i= 0; i < nframes; ++i )
+          render_frame ( (src_t) s, FB_FORMATS[f], _fb );
+        t= now () - t0;
+        printf ( "  %-8s -> %-8s  %8.3f ms/frame  %8.1f Mpixel/s\n",
+                 SRC_NAMES[s], FB_NAMES[f], 1e3*t/nframes,
+                 ((double) WIDTH)*HEIGHT*nframes/t*1e-6 );
+      }
+
+  return ok;
+
+} // end bench
+
+
+
+
+/******************/
+/* PUNT D'ENTRADA */
+/******************/
+
+int
+main (
+      int   argc,
+      char *argv[]
+      )
+{
+
+  size_t i;
+  int nframes;
+  bool ok;
+
+
+  nframes= argc > 1 ? atoi ( argv[1] ) : NFRAMES_DEFAULT;
+  if ( nframes <= 0 ) nframes= NFRAMES_DEFAULT;
+
+  // Dades pseudoaleatòries però reproduïbles.
+  _vram= (uint8_t *) malloc ( ((size_t) WIDTH)*HEIGHT*4 );
+  _fb= (uint8_t *) malloc ( ((size_t) WIDTH)*HEIGHT*4 );
+  _fb_ref= (uint8_t *) malloc ( ((size_t) WIDTH)*HEIGHT*4 );
+  if ( _vram == NULL || _fb == NULL || _fb_ref == NULL )
+    {
+      fprintf ( stderr, "no hi ha prou memòria\n" );
+      return EXIT_FAILURE;
+    }
+  srand ( 1234 );
+  for ( i= 0; i < ((size_t) WIDTH)*HEIGHT*4; ++i )
+    _vram[i]= (uint8_t) rand ();
+  for ( i= 0; i < 256; ++i )
+    _pal[i]= ((uint32_t) rand ())&0x00FFFFFF;
+
+  // Implementacions (les que la CPU no suporta es boten).
+  ok= bench ( "scalar", nframes );
+  ok= bench ( "sse2", nframes ) && ok;
+  ok= bench ( "avx2", nframes ) && ok;
+
+  free ( _vram );
+  free ( _fb );
+  free ( _fb_ref );
+
+  return ok ? EXIT_SUCCESS : EXIT_FAILURE;
+
+} // end main
@@ -0,0 +1,515 @@
+/*
+ * Copyright 2025 Adrià Giménez Pastor.
+ *
+ * This file is part of adriagipas/PC.
+ *
+ * adriagipas/PC is free software: you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as
+ * published by the Free Software Foundation, either version 3 of the
+ * License, or (at your option) any later version.
+ *
+ * adriagipas/PC is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with adriagipas/PC.  If not, see <https://www.gnu.org/licenses/>.
+ */
+/*
+ *  sb16_fm_block.c - Comprova que la síntesi FM per blocs de
+ *                    sound_blaster16.c dona exactament les mateixes
+ *                    mostres que la implementació antiga, que
+ *                    sintetitzava una mostra per cada 288 cicles.
+ *
+ *  Executa una seqüència pseudoaleatòria fixa d'escriptures en els
+ *  registres i de cicles: timers, mode OPL3, connexions de 4
+ *  operadors, el registre 0xBD (AM, VIB i ritme), keyon i keyoff, i
+ *  totes les formes d'ona. De tant en tant es fa keyoff de tot per a
+ *  provar també el xip en silenci. Cada 100 passos s'imprimeix un
+ *  hash de totes les mostres i de l'estat dels timers, i al final un
+ *  hash de l'estat de tots els operadors i canals.
+ *
+ *  L'eixida es compara amb sb16_fm_block.golden, que 'make golden'
+ *  genera compilant aquest mateix programa amb el sound_blaster16.c
+ *  anterior a la síntesi per blocs (SB16_FM_REF en el Makefile).
+ *  Opcionalment el primer argument és el nucli de _fm.op_out_block
+ *  ("scalar" o "avx2").
+ *
+ */
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "PC.h"
+
+#ifndef SB16_SRC
+#define SB16_SRC "../src/sound_blaster16.c"
+#endif
+
+#ifdef PC_AUDIO_FREQ_DEFAULT
+// Les mostres FM es capturen abans del remostrejador.
+static int
+test_resampler_push (
+                     PC_Resampler  *rs,
+                     const int16_t *in,
+                     const int      n,
+                     int16_t       *out
+                     );
+
+#define PC_resampler_push test_resampler_push
+#include SB16_SRC
+#undef PC_resampler_push
+#else
+#include SB16_SRC
+#endif
+
+
+
+
+/**********/
+/* MACROS */
+/**********/
+
+#define NSTEPS 10000
+#define SEED   1
+
+// Passos entre línies de l'eixida.
+#define PRINT_STEPS 100
+
+// Màxim de cicles entre escriptures. De tant en tant es deixa passar
+// molt de temps per a que els envelopes arriben al silenci.
+#define MAX_STEP_CC  400000
+#define LONG_STEP_CC 50000000
+
+// Cada pas s'executa en trossos de com a molt SUB_STEP_CC cicles
+// (unes 500 mostres) per a buidar _fm.out abans que s'òmpliga.
+#define SUB_STEP_CC 1000000
+
+
+
+
+/*********/
+/* ESTAT */
+/*********/
+
+static const int OP_OFFSET[18]=
+  { 0, 1, 2, 3, 4, 5, 8, 9, 10, 11, 12, 13, 16, 17, 18, 19, 20, 21 };
+
+static uint64_t _hash;
+static long _nframes;
+static uint32_t _rnd;
+
+
+
+
+/*************/
+/* SIMULADOR */
+/*************/
+
+int PC_Clock;
+long PC_ClockFreq= 100000000;
+int PC_NextEventCC;
+
+void
+PC_dma_dreq (
+             const int  chn_id,
+             const bool val
+             )
+{
+} // end PC_dma_dreq
+
+
+void
+PC_ic_irq (
+           const int  irq,
+           const bool in
+           )
+{
+} // end PC_ic_irq
+
+
+void
+PC_piix4_ide_get_next_cd_audio_sample (
+                                       int16_t *l,
+                                       int16_t *r
+                                       )
+{
+  *l= *r= 0;
+} // end PC_piix4_ide_get_next_cd_audio_sample
+
+
+void
+PC_sound_set (
+              const int16_t samples[PC_AUDIO_BUFFER_SIZE*2],
+              const int     source_id
+              )
+{
+} // end PC_sound_set
+
+
+static void
+warning (
+         void       *udata,
+         const char *format,
+         ...
+         )
+{
+  fprintf ( stderr, "%s\n", format );
+} // end warning
+
+
+
+
+/*********************/
+/* FUNCIONS PRIVADES */
+/*********************/
+
+static void
+hash_add (
+          uint64_t      *h,
+          const int64_t  val
+          )
+{
+  *h= (*h^((uint64_t) val))*1099511628211ULL;
+} // end hash_add
+
+
+static void
+frame_add (
+           const int32_t l,
+           const int32_t r
+           )
+{
+
+  hash_add ( &_hash, l );
+  hash_add ( &_hash, r );
+  ++_nframes;
+
+} // end frame_add
+
+
+#ifdef PC_AUDIO_FREQ_DEFAULT
+static int
+test_resampler_push (
+                     PC_Resampler  *rs,
+                     const int16_t *in,
+                     const int      n,
+                     int16_t       *out
+                     )
+{
+
+  int i;
+
+
+  if ( rs != &_fm.out.rs )
+    return PC_resampler_push ( rs, in, n, out );
+  for ( i= 0; i < n; ++i )
+    frame_add ( in[2*i], in[2*i+1] );
+
+  return 0;
+
+} // end test_resampler_push
+#endif
+
+
+// Buida les mostres que fm_clock ha deixat en _fm.out.
+static void
+drain_out (void)
+{
+
+  for ( ; _fm.out.N > 0; --_fm.out.N )
+    {
+      frame_add ( _fm.out.l[_fm.out.p], _fm.out.r[_fm.out.p] );
+      _fm.out.p= (_fm.out.p+1)%FM_BUF_SIZE;
+    }
+
+} // end drain_out
+
+
+static uint32_t
+rnd (void)
+{
+
+  _rnd^= _rnd<<13;
+  _rnd^= _rnd>>17;
+  _rnd^= _rnd<<5;
+
+  return _rnd;
+
+} // end rnd
+
+
+static uint64_t
+hash_state (void)
+{
+
+  uint64_t h;
+  int a,i;
+  const fm_op_t *op;
+  const fm_channel_t *chn;
+
+
+  h= 1469598103934665603ULL;
+  for ( a= 0; a < 2; ++a )
+    {
+      for ( i= 0; i < 18; ++i )
+        {
+          op= &_fm.ops[a][i];
+          hash_add ( &h, op->phase );
+          hash_add ( &h, op->pg );
+          hash_add ( &h, op->out );
+          hash_add ( &h, op->eg.out );
+          hash_add ( &h, op->eg.state );
+          hash_add ( &h, op->eg.counter );
+          hash_add ( &h, op->eg.cc );
+          hash_add ( &h, op->vib.cc );
+          hash_add ( &h, op->vib.counter );
+          hash_add ( &h, op->am.cc );
+          hash_add ( &h, op->am.counter );
+        }
+      for ( i= 0; i < 9; ++i )
+        {
+          chn= &_fm.channels[a][i];
+          hash_add ( &h, chn->fb_buf[0] );
+          hash_add ( &h, chn->fb_buf[1] );
+          hash_add ( &h, chn->out );
+        }
+    }
+  hash_add ( &h, _fm.cc_accum );
+  hash_add ( &h, _fm.cc_fm_accum );
+
+  return h;
+
+} // end hash_state
+
+
+// Bits de PC_sb16_fm_status, sense el retard artificial que aquella
+// afegeix a PC_Clock.
+static uint8_t
+timers_status (void)
+{
+  return
+    ((_fm.timers[0].irq_done || _fm.timers[1].irq_done) ? 0x80 : 0x00) |
+    (_fm.timers[0].irq_done ? 0x40 : 0x00) |
+    (_fm.timers[1].irq_done ? 0x20 : 0x00);
+} // end timers_status
+
+
+// PC_Clock no avança mai, per tant el clock que fan les escriptures
+// no sintetitza res i tot el temps passa per fm_clock.
+static void
+fm_write (
+          const int     array,
+          const uint8_t addr,
+          const uint8_t data
+          )
+{
+
+  PC_sb16_fm_set_addr ( addr, array );
+  PC_sb16_fm_write_data ( data, array );
+
+} // end fm_write
+
+
+// Programa tots els canals dels dos arrays amb notes sonant, cada
+// operador amb una forma d'ona diferent. PC_sb16_init no reinicia
+// les connexions de 4 operadors, per tant s'escriuen explícitament.
+static void
+setup_voices (void)
+{
+
+  int a,i;
+
+
+  fm_write ( 1, 0x04, 0x00 );
+  fm_write ( 1, 0x05, 0x01 );
+  for ( a= 0; a < 2; ++a )
+    {
+      for ( i= 0; i < 18; ++i )
+        {
+          fm_write ( a, 0x20+OP_OFFSET[i], 0x21 | ((i&3)<<6) );
+          fm_write ( a, 0x40+OP_OFFSET[i], (i&1) ? 0x00 : 0x18 );
+          fm_write ( a, 0x60+OP_OFFSET[i], 0xF2 );
+          fm_write ( a, 0x80+OP_OFFSET[i], 0x54 );
+          fm_write ( a, 0xE0+OP_OFFSET[i], i&0x7 );
+        }
+      for ( i= 0; i < 9; ++i )
+        {
+          fm_write ( a, 0xC0+i, 0x30 | ((i&7)<<1) | (i&1) );
+          fm_write ( a, 0xA0+i, 0x40 + 17*i );
+          fm_write ( a, 0xB0+i, 0x20 | ((i&7)<<2) | 0x1 );
+        }
+    }
+
+} // end setup_voices
+
+
+// Fa keyoff de tots els canals amb el release més ràpid, per a que
+// el xip arribe al silenci (fm_run_silent).
+static void
+silence_voices (void)
+{
+
+  int a,i;
+
+
+  for ( a= 0; a < 2; ++a )
+    {
+      for ( i= 0; i < 18; ++i )
+        fm_write ( a, 0x80+OP_OFFSET[i], 0xFF );
+      for ( i= 0; i < 9; ++i )
+        fm_write ( a, 0xB0+i, 0x00 );
+    }
+
+} // end silence_voices
+
+
+static void
+random_write (void)
+{
+
+  int array,r,addr,data;
+
+
+  array= (rnd ()%4) == 0;
+  r= (int) (rnd ()%100);
+  data= (int) (rnd ()&0xFF);
+  if ( r < 3 ) // OPL3
+    {
+      array= 1;
+      addr= 0x05;
+      data= (rnd ()%3) != 0;
+    }
+  else if ( r < 6 ) // Connexions de 4 operadors
+    {
+      array= 1;
+      addr= 0x04;
+      data&= 0x3F;
+    }
+  else if ( r < 8 ) addr= 0xBD; // Ritme, AM i VIB
+  else if ( r < 9 ) addr= 0x08;
+  else if ( r < 12 ) // Timers
+    {
+      array= 0;
+      addr= 0x02 + (int) (rnd ()%3);
+    }
+  else if ( r < 22 ) addr= 0x20+OP_OFFSET[rnd ()%18];
+  else if ( r < 33 )
+    {
+      addr= 0x40+OP_OFFSET[rnd ()%18];
+      if ( rnd ()%2 ) data&= 0xC7;
+    }
+  else if ( r < 44 ) addr= 0x60+OP_OFFSET[rnd ()%18];
+  else if ( r < 55 ) addr= 0x80+OP_OFFSET[rnd ()%18];
+  else if ( r < 64 ) addr= 0xE0+OP_OFFSET[rnd ()%18];
+  else if ( r < 74 ) addr= 0xA0+(int) (rnd ()%9);
+  else if ( r < 90 ) addr= 0xB0+(int) (rnd ()%9); // Keyon/keyoff
+  else
+    {
+      addr= 0xC0+(int) (rnd ()%9);
+      data&= 0x3F;
+      if ( rnd ()%3 == 0 ) data|= 0x30;
+    }
+  fm_write ( array, (uint8_t) addr, (uint8_t) data );
+
+} // end random_write
+
+
+// Tria el nucli de _fm.op_out_block. La implementació de referència
+// no en té.
+static void
+set_kernel (
+            const char *name
+            )
+{
+
+#ifdef FM_BLOCK_SIZE
+  if ( strcmp ( name, "scalar" ) == 0 )
+    _fm.op_out_block= fm_op_out_block_scalar;
+#ifdef FM_X86
+  else if ( strcmp ( name, "avx2" ) == 0 )
+    {
+      __builtin_cpu_init ();
+      if ( __builtin_cpu_supports ( "avx2" ) )
+        _fm.op_out_block= fm_op_out_block_avx2;
+      else
+        fprintf ( stderr, "la CPU no té AVX2, es gasta l'escalar\n" );
+    }
+#endif
+  else
+    {
+      fprintf ( stderr, "nucli desconegut: %s\n", name );
+      exit ( EXIT_FAILURE );
+    }
+#endif
+
+} // end set_kernel
+
+
+
+
+/******************/
+/* PUNT D'ENTRADA */
+/******************/
+
+int
+main (
+      int   argc,
+      char *argv[]
+      )
+{
+
+  long step;
+  int cc,tmp,nw,k;
+
+
+  PC_Clock= 0;
+#ifdef PC_AUDIO_FREQ_DEFAULT
+  PC_sb16_init ( warning, NULL, PC_AUDIO_FREQ_DEFAULT );
+#else
+  PC_sb16_init ( warning, NULL );
+#endif
+  if ( argc > 1 ) set_kernel ( argv[1] );
+  _hash= 1469598103934665603ULL;
+  _nframes= 0;
+  _rnd= SEED;
+  setup_voices ();
+  for ( step= 0; step < NSTEPS; ++step )
+    {
+
+      // Cicles. Alguns passos molt curts per a provar blocs menuts.
+      if ( rnd ()%256 == 0 )
+        {
+          silence_voices ();
+          cc= LONG_STEP_CC;
+        }
+      else if ( rnd ()%64 == 0 ) cc= LONG_STEP_CC;
+      else if ( rnd ()%4 == 0 ) cc= 1 + (int) (rnd ()%600);
+      else cc= 1 + (int) (rnd ()%MAX_STEP_CC);
+      for ( ; cc > 0; cc-= tmp )
+        {
+          tmp= cc > SUB_STEP_CC ? SUB_STEP_CC : cc;
+          fm_clock ( tmp );
+          drain_out ();
+        }
+      hash_add ( &_hash, timers_status () );
+
+      // Escriptures.
+      nw= (int) (rnd ()%6);
+      for ( k= 0; k < nw; ++k )
+        random_write ();
+
+      if ( (step+1)%PRINT_STEPS == 0 )
+        printf ( "%ld %ld %016llx\n",
+                 step+1, _nframes, (unsigned long long) _hash );
+
+    }
+  printf ( "estat %016llx\n", (unsigned long long) hash_state () );
+
+  return EXIT_SUCCESS;
+
+} // end main